@@ -0,0 +1,518 @@
+export module AdaptiveSlotMap;
+
+#define DEFAULT_CAPACITY 8
+
+// A slotmap that keeps count of how it is used, and moves its values between
+// SlotMap's dense layout (iteration only touches live values) and
+// StableSlotMap's direct-index layout (lookups skip an indirection, erases move
+// nothing), whichever suits the mix of operations of late.
+//
+// Guarantees:
+// keys stay valid across migrations: a value keeps its key's index and
+// generation in either layout, and free slots keep theirs, so stale keys stay stale
+// migration is incremental: every call moves a few slots over, in index order
+// (AdaptiveSlotMapPolicy::migrationStep), so no single call pays for the whole map
+// the layout being migrated from answers every call until the migration is done;
+// changes to slots that were already moved over are made in both layouts
+// a migration the mix no longer calls for is abandoned, which costs nothing
+// but the copies made so far
+// lookups and ForEach() never free or move values: only calls that change the
+// map (and Migrate()) finish a migration, so references from operator[] stay
+// valid until the next one of those, like SlotMap's until the next insert or erase
+//
+// The price is that values are copied while migrating, not moved: the map holds
+// two copies of what was migrated so far, T has to be copy constructible, and
+// there is no mutable access (values are changed through Update(), which changes
+// both copies). Lookups count towards the mix and do their share of copying
+// slots over, so they aren't const.
+
+import <cstddef>;
+import <cstdint>;
+import <optional>;
+import <stdexcept>;
+import <type_traits>;
+import <utility>;
+import SlotMap;
+import StableSlotMap;
+
+export namespace Unalmas
+{
+	enum class AdaptiveSlotMapMode
+	{
+		Dense,			// SlotMap
+		Stable,			// StableSlotMap
+	};
+
+	struct AdaptiveSlotMapPolicy
+	{
+		// Operations counted between decisions, where visiting a value while
+		// iterating counts as one; 0 leaves the mode to SetMode().
+		int		window{ 1 << 16 };
+
+		// Shares of those that were iteration, below which the map goes stable and
+		// above which it goes dense again; in between, it stays as it is.
+		double	toStable{ 0.5 };
+		double	toDense{ 0.8 };
+
+		int		migrationStep{ 32 };	// Slots moved over per call while migrating; at least 1
+	};
+
+	template <typename T>
+	class AdaptiveSlotMap
+	{
+		static_assert(std::is_copy_constructible<T>(), "Values are copied between layouts, so the element type has to be copy constructible.");
+
+	private:
+		std::optional<SlotMap<T>>		dense;
+		std::optional<StableSlotMap<T>>	stable;
+		AdaptiveSlotMapPolicy			policy;
+		AdaptiveSlotMapMode				mode{ AdaptiveSlotMapMode::Dense };		// The layout that answers calls
+		int								cursor{ -1 };		// Slots below it were moved over; -1 unless migrating
+		int								migrationCount{ 0 };
+
+		// The mix in the current window.
+		std::int64_t					iterated{ 0 };
+		std::int64_t					lookups{ 0 };
+		std::int64_t					erases{ 0 };
+		std::int64_t					others{ 0 };
+
+		// Operations until Tick() has something to do: the end of the window, or
+		// the next migration step. Keeps the per-call cost to one decrement and branch.
+		std::int64_t					untilTick{ 0 };
+
+	public:
+		AdaptiveSlotMap(int capacity = DEFAULT_CAPACITY, const AdaptiveSlotMapPolicy& policy = AdaptiveSlotMapPolicy());
+
+		AdaptiveSlotMap(const AdaptiveSlotMap& rhs) = delete;
+		AdaptiveSlotMap(AdaptiveSlotMap&& rhs) = delete;
+		AdaptiveSlotMap& operator=(const AdaptiveSlotMap& rhs) = delete;
+		AdaptiveSlotMap& operator=(AdaptiveSlotMap&& rhs) = delete;
+
+		// No mutable access: values are changed through Update(), so both layouts see it.
+		const T& operator[](const SlotMapKey& key);
+		bool						TryGet(const SlotMapKey& key, T& value);
+		bool						Contains(const SlotMapKey& key);
+		const T*					Find(const SlotMapKey& key);	// nullptr if the key is no longer valid; checked in every build
+
+		int							Size() const;
+		int							Capacity() const;
+
+		// What both layouts hold, while migrating.
+		std::size_t					MemoryBytes() const;
+
+		template <typename U>
+		SlotMapKey					Insert(U&& value);
+		bool						Update(const SlotMapKey& key, const T& value);
+		bool						Erase(const SlotMapKey& key);
+		void						Clear();
+
+		// Visits every value, in the order of the layout that answers calls.
+		template <typename F>
+		void						ForEach(F&& func);
+
+		AdaptiveSlotMapMode			Mode() const { return mode; }
+		bool						IsMigrating() const { return cursor >= 0; }
+		int							MigrationCount() const { return migrationCount; }
+
+		// Starts migrating to the given layout, or abandons a migration away from
+		// it. The policy may change its mind again after its next window.
+		void						SetMode(AdaptiveSlotMapMode mode);
+
+		// Moves up to count more slots over, e.g. when there's time to spare, and
+		// finishes the migration once they're all there; returns true once no
+		// migration is underway.
+		bool						Migrate(int count);
+
+	private:
+		// Calls that change the map may finish a migration; lookups only copy slots over.
+		void						Count(std::int64_t& counter, std::int64_t count, bool changes);
+		void						Tick(bool changes);
+		bool						Step(int count, bool finish);
+		void						ScheduleTick();
+		void						MigrateSlots(SlotMap<T>& from, StableSlotMap<T>& to, int first, int last);
+		void						MigrateSlots(StableSlotMap<T>& from, SlotMap<T>& to, int first, int last);
+
+		// Calls func with the layout that answers calls, or with the one being migrated to.
+		template <typename F>
+		decltype(auto)				WithSource(F&& func);
+		template <typename F>
+		decltype(auto)				WithSource(F&& func) const;
+		template <typename F>
+		void						WithTarget(F&& func);
+	};
+
+	template <typename T>
+	AdaptiveSlotMap<T>::AdaptiveSlotMap(int capacity, const AdaptiveSlotMapPolicy& policy_)
+		: policy{ policy_ }
+	{
+		if (policy.migrationStep < 1)
+		{
+			throw std::invalid_argument("[AdaptiveSlotMap] Migration step has to be at least one slot.");
+		}
+
+		dense.emplace(capacity);
+		ScheduleTick();
+	}
+
+	template <typename T>
+	template <typename F>
+	decltype(auto) AdaptiveSlotMap<T>::WithSource(F&& func)
+	{
+		return mode == AdaptiveSlotMapMode::Dense ? func(*dense) : func(*stable);
+	}
+
+	template <typename T>
+	template <typename F>
+	decltype(auto) AdaptiveSlotMap<T>::WithSource(F&& func) const
+	{
+		return mode == AdaptiveSlotMapMode::Dense ? func(*dense) : func(*stable);
+	}
+
+	template <typename T>
+	template <typename F>
+	void AdaptiveSlotMap<T>::WithTarget(F&& func)
+	{
+		if (mode == AdaptiveSlotMapMode::Dense)
+		{
+			func(*stable);
+		}
+		else
+		{
+			func(*dense);
+		}
+	}
+
+	template <typename T>
+	const T& AdaptiveSlotMap<T>::operator[](const SlotMapKey& key)
+	{
+		Count(lookups, 1, false);
+		return WithSource([&](auto& map) -> const T& { return map[key]; });
+	}
+
+	template <typename T>
+	bool AdaptiveSlotMap<T>::TryGet(const SlotMapKey& key, T& value)
+	{
+		Count(lookups, 1, false);
+		return WithSource([&](auto& map) { return map.TryGet(key, value); });
+	}
+
+	template <typename T>
+	const T* AdaptiveSlotMap<T>::Find(const SlotMapKey& key)
+	{
+		Count(lookups, 1, false);
+		return WithSource([&](auto& map) -> const T* { return map.Contains(key) ? &map[key] : nullptr; });
+	}
+
+	template <typename T>
+	bool AdaptiveSlotMap<T>::Contains(const SlotMapKey& key)
+	{
+		Count(lookups, 1, false);
+		return WithSource([&](auto& map) { return map.Contains(key); });
+	}
+
+	template <typename T>
+	int AdaptiveSlotMap<T>::Size() const
+	{
+		return WithSource([](const auto& map) { return map.Size(); });
+	}
+
+	template <typename T>
+	int AdaptiveSlotMap<T>::Capacity() const
+	{
+		return WithSource([](const auto& map) { return map.Capacity(); });
+	}
+
+	template <typename T>
+	std::size_t AdaptiveSlotMap<T>::MemoryBytes() const
+	{
+		return (dense ? dense->MemoryUsage().Total() : 0) + (stable ? stable->MemoryUsage().Total() : 0);
+	}
+
+	template <typename T>
+	template <typename U>
+	SlotMapKey AdaptiveSlotMap<T>::Insert(U&& value)
+	{
+		Count(others, 1, true);
+
+		const SlotMapKey key = WithSource([&](auto& map) { return map.Insert(std::forward<U>(value)); });
+		if (key.index < cursor)
+		{
+			const T& inserted = WithSource([&](auto& map) -> const T& { return map[key]; });
+			WithTarget([&](auto& map) { map.InsertAt(key, inserted); });
+		}
+
+		return key;
+	}
+
+	template <typename T>
+	bool AdaptiveSlotMap<T>::Update(const SlotMapKey& key, const T& value)
+	{
+		Count(others, 1, true);
+
+		if (!WithSource([&](auto& map) { return map.Contains(key); }))
+		{
+			return false;
+		}
+
+		WithSource([&](auto& map) { map[key] = value; });
+		if (key.index < cursor)
+		{
+			WithTarget([&](auto& map) { map[key] = value; });
+		}
+
+		return true;
+	}
+
+	template <typename T>
+	bool AdaptiveSlotMap<T>::Erase(const SlotMapKey& key)
+	{
+		Count(erases, 1, true);
+
+		if (!WithSource([&](auto& map) { return map.Erase(key); }))
+		{
+			return false;
+		}
+
+		if (key.index < cursor)
+		{
+			WithTarget([&](auto& map) { map.Erase(key); });
+		}
+
+		return true;
+	}
+
+	template <typename T>
+	void AdaptiveSlotMap<T>::Clear()
+	{
+		Count(others, 1, true);
+		WithSource([](auto& map) { map.Clear(); });
+
+		// Start over with a fresh layout to migrate to, rather than clearing both alike.
+		if (IsMigrating())
+		{
+			const AdaptiveSlotMapMode target = mode == AdaptiveSlotMapMode::Dense ? AdaptiveSlotMapMode::Stable : AdaptiveSlotMapMode::Dense;
+			SetMode(mode);
+			SetMode(target);
+		}
+	}
+
+	template <typename T>
+	template <typename F>
+	void AdaptiveSlotMap<T>::ForEach(F&& func)
+	{
+		Count(iterated, Size(), false);
+
+		WithSource([&](const auto& map)
+		{
+			for (const T& value : map)
+			{
+				func(value);
+			}
+		});
+	}
+
+	template <typename T>
+	void AdaptiveSlotMap<T>::SetMode(AdaptiveSlotMapMode mode_)
+	{
+		if (IsMigrating())
+		{
+			// Already headed there, or back to where the values still are.
+			if (mode_ == mode)
+			{
+				if (mode == AdaptiveSlotMapMode::Dense)
+				{
+					stable.reset();
+				}
+				else
+				{
+					dense.reset();
+				}
+
+				cursor = -1;
+				ScheduleTick();
+			}
+
+			return;
+		}
+
+		if (mode_ == mode)
+		{
+			return;
+		}
+
+		// The layout migrated to starts out with every slot at generation 0, so the
+		// source's keys can all be put into it as they are.
+		const int capacity = Capacity();
+		if (mode == AdaptiveSlotMapMode::Dense)
+		{
+			stable.emplace(capacity);
+		}
+		else
+		{
+			dense.emplace(capacity);
+		}
+
+		cursor = 0;
+		ScheduleTick();
+	}
+
+	template <typename T>
+	bool AdaptiveSlotMap<T>::Migrate(int count)
+	{
+		if (count < 1)
+		{
+			return !IsMigrating();
+		}
+
+		return Step(count, true);
+	}
+
+	template <typename T>
+	bool AdaptiveSlotMap<T>::Step(int count, bool finish)
+	{
+		if (!IsMigrating())
+		{
+			return true;
+		}
+
+		// The source may have grown since the migration started.
+		const int capacity = Capacity();
+		const int last = count < capacity - cursor ? cursor + count : capacity;
+
+		if (mode == AdaptiveSlotMapMode::Dense)
+		{
+			MigrateSlots(*dense, *stable, cursor, last);
+		}
+		else
+		{
+			MigrateSlots(*stable, *dense, cursor, last);
+		}
+
+		cursor = last;
+		if (cursor < capacity || !finish)
+		{
+			return false;
+		}
+
+		// Only now is the old layout freed, along with any references into it.
+
+		if (mode == AdaptiveSlotMapMode::Dense)
+		{
+			mode = AdaptiveSlotMapMode::Stable;
+			dense.reset();
+		}
+		else
+		{
+			mode = AdaptiveSlotMapMode::Dense;
+			stable.reset();
+		}
+
+		cursor = -1;
+		migrationCount++;
+		ScheduleTick();
+
+		return true;
+	}
+
+	template <typename T>
+	void AdaptiveSlotMap<T>::MigrateSlots(SlotMap<T>& from, StableSlotMap<T>& to, int first, int last)
+	{
+		const SlotMapLayout<T> layout = from.GetLayout();
+
+		for (int i = first; i < last; ++i)
+		{
+			// Taken slots point at a value that points back at them (see SlotMap::InsertAt);
+			// free ones hold the generation of the next key they issue.
+			const SlotMapKey& slot = layout.slots[i];
+			if (slot.index < layout.size && layout.valueToSlot[slot.index] == static_cast<unsigned int>(i))
+			{
+				to.InsertAt(SlotMapKey(i, slot.generation), layout.values[slot.index]);
+			}
+			else if (slot.generation > 0)
+			{
+				to.RetireKey(SlotMapKey(i, slot.generation - 1));
+			}
+		}
+	}
+
+	template <typename T>
+	void AdaptiveSlotMap<T>::MigrateSlots(StableSlotMap<T>& from, SlotMap<T>& to, int first, int last)
+	{
+		const StableSlotMapLayout<T> layout = from.GetLayout();
+
+		for (int i = first; i < last; ++i)
+		{
+			const int generation = layout.generations[i];
+			if (generation >= 0)
+			{
+				to.InsertAt(SlotMapKey(i, generation), layout.values[i]);
+			}
+			else if (~generation > 0)
+			{
+				to.RetireKey(SlotMapKey(i, ~generation - 1));
+			}
+		}
+	}
+
+	template <typename T>
+	void AdaptiveSlotMap<T>::Count(std::int64_t& counter, std::int64_t count, bool changes)
+	{
+		counter += count;
+		untilTick -= count;
+
+		if (untilTick <= 0)
+		{
+			Tick(changes);
+		}
+	}
+
+	template <typename T>
+	void AdaptiveSlotMap<T>::Tick(bool changes)
+	{
+		const std::int64_t counted = iterated + lookups + erases + others;
+		if (policy.window > 0 && counted >= policy.window)
+		{
+			const double share = static_cast<double>(iterated) / static_cast<double>(counted);
+
+			if (share < policy.toStable)
+			{
+				SetMode(AdaptiveSlotMapMode::Stable);
+			}
+			else if (share > policy.toDense)
+			{
+				SetMode(AdaptiveSlotMapMode::Dense);
+			}
+
+			iterated = 0;
+			lookups = 0;
+			erases = 0;
+			others = 0;
+		}
+
+		if (IsMigrating())
+		{
+			Step(policy.migrationStep, changes);
+		}
+
+		ScheduleTick();
+	}
+
+	template <typename T>
+	void AdaptiveSlotMap<T>::ScheduleTick()
+	{
+		const std::int64_t counted = iterated + lookups + erases + others;
+
+		if (IsMigrating())
+		{
+			untilTick = 1;
+		}
+		else if (policy.window > 0)
+		{
+			untilTick = policy.window - counted;
+		}
+		else
+		{
+			untilTick = INT64_MAX;
+		}
+	}
+} // namespace Unalmas
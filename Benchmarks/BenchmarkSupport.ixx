@@ -0,0 +1,612 @@
+module;
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define SLOTMAP_BENCHMARK_CYCLE_COUNTER
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SLOTMAP_BENCHMARK_CYCLE_COUNTER
+#endif
+
+export module BenchmarkSupport;
+
+// Pieces shared by the benchmarks: element payloads of a given size, key access
+// patterns, timing, latency histograms, command line parsing, and the JSON report.
+//
+// Guarantees:
+// access sequences depend on nothing but their parameters and the seed, so runs
+// before and after a change (built with the same standard library) see the same
+// workload
+// nothing is timed while a workload is generated
+// latency histograms take constant time and no allocations per recorded value,
+// and report any percentile to within 1/32 (about 3%) of the recorded value
+
+import <algorithm>;
+import <bit>;
+import <chrono>;
+import <cmath>;
+import <cstdint>;
+import <cstdio>;
+import <cstdlib>;
+import <cstring>;
+import <random>;
+import <string>;
+import <type_traits>;
+import <utility>;
+import <vector>;
+
+export namespace Unalmas::Benchmarks
+{
+	// An element of the given size. Only the first and last words are ever read,
+	// so bigger payloads cost what they cost in memory traffic, not in arithmetic.
+	template <int Bytes>
+	struct Payload
+	{
+		static_assert(Bytes >= 4 && Bytes % 4 == 0, "Payloads are made of 32 bit words.");
+
+		std::uint32_t	words[Bytes / 4]{};
+
+		Payload() = default;
+		explicit Payload(std::uint32_t value) : words{ value } {}
+
+		std::uint32_t	Checksum() const { return words[0] + words[Bytes / 4 - 1]; }
+	};
+
+	constexpr int		PayloadSizes[]{ 4, 16, 64, 256, 1024, 4096 };
+
+	// Calls func with a std::type_identity of the payload of the given size;
+	// returns false if there is no such payload.
+	template <typename F>
+	bool WithPayload(int bytes, F&& func)
+	{
+		switch (bytes)
+		{
+		case 4:		func(std::type_identity<Payload<4>>{}); return true;
+		case 16:	func(std::type_identity<Payload<16>>{}); return true;
+		case 64:	func(std::type_identity<Payload<64>>{}); return true;
+		case 256:	func(std::type_identity<Payload<256>>{}); return true;
+		case 1024:	func(std::type_identity<Payload<1024>>{}); return true;
+		case 4096:	func(std::type_identity<Payload<4096>>{}); return true;
+		default:	return false;
+		}
+	}
+
+	enum class AccessPattern
+	{
+		Sequential,		// In insertion order
+		Random,			// Uniformly distributed
+		Zipfian,		// A few hot keys, scattered over the map
+	};
+
+	const char*			AccessPatternName(AccessPattern pattern);
+	bool				ParseAccessPattern(const char* text, AccessPattern& pattern);
+
+	// Draws ranks in [0, count) with probability proportional to 1 / (rank + 1)^theta,
+	// as described by Gray et al. in "Quickly Generating Billion-Record Synthetic
+	// Databases" (and used by YCSB).
+	class ZipfianGenerator
+	{
+	public:
+		ZipfianGenerator(std::int64_t count, double theta = 0.99);
+
+		template <typename Random>
+		std::int64_t	operator()(Random& random);
+
+	private:
+		static double	Zeta(std::int64_t count, double theta);
+
+		std::int64_t	count;
+		double			theta;
+		double			alpha;
+		double			zetaN;
+		double			eta;
+	};
+
+	// Everything read while timing ends up in here, so none of it can be optimized away.
+	std::uint32_t		checksum = 0;
+
+	// Positions in [0, keyCount) to access, in order.
+	std::vector<int>	MakeAccessSequence(AccessPattern pattern, int keyCount, int length, std::uint64_t seed);
+
+	// Wall clock time of one call, in nanoseconds.
+	template <typename F>
+	double TimeNanoseconds(F&& func)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		func();
+		const auto stop = std::chrono::steady_clock::now();
+
+		return std::chrono::duration<double, std::nano>(stop - start).count();
+	}
+
+	// Per-operation timestamps, either from steady_clock or, where there is one,
+	// from the CPU's cycle counter, which is cheaper to read but has to be
+	// calibrated against steady_clock first.
+	class LatencyClock
+	{
+	public:
+		explicit LatencyClock(bool useCycleCounter = false);
+
+		std::uint64_t	Now() const;
+		std::uint64_t	ToNanoseconds(std::uint64_t ticks) const { return static_cast<std::uint64_t>(static_cast<double>(ticks) * nanosecondsPerTick); }
+
+		const char*		Name() const { return cycles ? "cycles" : "steady_clock"; }
+		static bool		HasCycleCounter();
+
+	private:
+		bool			cycles{ false };
+		double			nanosecondsPerTick{ 1.0 };
+	};
+
+	// HDR-style histogram of latencies: values below 32 ns are counted exactly,
+	// and every power of two above that is split into 32 equal buckets.
+	class LatencyHistogram
+	{
+	public:
+		LatencyHistogram() : counts(BucketCount, 0) {}
+
+		void			Record(std::uint64_t nanoseconds);
+
+		std::uint64_t	Count() const { return count; }
+		std::uint64_t	Max() const { return max; }
+		double			Mean() const { return count > 0 ? static_cast<double>(sum) / static_cast<double>(count) : 0.0; }
+
+		// The smallest recorded bucket's upper bound that at least the given
+		// fraction of values is at or below (capped at the maximum).
+		std::uint64_t	Percentile(double fraction) const;
+
+		// How many recorded values are above the given limit (to within a bucket).
+		std::uint64_t	CountAbove(std::uint64_t nanoseconds) const;
+
+	private:
+		static constexpr int			SubBucketBits = 5;
+		static constexpr std::uint64_t	SubBuckets = 1ull << SubBucketBits;
+		static constexpr std::size_t	BucketCount = (65 - SubBucketBits) * SubBuckets;
+
+		static std::size_t		BucketOf(std::uint64_t value);
+		static std::uint64_t	UpperBoundOf(std::size_t bucket);
+
+		std::vector<std::uint64_t>	counts;
+		std::uint64_t	count{ 0 };
+		std::uint64_t	sum{ 0 };
+		std::uint64_t	max{ 0 };
+	};
+
+	// One line of the report: what was measured, and the measurements.
+	struct BenchmarkResult
+	{
+		std::vector<std::pair<std::string, std::string>>	labels;
+		std::vector<std::pair<std::string, double>>			values;
+
+		BenchmarkResult& Label(const char* name, std::string value) { labels.emplace_back(name, std::move(value)); return *this; }
+		BenchmarkResult& Value(const char* name, double value) { values.emplace_back(name, value); return *this; }
+	};
+
+	// What a pair of timestamps from the clock costs (the median of many); it is
+	// included in every latency measured with it.
+	double				TimerOverheadNanoseconds(const LatencyClock& clock);
+
+	// Median and minimum of repeated measurements of the same thing.
+	struct Repetitions
+	{
+		double			median{ 0.0 };
+		double			minimum{ 0.0 };
+	};
+
+	Repetitions			Summarize(std::vector<double> samples);
+
+	// Adds count, mean, p50/p90/p99/p99.9/p99.99 and max (all in ns) to a result.
+	void				AddLatencyValues(BenchmarkResult& result, const LatencyHistogram& histogram);
+
+	// Writes the report as one JSON object, with the run's settings at the top and
+	// the results in a "results" array.
+	void				WriteJson(std::FILE* file, const BenchmarkResult& settings, const std::vector<BenchmarkResult>& results);
+
+	// Writes the report to the file at path, or to stdout if there is no path;
+	// returns false, after saying so on stderr, if the file can't be opened.
+	bool				WriteReport(const char* path, const BenchmarkResult& settings, const std::vector<BenchmarkResult>& results);
+
+	// "release" or "debug", depending on NDEBUG, for the report's settings.
+	const char*			BuildName();
+
+	// Splits a comma separated list.
+	std::vector<std::string>	SplitList(const char* text);
+
+	// Parses a count in [1, 2^30], written as 1e6 as well as 1000000.
+	bool				ParseCount(const char* text, int& count);
+
+	const char* AccessPatternName(AccessPattern pattern)
+	{
+		switch (pattern)
+		{
+		case AccessPattern::Sequential:	return "sequential";
+		case AccessPattern::Random:		return "random";
+		case AccessPattern::Zipfian:	return "zipfian";
+		}
+
+		return "unknown";
+	}
+
+	bool ParseAccessPattern(const char* text, AccessPattern& pattern)
+	{
+		for (const AccessPattern candidate : { AccessPattern::Sequential, AccessPattern::Random, AccessPattern::Zipfian })
+		{
+			if (std::strcmp(text, AccessPatternName(candidate)) == 0)
+			{
+				pattern = candidate;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	ZipfianGenerator::ZipfianGenerator(std::int64_t count_, double theta_) : count{ count_ }, theta{ theta_ }
+	{
+		zetaN = Zeta(count, theta);
+		alpha = 1.0 / (1.0 - theta);
+		eta = (1.0 - std::pow(2.0 / static_cast<double>(count), 1.0 - theta)) / (1.0 - Zeta(2, theta) / zetaN);
+	}
+
+	double ZipfianGenerator::Zeta(std::int64_t count, double theta)
+	{
+		// Summing 10^8 powers takes seconds; past the first million terms, the
+		// integral of x^-theta is accurate to well below what a benchmark can tell.
+		constexpr std::int64_t exactTerms = 1 << 20;
+
+		double sum = 0.0;
+		for (std::int64_t i = 1; i <= std::min(count, exactTerms); ++i)
+		{
+			sum += 1.0 / std::pow(static_cast<double>(i), theta);
+		}
+
+		if (count > exactTerms)
+		{
+			const double from = static_cast<double>(exactTerms) + 0.5;
+			const double to = static_cast<double>(count) + 0.5;
+			sum += (std::pow(to, 1.0 - theta) - std::pow(from, 1.0 - theta)) / (1.0 - theta);
+		}
+
+		return sum;
+	}
+
+	template <typename Random>
+	std::int64_t ZipfianGenerator::operator()(Random& random)
+	{
+		const double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+		const double uz = u * zetaN;
+
+		if (uz < 1.0)
+		{
+			return 0;
+		}
+
+		if (uz < 1.0 + std::pow(0.5, theta))
+		{
+			return 1;
+		}
+
+		const auto rank = static_cast<std::int64_t>(static_cast<double>(count) * std::pow(eta * u - eta + 1.0, alpha));
+		return std::min(rank, count - 1);
+	}
+
+	std::vector<int> MakeAccessSequence(AccessPattern pattern, int keyCount, int length, std::uint64_t seed)
+	{
+		std::vector<int> sequence(length);
+		std::mt19937_64 random(seed);
+
+		switch (pattern)
+		{
+		case AccessPattern::Sequential:
+			for (int i = 0; i < length; ++i)
+			{
+				sequence[i] = i % keyCount;
+			}
+			break;
+
+		case AccessPattern::Random:
+		{
+			std::uniform_int_distribution<int> position(0, keyCount - 1);
+			for (int& next : sequence)
+			{
+				next = position(random);
+			}
+			break;
+		}
+
+		case AccessPattern::Zipfian:
+		{
+			// Hot ranks would otherwise all sit at the front of the map, which
+			// makes them look far more cache friendly than real hot keys are.
+			ZipfianGenerator zipfian(keyCount);
+			for (int& next : sequence)
+			{
+				const std::uint64_t rank = static_cast<std::uint64_t>(zipfian(random));
+				next = static_cast<int>((rank * 0x9E3779B97F4A7C15ull >> 11) % static_cast<std::uint64_t>(keyCount));
+			}
+			break;
+		}
+		}
+
+		return sequence;
+	}
+
+	bool LatencyClock::HasCycleCounter()
+	{
+#ifdef SLOTMAP_BENCHMARK_CYCLE_COUNTER
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	LatencyClock::LatencyClock(bool useCycleCounter) : cycles{ useCycleCounter && HasCycleCounter() }
+	{
+		if (!cycles)
+		{
+			return;
+		}
+
+		// Count cycles over a few milliseconds of steady_clock time.
+		const auto start = std::chrono::steady_clock::now();
+		const std::uint64_t startTicks = Now();
+
+		auto stop = start;
+		while (stop - start < std::chrono::milliseconds(20))
+		{
+			stop = std::chrono::steady_clock::now();
+		}
+
+		const std::uint64_t ticks = Now() - startTicks;
+		nanosecondsPerTick = std::chrono::duration<double, std::nano>(stop - start).count() / static_cast<double>(ticks);
+	}
+
+	std::uint64_t LatencyClock::Now() const
+	{
+#ifdef SLOTMAP_BENCHMARK_CYCLE_COUNTER
+		if (cycles)
+		{
+			return __rdtsc();
+		}
+#endif
+
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	std::size_t LatencyHistogram::BucketOf(std::uint64_t value)
+	{
+		if (value < SubBuckets)
+		{
+			return static_cast<std::size_t>(value);
+		}
+
+		const int shift = std::bit_width(value) - 1 - SubBucketBits;
+		return static_cast<std::size_t>((shift + 1) * SubBuckets + ((value >> shift) - SubBuckets));
+	}
+
+	std::uint64_t LatencyHistogram::UpperBoundOf(std::size_t bucket)
+	{
+		if (bucket < SubBuckets)
+		{
+			return bucket;
+		}
+
+		const int shift = static_cast<int>(bucket / SubBuckets) - 1;
+		const std::uint64_t lower = (bucket % SubBuckets + SubBuckets) << shift;
+		return lower + ((1ull << shift) - 1);
+	}
+
+	void LatencyHistogram::Record(std::uint64_t nanoseconds)
+	{
+		++counts[BucketOf(nanoseconds)];
+		++count;
+		sum += nanoseconds;
+		max = std::max(max, nanoseconds);
+	}
+
+	std::uint64_t LatencyHistogram::Percentile(double fraction) const
+	{
+		if (count == 0)
+		{
+			return 0;
+		}
+
+		const auto rank = static_cast<std::uint64_t>(std::ceil(fraction * static_cast<double>(count)));
+		std::uint64_t seen = 0;
+
+		for (std::size_t bucket = 0; bucket < counts.size(); ++bucket)
+		{
+			seen += counts[bucket];
+			if (seen >= std::max<std::uint64_t>(rank, 1))
+			{
+				return std::min(UpperBoundOf(bucket), max);
+			}
+		}
+
+		return max;
+	}
+
+	std::uint64_t LatencyHistogram::CountAbove(std::uint64_t nanoseconds) const
+	{
+		std::uint64_t above = 0;
+		for (std::size_t bucket = BucketOf(nanoseconds) + 1; bucket < counts.size(); ++bucket)
+		{
+			above += counts[bucket];
+		}
+
+		return above;
+	}
+
+	void AddLatencyValues(BenchmarkResult& result, const LatencyHistogram& histogram)
+	{
+		result
+			.Value("count", static_cast<double>(histogram.Count()))
+			.Value("meanNs", histogram.Mean())
+			.Value("p50Ns", static_cast<double>(histogram.Percentile(0.5)))
+			.Value("p90Ns", static_cast<double>(histogram.Percentile(0.9)))
+			.Value("p99Ns", static_cast<double>(histogram.Percentile(0.99)))
+			.Value("p999Ns", static_cast<double>(histogram.Percentile(0.999)))
+			.Value("p9999Ns", static_cast<double>(histogram.Percentile(0.9999)))
+			.Value("maxNs", static_cast<double>(histogram.Max()));
+	}
+
+	double TimerOverheadNanoseconds(const LatencyClock& clock)
+	{
+		LatencyHistogram overhead;
+		for (int i = 0; i < 10000; ++i)
+		{
+			const std::uint64_t start = clock.Now();
+			overhead.Record(clock.ToNanoseconds(clock.Now() - start));
+		}
+
+		return static_cast<double>(overhead.Percentile(0.5));
+	}
+
+	Repetitions Summarize(std::vector<double> samples)
+	{
+		Repetitions result;
+		if (samples.empty())
+		{
+			return result;
+		}
+
+		std::sort(samples.begin(), samples.end());
+		result.minimum = samples.front();
+		result.median = samples[samples.size() / 2];
+
+		return result;
+	}
+
+	namespace Detail
+	{
+		void WriteJsonString(std::FILE* file, const std::string& text)
+		{
+			std::fputc('"', file);
+			for (const char c : text)
+			{
+				if (c == '"' || c == '\\')
+				{
+					std::fputc('\\', file);
+				}
+
+				std::fputc(c, file);
+			}
+			std::fputc('"', file);
+		}
+
+		void WriteJsonMembers(std::FILE* file, const BenchmarkResult& result, const char* indent)
+		{
+			bool first = true;
+			for (const auto& [name, value] : result.labels)
+			{
+				std::fprintf(file, "%s\n%s\"%s\": ", first ? "" : ",", indent, name.c_str());
+				WriteJsonString(file, value);
+				first = false;
+			}
+
+			for (const auto& [name, value] : result.values)
+			{
+				// JSON has no infinities or NaNs.
+				if (std::isfinite(value))
+				{
+					std::fprintf(file, "%s\n%s\"%s\": %.15g", first ? "" : ",", indent, name.c_str(), value);
+				}
+				else
+				{
+					std::fprintf(file, "%s\n%s\"%s\": null", first ? "" : ",", indent, name.c_str());
+				}
+				first = false;
+			}
+		}
+	}
+
+	void WriteJson(std::FILE* file, const BenchmarkResult& settings, const std::vector<BenchmarkResult>& results)
+	{
+		std::fputc('{', file);
+		Detail::WriteJsonMembers(file, settings, "  ");
+		std::fprintf(file, "%s\n  \"results\": [", settings.labels.empty() && settings.values.empty() ? "" : ",");
+
+		for (std::size_t i = 0; i < results.size(); ++i)
+		{
+			std::fprintf(file, "%s\n    {", i == 0 ? "" : ",");
+			Detail::WriteJsonMembers(file, results[i], "      ");
+			std::fprintf(file, "\n    }");
+		}
+
+		std::fprintf(file, "\n  ]\n}\n");
+	}
+
+	bool WriteReport(const char* path, const BenchmarkResult& settings, const std::vector<BenchmarkResult>& results)
+	{
+		std::FILE* file = path ? std::fopen(path, "w") : stdout;
+		if (!file)
+		{
+			std::fprintf(stderr, "Could not open %s.\n", path);
+			return false;
+		}
+
+		WriteJson(file, settings, results);
+
+		if (file != stdout)
+		{
+			std::fclose(file);
+		}
+
+		return true;
+	}
+
+	const char* BuildName()
+	{
+#ifdef NDEBUG
+		return "release";
+#else
+		return "debug";
+#endif
+	}
+
+	std::vector<std::string> SplitList(const char* text)
+	{
+		std::vector<std::string> items;
+		std::string item;
+
+		for (const char* c = text; ; ++c)
+		{
+			if (*c == ',' || *c == '\0')
+			{
+				if (!item.empty())
+				{
+					items.push_back(item);
+				}
+
+				item.clear();
+
+				if (*c == '\0')
+				{
+					break;
+				}
+			}
+			else
+			{
+				item += *c;
+			}
+		}
+
+		return items;
+	}
+
+	bool ParseCount(const char* text, int& count)
+	{
+		char* end = nullptr;
+		const double value = std::strtod(text, &end);
+
+		// Converting a double that doesn't fit an int is undefined, so check the range first.
+		if (end == text || *end != '\0' || !(value >= 1.0 && value <= (1 << 30)))
+		{
+			return false;
+		}
+
+		count = static_cast<int>(value);
+		return value == static_cast<double>(count);
+	}
+} // namespace Unalmas::Benchmarks
@@ -0,0 +1,576 @@
+// Micro-benchmarks of the SlotMap operations, over a grid of element sizes, map
+// sizes, key access patterns and churn ratios. Results go to stdout (or --output)
+// as JSON, progress goes to stderr.
+//
+// "Benchmarks compare ..." runs the comparison with other containers instead
+// (see BenchmarkComparison), "Benchmarks latency ..." the per-operation latency
+// histograms (see BenchmarkLatency), "Benchmarks replay ..." a recorded trace
+// (see BenchmarkReplay), and "Benchmarks memory ..." the memory held over long
+// churn runs (see BenchmarkMemory).
+//
+// Where perf_event_open is available, every result also gets hardware counters
+// per operation (see BenchmarkCounters).
+//
+// Build in Release, and with SLOTMAP_RELEASE defined, to measure what production
+// code gets rather than the cost of the key checks.
+
+import <algorithm>;
+import <cstdint>;
+import <cstdio>;
+import <cstdlib>;
+import <cstring>;
+import <memory>;
+import <numeric>;
+import <random>;
+import <string>;
+import <type_traits>;
+import <vector>;
+import SlotMap;
+import BenchmarkSupport;
+import BenchmarkCounters;
+import BenchmarkComparison;
+import BenchmarkLatency;
+import BenchmarkReplay;
+import BenchmarkMemory;
+
+using namespace Unalmas;
+using namespace Unalmas::Benchmarks;
+
+namespace
+{
+	struct Options
+	{
+		std::vector<int>			elementSizes{ 4, 64, 256, 4096 };
+		std::vector<int>			mapSizes{ 1000, 100000, 1000000 };
+		std::vector<AccessPattern>	patterns{ AccessPattern::Sequential, AccessPattern::Random, AccessPattern::Zipfian };
+		std::vector<double>			churnRatios{ 0.01, 0.1 };
+		std::vector<SlotMapReuse>	reuses{ SlotMapReuse::Fifo, SlotMapReuse::Lifo, SlotMapReuse::LowestIndex };
+		int							operations{ 1000000 };
+		int							repetitions{ 5 };
+		std::uint64_t				seed{ 1 };
+		std::int64_t				memoryLimit{ 4ll << 30 };
+		bool						counters{ true };
+		const char*					output{ nullptr };
+	};
+
+	// Hardware counters around each measurement, where there are any.
+	PerfCounters counters;
+
+	const char* ReuseName(SlotMapReuse reuse)
+	{
+		switch (reuse)
+		{
+		case SlotMapReuse::Fifo:		return "fifo";
+		case SlotMapReuse::Lifo:		return "lifo";
+		case SlotMapReuse::LowestIndex:	return "lowest";
+		}
+
+		return "unknown";
+	}
+
+	void PrintUsage()
+	{
+		std::fprintf(stderr,
+			"Usage: Benchmarks [options]\n"
+			"       Benchmarks compare [options]   (see Benchmarks compare --help)\n"
+			"       Benchmarks latency [options]   (see Benchmarks latency --help)\n"
+			"       Benchmarks replay TRACE [options]   (see Benchmarks replay --help)\n"
+			"       Benchmarks memory [options]    (see Benchmarks memory --help)\n"
+			"  --element-sizes LIST   bytes per element, out of 4,16,64,256,1024,4096 (default 4,64,256,4096)\n"
+			"  --sizes LIST           element counts, e.g. 1e3,1e6,1e8 (default 1e3,1e5,1e6)\n"
+			"  --patterns LIST        sequential, random and/or zipfian (default all)\n"
+			"  --churn LIST           fractions of mixed operations that erase and reinsert (default 0.01,0.1)\n"
+			"  --reuse LIST           free slot reuse policies, out of fifo,lifo,lowest (default all)\n"
+			"  --operations N         lookups per measurement (default 1e6)\n"
+			"  --repetitions N        measurements per result; the median is reported (default 5)\n"
+			"  --seed N               seed of all generated workloads (default 1)\n"
+			"  --memory-limit MB      skips combinations that would need more (default 4096)\n"
+			"  --counters on|off      hardware performance counters per operation, where available (default on)\n"
+			"  --output PATH          writes the JSON report there instead of to stdout\n");
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			const char* name = argv[i];
+			if (i + 1 == argc)
+			{
+				return false;
+			}
+
+			const char* value = argv[++i];
+			int count = 0;
+
+			if (std::strcmp(name, "--element-sizes") == 0)
+			{
+				options.elementSizes.clear();
+				for (const std::string& item : SplitList(value))
+				{
+					const int bytes = std::atoi(item.c_str());
+					if (std::find(std::begin(PayloadSizes), std::end(PayloadSizes), bytes) == std::end(PayloadSizes))
+					{
+						return false;
+					}
+
+					options.elementSizes.push_back(bytes);
+				}
+			}
+			else if (std::strcmp(name, "--sizes") == 0)
+			{
+				options.mapSizes.clear();
+				for (const std::string& item : SplitList(value))
+				{
+					if (!ParseCount(item.c_str(), count))
+					{
+						return false;
+					}
+
+					options.mapSizes.push_back(count);
+				}
+			}
+			else if (std::strcmp(name, "--patterns") == 0)
+			{
+				options.patterns.clear();
+				for (const std::string& item : SplitList(value))
+				{
+					AccessPattern pattern;
+					if (!ParseAccessPattern(item.c_str(), pattern))
+					{
+						return false;
+					}
+
+					options.patterns.push_back(pattern);
+				}
+			}
+			else if (std::strcmp(name, "--churn") == 0)
+			{
+				options.churnRatios.clear();
+				for (const std::string& item : SplitList(value))
+				{
+					const double ratio = std::atof(item.c_str());
+					if (ratio < 0.0 || ratio > 1.0)
+					{
+						return false;
+					}
+
+					options.churnRatios.push_back(ratio);
+				}
+			}
+			else if (std::strcmp(name, "--reuse") == 0)
+			{
+				options.reuses.clear();
+				for (const std::string& item : SplitList(value))
+				{
+					const SlotMapReuse policies[]{ SlotMapReuse::Fifo, SlotMapReuse::Lifo, SlotMapReuse::LowestIndex };
+					const auto policy = std::find_if(std::begin(policies), std::end(policies),
+						[&](SlotMapReuse reuse) { return item == ReuseName(reuse); });
+
+					if (policy == std::end(policies))
+					{
+						return false;
+					}
+
+					options.reuses.push_back(*policy);
+				}
+			}
+			else if (std::strcmp(name, "--operations") == 0 && ParseCount(value, count))
+			{
+				options.operations = count;
+			}
+			else if (std::strcmp(name, "--repetitions") == 0 && ParseCount(value, count) && count <= 1000)
+			{
+				options.repetitions = count;
+			}
+			else if (std::strcmp(name, "--seed") == 0)
+			{
+				options.seed = std::strtoull(value, nullptr, 10);
+			}
+			else if (std::strcmp(name, "--memory-limit") == 0 && ParseCount(value, count))
+			{
+				options.memoryLimit = static_cast<std::int64_t>(count) << 20;
+			}
+			else if (std::strcmp(name, "--counters") == 0 && (std::strcmp(value, "on") == 0 || std::strcmp(value, "off") == 0))
+			{
+				options.counters = std::strcmp(value, "on") == 0;
+			}
+			else if (std::strcmp(name, "--output") == 0)
+			{
+				options.output = value;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// What one combination needs at its peak: a growing map holds the old and
+	// the new arrays at the same time, at up to twice the element count each.
+	std::int64_t EstimateMemory(int elementSize, int mapSize, int operations)
+	{
+		const std::int64_t perElement = elementSize + sizeof(SlotMapKey) + 2 * sizeof(int);
+		return 3 * perElement * mapSize + static_cast<std::int64_t>(sizeof(SlotMapKey)) * mapSize + sizeof(int) * static_cast<std::int64_t>(operations);
+	}
+
+	void Record(std::vector<BenchmarkResult>& results, const char* operation, AccessPattern pattern,
+		int elementSize, int mapSize, double churn, int operations, const std::vector<double>& samples, const char* reuse = nullptr)
+	{
+		const Repetitions time = Summarize(samples);
+
+		BenchmarkResult& result = results.emplace_back(BenchmarkResult()
+			.Label("operation", operation)
+			.Label("pattern", AccessPatternName(pattern))
+			.Value("elementSize", elementSize)
+			.Value("mapSize", mapSize)
+			.Value("churn", churn)
+			.Value("operations", operations)
+			.Value("nsPerOp", time.median / operations)
+			.Value("minNsPerOp", time.minimum / operations)
+			.Value("opsPerSecond", operations / time.median * 1e9));
+
+		// Everything counted since the previous result, i.e. over all of this one's repetitions.
+		AddCounterValues(result, counters.Take(), static_cast<double>(operations) * samples.size());
+
+		if (reuse)
+		{
+			result.Label("reuse", reuse);
+		}
+
+		std::fprintf(stderr, "%-16s %-10s %5d B %10d elements, churn %.2f%s%s: %9.2f ns/op\n",
+			operation, AccessPatternName(pattern), elementSize, mapSize, churn, reuse ? ", reuse " : "", reuse ? reuse : "", time.median / operations);
+	}
+
+	template <typename T>
+	void BenchmarkInsert(const Options& options, int mapSize, bool presized, std::vector<BenchmarkResult>& results)
+	{
+		std::vector<double> samples;
+
+		for (int repetition = 0; repetition < options.repetitions; ++repetition)
+		{
+			// Without a capacity up front, the map grows log2(mapSize / 8) times on
+			// the way; the difference to the presized run is what Grow() costs.
+			auto slotmap = presized ? std::make_unique<SlotMap<T>>(mapSize) : std::make_unique<SlotMap<T>>();
+
+			samples.push_back(counters.TimeNanoseconds([&]()
+			{
+				for (int i = 0; i < mapSize; ++i)
+				{
+					slotmap->Insert(T(i));
+				}
+			}));
+
+			checksum += slotmap->Size();
+		}
+
+		Record(results, presized ? "insert_presized" : "insert", AccessPattern::Sequential, sizeof(T), mapSize, 0.0, mapSize, samples);
+	}
+
+	template <typename T>
+	void BenchmarkErase(const Options& options, int mapSize, AccessPattern pattern, std::vector<BenchmarkResult>& results)
+	{
+		std::vector<double> samples;
+
+		std::vector<int> order(mapSize);
+		std::iota(order.begin(), order.end(), 0);
+		if (pattern == AccessPattern::Random)
+		{
+			std::shuffle(order.begin(), order.end(), std::mt19937_64(options.seed));
+		}
+
+		for (int repetition = 0; repetition < options.repetitions; ++repetition)
+		{
+			SlotMap<T> slotmap(mapSize);
+			std::vector<SlotMapKey> keys(mapSize);
+			for (int i = 0; i < mapSize; ++i)
+			{
+				keys[i] = slotmap.Insert(T(i));
+			}
+
+			samples.push_back(counters.TimeNanoseconds([&]()
+			{
+				for (const int position : order)
+				{
+					slotmap.Erase(keys[position]);
+				}
+			}));
+
+			checksum += slotmap.Size();
+		}
+
+		Record(results, "erase", pattern, sizeof(T), mapSize, 0.0, mapSize, samples);
+	}
+
+	template <typename T>
+	void BenchmarkLookups(const Options& options, int mapSize, std::vector<BenchmarkResult>& results)
+	{
+		// The churned runs change the map's keys and layout, so every pattern and
+		// every churned repetition starts from a freshly filled map instead.
+		std::unique_ptr<SlotMap<T>> slotmap;
+		std::vector<SlotMapKey> keys(mapSize);
+		const auto fill = [&]()
+		{
+			slotmap = std::make_unique<SlotMap<T>>(mapSize);
+			for (int i = 0; i < mapSize; ++i)
+			{
+				keys[i] = slotmap->Insert(T(i));
+			}
+		};
+
+		fill();
+		std::vector<double> samples;
+
+		for (int repetition = 0; repetition < options.repetitions; ++repetition)
+		{
+			samples.push_back(counters.TimeNanoseconds([&]()
+			{
+				const SlotMap<T>& view = *slotmap;
+				std::uint32_t sum = 0;
+				for (const T& value : view)
+				{
+					sum += value.Checksum();
+				}
+				checksum += sum;
+			}));
+		}
+
+		Record(results, "iterate", AccessPattern::Sequential, sizeof(T), mapSize, 0.0, mapSize, samples);
+
+		for (const AccessPattern pattern : options.patterns)
+		{
+			const std::vector<int> sequence = MakeAccessSequence(pattern, mapSize, options.operations, options.seed);
+			fill();
+			const SlotMap<T>& view = *slotmap;
+
+			samples.clear();
+			for (int repetition = 0; repetition < options.repetitions; ++repetition)
+			{
+				samples.push_back(counters.TimeNanoseconds([&]()
+				{
+					std::uint32_t sum = 0;
+					for (const int position : sequence)
+					{
+						sum += view[keys[position]].Checksum();
+					}
+					checksum += sum;
+				}));
+			}
+
+			Record(results, "lookup", pattern, sizeof(T), mapSize, 0.0, options.operations, samples);
+
+			samples.clear();
+			for (int repetition = 0; repetition < options.repetitions; ++repetition)
+			{
+				samples.push_back(counters.TimeNanoseconds([&]()
+				{
+					std::uint32_t sum = 0;
+					T value;
+					for (const int position : sequence)
+					{
+						if (view.TryGet(keys[position], value))
+						{
+							sum += value.Checksum();
+						}
+					}
+					checksum += sum;
+				}));
+			}
+
+			Record(results, "tryget", pattern, sizeof(T), mapSize, 0.0, options.operations, samples);
+
+			// Lookups mixed with erase-and-reinsert pairs at the same positions, so
+			// the map keeps its size while its keys and layout churn.
+			for (const double churn : options.churnRatios)
+			{
+				if (churn <= 0.0)
+				{
+					continue;
+				}
+
+				std::vector<unsigned char> churns(options.operations);
+				std::mt19937_64 random(options.seed + 1);
+				std::bernoulli_distribution coin(churn);
+				for (unsigned char& next : churns)
+				{
+					next = coin(random);
+				}
+
+				samples.clear();
+				for (int repetition = 0; repetition < options.repetitions; ++repetition)
+				{
+					fill();
+					SlotMap<T>& churned = *slotmap;
+					const SlotMap<T>& churnedView = churned;
+
+					samples.push_back(counters.TimeNanoseconds([&]()
+					{
+						std::uint32_t sum = 0;
+						for (int i = 0; i < options.operations; ++i)
+						{
+							SlotMapKey& key = keys[sequence[i]];
+							if (churns[i])
+							{
+								churned.Erase(key);
+								key = churned.Insert(T(i));
+							}
+							else
+							{
+								sum += churnedView[key].Checksum();
+							}
+						}
+						checksum += sum;
+					}));
+				}
+
+				Record(results, "mixed", pattern, sizeof(T), mapSize, churn, options.operations, samples);
+			}
+		}
+	}
+
+	// How the free slot reuse policy shapes a map after a spike: half of it is
+	// erased at random, then erases and inserts alternate with that many free
+	// slots to choose from, and the lookups afterwards see where the live slots
+	// ended up.
+	template <typename T>
+	void BenchmarkReuse(const Options& options, int mapSize, SlotMapReuse reuse, std::vector<BenchmarkResult>& results)
+	{
+		SlotMap<T> slotmap(mapSize, reuse);
+		std::vector<SlotMapKey> keys(mapSize);
+		for (int i = 0; i < mapSize; ++i)
+		{
+			keys[i] = slotmap.Insert(T(i));
+		}
+
+		std::mt19937_64 random(options.seed);
+		std::shuffle(keys.begin(), keys.end(), random);
+		while (keys.size() > 1 && static_cast<int>(keys.size()) > mapSize / 2)
+		{
+			slotmap.Erase(keys.back());
+			keys.pop_back();
+		}
+
+		const int liveCount = static_cast<int>(keys.size());
+		const std::vector<int> sequence = MakeAccessSequence(AccessPattern::Random, liveCount, options.operations, options.seed);
+		const SlotMap<T>& view = slotmap;
+		std::vector<double> samples;
+
+		for (int repetition = 0; repetition < options.repetitions; ++repetition)
+		{
+			samples.push_back(counters.TimeNanoseconds([&]()
+			{
+				for (int i = 0; i < options.operations; ++i)
+				{
+					SlotMapKey& key = keys[sequence[i]];
+					slotmap.Erase(key);
+					key = slotmap.Insert(T(i));
+				}
+			}));
+		}
+
+		Record(results, "reuse_churn", AccessPattern::Random, sizeof(T), mapSize, 0.5, options.operations, samples, ReuseName(reuse));
+
+		samples.clear();
+		for (int repetition = 0; repetition < options.repetitions; ++repetition)
+		{
+			samples.push_back(counters.TimeNanoseconds([&]()
+			{
+				std::uint32_t sum = 0;
+				for (const int position : sequence)
+				{
+					sum += view[keys[position]].Checksum();
+				}
+				checksum += sum;
+			}));
+		}
+
+		Record(results, "reuse_lookup", AccessPattern::Random, sizeof(T), mapSize, 0.5, options.operations, samples, ReuseName(reuse));
+	}
+
+	template <typename T>
+	void RunBenchmarks(const Options& options, int mapSize, std::vector<BenchmarkResult>& results)
+	{
+		BenchmarkInsert<T>(options, mapSize, false, results);
+		BenchmarkInsert<T>(options, mapSize, true, results);
+
+		// Erasing in a skewed order would mostly hit keys that are already gone.
+		for (const AccessPattern pattern : options.patterns)
+		{
+			if (pattern != AccessPattern::Zipfian)
+			{
+				BenchmarkErase<T>(options, mapSize, pattern, results);
+			}
+		}
+
+		BenchmarkLookups<T>(options, mapSize, results);
+
+		for (const SlotMapReuse reuse : options.reuses)
+		{
+			BenchmarkReuse<T>(options, mapSize, reuse, results);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1 && std::strcmp(argv[1], "compare") == 0)
+	{
+		return RunComparison(argc - 2, argv + 2);
+	}
+
+	if (argc > 1 && std::strcmp(argv[1], "latency") == 0)
+	{
+		return RunLatency(argc - 2, argv + 2);
+	}
+
+	if (argc > 1 && std::strcmp(argv[1], "replay") == 0)
+	{
+		return RunReplay(argc - 2, argv + 2);
+	}
+
+	if (argc > 1 && std::strcmp(argv[1], "memory") == 0)
+	{
+		return RunMemory(argc - 2, argv + 2);
+	}
+
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	if (options.counters && !counters.Open())
+	{
+		std::fprintf(stderr, "No hardware counters (%s); reporting times only.\n", counters.Error().c_str());
+	}
+
+	std::vector<BenchmarkResult> results;
+
+	for (const int elementSize : options.elementSizes)
+	{
+		for (const int mapSize : options.mapSizes)
+		{
+			if (EstimateMemory(elementSize, mapSize, options.operations) > options.memoryLimit)
+			{
+				std::fprintf(stderr, "Skipping %d B x %d elements, it would need more than the memory limit.\n", elementSize, mapSize);
+				continue;
+			}
+
+			WithPayload(elementSize, [&](auto type)
+			{
+				RunBenchmarks<typename decltype(type)::type>(options, mapSize, results);
+			});
+		}
+	}
+
+	return WriteReport(options.output, BenchmarkResult()
+		.Label("benchmark", "SlotMap")
+		.Label("build", BuildName())
+		.Label("counters", counters.IsOpen() ? counters.Names() : "none")
+		.Value("seed", static_cast<double>(options.seed))
+		.Value("operations", options.operations)
+		.Value("repetitions", options.repetitions)
+		.Value("checksum", checksum), results) ? 0 : 1;
+}
@@ -0,0 +1,811 @@
+export module BenchmarkComparison;
+
+// Head-to-head comparison of SlotMap with other ways of handing out keys to
+// values, on identical mixed workloads.
+//
+// Guarantees:
+// every container runs the exact same sequence of inserts, erases and lookups
+// (generated from the seed up front), and the same positions in its list of
+// live keys are looked up and erased
+// all containers detect stale keys the same way, with a generation per slot,
+// and every Get checks its key explicitly (aborting on a stale one), so none of
+// them wins by skipping checks the others make; the slotmaps' operator[] checks
+// once more in builds without SLOTMAP_RELEASE (the Makefile's release build
+// defines it), so only compare numbers from builds configured alike
+// memory is what the container holds at the end of a run, counted through its
+// allocator (std containers) or from its capacity (the slotmaps)
+
+import <algorithm>;
+import <cstddef>;
+import <cstdint>;
+import <cstdio>;
+import <cstdlib>;
+import <cstring>;
+import <functional>;
+import <new>;
+import <optional>;
+import <random>;
+import <string>;
+import <type_traits>;
+import <unordered_map>;
+import <utility>;
+import <vector>;
+import SlotMap;
+import StableSlotMap;
+import AdaptiveSlotMap;
+import BenchmarkSupport;
+import BenchmarkCounters;
+
+export namespace Unalmas::Benchmarks
+{
+	// Runs the comparison with the given command line (without the program name
+	// and the "compare" command); returns the process exit code.
+	int						RunComparison(int argc, char** argv);
+
+	// An allocator that keeps a running total of the bytes it holds.
+	template <typename T>
+	struct CountingAllocator
+	{
+		using value_type = T;
+
+		std::size_t* bytes;
+
+		explicit CountingAllocator(std::size_t* bytes_) : bytes{ bytes_ } {}
+
+		template <typename U>
+		CountingAllocator(const CountingAllocator<U>& other) : bytes{ other.bytes } {}
+
+		T* allocate(std::size_t count)
+		{
+			*bytes += count * sizeof(T);
+			return std::allocator<T>().allocate(count);
+		}
+
+		void deallocate(T* pointer, std::size_t count)
+		{
+			*bytes -= count * sizeof(T);
+			std::allocator<T>().deallocate(pointer, count);
+		}
+
+		template <typename U>
+		bool operator==(const CountingAllocator<U>& other) const { return bytes == other.bytes; }
+	};
+
+	// The containers below share one interface: Insert returns a key, Erase and
+	// Get take one (Get only live ones), ForEach visits every value, and
+	// MemoryBytes tells what the container holds.
+
+	template <typename T>
+	class SlotMapContainer
+	{
+	public:
+		static constexpr const char* Name = "slotmap";
+
+		SlotMapKey			Insert(const T& value) { return map.Insert(value); }
+		bool				Erase(const SlotMapKey& key) { return map.Erase(key); }
+
+		// operator[] doesn't check keys under SLOTMAP_RELEASE; the other containers always do.
+		const T& Get(const SlotMapKey& key) const
+		{
+			if (!map.Contains(key))
+			{
+				std::abort();
+			}
+
+			return map[key];
+		}
+
+		template <typename F>
+		void ForEach(F&& func) const
+		{
+			for (const T& value : map)
+			{
+				func(value);
+			}
+		}
+
+		std::size_t MemoryBytes() const { return map.MemoryUsage().Total(); }
+
+	private:
+		SlotMap<T>			map;
+	};
+
+	template <typename T>
+	class StableSlotMapContainer
+	{
+	public:
+		static constexpr const char* Name = "stable_slotmap";
+
+		SlotMapKey			Insert(const T& value) { return map.Insert(value); }
+		bool				Erase(const SlotMapKey& key) { return map.Erase(key); }
+
+		// operator[] doesn't check keys under SLOTMAP_RELEASE; the other containers always do.
+		const T& Get(const SlotMapKey& key) const
+		{
+			if (!map.Contains(key))
+			{
+				std::abort();
+			}
+
+			return map[key];
+		}
+
+		template <typename F>
+		void ForEach(F&& func) const
+		{
+			for (const T& value : map)
+			{
+				func(value);
+			}
+		}
+
+		std::size_t MemoryBytes() const { return map.MemoryUsage().Total(); }
+
+	private:
+		StableSlotMap<T>	map;
+	};
+
+	// Lookups and iteration count towards the map's mix (and may move a few
+	// slots over), so they aren't const.
+	template <typename T>
+	class AdaptiveSlotMapContainer
+	{
+	public:
+		static constexpr const char* Name = "adaptive_slotmap";
+
+		SlotMapKey			Insert(const T& value) { return map.Insert(value); }
+		bool				Erase(const SlotMapKey& key) { return map.Erase(key); }
+
+		// Find counts as one lookup towards the mix, like operator[] would.
+		const T& Get(const SlotMapKey& key) const
+		{
+			const T* value = map.Find(key);
+			if (value == nullptr)
+			{
+				std::abort();
+			}
+
+			return *value;
+		}
+
+		template <typename F>
+		void ForEach(F&& func) const
+		{
+			map.ForEach(func);
+		}
+
+		std::size_t MemoryBytes() const { return map.MemoryBytes(); }
+
+	private:
+		mutable AdaptiveSlotMap<T>	map;
+	};
+
+	struct SlotMapKeyHash
+	{
+		std::size_t operator()(const SlotMapKey& key) const
+		{
+			return std::hash<std::uint64_t>()(static_cast<std::uint64_t>(static_cast<std::uint32_t>(key.index)) << 32
+				| static_cast<std::uint32_t>(key.generation));
+		}
+	};
+
+	// Keys are never reused, so the generation is always 0.
+	template <typename T>
+	class UnorderedMapContainer
+	{
+	public:
+		static constexpr const char* Name = "unordered_map";
+
+		SlotMapKey Insert(const T& value)
+		{
+			const SlotMapKey key{ nextIndex++, 0 };
+			map.emplace(key, value);
+			return key;
+		}
+
+		bool				Erase(const SlotMapKey& key) { return map.erase(key) == 1; }
+		const T&			Get(const SlotMapKey& key) const { return map.find(key)->second; }
+
+		template <typename F>
+		void ForEach(F&& func) const
+		{
+			for (const auto& entry : map)
+			{
+				func(entry.second);
+			}
+		}
+
+		std::size_t			MemoryBytes() const { return bytes; }
+
+	private:
+		using Allocator = CountingAllocator<std::pair<const SlotMapKey, T>>;
+
+		std::size_t			bytes{ 0 };
+		int					nextIndex{ 0 };
+		std::unordered_map<SlotMapKey, T, SlotMapKeyHash, std::equal_to<SlotMapKey>, Allocator>	map{ 0, SlotMapKeyHash(), std::equal_to<SlotMapKey>(), Allocator(&bytes) };
+	};
+
+	// Values stay where they were inserted; erased entries are emptied and their
+	// indices pushed on a free stack, which inserts pop first.
+	template <typename T>
+	class OptionalVectorContainer
+	{
+	public:
+		static constexpr const char* Name = "optional_vector";
+
+		SlotMapKey Insert(const T& value)
+		{
+			int index;
+			if (!freeIndices.empty())
+			{
+				index = freeIndices.back();
+				freeIndices.pop_back();
+			}
+			else
+			{
+				index = static_cast<int>(values.size());
+				values.emplace_back();
+				generations.push_back(0);
+			}
+
+			values[index].emplace(value);
+			return SlotMapKey{ index, generations[index] };
+		}
+
+		bool Erase(const SlotMapKey& key)
+		{
+			if (!IsLive(key))
+			{
+				return false;
+			}
+
+			values[key.index].reset();
+			++generations[key.index];
+			freeIndices.push_back(key.index);
+			return true;
+		}
+
+		const T& Get(const SlotMapKey& key) const
+		{
+			if (!IsLive(key))
+			{
+				std::abort();
+			}
+
+			return *values[key.index];
+		}
+
+		template <typename F>
+		void ForEach(F&& func) const
+		{
+			for (const std::optional<T>& value : values)
+			{
+				if (value)
+				{
+					func(*value);
+				}
+			}
+		}
+
+		std::size_t			MemoryBytes() const { return bytes; }
+
+	private:
+		bool IsLive(const SlotMapKey& key) const
+		{
+			return key.index >= 0 && key.index < static_cast<int>(values.size()) && generations[key.index] == key.generation;
+		}
+
+		std::size_t			bytes{ 0 };
+		std::vector<std::optional<T>, CountingAllocator<std::optional<T>>>	values{ CountingAllocator<std::optional<T>>(&bytes) };
+		std::vector<int, CountingAllocator<int>>	generations{ CountingAllocator<int>(&bytes) };
+		std::vector<int, CountingAllocator<int>>	freeIndices{ CountingAllocator<int>(&bytes) };
+	};
+
+	// Erasing only marks an entry dead (a tombstone). Inserts append until half of
+	// the entries are dead, then one sweep collects all tombstones for reuse.
+	template <typename T>
+	class TombstoneVectorContainer
+	{
+	public:
+		static constexpr const char* Name = "tombstone_vector";
+
+		SlotMapKey Insert(const T& value)
+		{
+			if (freeIndices.empty() && tombstones > 0 && 2 * tombstones >= static_cast<int>(values.size()))
+			{
+				for (int i = static_cast<int>(values.size()) - 1; i >= 0; --i)
+				{
+					if (!alive[i])
+					{
+						freeIndices.push_back(i);
+					}
+				}
+			}
+
+			int index;
+			if (!freeIndices.empty())
+			{
+				index = freeIndices.back();
+				freeIndices.pop_back();
+				values[index] = value;
+				alive[index] = 1;
+				--tombstones;
+			}
+			else
+			{
+				index = static_cast<int>(values.size());
+				values.push_back(value);
+				alive.push_back(1);
+				generations.push_back(0);
+			}
+
+			return SlotMapKey{ index, generations[index] };
+		}
+
+		bool Erase(const SlotMapKey& key)
+		{
+			if (!IsLive(key))
+			{
+				return false;
+			}
+
+			alive[key.index] = 0;
+			++generations[key.index];
+			++tombstones;
+			return true;
+		}
+
+		const T& Get(const SlotMapKey& key) const
+		{
+			if (!IsLive(key))
+			{
+				std::abort();
+			}
+
+			return values[key.index];
+		}
+
+		template <typename F>
+		void ForEach(F&& func) const
+		{
+			for (std::size_t i = 0; i < values.size(); ++i)
+			{
+				if (alive[i])
+				{
+					func(values[i]);
+				}
+			}
+		}
+
+		std::size_t			MemoryBytes() const { return bytes; }
+
+	private:
+		bool IsLive(const SlotMapKey& key) const
+		{
+			return key.index >= 0 && key.index < static_cast<int>(values.size()) && generations[key.index] == key.generation;
+		}
+
+		std::size_t			bytes{ 0 };
+		int					tombstones{ 0 };
+		std::vector<T, CountingAllocator<T>>		values{ CountingAllocator<T>(&bytes) };
+		std::vector<unsigned char, CountingAllocator<unsigned char>>	alive{ CountingAllocator<unsigned char>(&bytes) };
+		std::vector<int, CountingAllocator<int>>	generations{ CountingAllocator<int>(&bytes) };
+		std::vector<int, CountingAllocator<int>>	freeIndices{ CountingAllocator<int>(&bytes) };
+	};
+
+	namespace Comparison
+	{
+		enum class StepKind : unsigned char
+		{
+			Insert,
+			Erase,
+			Lookup,
+		};
+
+		struct Step
+		{
+			StepKind		kind;
+			int				position;	// Into the list of live keys
+		};
+
+		struct Workload
+		{
+			const char*		name;
+			double			insertShare;
+			double			eraseShare;		// The rest are lookups
+		};
+
+		constexpr Workload	Workloads[]
+		{
+			{ "read_heavy", 0.05, 0.05 },
+			{ "balanced", 0.25, 0.25 },
+			{ "write_heavy", 0.45, 0.45 },
+		};
+
+		struct Options
+		{
+			std::vector<std::string>	containers{ "slotmap", "stable_slotmap", "adaptive_slotmap", "unordered_map", "optional_vector", "tombstone_vector" };
+			std::vector<int>			elementSizes{ 16, 256 };
+			std::vector<int>			mapSizes{ 100000 };
+			std::vector<const Workload*>	workloads{ &Workloads[0], &Workloads[1], &Workloads[2] };
+			int							operations{ 1000000 };
+			int							repetitions{ 3 };
+			std::uint64_t				seed{ 1 };
+			bool						counters{ true };
+			const char*					output{ nullptr };
+		};
+
+		// Hardware counters around each throughput measurement, where there are any.
+		PerfCounters counters;
+
+		// Inserts add a key at the end of the live list; erases move the last key
+		// into the erased one's place. The list's length only depends on the steps,
+		// so the positions can be drawn up front.
+		std::vector<Step> MakeSteps(const Workload& workload, int initialSize, int count, std::uint64_t seed)
+		{
+			std::vector<Step> steps(count);
+			std::mt19937_64 random(seed);
+			std::uniform_real_distribution<double> share(0.0, 1.0);
+
+			int live = initialSize;
+			for (Step& step : steps)
+			{
+				const double draw = share(random);
+				step.kind = draw < workload.insertShare ? StepKind::Insert
+					: draw < workload.insertShare + workload.eraseShare ? StepKind::Erase : StepKind::Lookup;
+
+				if (step.kind != StepKind::Insert && live == 0)
+				{
+					step.kind = StepKind::Insert;
+				}
+
+				if (step.kind == StepKind::Insert)
+				{
+					step.position = live++;
+				}
+				else
+				{
+					step.position = std::uniform_int_distribution<int>(0, live - 1)(random);
+					live -= step.kind == StepKind::Erase ? 1 : 0;
+				}
+			}
+
+			return steps;
+		}
+
+		template <typename Container, typename T>
+		std::uint32_t Execute(Container& container, std::vector<SlotMapKey>& keys, const Step& step, int i)
+		{
+			switch (step.kind)
+			{
+			case StepKind::Insert:
+				keys.push_back(container.Insert(T(i)));
+				return 0;
+
+			case StepKind::Erase:
+				container.Erase(keys[step.position]);
+				keys[step.position] = keys.back();
+				keys.pop_back();
+				return 0;
+
+			case StepKind::Lookup:
+				return container.Get(keys[step.position]).Checksum();
+			}
+
+			return 0;
+		}
+
+		template <typename Container, typename T>
+		void Fill(Container& container, std::vector<SlotMapKey>& keys, int size)
+		{
+			keys.clear();
+			for (int i = 0; i < size; ++i)
+			{
+				keys.push_back(container.Insert(T(i)));
+			}
+		}
+
+		template <typename Container, typename T>
+		void Run(const Options& options, int mapSize, std::vector<BenchmarkResult>& results)
+		{
+			const auto label = [&](const char* operation, const char* workload)
+			{
+				return BenchmarkResult()
+					.Label("container", Container::Name)
+					.Label("operation", operation)
+					.Label("workload", workload)
+					.Value("elementSize", sizeof(T))
+					.Value("mapSize", mapSize);
+			};
+
+			std::vector<SlotMapKey> keys;
+			std::vector<double> samples;
+
+			for (int repetition = 0; repetition < options.repetitions; ++repetition)
+			{
+				Container container;
+				samples.push_back(counters.TimeNanoseconds([&]() { Fill<Container, T>(container, keys, mapSize); }));
+			}
+
+			{
+				const Repetitions time = Summarize(samples);
+				const PerfCounterValues counts = counters.Take();
+				Container container;
+				Fill<Container, T>(container, keys, mapSize);
+
+				BenchmarkResult& result = results.emplace_back(label("fill", "none")
+					.Value("operations", mapSize)
+					.Value("nsPerOp", time.median / mapSize)
+					.Value("minNsPerOp", time.minimum / mapSize)
+					.Value("opsPerSecond", mapSize / time.median * 1e9)
+					.Value("memoryBytes", static_cast<double>(container.MemoryBytes())));
+
+				AddCounterValues(result, counts, static_cast<double>(mapSize) * options.repetitions);
+			}
+
+			for (const Workload* workload : options.workloads)
+			{
+				const std::vector<Step> steps = MakeSteps(*workload, mapSize, options.operations, options.seed);
+
+				// Throughput: the whole sequence in one go.
+				samples.clear();
+				std::vector<double> iterations;
+				PerfCounterValues mixedCounts;
+				PerfCounterValues iterationCounts;
+				double iterated = 0.0;
+				std::size_t memory = 0;
+				int liveCount = 0;
+
+				for (int repetition = 0; repetition < options.repetitions; ++repetition)
+				{
+					Container container;
+					Fill<Container, T>(container, keys, mapSize);
+
+					samples.push_back(counters.TimeNanoseconds([&]()
+					{
+						std::uint32_t sum = 0;
+						for (int i = 0; i < options.operations; ++i)
+						{
+							sum += Execute<Container, T>(container, keys, steps[i], i);
+						}
+						checksum += sum;
+					}));
+					mixedCounts += counters.Take();
+
+					// Iterating what the workload left behind shows how holes hurt.
+					iterations.push_back(counters.TimeNanoseconds([&]()
+					{
+						std::uint32_t sum = 0;
+						container.ForEach([&](const T& value) { sum += value.Checksum(); });
+						checksum += sum;
+					}));
+					iterationCounts += counters.Take();
+					iterated += static_cast<double>(keys.size());
+
+					memory = container.MemoryBytes();
+					liveCount = static_cast<int>(keys.size());
+				}
+
+				// Latency: every operation timed on its own, on a fresh container.
+				LatencyHistogram latencies;
+				{
+					const LatencyClock clock;
+					Container container;
+					Fill<Container, T>(container, keys, mapSize);
+
+					std::uint32_t sum = 0;
+					for (int i = 0; i < options.operations; ++i)
+					{
+						const std::uint64_t start = clock.Now();
+						sum += Execute<Container, T>(container, keys, steps[i], i);
+						latencies.Record(clock.ToNanoseconds(clock.Now() - start));
+					}
+					checksum += sum;
+				}
+
+				const Repetitions time = Summarize(samples);
+				BenchmarkResult& result = results.emplace_back(label("mixed", workload->name)
+					.Value("operations", options.operations)
+					.Value("nsPerOp", time.median / options.operations)
+					.Value("minNsPerOp", time.minimum / options.operations)
+					.Value("opsPerSecond", options.operations / time.median * 1e9)
+					.Value("memoryBytes", static_cast<double>(memory))
+					.Value("bytesPerElement", liveCount > 0 ? static_cast<double>(memory) / liveCount : 0.0));
+
+				AddLatencyValues(result, latencies);
+				AddCounterValues(result, mixedCounts, static_cast<double>(options.operations) * options.repetitions);
+
+				const Repetitions iteration = Summarize(iterations);
+				AddCounterValues(results.emplace_back(label("iterate", workload->name)
+					.Value("operations", liveCount)
+					.Value("nsPerOp", liveCount > 0 ? iteration.median / liveCount : 0.0)
+					.Value("minNsPerOp", liveCount > 0 ? iteration.minimum / liveCount : 0.0)), iterationCounts, iterated);
+
+				std::fprintf(stderr, "%-16s %-12s %5d B %9d elements: %8.2f ns/op, p99 %8.0f ns, %6.1f B/element, iterate %6.2f ns/element\n",
+					Container::Name, workload->name, static_cast<int>(sizeof(T)), mapSize, time.median / options.operations,
+					static_cast<double>(latencies.Percentile(0.99)), liveCount > 0 ? static_cast<double>(memory) / liveCount : 0.0,
+					liveCount > 0 ? iteration.median / liveCount : 0.0);
+			}
+		}
+
+		template <typename T>
+		bool RunContainer(const std::string& name, const Options& options, int mapSize, std::vector<BenchmarkResult>& results)
+		{
+			if (name == SlotMapContainer<T>::Name)
+			{
+				Run<SlotMapContainer<T>, T>(options, mapSize, results);
+			}
+			else if (name == StableSlotMapContainer<T>::Name)
+			{
+				Run<StableSlotMapContainer<T>, T>(options, mapSize, results);
+			}
+			else if (name == AdaptiveSlotMapContainer<T>::Name)
+			{
+				Run<AdaptiveSlotMapContainer<T>, T>(options, mapSize, results);
+			}
+			else if (name == UnorderedMapContainer<T>::Name)
+			{
+				Run<UnorderedMapContainer<T>, T>(options, mapSize, results);
+			}
+			else if (name == OptionalVectorContainer<T>::Name)
+			{
+				Run<OptionalVectorContainer<T>, T>(options, mapSize, results);
+			}
+			else if (name == TombstoneVectorContainer<T>::Name)
+			{
+				Run<TombstoneVectorContainer<T>, T>(options, mapSize, results);
+			}
+			else
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		void PrintUsage()
+		{
+			std::fprintf(stderr,
+				"Usage: Benchmarks compare [options]\n"
+				"  --containers LIST      slotmap, stable_slotmap, adaptive_slotmap, unordered_map, optional_vector\n"
+				"                         and/or tombstone_vector (default all)\n"
+				"  --element-sizes LIST   bytes per element, out of 4,16,64,256,1024,4096 (default 16,256)\n"
+				"  --sizes LIST           live elements before each workload starts (default 1e5)\n"
+				"  --workloads LIST       read_heavy, balanced and/or write_heavy (default all)\n"
+				"  --operations N         operations per workload (default 1e6)\n"
+				"  --repetitions N        throughput measurements per result; the median is reported (default 3)\n"
+				"  --seed N               seed of all generated workloads (default 1)\n"
+				"  --counters on|off      hardware performance counters per operation, where available (default on)\n"
+				"  --output PATH          writes the JSON report there instead of to stdout\n");
+		}
+
+		bool ParseOptions(int argc, char** argv, Options& options)
+		{
+			for (int i = 0; i < argc; ++i)
+			{
+				const char* name = argv[i];
+				if (i + 1 == argc)
+				{
+					return false;
+				}
+
+				const char* value = argv[++i];
+				int count = 0;
+
+				if (std::strcmp(name, "--containers") == 0)
+				{
+					options.containers = SplitList(value);
+				}
+				else if (std::strcmp(name, "--element-sizes") == 0)
+				{
+					options.elementSizes.clear();
+					for (const std::string& item : SplitList(value))
+					{
+						options.elementSizes.push_back(std::atoi(item.c_str()));
+					}
+				}
+				else if (std::strcmp(name, "--sizes") == 0)
+				{
+					options.mapSizes.clear();
+					for (const std::string& item : SplitList(value))
+					{
+						if (!ParseCount(item.c_str(), count))
+						{
+							return false;
+						}
+
+						options.mapSizes.push_back(count);
+					}
+				}
+				else if (std::strcmp(name, "--workloads") == 0)
+				{
+					options.workloads.clear();
+					for (const std::string& item : SplitList(value))
+					{
+						const auto found = std::find_if(std::begin(Workloads), std::end(Workloads), [&](const Workload& workload) { return item == workload.name; });
+						if (found == std::end(Workloads))
+						{
+							return false;
+						}
+
+						options.workloads.push_back(found);
+					}
+				}
+				else if (std::strcmp(name, "--operations") == 0 && ParseCount(value, count))
+				{
+					options.operations = count;
+				}
+				else if (std::strcmp(name, "--repetitions") == 0 && ParseCount(value, count))
+				{
+					options.repetitions = count;
+				}
+				else if (std::strcmp(name, "--seed") == 0)
+				{
+					options.seed = std::strtoull(value, nullptr, 10);
+				}
+				else if (std::strcmp(name, "--counters") == 0 && (std::strcmp(value, "on") == 0 || std::strcmp(value, "off") == 0))
+				{
+					options.counters = std::strcmp(value, "on") == 0;
+				}
+				else if (std::strcmp(name, "--output") == 0)
+				{
+					options.output = value;
+				}
+				else
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+	}
+
+	int RunComparison(int argc, char** argv)
+	{
+		Comparison::Options options;
+		if (!Comparison::ParseOptions(argc, argv, options))
+		{
+			Comparison::PrintUsage();
+			return 1;
+		}
+
+		if (options.counters && !Comparison::counters.Open())
+		{
+			std::fprintf(stderr, "No hardware counters (%s); reporting times only.\n", Comparison::counters.Error().c_str());
+		}
+
+		std::vector<BenchmarkResult> results;
+
+		for (const int elementSize : options.elementSizes)
+		{
+			for (const int mapSize : options.mapSizes)
+			{
+				for (const std::string& container : options.containers)
+				{
+					bool known = false;
+					const bool supported = WithPayload(elementSize, [&](auto type)
+					{
+						known = Comparison::RunContainer<typename decltype(type)::type>(container, options, mapSize, results);
+					});
+
+					if (!supported || !known)
+					{
+						Comparison::PrintUsage();
+						return 1;
+					}
+				}
+			}
+		}
+
+		return WriteReport(options.output, BenchmarkResult()
+			.Label("benchmark", "SlotMap comparison")
+			.Label("build", BuildName())
+			.Label("counters", Comparison::counters.IsOpen() ? Comparison::counters.Names() : "none")
+			.Value("seed", static_cast<double>(options.seed))
+			.Value("operations", options.operations)
+			.Value("repetitions", options.repetitions)
+			.Value("timerOverheadNs", TimerOverheadNanoseconds(LatencyClock()))
+			.Value("checksum", checksum), results) ? 0 : 1;
+	}
+} // namespace Unalmas::Benchmarks
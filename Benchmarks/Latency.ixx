@@ -0,0 +1,292 @@
+export module BenchmarkLatency;
+
+// Per-operation latency of SlotMap, as histograms, so that the rare slow
+// operations (most of all the inserts that Grow() the map) show up instead of
+// disappearing in an average.
+//
+// Guarantees:
+// every operation is timed on its own; inserts that grew the map are told
+// apart by the capacity changing, which is checked outside the timed region
+// each Grow() is also reported on its own, with the capacities before and after
+// the same map is measured growing from the default capacity and presized, so
+// the two can be compared on the same workload
+
+import <cstdint>;
+import <cstdio>;
+import <cstdlib>;
+import <cstring>;
+import <memory>;
+import <random>;
+import <string>;
+import <vector>;
+import SlotMap;
+import BenchmarkSupport;
+
+export namespace Unalmas::Benchmarks
+{
+	// Runs the latency benchmark with the given command line (without the program
+	// name and the "latency" command); returns the process exit code.
+	int						RunLatency(int argc, char** argv);
+
+	namespace Latency
+	{
+		struct Options
+		{
+			std::vector<int>			elementSizes{ 16, 256 };
+			std::vector<int>			mapSizes{ 100000, 1000000 };
+			int							operations{ 1000000 };
+			std::uint64_t				budgetNanoseconds{ 0 };
+			bool						cycleCounter{ false };
+			std::uint64_t				seed{ 1 };
+			const char*					output{ nullptr };
+		};
+
+		struct GrowEvent
+		{
+			int							fromCapacity;
+			int							toCapacity;
+			std::uint64_t				nanoseconds;
+		};
+
+		template <typename T>
+		void Run(const Options& options, const LatencyClock& clock, int mapSize, bool presized, std::vector<BenchmarkResult>& results)
+		{
+			const char* strategy = presized ? "presized" : "growing";
+
+			LatencyHistogram fillInserts;
+			LatencyHistogram grows;
+			LatencyHistogram lookups;
+			LatencyHistogram erases;
+			LatencyHistogram inserts;
+			std::vector<GrowEvent> growEvents;
+
+			auto slotmap = presized ? std::make_unique<SlotMap<T>>(mapSize) : std::make_unique<SlotMap<T>>();
+			std::vector<SlotMapKey> keys(mapSize);
+
+			for (int i = 0; i < mapSize; ++i)
+			{
+				const int capacity = slotmap->Capacity();
+
+				const std::uint64_t start = clock.Now();
+				keys[i] = slotmap->Insert(T(i));
+				const std::uint64_t nanoseconds = clock.ToNanoseconds(clock.Now() - start);
+
+				if (slotmap->Capacity() != capacity)
+				{
+					grows.Record(nanoseconds);
+					growEvents.push_back(GrowEvent{ capacity, slotmap->Capacity(), nanoseconds });
+				}
+				else
+				{
+					fillInserts.Record(nanoseconds);
+				}
+			}
+
+			std::mt19937_64 random(options.seed);
+			std::uniform_int_distribution<int> position(0, mapSize - 1);
+			const SlotMap<T>& view = *slotmap;
+
+			std::uint32_t sum = 0;
+			for (int i = 0; i < options.operations; ++i)
+			{
+				const SlotMapKey& key = keys[position(random)];
+
+				const std::uint64_t start = clock.Now();
+				sum += view[key].Checksum();
+				lookups.Record(clock.ToNanoseconds(clock.Now() - start));
+			}
+			checksum += sum;
+
+			// Steady state: erase a random element and insert another, so the size
+			// (and with it the capacity) stays where it is.
+			for (int i = 0; i < options.operations; ++i)
+			{
+				SlotMapKey& key = keys[position(random)];
+
+				std::uint64_t start = clock.Now();
+				slotmap->Erase(key);
+				erases.Record(clock.ToNanoseconds(clock.Now() - start));
+
+				start = clock.Now();
+				key = slotmap->Insert(T(i));
+				inserts.Record(clock.ToNanoseconds(clock.Now() - start));
+			}
+
+			const auto record = [&](const char* operation, const LatencyHistogram& histogram)
+			{
+				if (histogram.Count() == 0)
+				{
+					return;
+				}
+
+				BenchmarkResult result;
+				result
+					.Label("operation", operation)
+					.Label("strategy", strategy)
+					.Value("elementSize", sizeof(T))
+					.Value("mapSize", mapSize);
+
+				AddLatencyValues(result, histogram);
+
+				if (options.budgetNanoseconds > 0)
+				{
+					result.Value("overBudget", static_cast<double>(histogram.CountAbove(options.budgetNanoseconds)));
+				}
+
+				results.push_back(result);
+
+				std::fprintf(stderr, "%-12s %-8s %5d B %9d elements: p50 %7llu  p99 %7llu  p99.9 %8llu  max %10llu ns\n",
+					operation, strategy, static_cast<int>(sizeof(T)), mapSize,
+					static_cast<unsigned long long>(histogram.Percentile(0.5)), static_cast<unsigned long long>(histogram.Percentile(0.99)),
+					static_cast<unsigned long long>(histogram.Percentile(0.999)), static_cast<unsigned long long>(histogram.Max()));
+			};
+
+			record("fill_insert", fillInserts);
+			record("grow", grows);
+			record("lookup", lookups);
+			record("erase", erases);
+			record("insert", inserts);
+
+			for (const GrowEvent& event : growEvents)
+			{
+				results.push_back(BenchmarkResult()
+					.Label("operation", "grow_event")
+					.Label("strategy", strategy)
+					.Value("elementSize", sizeof(T))
+					.Value("mapSize", mapSize)
+					.Value("fromCapacity", event.fromCapacity)
+					.Value("toCapacity", event.toCapacity)
+					.Value("nanoseconds", static_cast<double>(event.nanoseconds)));
+			}
+		}
+
+		void PrintUsage()
+		{
+			std::fprintf(stderr,
+				"Usage: Benchmarks latency [options]\n"
+				"  --element-sizes LIST   bytes per element, out of 4,16,64,256,1024,4096 (default 16,256)\n"
+				"  --sizes LIST           elements inserted before the lookups and churn (default 1e5,1e6)\n"
+				"  --operations N         lookups, and erase/insert pairs, per map (default 1e6)\n"
+				"  --budget-ns N          also counts the operations slower than this\n"
+				"  --clock NAME           steady_clock (default) or cycles, where there is a cycle counter\n"
+				"  --seed N               seed of the key positions (default 1)\n"
+				"  --output PATH          writes the JSON report there instead of to stdout\n");
+		}
+
+		bool ParseOptions(int argc, char** argv, Options& options)
+		{
+			for (int i = 0; i < argc; ++i)
+			{
+				const char* name = argv[i];
+				if (i + 1 == argc)
+				{
+					return false;
+				}
+
+				const char* value = argv[++i];
+				int count = 0;
+
+				if (std::strcmp(name, "--element-sizes") == 0)
+				{
+					options.elementSizes.clear();
+					for (const std::string& item : SplitList(value))
+					{
+						options.elementSizes.push_back(std::atoi(item.c_str()));
+					}
+				}
+				else if (std::strcmp(name, "--sizes") == 0)
+				{
+					options.mapSizes.clear();
+					for (const std::string& item : SplitList(value))
+					{
+						if (!ParseCount(item.c_str(), count))
+						{
+							return false;
+						}
+
+						options.mapSizes.push_back(count);
+					}
+				}
+				else if (std::strcmp(name, "--operations") == 0 && ParseCount(value, count))
+				{
+					options.operations = count;
+				}
+				else if (std::strcmp(name, "--budget-ns") == 0 && ParseCount(value, count))
+				{
+					options.budgetNanoseconds = static_cast<std::uint64_t>(count);
+				}
+				else if (std::strcmp(name, "--clock") == 0 && (std::strcmp(value, "steady_clock") == 0 || std::strcmp(value, "cycles") == 0))
+				{
+					options.cycleCounter = std::strcmp(value, "cycles") == 0;
+				}
+				else if (std::strcmp(name, "--seed") == 0)
+				{
+					options.seed = std::strtoull(value, nullptr, 10);
+				}
+				else if (std::strcmp(name, "--output") == 0)
+				{
+					options.output = value;
+				}
+				else
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+	}
+
+	int RunLatency(int argc, char** argv)
+	{
+		Latency::Options options;
+		if (!Latency::ParseOptions(argc, argv, options))
+		{
+			Latency::PrintUsage();
+			return 1;
+		}
+
+		if (options.cycleCounter && !LatencyClock::HasCycleCounter())
+		{
+			std::fprintf(stderr, "There is no cycle counter on this platform; using steady_clock.\n");
+		}
+
+		const LatencyClock clock(options.cycleCounter);
+		std::vector<BenchmarkResult> results;
+
+		for (const int elementSize : options.elementSizes)
+		{
+			for (const int mapSize : options.mapSizes)
+			{
+				const bool supported = WithPayload(elementSize, [&](auto type)
+				{
+					Latency::Run<typename decltype(type)::type>(options, clock, mapSize, false, results);
+					Latency::Run<typename decltype(type)::type>(options, clock, mapSize, true, results);
+				});
+
+				if (!supported)
+				{
+					Latency::PrintUsage();
+					return 1;
+				}
+			}
+		}
+
+		BenchmarkResult settings;
+		settings
+			.Label("benchmark", "SlotMap latency")
+			.Label("build", BuildName())
+			.Label("clock", clock.Name())
+			.Value("seed", static_cast<double>(options.seed))
+			.Value("operations", options.operations)
+			.Value("timerOverheadNs", TimerOverheadNanoseconds(clock))
+			.Value("checksum", checksum);
+
+		if (options.budgetNanoseconds > 0)
+		{
+			settings.Value("budgetNs", static_cast<double>(options.budgetNanoseconds));
+		}
+
+		return WriteReport(options.output, settings, results) ? 0 : 1;
+	}
+} // namespace Unalmas::Benchmarks
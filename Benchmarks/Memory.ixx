@@ -0,0 +1,333 @@
+module;
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
+
+export module BenchmarkMemory;
+
+// How much memory SlotMap holds on to over long churn runs, both as the map
+// reports it (SlotMap::MemoryUsage()) and as the operating system sees it (the
+// process's resident set).
+//
+// Guarantees:
+// "steady" churns a map at a constant size: erase a fraction of it, insert as
+// many again, round after round
+// "burst" grows the map to a peak and erases it back down every round, which
+// shows what the map keeps once the burst is over; with --shrink on, it then
+// calls ShrinkToFit() and CompactSlots() and samples again
+// the resident set is sampled after every phase, next to what the map reports;
+// where it can't be read, it is left out and everything else is still reported
+
+import <algorithm>;
+import <cstdint>;
+import <cstdio>;
+import <cstdlib>;
+import <cstring>;
+import <random>;
+import <string>;
+import <vector>;
+import SlotMap;
+import BenchmarkSupport;
+
+export namespace Unalmas::Benchmarks
+{
+	// Runs the memory benchmark with the given command line (without the program
+	// name and the "memory" command); returns the process exit code.
+	int						RunMemory(int argc, char** argv);
+
+	// The process's resident set in bytes, or -1 where it can't be read.
+	std::int64_t			ResidentBytes();
+	const char*				ResidentBytesSource();
+
+	namespace Memory
+	{
+		struct Options
+		{
+			std::vector<int>			elementSizes{ 64 };
+			std::vector<std::string>	scenarios{ "steady", "burst" };
+			int							mapSize{ 100000 };
+			int							peakFactor{ 4 };
+			int							rounds{ 10 };
+			double						churn{ 0.25 };
+			bool						shrink{ false };
+			std::uint64_t				seed{ 1 };
+			const char*					output{ nullptr };
+		};
+
+		template <typename T>
+		class Churner
+		{
+		public:
+			Churner(const Options& options_, const char* scenario_, std::vector<BenchmarkResult>& results_)
+				: options{ options_ }, scenario{ scenario_ }, results{ results_ }, random(options_.seed)
+			{
+				baseline = ResidentBytes();
+			}
+
+			void Run()
+			{
+				Grow(options.mapSize);
+				Sample(0, "filled");
+
+				const bool burst = std::strcmp(scenario, "burst") == 0;
+				for (int round = 1; round <= options.rounds; ++round)
+				{
+					if (burst)
+					{
+						Grow(options.mapSize * options.peakFactor);
+						Sample(round, "peak");
+						Shrink(options.mapSize);
+						Sample(round, "trough");
+
+						if (options.shrink)
+						{
+							slotmap.ShrinkToFit();
+							slotmap.CompactSlots();
+							Sample(round, "shrunk");
+						}
+					}
+					else
+					{
+						const int churned = static_cast<int>(options.mapSize * options.churn);
+						Shrink(options.mapSize - churned);
+						Grow(options.mapSize);
+						Sample(round, "churned");
+					}
+				}
+			}
+
+		private:
+			void Grow(int size)
+			{
+				while (static_cast<int>(keys.size()) < size)
+				{
+					keys.push_back(slotmap.Insert(T(static_cast<std::uint32_t>(keys.size()))));
+				}
+			}
+
+			void Shrink(int size)
+			{
+				// Random victims, so the free list ends up scattered over the slots.
+				while (static_cast<int>(keys.size()) > size)
+				{
+					const std::size_t victim = std::uniform_int_distribution<std::size_t>(0, keys.size() - 1)(random);
+					slotmap.Erase(keys[victim]);
+					keys[victim] = keys.back();
+					keys.pop_back();
+				}
+			}
+
+			void Sample(int round, const char* phase)
+			{
+				const SlotMapMemoryUsage usage = slotmap.MemoryUsage();
+				const std::int64_t resident = ResidentBytes();
+
+				BenchmarkResult& result = results.emplace_back(BenchmarkResult()
+					.Label("scenario", scenario)
+					.Label("phase", phase)
+					.Value("elementSize", sizeof(T))
+					.Value("round", round)
+					.Value("size", slotmap.Size())
+					.Value("capacity", slotmap.Capacity())
+					.Value("mapBytes", static_cast<double>(usage.Total()))
+					.Value("liveBytes", static_cast<double>(usage.Live()))
+					.Value("freeBytes", static_cast<double>(usage.slots.free + usage.freeListLinks.free))
+					.Value("slackBytes", static_cast<double>(usage.values.slack + usage.valueToSlot.slack))
+					.Value("occupancy", usage.occupancy));
+
+				if (resident >= 0 && baseline >= 0)
+				{
+					result
+						.Value("rssBytes", static_cast<double>(resident))
+						.Value("rssGrowthBytes", static_cast<double>(resident - baseline));
+				}
+
+				std::fprintf(stderr, "%-7s %-8s %5d B round %3d: %9d elements, capacity %9d, map %8.1f MB (%5.1f%% occupied), rss %8.1f MB\n",
+					scenario, phase, static_cast<int>(sizeof(T)), round, slotmap.Size(), slotmap.Capacity(),
+					usage.Total() / 1048576.0, usage.occupancy * 100.0, resident >= 0 ? resident / 1048576.0 : 0.0);
+			}
+
+			const Options&					options;
+			const char*						scenario;
+			std::vector<BenchmarkResult>&	results;
+			std::mt19937_64					random;
+			SlotMap<T>						slotmap;
+			std::vector<SlotMapKey>			keys;
+			std::int64_t					baseline{ -1 };
+		};
+
+		void PrintUsage()
+		{
+			std::fprintf(stderr,
+				"Usage: Benchmarks memory [options]\n"
+				"  --element-sizes LIST   bytes per element, out of 4,16,64,256,1024,4096 (default 64)\n"
+				"  --scenarios LIST       steady and/or burst (default both)\n"
+				"  --size N               elements the map holds between bursts, or while churning (default 1e5)\n"
+				"  --peak-factor N        how many times that a burst grows the map to (default 4)\n"
+				"  --rounds N             churn rounds, or bursts (default 10)\n"
+				"  --churn F              fraction of the map erased and reinserted per steady round (default 0.25)\n"
+				"  --shrink on|off        gives memory back after every burst (default off)\n"
+				"  --seed N               seed of the erased positions (default 1)\n"
+				"  --output PATH          writes the JSON report there instead of to stdout\n");
+		}
+
+		bool ParseOptions(int argc, char** argv, Options& options)
+		{
+			for (int i = 0; i < argc; ++i)
+			{
+				const char* name = argv[i];
+				if (i + 1 == argc)
+				{
+					return false;
+				}
+
+				const char* value = argv[++i];
+				int count = 0;
+
+				if (std::strcmp(name, "--element-sizes") == 0)
+				{
+					options.elementSizes.clear();
+					for (const std::string& item : SplitList(value))
+					{
+						options.elementSizes.push_back(std::atoi(item.c_str()));
+					}
+				}
+				else if (std::strcmp(name, "--scenarios") == 0)
+				{
+					options.scenarios = SplitList(value);
+					for (const std::string& scenario : options.scenarios)
+					{
+						if (scenario != "steady" && scenario != "burst")
+						{
+							return false;
+						}
+					}
+				}
+				else if (std::strcmp(name, "--size") == 0 && ParseCount(value, count))
+				{
+					options.mapSize = count;
+				}
+				else if (std::strcmp(name, "--peak-factor") == 0 && ParseCount(value, count) && count <= 64)
+				{
+					options.peakFactor = count;
+				}
+				else if (std::strcmp(name, "--rounds") == 0 && ParseCount(value, count))
+				{
+					options.rounds = count;
+				}
+				else if (std::strcmp(name, "--churn") == 0 && std::atof(value) >= 0.0 && std::atof(value) <= 1.0)
+				{
+					options.churn = std::atof(value);
+				}
+				else if (std::strcmp(name, "--shrink") == 0 && (std::strcmp(value, "on") == 0 || std::strcmp(value, "off") == 0))
+				{
+					options.shrink = std::strcmp(value, "on") == 0;
+				}
+				else if (std::strcmp(name, "--seed") == 0)
+				{
+					options.seed = std::strtoull(value, nullptr, 10);
+				}
+				else if (std::strcmp(name, "--output") == 0)
+				{
+					options.output = value;
+				}
+				else
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+	}
+
+	std::int64_t ResidentBytes()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		{
+			return static_cast<std::int64_t>(counters.WorkingSetSize);
+		}
+#elif defined(__linux__)
+		// The second number is the resident set, in pages.
+		std::FILE* file = std::fopen("/proc/self/statm", "r");
+		if (file)
+		{
+			long long total = 0;
+			long long resident = 0;
+			const bool read = std::fscanf(file, "%lld %lld", &total, &resident) == 2;
+			std::fclose(file);
+
+			if (read)
+			{
+				return resident * static_cast<std::int64_t>(sysconf(_SC_PAGESIZE));
+			}
+		}
+#endif
+
+		return -1;
+	}
+
+	const char* ResidentBytesSource()
+	{
+#ifdef _WIN32
+		return "GetProcessMemoryInfo";
+#elif defined(__linux__)
+		return "/proc/self/statm";
+#else
+		return "none";
+#endif
+	}
+
+	int RunMemory(int argc, char** argv)
+	{
+		Memory::Options options;
+		if (!Memory::ParseOptions(argc, argv, options))
+		{
+			Memory::PrintUsage();
+			return 1;
+		}
+
+		if (ResidentBytes() < 0)
+		{
+			std::fprintf(stderr, "Can't read the resident set here; reporting what the map holds only.\n");
+		}
+
+		std::vector<BenchmarkResult> results;
+
+		for (const int elementSize : options.elementSizes)
+		{
+			for (const std::string& scenario : options.scenarios)
+			{
+				const bool supported = WithPayload(elementSize, [&](auto type)
+				{
+					Memory::Churner<typename decltype(type)::type>(options, scenario.c_str(), results).Run();
+				});
+
+				if (!supported)
+				{
+					Memory::PrintUsage();
+					return 1;
+				}
+			}
+		}
+
+		return WriteReport(options.output, BenchmarkResult()
+			.Label("benchmark", "SlotMap memory")
+			.Label("build", BuildName())
+			.Label("rssSource", ResidentBytesSource())
+			.Value("seed", static_cast<double>(options.seed))
+			.Value("mapSize", options.mapSize)
+			.Value("peakFactor", options.peakFactor)
+			.Value("rounds", options.rounds)
+			.Value("churn", options.churn)
+			.Value("shrink", options.shrink ? 1 : 0), results) ? 0 : 1;
+	}
+} // namespace Unalmas::Benchmarks
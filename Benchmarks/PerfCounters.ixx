@@ -0,0 +1,321 @@
+module;
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#define SLOTMAP_BENCHMARK_PERF_EVENTS
+#endif
+
+export module BenchmarkCounters;
+
+// Hardware performance counters (Linux perf_event_open) around the timed
+// regions of the benchmarks, so that a change in time can be told apart into
+// cache, TLB and branch behavior.
+//
+// Guarantees:
+// counters are only enabled around the measured function; opening, enabling,
+// disabling and reading them all happen outside the timed region
+// each counter is opened on its own, so one the CPU (or a virtual machine)
+// doesn't have never takes the others down with it; a counter that had to share
+// the hardware with others is scaled up to the time it was enabled
+// where there are no counters at all (other platforms, containers without
+// perf_event_open, perf_event_paranoid too high), everything still runs and
+// reports times only
+
+import <cstdint>;
+import <string>;
+import BenchmarkSupport;
+
+export namespace Unalmas::Benchmarks
+{
+	enum class PerfCounter
+	{
+		Cycles,
+		Instructions,
+		L1dMisses,		// L1 data cache read misses
+		LlcMisses,		// Last level cache misses
+		DtlbMisses,		// Data TLB read misses
+		BranchMisses,	// Mispredicted branches
+	};
+
+	constexpr int			PerfCounterCount = static_cast<int>(PerfCounter::BranchMisses) + 1;
+
+	const char*				PerfCounterName(PerfCounter counter);
+
+	// Counts of one or more measurements; counters that couldn't be opened are left out.
+	struct PerfCounterValues
+	{
+		double				counts[PerfCounterCount]{};
+		bool				available[PerfCounterCount]{};
+
+		PerfCounterValues&	operator+=(const PerfCounterValues& rhs);
+	};
+
+	class PerfCounters
+	{
+	public:
+		PerfCounters() = default;
+		~PerfCounters() { Close(); }
+
+		PerfCounters(const PerfCounters& rhs) = delete;
+		PerfCounters& operator=(const PerfCounters& rhs) = delete;
+
+		// Returns false if none of the counters could be opened; Error() tells why.
+		bool				Open();
+		void				Close();
+
+		bool				IsOpen() const;
+		bool				Has(PerfCounter counter) const { return fds[static_cast<int>(counter)] >= 0; }
+		const std::string&	Error() const { return error; }
+
+		// The names of the open counters, comma separated.
+		std::string			Names() const;
+
+		// Times one call like Benchmarks::TimeNanoseconds, counting while it runs.
+		template <typename F>
+		double				TimeNanoseconds(F&& func);
+
+		// What was counted since the last Take(), which starts over.
+		PerfCounterValues	Take();
+
+	private:
+		struct Reading
+		{
+			std::uint64_t	value{ 0 };
+			std::uint64_t	enabled{ 0 };
+			std::uint64_t	running{ 0 };
+		};
+
+		void				Start();
+		void				Stop();
+		bool				Read(int counter, Reading& reading) const;
+
+		int					fds[PerfCounterCount]{ -1, -1, -1, -1, -1, -1 };
+		Reading				started[PerfCounterCount];
+		PerfCounterValues	totals;
+		std::string			error;
+	};
+
+	// Adds the counts per operation (e.g. "l1dMissesPerOp") of the available
+	// counters to a result, and instructionsPerCycle when both are there.
+	void					AddCounterValues(BenchmarkResult& result, const PerfCounterValues& values, double operations);
+
+	const char* PerfCounterName(PerfCounter counter)
+	{
+		switch (counter)
+		{
+		case PerfCounter::Cycles:		return "cycles";
+		case PerfCounter::Instructions:	return "instructions";
+		case PerfCounter::L1dMisses:	return "l1dMisses";
+		case PerfCounter::LlcMisses:	return "llcMisses";
+		case PerfCounter::DtlbMisses:	return "dtlbMisses";
+		case PerfCounter::BranchMisses:	return "branchMisses";
+		}
+
+		return "unknown";
+	}
+
+	PerfCounterValues& PerfCounterValues::operator+=(const PerfCounterValues& rhs)
+	{
+		for (int i = 0; i < PerfCounterCount; ++i)
+		{
+			counts[i] += rhs.counts[i];
+			available[i] = available[i] || rhs.available[i];
+		}
+
+		return *this;
+	}
+
+	bool PerfCounters::Open()
+	{
+		Close();
+
+#ifdef SLOTMAP_BENCHMARK_PERF_EVENTS
+		const auto cache = [](std::uint64_t cache, std::uint64_t result)
+		{
+			return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+		};
+
+		const std::uint32_t types[PerfCounterCount]{ PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+			PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE };
+		const std::uint64_t configs[PerfCounterCount]{ PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+			cache(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS), PERF_COUNT_HW_CACHE_MISSES,
+			cache(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS), PERF_COUNT_HW_BRANCH_MISSES };
+
+		for (int i = 0; i < PerfCounterCount; ++i)
+		{
+			perf_event_attr attributes;
+			std::memset(&attributes, 0, sizeof(attributes));
+			attributes.size = sizeof(attributes);
+			attributes.type = types[i];
+			attributes.config = configs[i];
+			attributes.disabled = 1;
+			attributes.exclude_kernel = 1;	// Allowed at perf_event_paranoid 2, and the benchmarks don't call into the kernel
+			attributes.exclude_hv = 1;
+			attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+			fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+			if (fds[i] < 0 && error.empty())
+			{
+				error = std::string("perf_event_open: ") + std::strerror(errno);
+			}
+		}
+#else
+		error = "perf_event_open is only available on Linux";
+#endif
+
+		if (!IsOpen())
+		{
+			return false;
+		}
+
+		error.clear();
+		return true;
+	}
+
+	void PerfCounters::Close()
+	{
+		for (int& fd : fds)
+		{
+#ifdef SLOTMAP_BENCHMARK_PERF_EVENTS
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+#endif
+			fd = -1;
+		}
+
+		totals = PerfCounterValues();
+	}
+
+	bool PerfCounters::IsOpen() const
+	{
+		for (const int fd : fds)
+		{
+			if (fd >= 0)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	std::string PerfCounters::Names() const
+	{
+		std::string names;
+		for (int i = 0; i < PerfCounterCount; ++i)
+		{
+			if (fds[i] >= 0)
+			{
+				names += names.empty() ? "" : ",";
+				names += PerfCounterName(static_cast<PerfCounter>(i));
+			}
+		}
+
+		return names;
+	}
+
+	template <typename F>
+	double PerfCounters::TimeNanoseconds(F&& func)
+	{
+		Start();
+		const double nanoseconds = Benchmarks::TimeNanoseconds(func);
+		Stop();
+
+		return nanoseconds;
+	}
+
+	bool PerfCounters::Read(int counter, Reading& reading) const
+	{
+#ifdef SLOTMAP_BENCHMARK_PERF_EVENTS
+		return read(fds[counter], &reading, sizeof(reading)) == static_cast<ssize_t>(sizeof(reading));
+#else
+		return false;
+#endif
+	}
+
+	void PerfCounters::Start()
+	{
+		for (int i = 0; i < PerfCounterCount; ++i)
+		{
+			if (fds[i] >= 0)
+			{
+				Read(i, started[i]);
+#ifdef SLOTMAP_BENCHMARK_PERF_EVENTS
+				ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+#endif
+			}
+		}
+	}
+
+	void PerfCounters::Stop()
+	{
+		for (int i = 0; i < PerfCounterCount; ++i)
+		{
+			if (fds[i] < 0)
+			{
+				continue;
+			}
+
+#ifdef SLOTMAP_BENCHMARK_PERF_EVENTS
+			ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+
+			Reading stopped;
+			if (!Read(i, stopped))
+			{
+				continue;
+			}
+
+			// The counter only saw part of the time if the kernel multiplexed it
+			// with others; extrapolate to all of it.
+			const double value = static_cast<double>(stopped.value - started[i].value);
+			const std::uint64_t enabled = stopped.enabled - started[i].enabled;
+			const std::uint64_t running = stopped.running - started[i].running;
+
+			if (running > 0)
+			{
+				totals.counts[i] += running < enabled ? value * static_cast<double>(enabled) / static_cast<double>(running) : value;
+				totals.available[i] = true;
+			}
+		}
+	}
+
+	PerfCounterValues PerfCounters::Take()
+	{
+		const PerfCounterValues values = totals;
+		totals = PerfCounterValues();
+
+		return values;
+	}
+
+	void AddCounterValues(BenchmarkResult& result, const PerfCounterValues& values, double operations)
+	{
+		if (operations <= 0.0)
+		{
+			return;
+		}
+
+		for (int i = 0; i < PerfCounterCount; ++i)
+		{
+			if (values.available[i])
+			{
+				result.Value((std::string(PerfCounterName(static_cast<PerfCounter>(i))) + "PerOp").c_str(), values.counts[i] / operations);
+			}
+		}
+
+		const int cycles = static_cast<int>(PerfCounter::Cycles);
+		const int instructions = static_cast<int>(PerfCounter::Instructions);
+
+		if (values.available[cycles] && values.available[instructions] && values.counts[cycles] > 0.0)
+		{
+			result.Value("instructionsPerCycle", values.counts[instructions] / values.counts[cycles]);
+		}
+	}
+} // namespace Unalmas::Benchmarks
@@ -0,0 +1,426 @@
+export module BenchmarkReplay;
+
+// Replays a trace recorded with TracedSlotMap (see SlotMapTrace), so that a
+// change to SlotMap can be measured on what an application really did with it,
+// rather than on a synthetic workload.
+//
+// Guarantees:
+// the trace is read and decoded before anything is timed
+// keys are remapped: every key the trace inserted refers to whatever the
+// replayed map returned for that insert, so a replay stays correct when the
+// map (or its initial capacity) hands out different keys than the recording
+// keys that were live when recording started are inserted first, untimed
+// lookups of keys the trace never saw are replayed as lookups of a missing key;
+// erases of such keys are left out (and counted), as there is nothing to erase
+
+import <algorithm>;
+import <cstdint>;
+import <cstdio>;
+import <cstdlib>;
+import <cstring>;
+import <map>;
+import <memory>;
+import <utility>;
+import <vector>;
+import SlotMap;
+import SlotMapTrace;
+import BenchmarkSupport;
+
+export namespace Unalmas::Benchmarks
+{
+	// Runs the replay benchmark with the given command line (without the program
+	// name and the "replay" command); returns the process exit code.
+	int						RunReplay(int argc, char** argv);
+
+	namespace Replay
+	{
+		struct Options
+		{
+			const char*					trace{ nullptr };
+			int							elementSize{ 0 };	// 0: the recorded one
+			int							capacity{ 0 };		// 0: the SlotMap default
+			int							repetitions{ 5 };
+			bool						cycleCounter{ false };
+			const char*					output{ nullptr };
+		};
+
+		// A decoded record; id numbers the keys the trace has seen, -1 is a key it never handed out.
+		struct Step
+		{
+			SlotMapTraceOp				op;
+			int							id;
+		};
+
+		struct Trace
+		{
+			std::vector<Step>			steps;
+			int							keyCount{ 0 };
+			int							elementSize{ 0 };
+			std::uint64_t				recordedNanoseconds{ 0 };
+			std::uint64_t				droppedErases{ 0 };
+		};
+
+		constexpr int					OpCount = static_cast<int>(SlotMapTraceOp::Clear) + 1;
+
+		const char* OpName(SlotMapTraceOp op)
+		{
+			switch (op)
+			{
+			case SlotMapTraceOp::Existing:	return "existing";
+			case SlotMapTraceOp::Insert:	return "insert";
+			case SlotMapTraceOp::Erase:		return "erase";
+			case SlotMapTraceOp::Get:		return "get";
+			case SlotMapTraceOp::TryGet:	return "tryget";
+			case SlotMapTraceOp::Contains:	return "contains";
+			case SlotMapTraceOp::Iterate:	return "iterate";
+			case SlotMapTraceOp::Clear:		return "clear";
+			}
+
+			return "unknown";
+		}
+
+		bool ReadTrace(const char* path, Trace& trace)
+		{
+			SlotMapTraceReader reader;
+			if (!reader.Open(path))
+			{
+				return false;
+			}
+
+			trace.elementSize = reader.ElementSize();
+
+			std::map<std::pair<int, int>, int> ids;
+			SlotMapTraceRecord record;
+
+			while (reader.Next(record))
+			{
+				const std::pair<int, int> key{ record.key.index, record.key.generation };
+				Step step{ record.op, -1 };
+
+				if (record.op == SlotMapTraceOp::Existing || record.op == SlotMapTraceOp::Insert)
+				{
+					step.id = trace.keyCount++;
+					ids[key] = step.id;
+				}
+				else if (record.op != SlotMapTraceOp::Iterate && record.op != SlotMapTraceOp::Clear)
+				{
+					const auto found = ids.find(key);
+					if (found != ids.end())
+					{
+						step.id = found->second;
+					}
+					else if (record.op == SlotMapTraceOp::Erase)
+					{
+						++trace.droppedErases;
+						continue;
+					}
+				}
+
+				trace.steps.push_back(step);
+				trace.recordedNanoseconds = record.nanoseconds;
+			}
+
+			return true;
+		}
+
+		template <typename T>
+		class Replayer
+		{
+		public:
+			Replayer(const Options& options, const Trace& trace_)
+				: trace{ trace_ }, keys(trace_.keyCount)
+			{
+				slotmap = options.capacity > 0 ? std::make_unique<SlotMap<T>>(options.capacity) : std::make_unique<SlotMap<T>>();
+
+				// Keys that were live before recording started.
+				for (; first < trace.steps.size() && trace.steps[first].op == SlotMapTraceOp::Existing; ++first)
+				{
+					keys[trace.steps[first].id] = slotmap->Insert(T(static_cast<std::uint32_t>(first)));
+				}
+
+				peakCapacity = slotmap->Capacity();
+			}
+
+			std::size_t					First() const { return first; }
+
+			void Step(std::size_t i)
+			{
+				const Replay::Step& step = trace.steps[i];
+				const SlotMapKey key = step.id >= 0 ? keys[step.id] : SlotMapKey();
+
+				switch (step.op)
+				{
+				case SlotMapTraceOp::Existing:
+				case SlotMapTraceOp::Insert:
+					keys[step.id] = slotmap->Insert(T(static_cast<std::uint32_t>(i)));
+					peakCapacity = std::max(peakCapacity, slotmap->Capacity());
+					break;
+
+				case SlotMapTraceOp::Erase:
+					slotmap->Erase(key);
+					break;
+
+				case SlotMapTraceOp::Get:
+					sum += (*slotmap)[key].Checksum();
+					break;
+
+				case SlotMapTraceOp::TryGet:
+				{
+					T value;
+					if (slotmap->TryGet(key, value))
+					{
+						sum += value.Checksum();
+					}
+					break;
+				}
+
+				case SlotMapTraceOp::Contains:
+					sum += slotmap->Contains(key);
+					break;
+
+				case SlotMapTraceOp::Iterate:
+					for (const T& value : static_cast<const SlotMap<T>&>(*slotmap))
+					{
+						sum += value.Checksum();
+					}
+					break;
+
+				case SlotMapTraceOp::Clear:
+					slotmap->Clear();
+					break;
+				}
+			}
+
+			int							PeakCapacity() const { return peakCapacity; }
+
+			// Nothing a trace can do shrinks the map's arrays, so after the replay
+			// they are as big as they got: this is the peak.
+			std::size_t					MemoryBytes() const { return slotmap->MemoryUsage().Total(); }
+
+			~Replayer() { checksum += sum; }
+
+		private:
+			const Trace&				trace;
+			std::unique_ptr<SlotMap<T>>	slotmap;
+			std::vector<SlotMapKey>		keys;
+			std::size_t					first{ 0 };
+			int							peakCapacity{ 0 };
+			std::uint32_t				sum{ 0 };
+		};
+
+		template <typename T>
+		void Run(const Options& options, const LatencyClock& clock, const Trace& trace, std::vector<BenchmarkResult>& results)
+		{
+			std::vector<double> samples;
+			int peakCapacity = 0;
+			std::size_t memoryBytes = 0;
+			std::size_t operations = 0;
+
+			// The whole trace at once, for throughput.
+			for (int repetition = 0; repetition < options.repetitions; ++repetition)
+			{
+				Replayer<T> replayer(options, trace);
+
+				samples.push_back(TimeNanoseconds([&]()
+				{
+					for (std::size_t i = replayer.First(); i < trace.steps.size(); ++i)
+					{
+						replayer.Step(i);
+					}
+				}));
+
+				peakCapacity = replayer.PeakCapacity();
+				memoryBytes = replayer.MemoryBytes();
+				operations = trace.steps.size() - replayer.First();
+			}
+
+			const Repetitions time = Summarize(samples);
+			const double count = static_cast<double>(std::max<std::size_t>(operations, 1));
+
+			results.push_back(BenchmarkResult()
+				.Label("operation", "all")
+				.Value("elementSize", sizeof(T))
+				.Value("operations", static_cast<double>(operations))
+				.Value("nanoseconds", time.median)
+				.Value("minNanoseconds", time.minimum)
+				.Value("nsPerOp", time.median / count)
+				.Value("opsPerSecond", count / time.median * 1e9)
+				.Value("peakCapacity", peakCapacity)
+				.Value("memoryBytes", static_cast<double>(memoryBytes)));
+
+			std::fprintf(stderr, "all          %5d B %10zu operations: %9.2f ns/op, peak capacity %d\n",
+				static_cast<int>(sizeof(T)), operations, time.median / count, peakCapacity);
+
+			// Then once more with every operation timed on its own.
+			LatencyHistogram histograms[OpCount];
+			{
+				Replayer<T> replayer(options, trace);
+				for (std::size_t i = replayer.First(); i < trace.steps.size(); ++i)
+				{
+					const std::uint64_t start = clock.Now();
+					replayer.Step(i);
+					histograms[static_cast<int>(trace.steps[i].op)].Record(clock.ToNanoseconds(clock.Now() - start));
+				}
+			}
+
+			for (int op = 0; op < OpCount; ++op)
+			{
+				const LatencyHistogram& histogram = histograms[op];
+				if (histogram.Count() == 0)
+				{
+					continue;
+				}
+
+				const char* name = OpName(static_cast<SlotMapTraceOp>(op));
+
+				BenchmarkResult result;
+				result
+					.Label("operation", name)
+					.Value("elementSize", sizeof(T));
+
+				AddLatencyValues(result, histogram);
+				results.push_back(result);
+
+				std::fprintf(stderr, "%-12s %5d B %10llu operations: p50 %7llu  p99 %7llu  max %10llu ns\n",
+					name, static_cast<int>(sizeof(T)), static_cast<unsigned long long>(histogram.Count()),
+					static_cast<unsigned long long>(histogram.Percentile(0.5)), static_cast<unsigned long long>(histogram.Percentile(0.99)),
+					static_cast<unsigned long long>(histogram.Max()));
+			}
+		}
+
+		void PrintUsage()
+		{
+			std::fprintf(stderr,
+				"Usage: Benchmarks replay TRACE [options]\n"
+				"  --element-size N       bytes per element, out of 4,16,64,256,1024,4096 (default: the\n"
+				"                         smallest that holds the recorded element)\n"
+				"  --capacity N           initial capacity of the replayed map (default: the SlotMap default)\n"
+				"  --repetitions N        replays of the whole trace; the median is reported (default 5)\n"
+				"  --clock NAME           steady_clock (default) or cycles, for the per-operation latencies\n"
+				"  --output PATH          writes the JSON report there instead of to stdout\n");
+		}
+
+		bool ParseOptions(int argc, char** argv, Options& options)
+		{
+			if (argc < 1 || argv[0][0] == '-')
+			{
+				return false;
+			}
+
+			options.trace = argv[0];
+
+			for (int i = 1; i < argc; ++i)
+			{
+				const char* name = argv[i];
+				if (i + 1 == argc)
+				{
+					return false;
+				}
+
+				const char* value = argv[++i];
+				int count = 0;
+
+				if (std::strcmp(name, "--element-size") == 0 && ParseCount(value, count))
+				{
+					options.elementSize = count;
+				}
+				else if (std::strcmp(name, "--capacity") == 0 && ParseCount(value, count))
+				{
+					options.capacity = count;
+				}
+				else if (std::strcmp(name, "--repetitions") == 0 && ParseCount(value, count) && count <= 1000)
+				{
+					options.repetitions = count;
+				}
+				else if (std::strcmp(name, "--clock") == 0 && (std::strcmp(value, "steady_clock") == 0 || std::strcmp(value, "cycles") == 0))
+				{
+					options.cycleCounter = std::strcmp(value, "cycles") == 0;
+				}
+				else if (std::strcmp(name, "--output") == 0)
+				{
+					options.output = value;
+				}
+				else
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+	}
+
+	int RunReplay(int argc, char** argv)
+	{
+		Replay::Options options;
+		if (!Replay::ParseOptions(argc, argv, options))
+		{
+			Replay::PrintUsage();
+			return 1;
+		}
+
+		Replay::Trace trace;
+		if (!Replay::ReadTrace(options.trace, trace))
+		{
+			std::fprintf(stderr, "Could not read a trace from %s.\n", options.trace);
+			return 1;
+		}
+
+		int elementSize = options.elementSize;
+		if (elementSize == 0)
+		{
+			const auto fits = std::find_if(std::begin(PayloadSizes), std::end(PayloadSizes), [&](int bytes) { return bytes >= trace.elementSize; });
+			elementSize = fits != std::end(PayloadSizes) ? *fits : PayloadSizes[std::size(PayloadSizes) - 1];
+		}
+
+		if (options.cycleCounter && !LatencyClock::HasCycleCounter())
+		{
+			std::fprintf(stderr, "There is no cycle counter on this platform; using steady_clock.\n");
+		}
+
+		if (trace.droppedErases > 0)
+		{
+			std::fprintf(stderr, "Leaving out %llu erases of keys the trace never handed out.\n", static_cast<unsigned long long>(trace.droppedErases));
+		}
+
+		const LatencyClock clock(options.cycleCounter);
+		std::vector<BenchmarkResult> results;
+
+		const bool supported = WithPayload(elementSize, [&](auto type)
+		{
+			Replay::Run<typename decltype(type)::type>(options, clock, trace, results);
+		});
+
+		if (!supported)
+		{
+			Replay::PrintUsage();
+			return 1;
+		}
+
+		// How fast the application made its calls, to compare the replay with.
+		const double recordedSeconds = static_cast<double>(trace.recordedNanoseconds) * 1e-9;
+		const double records = static_cast<double>(trace.steps.size());
+
+		BenchmarkResult settings;
+		settings
+			.Label("benchmark", "SlotMap replay")
+			.Label("build", BuildName())
+			.Label("trace", options.trace)
+			.Label("clock", clock.Name())
+			.Value("recordedElementSize", trace.elementSize)
+			.Value("records", records)
+			.Value("droppedErases", static_cast<double>(trace.droppedErases))
+			.Value("recordedSeconds", recordedSeconds)
+			.Value("recordedOpsPerSecond", recordedSeconds > 0.0 ? records / recordedSeconds : 0.0)
+			.Value("repetitions", options.repetitions)
+			.Value("timerOverheadNs", TimerOverheadNanoseconds(clock))
+			.Value("checksum", checksum);
+
+		if (options.capacity > 0)
+		{
+			settings.Value("initialCapacity", options.capacity);
+		}
+
+		return WriteReport(options.output, settings, results) ? 0 : 1;
+	}
+} // namespace Unalmas::Benchmarks
@@ -0,0 +1,218 @@
+export module ConcurrentSlotAllocator;
+
+#define DEFAULT_CAPACITY 8
+
+// Hands out and takes back SlotMap-style keys from any number of threads at
+// the same time, without a mutex. It only manages keys; where the values live
+// is up to the caller (e.g. an array indexed by key.index, owned by one thread).
+//
+// Guarantees:
+// Acquire and Release are lock-free, except when the free list runs dry and a
+// new chunk of slots has to be allocated
+// the free list is a Treiber stack; its head is tagged with a counter that
+// changes on every push and pop, so a stale head can't win a CAS (ABA)
+// slots live in chunks that are never moved or freed while the allocator is
+// alive, so a slot can be touched safely even while another thread grows
+// releasing a key twice, or releasing a stale key, fails and returns false
+
+import <atomic>;
+import <bit>;
+import <climits>;
+import <cstdint>;
+import <mutex>;
+import <stdexcept>;
+import SlotMap;
+
+export namespace Unalmas
+{
+	class ConcurrentSlotAllocator
+	{
+	private:
+		static constexpr int			MaxChunks = 31;
+		static constexpr std::uint32_t	EmptyIndex = 0xFFFFFFFFu;
+		static constexpr std::uint64_t	AliveBit = 1;
+
+		struct Slot
+		{
+			std::atomic<std::uint32_t>	next{ EmptyIndex };
+			std::atomic<std::uint64_t>	state{ 0 };		// generation << 1 | alive
+		};
+
+		std::atomic<std::uint64_t>	head{ EmptyIndex };		// tag << 32 | index
+		std::atomic<Slot*>			chunks[MaxChunks]{};
+		std::atomic<int>			chunkCount{ 0 };
+		std::atomic<int>			size{ 0 };
+		std::mutex					growLock;
+		int							firstChunkSize;
+
+	public:
+		ConcurrentSlotAllocator() : ConcurrentSlotAllocator(DEFAULT_CAPACITY) {}
+		ConcurrentSlotAllocator(int capacity);
+
+		ConcurrentSlotAllocator(const ConcurrentSlotAllocator& rhs) = delete;
+		ConcurrentSlotAllocator(ConcurrentSlotAllocator&& rhs) = delete;
+		ConcurrentSlotAllocator& operator=(const ConcurrentSlotAllocator& rhs) = delete;
+		ConcurrentSlotAllocator& operator=(ConcurrentSlotAllocator&& rhs) = delete;
+		~ConcurrentSlotAllocator();
+
+		SlotMapKey				Acquire();
+		bool					Release(const SlotMapKey& key);
+		bool					IsAlive(const SlotMapKey& key) const;
+
+		int						Size() const { return size.load(std::memory_order_relaxed); }
+		int						Capacity() const;
+
+	private:
+		Slot* TryGetSlot(int index) const;
+		Slot& GetSlot(std::uint32_t index) const;
+		void					Push(std::uint32_t first, std::uint32_t last);
+		void					Grow(std::uint64_t observedHead);
+
+		int						ChunkStart(int chunk) const { return firstChunkSize * ((1 << chunk) - 1); }
+		int						ChunkSize(int chunk) const { return firstChunkSize << chunk; }
+
+		static std::uint64_t	MakeHead(std::uint32_t index, std::uint64_t tag) { return (tag << 32) | index; }
+		static std::uint32_t	HeadIndex(std::uint64_t head) { return static_cast<std::uint32_t>(head); }
+		static std::uint64_t	HeadTag(std::uint64_t head) { return head >> 32; }
+	};
+
+	ConcurrentSlotAllocator::ConcurrentSlotAllocator(int capacity)
+		: firstChunkSize{ static_cast<int>(std::bit_ceil(static_cast<unsigned int>(capacity < 1 ? 1 : capacity))) }
+	{
+		Grow(head.load());
+	}
+
+	ConcurrentSlotAllocator::~ConcurrentSlotAllocator()
+	{
+		for (int i = 0; i < chunkCount.load(); ++i)
+		{
+			delete[] chunks[i].load();
+		}
+	}
+
+	int ConcurrentSlotAllocator::Capacity() const
+	{
+		return ChunkStart(chunkCount.load(std::memory_order_acquire));
+	}
+
+	ConcurrentSlotAllocator::Slot* ConcurrentSlotAllocator::TryGetSlot(int index) const
+	{
+		if (index < 0 || index >= Capacity())
+		{
+			return nullptr;
+		}
+
+		return &GetSlot(static_cast<std::uint32_t>(index));
+	}
+
+	ConcurrentSlotAllocator::Slot& ConcurrentSlotAllocator::GetSlot(std::uint32_t index) const
+	{
+		// Chunk k holds firstChunkSize * 2^k slots, starting at firstChunkSize * (2^k - 1).
+		const int chunk = std::bit_width(index / static_cast<std::uint32_t>(firstChunkSize) + 1) - 1;
+		return chunks[chunk].load(std::memory_order_acquire)[index - ChunkStart(chunk)];
+	}
+
+	SlotMapKey ConcurrentSlotAllocator::Acquire()
+	{
+		std::uint64_t current = head.load(std::memory_order_acquire);
+
+		while (true)
+		{
+			const std::uint32_t index = HeadIndex(current);
+			if (index == EmptyIndex)
+			{
+				Grow(current);
+				current = head.load(std::memory_order_acquire);
+				continue;
+			}
+
+			// If another thread pops this slot first, the tag will have moved on
+			// and the CAS below fails, so a stale "next" is never installed.
+			Slot& slot = GetSlot(index);
+			const std::uint32_t next = slot.next.load(std::memory_order_relaxed);
+
+			if (head.compare_exchange_weak(current, MakeHead(next, HeadTag(current) + 1),
+				std::memory_order_acquire, std::memory_order_acquire))
+			{
+				const std::uint64_t generation = slot.state.load(std::memory_order_relaxed) >> 1;
+				slot.state.store((generation << 1) | AliveBit, std::memory_order_release);
+				size.fetch_add(1, std::memory_order_relaxed);
+
+				return SlotMapKey(static_cast<int>(index), static_cast<int>(generation));
+			}
+		}
+	}
+
+	bool ConcurrentSlotAllocator::Release(const SlotMapKey& key)
+	{
+		Slot* slot = TryGetSlot(key.index);
+		if (slot == nullptr)
+		{
+			return false;
+		}
+
+		// Only one of several racing Release calls for the same key can win this.
+		std::uint64_t expected = (static_cast<std::uint64_t>(key.generation) << 1) | AliveBit;
+		const std::uint64_t released = static_cast<std::uint64_t>(key.generation + 1) << 1;
+		if (!slot->state.compare_exchange_strong(expected, released, std::memory_order_acq_rel))
+		{
+			return false;
+		}
+
+		size.fetch_sub(1, std::memory_order_relaxed);
+		Push(static_cast<std::uint32_t>(key.index), static_cast<std::uint32_t>(key.index));
+
+		return true;
+	}
+
+	bool ConcurrentSlotAllocator::IsAlive(const SlotMapKey& key) const
+	{
+		const Slot* slot = TryGetSlot(key.index);
+		return slot != nullptr &&
+			slot->state.load(std::memory_order_acquire) == ((static_cast<std::uint64_t>(key.generation) << 1) | AliveBit);
+	}
+
+	void ConcurrentSlotAllocator::Push(std::uint32_t first, std::uint32_t last)
+	{
+		Slot& lastSlot = GetSlot(last);
+		std::uint64_t current = head.load(std::memory_order_relaxed);
+
+		do
+		{
+			lastSlot.next.store(HeadIndex(current), std::memory_order_relaxed);
+		} while (!head.compare_exchange_weak(current, MakeHead(first, HeadTag(current) + 1),
+			std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	void ConcurrentSlotAllocator::Grow(std::uint64_t observedHead)
+	{
+		std::lock_guard lock(growLock);
+
+		// Somebody else may have grown (or released a slot) while we were waiting.
+		if (head.load(std::memory_order_acquire) != observedHead)
+		{
+			return;
+		}
+
+		const int chunk = chunkCount.load(std::memory_order_relaxed);
+		const long long end = static_cast<long long>(firstChunkSize) * ((2LL << chunk) - 1);
+		if (chunk >= MaxChunks || end > INT_MAX)
+		{
+			throw std::overflow_error("[ConcurrentSlotAllocator] Ran out of slots.");
+		}
+
+		const int start = ChunkStart(chunk);
+		const int count = ChunkSize(chunk);
+
+		Slot* slots = new Slot[count];
+		for (int i = 0; i < count - 1; ++i)
+		{
+			slots[i].next.store(static_cast<std::uint32_t>(start + i + 1), std::memory_order_relaxed);
+		}
+
+		chunks[chunk].store(slots, std::memory_order_release);
+		chunkCount.store(chunk + 1, std::memory_order_release);
+
+		Push(static_cast<std::uint32_t>(start), static_cast<std::uint32_t>(start + count - 1));
+	}
+} // namespace Unalmas
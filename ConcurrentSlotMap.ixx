@@ -0,0 +1,555 @@
+export module ConcurrentSlotMap;
+
+#define DEFAULT_CAPACITY 8
+
+// A single writer, multiple reader variant of SlotMap.
+//
+// Guarantees:
+// one thread may Insert, Erase, Update and Clear; any number of other threads
+// may call TryGet at the same time, and readers never block
+// each slot carries a sequence counter (seqlock) which is odd while the writer
+// is touching that slot; readers copy the value out optimistically and retry
+// if the sequence changed underneath them
+// Grow() publishes the new buffers with a single atomic store; the old ones are
+// only freed once no reader can still be looking at them (epoch-based reclamation)
+// with SLOTMAP_STATS defined, Stats() counts what SlotMap::Stats() does, in
+// relaxed atomics, so it can be called from any thread
+//
+// Values are copied byte by byte through relaxed atomics on both sides, so a
+// reader overlapping a write is not a data race; T must be trivially copyable.
+
+import <atomic>;
+import <cstdint>;
+import <cstring>;
+import <cstdlib>;
+import <new>;
+import <utility>;
+import <type_traits>;
+import <stdexcept>;
+import SlotMap;
+
+export namespace Unalmas
+{
+	namespace ConcurrentSlotMapDetail
+	{
+		// Seqlock payload copies. A reader may copy a value while the writer
+		// overwrites it; the sequence check throws such copies away, but the
+		// bytes themselves still have to be accessed atomically for the overlap
+		// to be well defined.
+		template <typename T>
+		void LoadValue(unsigned char* to, const T& from)
+		{
+			const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&from);
+			for (std::size_t i = 0; i < sizeof(T); ++i)
+			{
+				to[i] = std::atomic_ref<unsigned char>(const_cast<unsigned char&>(bytes[i])).load(std::memory_order_relaxed);
+			}
+		}
+
+		// Only the writer stores values, so the source can be read plainly.
+		template <typename T>
+		void StoreValue(T& to, const T& from)
+		{
+			unsigned char* bytes = reinterpret_cast<unsigned char*>(&to);
+			const unsigned char* source = reinterpret_cast<const unsigned char*>(&from);
+			for (std::size_t i = 0; i < sizeof(T); ++i)
+			{
+				std::atomic_ref<unsigned char>(bytes[i]).store(source[i], std::memory_order_relaxed);
+			}
+		}
+	}
+
+	template <typename T>
+	class ConcurrentSlotMap
+	{
+		static_assert(std::is_trivially_copyable<T>(), "ConcurrentSlotMap requires a trivially copyable element type.");
+
+	private:
+		struct Slot
+		{
+			std::atomic<unsigned int>	sequence{ 0 };
+			std::atomic<int>			index{ 0 };
+			std::atomic<int>			generation{ 0 };
+		};
+
+		struct Storage
+		{
+			Slot* slots{ nullptr };
+			T* values{ nullptr };
+			unsigned int* valueToSlot{ nullptr };
+			int							capacity{ 0 };
+
+			Storage* nextRetired{ nullptr };
+			std::uint64_t				retiredAt{ 0 };
+		};
+
+		// Readers announce themselves in the counter matching the parity of the
+		// epoch they entered in. The writer may only advance the epoch once
+		// nobody is left in the counter it is about to reuse.
+		struct ReadGuard
+		{
+			explicit ReadGuard(const ConcurrentSlotMap& map_) : map{ map_ }
+			{
+				parity = static_cast<int>(map.epoch.load() & 1);
+				map.activeReaders[parity].fetch_add(1);
+			}
+
+			~ReadGuard()
+			{
+				map.activeReaders[parity].fetch_sub(1, std::memory_order_release);
+			}
+
+			const ConcurrentSlotMap& map;
+			int							parity;
+		};
+
+		std::atomic<Storage*>		storage{ nullptr };
+		std::atomic<int>			size{ 0 };
+		std::atomic<int>			capacity{ 0 };
+		std::atomic<std::uint64_t>	epoch{ 0 };
+		mutable std::atomic<int>	activeReaders[2]{};
+		Storage* retired{ nullptr };
+		int							firstFreeSlot{ 0 };
+		int							lastFreeSlot{ 0 };
+
+#ifdef SLOTMAP_STATS
+		// Only the writer changes these (except staleLookups), so plain relaxed
+		// stores will do; they are atomic so that Stats() can read them anywhere.
+		mutable std::atomic<std::uint64_t>	staleLookups{ 0 };
+		std::atomic<std::uint64_t>	growCount{ 0 };
+		std::atomic<std::uint64_t>	bytesCopied{ 0 };
+		std::atomic<std::uint64_t>	eraseMoves{ 0 };
+		std::atomic<int>			peakSize{ 0 };
+		std::atomic<int>			maxGeneration{ 0 };
+#endif
+
+	public:
+		ConcurrentSlotMap();
+		ConcurrentSlotMap(int capacity);
+
+		ConcurrentSlotMap(const ConcurrentSlotMap& rhs) = delete;
+		ConcurrentSlotMap(ConcurrentSlotMap&& rhs) = delete;
+		ConcurrentSlotMap& operator=(const ConcurrentSlotMap& rhs) = delete;
+		ConcurrentSlotMap& operator=(ConcurrentSlotMap&& rhs) = delete;
+		~ConcurrentSlotMap();
+
+		// Reader side; safe to call from any thread.
+		bool					TryGet(const SlotMapKey& key, T& value) const;
+		int						Size() const { return size.load(std::memory_order_acquire); }
+		int						Capacity() const { return capacity.load(std::memory_order_acquire); }
+		SlotMapStats			Stats() const;
+
+		// Writer side; only ever call these from one thread at a time.
+		SlotMapKey				Insert(const T& value);
+		bool					Update(const SlotMapKey& key, const T& value);
+		bool					Erase(const SlotMapKey& key);
+		void					Clear();
+
+	private:
+		static Storage* AllocateStorage(int capacity);
+		static void				FreeStorage(Storage* storage);
+
+		static void				BeginWrite(Slot& slot);
+		static void				EndWrite(Slot& slot);
+
+		void					AppendToFreeList(Storage* s, int slotIndex);
+		void					Grow();
+		void					Retire(Storage* old);
+		void					Reclaim();
+
+		static void				Add(std::atomic<std::uint64_t>& counter, std::uint64_t amount);
+		static void				Max(std::atomic<int>& counter, int value);
+	};
+
+	template <typename T>
+	ConcurrentSlotMap<T>::ConcurrentSlotMap() : ConcurrentSlotMap<T>(DEFAULT_CAPACITY)
+	{
+	}
+
+	template <typename T>
+	ConcurrentSlotMap<T>::ConcurrentSlotMap(int capacity_)
+	{
+		Storage* s = AllocateStorage(capacity_);
+
+		for (int i = 0; i < capacity_ - 1; ++i)
+		{
+			s->slots[i].index.store(i + 1, std::memory_order_relaxed);
+		}
+
+		s->slots[capacity_ - 1].index.store(capacity_ - 1, std::memory_order_relaxed);
+
+		firstFreeSlot = 0;
+		lastFreeSlot = capacity_ - 1;
+
+		capacity.store(capacity_);
+		storage.store(s);
+	}
+
+	template <typename T>
+	ConcurrentSlotMap<T>::~ConcurrentSlotMap()
+	{
+		while (retired != nullptr)
+		{
+			Storage* next = retired->nextRetired;
+			FreeStorage(retired);
+			retired = next;
+		}
+
+		FreeStorage(storage.load());
+	}
+
+	template <typename T>
+	typename ConcurrentSlotMap<T>::Storage* ConcurrentSlotMap<T>::AllocateStorage(int capacity)
+	{
+		Storage* s = new Storage();
+		s->capacity = capacity;
+		s->slots = new Slot[capacity];
+		s->values = static_cast<T*>(std::malloc(capacity * sizeof(T)));
+		s->valueToSlot = new unsigned int[capacity];
+		return s;
+	}
+
+	template <typename T>
+	void ConcurrentSlotMap<T>::FreeStorage(Storage* s)
+	{
+		delete[] s->slots;
+		std::free(s->values);
+		delete[] s->valueToSlot;
+		delete s;
+	}
+
+	template <typename T>
+	void ConcurrentSlotMap<T>::BeginWrite(Slot& slot)
+	{
+		slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	template <typename T>
+	void ConcurrentSlotMap<T>::EndWrite(Slot& slot)
+	{
+		slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	template <typename T>
+	bool ConcurrentSlotMap<T>::TryGet(const SlotMapKey& key, T& value) const
+	{
+		ReadGuard guard(*this);
+		const Storage* s = storage.load();
+
+		if (key.index < 0 || key.index >= s->capacity)
+		{
+			return false;
+		}
+
+		const Slot& slot = s->slots[key.index];
+		alignas(T) unsigned char copy[sizeof(T)];
+
+		while (true)
+		{
+			const unsigned int before = slot.sequence.load(std::memory_order_acquire);
+			if ((before & 1) != 0)
+			{
+				continue;					// Writer is in the middle of touching this slot
+			}
+
+			if (slot.generation.load(std::memory_order_relaxed) != key.generation)
+			{
+#ifdef SLOTMAP_STATS
+				staleLookups.fetch_add(1, std::memory_order_relaxed);
+#endif
+				return false;
+			}
+
+			const int valueIndex = slot.index.load(std::memory_order_relaxed);
+			ConcurrentSlotMapDetail::LoadValue(copy, s->values[valueIndex]);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.sequence.load(std::memory_order_relaxed) == before)
+			{
+				std::memcpy(&value, copy, sizeof(T));
+				return true;
+			}
+		}
+	}
+
+	template <typename T>
+	SlotMapKey ConcurrentSlotMap<T>::Insert(const T& value)
+	{
+		if (retired != nullptr)
+		{
+			Reclaim();
+		}
+
+		const int newValueIndex = size.load(std::memory_order_relaxed);
+		if (newValueIndex >= capacity.load(std::memory_order_relaxed))
+		{
+			Grow();
+		}
+
+		Storage* s = storage.load(std::memory_order_relaxed);
+
+		const int slotIndex = firstFreeSlot;
+		Slot& slot = s->slots[slotIndex];
+
+		BeginWrite(slot);
+
+		ConcurrentSlotMapDetail::StoreValue(s->values[newValueIndex], value);
+		s->valueToSlot[newValueIndex] = slotIndex;
+
+		if (slot.index.load(std::memory_order_relaxed) == firstFreeSlot)
+		{
+			firstFreeSlot = -1;				// Ran out of free slots!
+			lastFreeSlot = -1;
+		}
+		else
+		{
+			firstFreeSlot = slot.index.load(std::memory_order_relaxed);
+		}
+
+		slot.index.store(newValueIndex, std::memory_order_relaxed);
+
+		EndWrite(slot);
+
+		size.store(newValueIndex + 1, std::memory_order_release);
+
+#ifdef SLOTMAP_STATS
+		Max(peakSize, newValueIndex + 1);
+#endif
+
+		return SlotMapKey(slotIndex, slot.generation.load(std::memory_order_relaxed));
+	}
+
+	template <typename T>
+	bool ConcurrentSlotMap<T>::Update(const SlotMapKey& key, const T& value)
+	{
+		Storage* s = storage.load(std::memory_order_relaxed);
+		if (key.index < 0 || key.index >= s->capacity)
+		{
+			return false;
+		}
+
+		Slot& slot = s->slots[key.index];
+		if (slot.generation.load(std::memory_order_relaxed) != key.generation)
+		{
+			return false;
+		}
+
+		BeginWrite(slot);
+		ConcurrentSlotMapDetail::StoreValue(s->values[slot.index.load(std::memory_order_relaxed)], value);
+		EndWrite(slot);
+
+		return true;
+	}
+
+	template <typename T>
+	bool ConcurrentSlotMap<T>::Erase(const SlotMapKey& key)
+	{
+		if (retired != nullptr)
+		{
+			Reclaim();
+		}
+
+		Storage* s = storage.load(std::memory_order_relaxed);
+		if (key.index < 0 || key.index >= s->capacity)
+		{
+			return false;
+		}
+
+		Slot& slot = s->slots[key.index];
+		const int generation = slot.generation.load(std::memory_order_relaxed);
+		if (generation != key.generation)
+		{
+			return false;
+		}
+
+		BeginWrite(slot);
+
+		slot.generation.store(generation + 1, std::memory_order_relaxed);
+
+#ifdef SLOTMAP_STATS
+		Max(maxGeneration, generation + 1);
+#endif
+
+		const int valueIndex = slot.index.load(std::memory_order_relaxed);
+		const int lastValueIndex = size.load(std::memory_order_relaxed) - 1;
+
+		// Move the last item into the freed position. The moved item's slot
+		// is bumped as well, so readers who were copying it start over.
+		if (valueIndex != lastValueIndex)
+		{
+			const unsigned int movedSlotIndex = s->valueToSlot[lastValueIndex];
+			Slot& movedSlot = s->slots[movedSlotIndex];
+
+			BeginWrite(movedSlot);
+			ConcurrentSlotMapDetail::StoreValue(s->values[valueIndex], s->values[lastValueIndex]);
+			s->valueToSlot[valueIndex] = movedSlotIndex;
+			movedSlot.index.store(valueIndex, std::memory_order_relaxed);
+			EndWrite(movedSlot);
+
+#ifdef SLOTMAP_STATS
+			Add(eraseMoves, 1);
+#endif
+		}
+
+		AppendToFreeList(s, key.index);
+
+		EndWrite(slot);
+
+		size.store(lastValueIndex, std::memory_order_release);
+
+		return true;
+	}
+
+	template <typename T>
+	void ConcurrentSlotMap<T>::Clear()
+	{
+		Storage* s = storage.load(std::memory_order_relaxed);
+		const int cap = s->capacity;
+
+		for (int i = 0; i < cap; ++i)
+		{
+			Slot& slot = s->slots[i];
+			BeginWrite(slot);
+			slot.generation.store(slot.generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			slot.index.store(i < cap - 1 ? i + 1 : i, std::memory_order_relaxed);
+			EndWrite(slot);
+		}
+
+		firstFreeSlot = 0;
+		lastFreeSlot = cap - 1;
+		size.store(0, std::memory_order_release);
+
+#ifdef SLOTMAP_STATS
+		Max(maxGeneration, maxGeneration.load(std::memory_order_relaxed) + 1);		// Every slot went up by one
+#endif
+	}
+
+	template <typename T>
+	void ConcurrentSlotMap<T>::AppendToFreeList(Storage* s, int slotIndex)
+	{
+		if (firstFreeSlot == -1)
+		{
+			firstFreeSlot = slotIndex;
+		}
+		else
+		{
+			s->slots[lastFreeSlot].index.store(slotIndex, std::memory_order_relaxed);
+		}
+
+		s->slots[slotIndex].index.store(slotIndex, std::memory_order_relaxed);
+		lastFreeSlot = slotIndex;
+	}
+
+	template <typename T>
+	void ConcurrentSlotMap<T>::Grow()
+	{
+		Storage* old = storage.load(std::memory_order_relaxed);
+		const int oldCapacity = old->capacity;
+		const int newCapacity = oldCapacity * 2;
+		const int count = size.load(std::memory_order_relaxed);
+
+		Storage* s = AllocateStorage(newCapacity);
+
+		for (int i = 0; i < oldCapacity; ++i)
+		{
+			s->slots[i].index.store(old->slots[i].index.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			s->slots[i].generation.store(old->slots[i].generation.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+
+		std::memcpy(s->valueToSlot, old->valueToSlot, count * sizeof(unsigned int));
+		std::memcpy(s->values, old->values, count * sizeof(T));
+
+		for (int i = oldCapacity; i < newCapacity; ++i)
+		{
+			AppendToFreeList(s, i);
+		}
+
+		// Readers that loaded the old storage keep using it until they are done;
+		// it is never written to again, so what they see is a consistent state.
+		storage.store(s);
+		capacity.store(newCapacity, std::memory_order_release);
+
+#ifdef SLOTMAP_STATS
+		Add(growCount, 1);
+		Add(bytesCopied, static_cast<std::uint64_t>(oldCapacity) * 2 * sizeof(int)
+			+ static_cast<std::uint64_t>(count) * (sizeof(unsigned int) + sizeof(T)));
+#endif
+
+		Retire(old);
+	}
+
+	template <typename T>
+	void ConcurrentSlotMap<T>::Retire(Storage* old)
+	{
+		old->retiredAt = epoch.load(std::memory_order_relaxed);
+		old->nextRetired = retired;
+		retired = old;
+
+		Reclaim();
+	}
+
+	template <typename T>
+	void ConcurrentSlotMap<T>::Reclaim()
+	{
+		// Storage retired in epoch E may still be referenced by readers that
+		// entered in E (or earlier), so it can be freed once we got to E + 2.
+		const std::uint64_t current = epoch.load(std::memory_order_relaxed);
+		if (activeReaders[(current + 1) & 1].load() == 0)
+		{
+			epoch.store(current + 1);
+		}
+
+		const std::uint64_t now = epoch.load(std::memory_order_relaxed);
+		Storage** link = &retired;
+		while (*link != nullptr)
+		{
+			Storage* candidate = *link;
+			if (candidate->retiredAt + 2 <= now)
+			{
+				*link = candidate->nextRetired;
+				FreeStorage(candidate);
+			}
+			else
+			{
+				link = &candidate->nextRetired;
+			}
+		}
+	}
+
+	template <typename T>
+	SlotMapStats ConcurrentSlotMap<T>::Stats() const
+	{
+		SlotMapStats stats;
+		stats.size = size.load(std::memory_order_relaxed);
+		stats.capacity = capacity.load(std::memory_order_relaxed);
+		stats.freeSlots = stats.capacity - stats.size;
+
+#ifdef SLOTMAP_STATS
+		stats.peakSize = peakSize.load(std::memory_order_relaxed);
+		stats.maxGeneration = maxGeneration.load(std::memory_order_relaxed);
+		stats.growCount = growCount.load(std::memory_order_relaxed);
+		stats.bytesCopied = bytesCopied.load(std::memory_order_relaxed);
+		stats.eraseMoves = eraseMoves.load(std::memory_order_relaxed);
+		stats.staleLookups = staleLookups.load(std::memory_order_relaxed);
+#endif
+
+		return stats;
+	}
+
+	template <typename T>
+	void ConcurrentSlotMap<T>::Add(std::atomic<std::uint64_t>& counter, std::uint64_t amount)
+	{
+		// Single writer: no read-modify-write needed.
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	template <typename T>
+	void ConcurrentSlotMap<T>::Max(std::atomic<int>& counter, int value)
+	{
+		if (value > counter.load(std::memory_order_relaxed))
+		{
+			counter.store(value, std::memory_order_relaxed);
+		}
+	}
+} // namespace Unalmas
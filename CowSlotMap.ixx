@@ -0,0 +1,431 @@
+export module CowSlotMap;
+
+#define DEFAULT_CAPACITY 8
+
+// A slotmap that can take cheap, immutable snapshots of itself, e.g. for a
+// background thread to serialize or analyze while the owner keeps writing.
+//
+// Guarantees:
+// slots, valueToSlot and values are stored in pages of Chunk entries each, which
+// are reference counted; Snapshot() only copies the page tables, so it costs
+// O(capacity / Chunk), whatever T is
+// the writer copies a page the first time it modifies it while a snapshot still
+// shares it, so a snapshot never changes, and untouched pages are never copied
+// growing adds pages; existing ones stay where they are
+// snapshots may be read (and destroyed) on other threads while the writer writes;
+// the map itself is single threaded, like SlotMap
+//
+// Unlike the SlotMap copy constructor, T doesn't have to be trivially copyable,
+// only copy constructible (a page is copied element by element).
+
+import <atomic>;
+import <cstdlib>;
+import <memory>;
+import <new>;
+import <utility>;
+import <vector>;
+import <stdexcept>;
+import <type_traits>;
+import SlotMap;
+
+export namespace Unalmas
+{
+	template <typename T, int Chunk>
+	class CowSlotMapSnapshot;
+
+	namespace CowSlotMapDetail
+	{
+		template <typename U, int Chunk>
+		struct Page
+		{
+			U items[Chunk];
+		};
+
+		// Values are dense, so a page holds its first count items, and the rest is raw storage.
+		template <typename T, int Chunk>
+		struct ValuePage
+		{
+			alignas(T) unsigned char storage[Chunk * sizeof(T)];
+			int count{ 0 };
+
+			ValuePage() = default;
+
+			ValuePage(const ValuePage& rhs)
+			{
+				try
+				{
+					for (; count < rhs.count; ++count)
+					{
+						new (&Item(count)) T(rhs.Item(count));
+					}
+				}
+				catch (...)
+				{
+					// The destructor won't run for a page that was never constructed.
+					while (count-- > 0)
+					{
+						Item(count).~T();
+					}
+
+					throw;
+				}
+			}
+
+			ValuePage& operator=(const ValuePage& rhs) = delete;
+
+			~ValuePage()
+			{
+				for (int i = 0; i < count; ++i)
+				{
+					Item(i).~T();
+				}
+			}
+
+			T& Item(int i) { return *std::launder(reinterpret_cast<T*>(storage) + i); }
+			const T& Item(int i) const { return *std::launder(reinterpret_cast<const T*>(storage) + i); }
+		};
+
+		template <typename T, int Chunk>
+		struct PageTables
+		{
+			std::vector<std::shared_ptr<Page<SlotMapKey, Chunk>>>	slots;
+			std::vector<std::shared_ptr<Page<unsigned int, Chunk>>>	valueToSlot;
+			std::vector<std::shared_ptr<ValuePage<T, Chunk>>>		values;
+			int														size{ 0 };
+			int														firstFreeSlot{ -1 };
+			int														lastFreeSlot{ -1 };
+
+			int					Capacity() const { return static_cast<int>(slots.size()) * Chunk; }
+
+			const SlotMapKey& Slot(int i) const { return slots[i / Chunk]->items[i % Chunk]; }
+			const T& Value(int i) const { return values[i / Chunk]->Item(i % Chunk); }
+
+			bool				Contains(const SlotMapKey& key) const
+			{
+				return 0 <= key.index && key.index < Capacity() && Slot(key.index).generation == key.generation;
+			}
+		};
+	}
+
+	template <typename T, int Chunk = 256>
+	class CowSlotMap
+	{
+		static_assert(Chunk > 0 && (Chunk & (Chunk - 1)) == 0, "The chunk size must be a power of two.");
+		static_assert(std::is_copy_constructible<T>(), "CowSlotMap copies pages, so T must be copy constructible.");
+
+	private:
+		using Tables = CowSlotMapDetail::PageTables<T, Chunk>;
+
+		Tables		tables;
+		int			copiedPages{ 0 };
+
+	public:
+		CowSlotMap() : CowSlotMap(DEFAULT_CAPACITY) {}
+		CowSlotMap(int capacity);
+
+		CowSlotMap(const CowSlotMap& rhs) = delete;
+		CowSlotMap(CowSlotMap&& rhs) = delete;
+		CowSlotMap& operator=(const CowSlotMap& rhs) = delete;
+		CowSlotMap& operator=(CowSlotMap&& rhs) = delete;
+
+		const T& operator[](const SlotMapKey& key) const;
+		T& operator[](const SlotMapKey& key);			// Copies the value's page if a snapshot shares it
+		bool						TryGet(const SlotMapKey& key, T& value) const;
+		bool						Contains(const SlotMapKey& key) const { return tables.Contains(key); }
+
+		int							Size() const { return tables.size; }
+		int							Capacity() const { return tables.Capacity(); }
+
+		template <typename U>
+		SlotMapKey					Insert(U&& value);
+		bool						Erase(const SlotMapKey& key);
+
+		// An immutable view of the map as it is now.
+		CowSlotMapSnapshot<T, Chunk>	Snapshot() const { return CowSlotMapSnapshot<T, Chunk>(tables); }
+
+		// How many pages were copied because a snapshot shared them, so far.
+		int							CopiedPages() const { return copiedPages; }
+
+		template <typename F>
+		void						ForEach(F&& func) const;
+
+	private:
+		template <typename P>
+		P& Writable(std::vector<std::shared_ptr<P>>& pages, int index);
+
+		SlotMapKey& WritableSlot(int i) { return Writable(tables.slots, i / Chunk).items[i % Chunk]; }
+		unsigned int& WritableValueToSlot(int i) { return Writable(tables.valueToSlot, i / Chunk).items[i % Chunk]; }
+		CowSlotMapDetail::ValuePage<T, Chunk>& WritableValuePage(int i) { return Writable(tables.values, i / Chunk); }
+
+		void						Grow();
+		int							PopFreeSlot();
+		void						PushFreeSlot(int slotIndex);
+	};
+
+	template <typename T, int Chunk = 256>
+	class CowSlotMapSnapshot
+	{
+	private:
+		CowSlotMapDetail::PageTables<T, Chunk>	tables;
+
+	public:
+		explicit CowSlotMapSnapshot(const CowSlotMapDetail::PageTables<T, Chunk>& tables_) : tables{ tables_ } {}
+
+		const T& operator[](const SlotMapKey& key) const;
+		const T& operator[](int index) const { return tables.Value(index); }
+		bool						TryGet(const SlotMapKey& key, T& value) const;
+		bool						Contains(const SlotMapKey& key) const { return tables.Contains(key); }
+
+		int							Size() const { return tables.size; }
+		int							Capacity() const { return tables.Capacity(); }
+
+		template <typename F>
+		void						ForEach(F&& func) const;
+
+		// Raw access to the pages, e.g. for serializing them: each holds Chunk
+		// entries, except for the values pages, which only hold the first Size().
+		int							ChunkCount() const { return static_cast<int>(tables.slots.size()); }
+		const SlotMapKey* SlotChunk(int chunk) const { return tables.slots[chunk]->items; }
+		const unsigned int* ValueToSlotChunk(int chunk) const { return tables.valueToSlot[chunk]->items; }
+		const T* ValueChunk(int chunk) const { return &tables.values[chunk]->Item(0); }
+		int							FirstFreeSlot() const { return tables.firstFreeSlot; }
+		int							LastFreeSlot() const { return tables.lastFreeSlot; }
+	};
+
+	template <typename T, int Chunk>
+	CowSlotMap<T, Chunk>::CowSlotMap(int capacity)
+	{
+		do
+		{
+			Grow();
+		} while (Capacity() < capacity);
+	}
+
+	template <typename T, int Chunk>
+	template <typename P>
+	P& CowSlotMap<T, Chunk>::Writable(std::vector<std::shared_ptr<P>>& pages, int index)
+	{
+		std::shared_ptr<P>& page = pages[index];
+
+		// Only this thread makes new references to our pages (by taking snapshots),
+		// so a page nobody else holds stays ours. The fence pairs with the release
+		// in the last snapshot's reference drop, so its reads are done.
+		if (page.use_count() > 1)
+		{
+			page = std::make_shared<P>(*page);
+			copiedPages++;
+		}
+		else
+		{
+			std::atomic_thread_fence(std::memory_order_acquire);
+		}
+
+		return *page;
+	}
+
+	template <typename T, int Chunk>
+	const T& CowSlotMap<T, Chunk>::operator[](const SlotMapKey& key) const
+	{
+#ifndef SLOTMAP_RELEASE
+		if (!tables.Contains(key))
+		{
+			throw std::runtime_error("[SlotMap] Trying to use a key which is no longer valid.");
+		}
+#endif
+
+		return tables.Value(tables.Slot(key.index).index);
+	}
+
+	template <typename T, int Chunk>
+	T& CowSlotMap<T, Chunk>::operator[](const SlotMapKey& key)
+	{
+#ifndef SLOTMAP_RELEASE
+		if (!tables.Contains(key))
+		{
+			throw std::runtime_error("[SlotMap] Trying to use a key which is no longer valid.");
+		}
+#endif
+
+		const int valueIndex = tables.Slot(key.index).index;
+		return WritableValuePage(valueIndex).Item(valueIndex % Chunk);
+	}
+
+	template <typename T, int Chunk>
+	bool CowSlotMap<T, Chunk>::TryGet(const SlotMapKey& key, T& value) const
+	{
+		if (tables.Contains(key))
+		{
+			value = tables.Value(tables.Slot(key.index).index);
+			return true;
+		}
+
+		return false;
+	}
+
+	template <typename T, int Chunk>
+	template <typename U>
+	SlotMapKey CowSlotMap<T, Chunk>::Insert(U&& value)
+	{
+		const int slotIndex = PopFreeSlot();
+		const int newValueIndex = tables.size;
+
+		auto& page = WritableValuePage(newValueIndex);
+		new (&page.Item(newValueIndex % Chunk)) T(std::forward<U>(value));
+		page.count++;
+		tables.size++;
+
+		WritableValueToSlot(newValueIndex) = slotIndex;
+
+		SlotMapKey& slot = WritableSlot(slotIndex);
+		slot.index = newValueIndex;
+
+		return SlotMapKey(slotIndex, slot.generation);
+	}
+
+	template <typename T, int Chunk>
+	bool CowSlotMap<T, Chunk>::Erase(const SlotMapKey& key)
+	{
+		if (!tables.Contains(key))
+		{
+			return false;
+		}
+
+		SlotMapKey& slot = WritableSlot(key.index);
+		slot.generation++;
+
+		const int valueIndex = slot.index;
+		const int lastValueIndex = tables.size - 1;
+
+		auto& lastPage = WritableValuePage(lastValueIndex);
+		T& last = lastPage.Item(lastValueIndex % Chunk);
+
+		// Move the last value into the hole, and point its slot at the new location.
+		if (valueIndex != lastValueIndex)
+		{
+			T& hole = WritableValuePage(valueIndex).Item(valueIndex % Chunk);
+			hole.~T();
+
+			if constexpr (std::is_move_constructible<T>())
+			{
+				new (&hole) T(std::move(last));
+			}
+			else
+			{
+				new (&hole) T(last);
+			}
+
+			const unsigned int movedSlotIndex = tables.valueToSlot[lastValueIndex / Chunk]->items[lastValueIndex % Chunk];
+			WritableValueToSlot(valueIndex) = movedSlotIndex;
+			WritableSlot(movedSlotIndex).index = valueIndex;
+		}
+
+		last.~T();
+		lastPage.count--;
+		tables.size--;
+
+		PushFreeSlot(key.index);
+
+		return true;
+	}
+
+	template <typename T, int Chunk>
+	template <typename F>
+	void CowSlotMap<T, Chunk>::ForEach(F&& func) const
+	{
+		for (int i = 0; i < tables.size; ++i)
+		{
+			func(tables.Value(i));
+		}
+	}
+
+	template <typename T, int Chunk>
+	void CowSlotMap<T, Chunk>::Grow()
+	{
+		// New pages aren't shared with any snapshot, and old pages don't move.
+		const int first = Capacity();
+
+		tables.slots.push_back(std::make_shared<CowSlotMapDetail::Page<SlotMapKey, Chunk>>());
+		tables.valueToSlot.push_back(std::make_shared<CowSlotMapDetail::Page<unsigned int, Chunk>>());
+		tables.values.push_back(std::make_shared<CowSlotMapDetail::ValuePage<T, Chunk>>());
+
+		for (int i = first; i < first + Chunk; ++i)
+		{
+			PushFreeSlot(i);
+		}
+	}
+
+	template <typename T, int Chunk>
+	int CowSlotMap<T, Chunk>::PopFreeSlot()
+	{
+		if (tables.firstFreeSlot == -1)
+		{
+			Grow();
+		}
+
+		const int slotIndex = tables.firstFreeSlot;
+		const int next = tables.Slot(slotIndex).index;
+
+		if (next == tables.firstFreeSlot)
+		{
+			tables.firstFreeSlot = -1;				// Ran out of free slots!
+			tables.lastFreeSlot = -1;
+		}
+		else
+		{
+			tables.firstFreeSlot = next;
+		}
+
+		return slotIndex;
+	}
+
+	template <typename T, int Chunk>
+	void CowSlotMap<T, Chunk>::PushFreeSlot(int slotIndex)
+	{
+		if (tables.firstFreeSlot == -1)
+		{
+			tables.firstFreeSlot = slotIndex;
+		}
+		else
+		{
+			WritableSlot(tables.lastFreeSlot).index = slotIndex;
+		}
+
+		WritableSlot(slotIndex).index = slotIndex;
+		tables.lastFreeSlot = slotIndex;
+	}
+
+	template <typename T, int Chunk>
+	const T& CowSlotMapSnapshot<T, Chunk>::operator[](const SlotMapKey& key) const
+	{
+#ifndef SLOTMAP_RELEASE
+		if (!tables.Contains(key))
+		{
+			throw std::runtime_error("[SlotMap] Trying to use a key which is not valid in this snapshot.");
+		}
+#endif
+
+		return tables.Value(tables.Slot(key.index).index);
+	}
+
+	template <typename T, int Chunk>
+	bool CowSlotMapSnapshot<T, Chunk>::TryGet(const SlotMapKey& key, T& value) const
+	{
+		if (tables.Contains(key))
+		{
+			value = tables.Value(tables.Slot(key.index).index);
+			return true;
+		}
+
+		return false;
+	}
+
+	template <typename T, int Chunk>
+	template <typename F>
+	void CowSlotMapSnapshot<T, Chunk>::ForEach(F&& func) const
+	{
+		for (int i = 0; i < tables.size; ++i)
+		{
+			func(tables.Value(i));
+		}
+	}
+} // namespace Unalmas
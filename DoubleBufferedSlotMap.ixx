@@ -0,0 +1,393 @@
+export module DoubleBufferedSlotMap;
+
+#define DEFAULT_CAPACITY 8
+
+// A slotmap with a front (read) and a back (write) value buffer sharing one key
+// space, for frame-based simulations that read last tick's state while writing
+// the next one.
+//
+// Guarantees:
+// readers see the state as of the last Swap(), however much is written meanwhile
+// writes never touch the front buffer, not even when the map grows, so other
+// threads can read the front while one thread writes the back
+// Swap() flips the buffers in O(1), then brings the new back buffer up to date
+// by copying only the elements written since the previous Swap()
+// Swap() itself must not overlap with readers or writers
+// ForEach() is O(capacity), not O(size): values live at their key's slot index
+// in both buffers (there is no dense array here), so it visits every slot of
+// the front buffer, empty ones included
+
+import <cstdlib>;
+import <new>;
+import <utility>;
+import <vector>;
+import <stdexcept>;
+import <type_traits>;
+import SlotMap;
+
+export namespace Unalmas
+{
+	template <typename T>
+	class DoubleBufferedSlotMap
+	{
+	private:
+		struct Buffer
+		{
+			T* values{ nullptr };
+			int* generations{ nullptr };		// Generation of the value held, or -1 if empty
+			int		size{ 0 };
+			int		capacity{ 0 };
+		};
+
+		SlotMapKey* slots{ nullptr };
+		unsigned char* dirtyFlags{ nullptr };
+		std::vector<int>	dirty;
+		Buffer				front;
+		Buffer				back;
+		int					firstFreeSlot{ 0 };
+		int					lastFreeSlot{ 0 };
+		int					capacity{ 0 };
+
+	public:
+		DoubleBufferedSlotMap();
+		DoubleBufferedSlotMap(int capacity);
+
+		DoubleBufferedSlotMap(const DoubleBufferedSlotMap& rhs) = delete;
+		DoubleBufferedSlotMap(DoubleBufferedSlotMap&& rhs) = delete;
+		DoubleBufferedSlotMap& operator=(const DoubleBufferedSlotMap& rhs) = delete;
+		DoubleBufferedSlotMap& operator=(DoubleBufferedSlotMap&& rhs) = delete;
+		~DoubleBufferedSlotMap();
+
+		// Front (read) side: the state as of the last Swap().
+		const T& Read(const SlotMapKey& key) const;
+		bool				TryGet(const SlotMapKey& key, T& value) const;
+		int					Size() const { return front.size; }
+
+		// Visits every slot of the front buffer, so it costs O(Capacity()).
+		template <typename F>
+		void				ForEach(F&& func) const;
+
+		// Back (write) side: becomes visible to readers on the next Swap().
+		template <typename U>
+		SlotMapKey			Insert(U&& value);
+		T& Write(const SlotMapKey& key);
+		bool				Erase(const SlotMapKey& key);
+		int					BackSize() const { return back.size; }
+		int					Capacity() const { return capacity; }
+
+		void				Swap();
+
+	private:
+		static void			AllocateBuffer(Buffer& buffer, int capacity);
+		static void			GrowBuffer(Buffer& buffer, int capacity);
+		static void			FreeBuffer(Buffer& buffer);
+
+		bool				IsLive(const Buffer& buffer, const SlotMapKey& key) const;
+		void				MarkDirty(int slotIndex);
+		void				Grow();
+	};
+
+	template <typename T>
+	DoubleBufferedSlotMap<T>::DoubleBufferedSlotMap() : DoubleBufferedSlotMap<T>(DEFAULT_CAPACITY)
+	{
+	}
+
+	template <typename T>
+	DoubleBufferedSlotMap<T>::DoubleBufferedSlotMap(int capacity_) : capacity{ capacity_ }
+	{
+		slots = new SlotMapKey[capacity];
+		dirtyFlags = new unsigned char[capacity]();
+
+		for (int i = 0; i < capacity - 1; ++i)
+		{
+			slots[i] = SlotMapKey(i + 1, 0);
+		}
+
+		slots[capacity - 1] = SlotMapKey(capacity - 1, 0);
+		lastFreeSlot = capacity - 1;
+
+		AllocateBuffer(front, capacity);
+		AllocateBuffer(back, capacity);
+	}
+
+	template <typename T>
+	DoubleBufferedSlotMap<T>::~DoubleBufferedSlotMap()
+	{
+		FreeBuffer(front);
+		FreeBuffer(back);
+
+		delete[] dirtyFlags;
+		delete[] slots;
+	}
+
+	template <typename T>
+	void DoubleBufferedSlotMap<T>::AllocateBuffer(Buffer& buffer, int capacity)
+	{
+		buffer.values = static_cast<T*>(std::malloc(capacity * sizeof(T)));
+		buffer.generations = new int[capacity];
+		buffer.capacity = capacity;
+		buffer.size = 0;
+
+		for (int i = 0; i < capacity; ++i)
+		{
+			buffer.generations[i] = -1;
+		}
+	}
+
+	template <typename T>
+	void DoubleBufferedSlotMap<T>::GrowBuffer(Buffer& buffer, int newCapacity)
+	{
+		T* newValues = static_cast<T*>(std::malloc(newCapacity * sizeof(T)));
+		int* newGenerations = new int[newCapacity];
+
+		for (int i = 0; i < buffer.capacity; ++i)
+		{
+			newGenerations[i] = buffer.generations[i];
+			if (buffer.generations[i] >= 0)
+			{
+				if constexpr (std::is_move_constructible<T>())
+				{
+					new (&newValues[i]) T(std::move(buffer.values[i]));
+				}
+				else
+				{
+					new (&newValues[i]) T(buffer.values[i]);
+				}
+
+				buffer.values[i].~T();
+			}
+		}
+
+		for (int i = buffer.capacity; i < newCapacity; ++i)
+		{
+			newGenerations[i] = -1;
+		}
+
+		std::free(buffer.values);
+		delete[] buffer.generations;
+
+		buffer.values = newValues;
+		buffer.generations = newGenerations;
+		buffer.capacity = newCapacity;
+	}
+
+	template <typename T>
+	void DoubleBufferedSlotMap<T>::FreeBuffer(Buffer& buffer)
+	{
+		for (int i = 0; i < buffer.capacity; ++i)
+		{
+			if (buffer.generations[i] >= 0)
+			{
+				buffer.values[i].~T();
+			}
+		}
+
+		std::free(buffer.values);
+		delete[] buffer.generations;
+	}
+
+	template <typename T>
+	bool DoubleBufferedSlotMap<T>::IsLive(const Buffer& buffer, const SlotMapKey& key) const
+	{
+		return 0 <= key.index && key.index < buffer.capacity && key.generation >= 0 &&
+			buffer.generations[key.index] == key.generation;
+	}
+
+	template <typename T>
+	const T& DoubleBufferedSlotMap<T>::Read(const SlotMapKey& key) const
+	{
+#ifndef SLOTMAP_RELEASE
+		if (!IsLive(front, key))
+		{
+			throw std::runtime_error("[SlotMap] Trying to read a key which is not valid in the front buffer.");
+		}
+#endif
+
+		return front.values[key.index];
+	}
+
+	template <typename T>
+	bool DoubleBufferedSlotMap<T>::TryGet(const SlotMapKey& key, T& value) const
+	{
+		if (IsLive(front, key))
+		{
+			value = front.values[key.index];
+			return true;
+		}
+
+		return false;
+	}
+
+	template <typename T>
+	template <typename F>
+	void DoubleBufferedSlotMap<T>::ForEach(F&& func) const
+	{
+		for (int i = 0; i < front.capacity; ++i)
+		{
+			if (front.generations[i] >= 0)
+			{
+				func(SlotMapKey(i, front.generations[i]), front.values[i]);
+			}
+		}
+	}
+
+	template <typename T>
+	template <typename U>
+	SlotMapKey DoubleBufferedSlotMap<T>::Insert(U&& value)
+	{
+		if (firstFreeSlot == -1)
+		{
+			Grow();
+		}
+
+		const int slotIndex = firstFreeSlot;
+		SlotMapKey& slot = slots[slotIndex];
+
+		if (slot.index == firstFreeSlot)
+		{
+			firstFreeSlot = -1;				// Ran out of free slots!
+			lastFreeSlot = -1;
+		}
+		else
+		{
+			firstFreeSlot = slot.index;
+		}
+
+		new (&back.values[slotIndex]) T(std::forward<U>(value));
+		back.generations[slotIndex] = slot.generation;
+		back.size++;
+
+		MarkDirty(slotIndex);
+
+		return SlotMapKey(slotIndex, slot.generation);
+	}
+
+	template <typename T>
+	T& DoubleBufferedSlotMap<T>::Write(const SlotMapKey& key)
+	{
+#ifndef SLOTMAP_RELEASE
+		if (!IsLive(back, key))
+		{
+			throw std::runtime_error("[SlotMap] Trying to write a key which is no longer valid.");
+		}
+#endif
+
+		MarkDirty(key.index);
+		return back.values[key.index];
+	}
+
+	template <typename T>
+	bool DoubleBufferedSlotMap<T>::Erase(const SlotMapKey& key)
+	{
+		if (!IsLive(back, key))
+		{
+			return false;
+		}
+
+		back.values[key.index].~T();
+		back.generations[key.index] = -1;
+		back.size--;
+
+		slots[key.index].generation++;
+
+		if (firstFreeSlot == -1)
+		{
+			firstFreeSlot = key.index;
+		}
+		else
+		{
+			slots[lastFreeSlot].index = key.index;
+		}
+
+		slots[key.index].index = key.index;
+		lastFreeSlot = key.index;
+
+		MarkDirty(key.index);
+
+		return true;
+	}
+
+	template <typename T>
+	void DoubleBufferedSlotMap<T>::MarkDirty(int slotIndex)
+	{
+		if (dirtyFlags[slotIndex] == 0)
+		{
+			dirtyFlags[slotIndex] = 1;
+			dirty.push_back(slotIndex);
+		}
+	}
+
+	template <typename T>
+	void DoubleBufferedSlotMap<T>::Swap()
+	{
+		std::swap(front, back);
+
+		// The new back buffer is the old front: it may be smaller, and it is
+		// missing everything written since the previous Swap().
+		if (back.capacity < front.capacity)
+		{
+			GrowBuffer(back, front.capacity);
+		}
+
+		for (const int i : dirty)
+		{
+			const bool inFront = front.generations[i] >= 0;
+			const bool inBack = back.generations[i] >= 0;
+
+			if (inFront && inBack)
+			{
+				back.values[i] = front.values[i];
+			}
+			else if (inFront)
+			{
+				new (&back.values[i]) T(front.values[i]);
+			}
+			else if (inBack)
+			{
+				back.values[i].~T();
+			}
+
+			back.generations[i] = front.generations[i];
+			dirtyFlags[i] = 0;
+		}
+
+		back.size = front.size;
+		dirty.clear();
+	}
+
+	template <typename T>
+	void DoubleBufferedSlotMap<T>::Grow()
+	{
+		// Only the back buffer grows right away; the front keeps its current
+		// arrays (readers may be using them) and catches up in Swap().
+		const int newCapacity = capacity * 2;
+
+		SlotMapKey* newSlots = new SlotMapKey[newCapacity];
+		unsigned char* newDirtyFlags = new unsigned char[newCapacity]();
+
+		for (int i = 0; i < capacity; ++i)
+		{
+			newSlots[i] = slots[i];
+			newDirtyFlags[i] = dirtyFlags[i];
+		}
+
+		delete[] slots;
+		delete[] dirtyFlags;
+
+		slots = newSlots;
+		dirtyFlags = newDirtyFlags;
+
+		for (int i = capacity; i < newCapacity - 1; ++i)
+		{
+			slots[i].index = i + 1;
+		}
+
+		slots[newCapacity - 1].index = newCapacity - 1;
+
+		firstFreeSlot = capacity;
+		lastFreeSlot = newCapacity - 1;
+
+		GrowBuffer(back, newCapacity);
+		capacity = newCapacity;
+	}
+} // namespace Unalmas
@@ -0,0 +1,534 @@
+export module PersistentSlotMap;
+
+#define DEFAULT_CAPACITY 8
+
+// A slotmap whose storage is a memory-mapped file, in the SlotMapFile format,
+// for trivially copyable element types.
+//
+// Guarantees:
+// Insert, Erase and Update write straight to the mapped pages; there is no
+// in-memory copy to dump, and nothing is serialized
+// Flush() writes back only the pages touched since the previous Flush(), then
+// the header, and returns once they are on disk
+// reopening the file restores the map as it is on disk, keys included, without
+// a rebuild; after a crash the file is repaired first (O(capacity)): the free list,
+// the size and valueToSlot are rebuilt from the values and slots that point at
+// each other, and erased keys stay invalid
+// Insert and Erase order their writes so that a process killed partway through
+// one leaves it either done or not done, after the repair
+// growing writes a complete, bigger copy of the file next to it, then atomically
+// replaces the original, so a crash while growing leaves either the old or the new file
+//
+// Values written after the last Flush() may or may not have reached the disk when
+// the system goes down; the OS writes dirty pages back whenever it likes, and in
+// any order. The repair still leaves a consistent map, but changes since the last
+// Flush() may be partly lost, and a value being updated at the time may be torn.
+
+import <atomic>;
+import <cstdint>;
+import <cstddef>;
+import <cstring>;
+import <string>;
+import <vector>;
+import <stdexcept>;
+import <type_traits>;
+import SlotMap;
+import SlotMapFile;
+
+export namespace Unalmas
+{
+	template <typename T>
+	class PersistentSlotMap
+	{
+		static_assert(std::is_trivially_copyable<T>(), "Only slotmaps with a trivially copyable element type can be persistent.");
+
+	private:
+		MappedFile					file;
+		std::string					path;
+		std::vector<std::uint64_t>	dirtyPages;		// One bit per page of the file
+		std::size_t					pageSize{ 0 };
+		bool						recovered{ false };
+
+		SlotMapFileHeader* header{ nullptr };
+		SlotMapKey* slots{ nullptr };
+		unsigned int* valueToSlot{ nullptr };
+		T* values{ nullptr };
+
+	public:
+		// Opens the file at path, or creates it with the given capacity if it
+		// doesn't exist (or is empty).
+		explicit PersistentSlotMap(const char* path, int capacity = DEFAULT_CAPACITY);
+		~PersistentSlotMap();
+
+		PersistentSlotMap(const PersistentSlotMap& rhs) = delete;
+		PersistentSlotMap(PersistentSlotMap&& rhs) = delete;
+		PersistentSlotMap& operator=(const PersistentSlotMap& rhs) = delete;
+		PersistentSlotMap& operator=(PersistentSlotMap&& rhs) = delete;
+
+		// No mutable access: values are changed through Update(), so that their pages get flushed.
+		const T& operator[](const SlotMapKey& key) const;
+		bool						TryGet(const SlotMapKey& key, T& value) const;
+		bool						Contains(const SlotMapKey& key) const;
+
+		int							Size() const { return header->size; }
+		int							Capacity() const { return header->capacity; }
+
+		SlotMapKey					Insert(const T& value);
+		bool						Update(const SlotMapKey& key, const T& value);
+		bool						Erase(const SlotMapKey& key);
+
+		bool						Flush();
+		int							DirtyPageCount() const;
+
+		// True if the file was not closed cleanly the last time, and had to be verified.
+		bool						WasRecovered() const { return recovered; }
+
+		SlotMapConstIterator<T>		begin() const { return SlotMapConstIterator<T>(values, header->size, 0); }
+		SlotMapConstIterator<T>		end() const { return SlotMapConstIterator<T>(values, header->size, header->size); }
+
+	private:
+		void						Create(int capacity);
+		void						Open();
+		void						Bind();
+		void						Recover();
+		void						Grow();
+
+		void						MarkDirty(const void* ptr, std::size_t bytes);
+		bool						FlushHeader();
+
+		int							PopFreeSlot();
+		void						PushFreeSlot(int slotIndex);
+	};
+
+	template <typename T>
+	PersistentSlotMap<T>::PersistentSlotMap(const char* path_, int capacity) : path{ path_ }, pageSize{ MappedFile::PageSize() }
+	{
+		if (!file.OpenReadWrite(path_))
+		{
+			throw std::runtime_error("[SlotMap] Could not open persistent slotmap file.");
+		}
+
+		if (file.Size() == 0)
+		{
+			Create(capacity < 1 ? 1 : capacity);
+		}
+		else
+		{
+			Open();
+		}
+
+		// Anybody opening the file after a crash will know to check it first.
+		header->flags |= SlotMapFileOpenForWriting;
+		FlushHeader();
+	}
+
+	template <typename T>
+	PersistentSlotMap<T>::~PersistentSlotMap()
+	{
+		if (header != nullptr)
+		{
+			Flush();
+			header->flags &= ~SlotMapFileOpenForWriting;
+			FlushHeader();
+		}
+	}
+
+	template <typename T>
+	void PersistentSlotMap<T>::Create(int capacity)
+	{
+		SlotMapLayout<T> layout;
+		layout.capacity = capacity;
+
+		const SlotMapFileHeader newHeader = MakeSlotMapFileHeader(layout, capacity);
+		if (!file.Resize(static_cast<std::size_t>(newHeader.fileSize)))
+		{
+			throw std::runtime_error("[SlotMap] Could not size persistent slotmap file.");
+		}
+
+		std::memcpy(file.Data(), &newHeader, sizeof(newHeader));
+		Bind();
+
+		header->flags |= SlotMapFileCapacityArrays;
+		header->firstFreeSlot = -1;
+		header->lastFreeSlot = -1;
+
+		for (int i = 0; i < capacity; ++i)
+		{
+			slots[i] = SlotMapKey(0, 0);
+			PushFreeSlot(i);
+		}
+
+		if (!file.Flush(0, file.Size()))
+		{
+			throw std::runtime_error("[SlotMap] Could not write persistent slotmap file.");
+		}
+	}
+
+	template <typename T>
+	void PersistentSlotMap<T>::Open()
+	{
+		SlotMapFileHeader fileHeader;
+		std::memcpy(&fileHeader, file.Data(), file.Size() < sizeof(fileHeader) ? file.Size() : sizeof(fileHeader));
+
+		if (const char* error = ValidateSlotMapFileHeader<T>(fileHeader, file.Size()))
+		{
+			throw std::runtime_error(error);
+		}
+
+		if ((fileHeader.flags & SlotMapFileCapacityArrays) == 0)
+		{
+			throw std::runtime_error("[SlotMap] Slotmap file is a snapshot; load it and save it as a persistent slotmap instead.");
+		}
+
+		Bind();
+
+		recovered = (header->flags & SlotMapFileOpenForWriting) != 0;
+		if (recovered)
+		{
+			Recover();
+		}
+	}
+
+	template <typename T>
+	void PersistentSlotMap<T>::Recover()
+	{
+		// A value is live if it is below the size and its slot points back at it;
+		// Insert and Erase make a value live or not with a single write (see there).
+		// Live values are packed to the front, and the rest is rebuilt around them.
+		const int capacity = header->capacity;
+		const int size = header->size < 0 ? 0 : header->size > capacity ? capacity : header->size;
+
+		int live = 0;
+		for (int valueIndex = 0; valueIndex < size; ++valueIndex)
+		{
+			const unsigned int slotIndex = valueToSlot[valueIndex];
+			if (slotIndex >= static_cast<unsigned int>(capacity) || slots[slotIndex].index != valueIndex)
+			{
+				continue;
+			}
+
+			if (live != valueIndex)
+			{
+				std::memcpy(&values[live], &values[valueIndex], sizeof(T));
+				valueToSlot[live] = slotIndex;
+				slots[slotIndex].index = live;
+			}
+
+			live++;
+		}
+
+		std::vector<bool> taken(capacity, false);
+		for (int valueIndex = 0; valueIndex < live; ++valueIndex)
+		{
+			taken[valueToSlot[valueIndex]] = true;
+		}
+
+		header->size = live;
+		header->reservedCount = 0;
+		header->firstFreeSlot = -1;
+		header->lastFreeSlot = -1;
+
+		// The erase that freed a slot may not have got to bumping its generation;
+		// skipping one more on every free slot makes sure no erased key comes back.
+		for (int i = 0; i < capacity; ++i)
+		{
+			if (!taken[i])
+			{
+				const int generation = slots[i].generation;
+				slots[i].generation = (generation < 0 ? ~generation : generation) + 1;
+				PushFreeSlot(i);
+			}
+		}
+
+		MarkDirty(file.Data(), file.Size());
+		Flush();
+	}
+
+	template <typename T>
+	void PersistentSlotMap<T>::Bind()
+	{
+		unsigned char* data = file.Data();
+
+		header = reinterpret_cast<SlotMapFileHeader*>(data);
+		slots = reinterpret_cast<SlotMapKey*>(data + header->slotsOffset);
+		valueToSlot = reinterpret_cast<unsigned int*>(data + header->valueToSlotOffset);
+		values = reinterpret_cast<T*>(data + header->valuesOffset);
+
+		dirtyPages.assign((file.Size() / pageSize + 64) / 64, 0);
+	}
+
+	template <typename T>
+	const T& PersistentSlotMap<T>::operator[](const SlotMapKey& key) const
+	{
+#ifndef SLOTMAP_RELEASE
+		if (key.index < 0 || key.index >= header->capacity)
+		{
+			throw std::out_of_range("[SlotMap] Key index is out of bounds.");
+		}
+
+		if (slots[key.index].generation != key.generation)
+		{
+			throw std::runtime_error("[SlotMap] Trying to use a key which is no longer valid.");
+		}
+#endif
+
+		return values[slots[key.index].index];
+	}
+
+	template <typename T>
+	bool PersistentSlotMap<T>::TryGet(const SlotMapKey& key, T& value) const
+	{
+		if (Contains(key))
+		{
+			value = values[slots[key.index].index];
+			return true;
+		}
+
+		return false;
+	}
+
+	template <typename T>
+	bool PersistentSlotMap<T>::Contains(const SlotMapKey& key) const
+	{
+		return 0 <= key.index && key.index < header->capacity && slots[key.index].generation == key.generation;
+	}
+
+	template <typename T>
+	SlotMapKey PersistentSlotMap<T>::Insert(const T& value)
+	{
+		if (header->firstFreeSlot == -1)
+		{
+			Grow();
+		}
+
+		const int slotIndex = PopFreeSlot();
+		const int newValueIndex = header->size;
+
+		// The value isn't live until the size takes it in, so that goes last
+		// (see Recover()). The fences only keep the compiler from reordering
+		// the writes; a killed process leaves its stores in program order.
+		std::memcpy(&values[newValueIndex], &value, sizeof(T));
+		valueToSlot[newValueIndex] = slotIndex;
+		slots[slotIndex].index = newValueIndex;
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+		header->size++;
+
+		MarkDirty(&values[newValueIndex], sizeof(T));
+		MarkDirty(&valueToSlot[newValueIndex], sizeof(unsigned int));
+		MarkDirty(&slots[slotIndex], sizeof(SlotMapKey));
+
+		return SlotMapKey(slotIndex, slots[slotIndex].generation);
+	}
+
+	template <typename T>
+	bool PersistentSlotMap<T>::Update(const SlotMapKey& key, const T& value)
+	{
+		if (!Contains(key))
+		{
+			return false;
+		}
+
+		T* target = &values[slots[key.index].index];
+		std::memcpy(target, &value, sizeof(T));
+		MarkDirty(target, sizeof(T));
+
+		return true;
+	}
+
+	template <typename T>
+	bool PersistentSlotMap<T>::Erase(const SlotMapKey& key)
+	{
+		if (!Contains(key))
+		{
+			return false;
+		}
+
+		SlotMapKey& slot = slots[key.index];
+		const int valueIndex = slot.index;
+		const int lastValueIndex = header->size - 1;
+
+		// The slot letting go of its value erases it, as far as Recover() is
+		// concerned; every write after that keeps the other values live.
+		slot.index = -1;
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+
+		// Move the last value into the hole, and point its slot at the new
+		// location only once the value is there.
+		if (valueIndex != lastValueIndex)
+		{
+			std::memcpy(&values[valueIndex], &values[lastValueIndex], sizeof(T));
+			valueToSlot[valueIndex] = valueToSlot[lastValueIndex];
+			std::atomic_signal_fence(std::memory_order_seq_cst);
+			slots[valueToSlot[valueIndex]].index = valueIndex;
+
+			MarkDirty(&values[valueIndex], sizeof(T));
+			MarkDirty(&valueToSlot[valueIndex], sizeof(unsigned int));
+			MarkDirty(&slots[valueToSlot[valueIndex]], sizeof(SlotMapKey));
+		}
+
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+		header->size--;
+
+		slot.generation++;
+		PushFreeSlot(key.index);
+
+		return true;
+	}
+
+	template <typename T>
+	int PersistentSlotMap<T>::PopFreeSlot()
+	{
+		const int slotIndex = header->firstFreeSlot;
+
+		if (slots[slotIndex].index == slotIndex)
+		{
+			header->firstFreeSlot = -1;			// Ran out of free slots!
+			header->lastFreeSlot = -1;
+		}
+		else
+		{
+			header->firstFreeSlot = slots[slotIndex].index;
+		}
+
+		return slotIndex;
+	}
+
+	template <typename T>
+	void PersistentSlotMap<T>::PushFreeSlot(int slotIndex)
+	{
+		if (header->firstFreeSlot == -1)
+		{
+			header->firstFreeSlot = slotIndex;
+		}
+		else
+		{
+			slots[header->lastFreeSlot].index = slotIndex;
+			MarkDirty(&slots[header->lastFreeSlot], sizeof(SlotMapKey));
+		}
+
+		slots[slotIndex].index = slotIndex;
+		header->lastFreeSlot = slotIndex;
+
+		MarkDirty(&slots[slotIndex], sizeof(SlotMapKey));
+	}
+
+	template <typename T>
+	void PersistentSlotMap<T>::MarkDirty(const void* ptr, std::size_t bytes)
+	{
+		const std::size_t offset = static_cast<const unsigned char*>(ptr) - file.Data();
+		const std::size_t lastPage = (offset + bytes - 1) / pageSize;
+
+		for (std::size_t page = offset / pageSize; page <= lastPage; ++page)
+		{
+			dirtyPages[page / 64] |= std::uint64_t(1) << (page % 64);
+		}
+	}
+
+	template <typename T>
+	int PersistentSlotMap<T>::DirtyPageCount() const
+	{
+		int count = 0;
+		for (std::uint64_t word : dirtyPages)
+		{
+			for (; word != 0; word &= word - 1)
+			{
+				++count;
+			}
+		}
+
+		return count;
+	}
+
+	template <typename T>
+	bool PersistentSlotMap<T>::Flush()
+	{
+		// Write back runs of consecutive dirty pages with one call each, and
+		// the header (which isn't tracked, it changes on every operation) last.
+		const std::size_t pageCount = (file.Size() + pageSize - 1) / pageSize;
+		bool ok = true;
+
+		for (std::size_t page = 0; page < pageCount; )
+		{
+			if ((dirtyPages[page / 64] & (std::uint64_t(1) << (page % 64))) == 0)
+			{
+				++page;
+				continue;
+			}
+
+			const std::size_t first = page;
+			while (page < pageCount && (dirtyPages[page / 64] & (std::uint64_t(1) << (page % 64))) != 0)
+			{
+				++page;
+			}
+
+			ok = file.Flush(first * pageSize, (page - first) * pageSize) && ok;
+		}
+
+		dirtyPages.assign(dirtyPages.size(), 0);
+
+		return FlushHeader() && ok;
+	}
+
+	template <typename T>
+	bool PersistentSlotMap<T>::FlushHeader()
+	{
+		return file.Flush(0, sizeof(SlotMapFileHeader));
+	}
+
+	template <typename T>
+	void PersistentSlotMap<T>::Grow()
+	{
+		const int capacity = header->capacity;
+		const int newCapacity = capacity * 2;
+
+		SlotMapLayout<T> layout;
+		layout.size = header->size;
+		layout.capacity = newCapacity;
+
+		SlotMapFileHeader newHeader = MakeSlotMapFileHeader(layout, newCapacity);
+		newHeader.flags = header->flags | SlotMapFileCapacityArrays;
+		newHeader.reservedCount = header->reservedCount;
+		newHeader.regrowGeneration = header->regrowGeneration;
+
+		// Build the grown file completely, on the side.
+		const std::string growPath = path + ".grow";
+		{
+			MappedFile grown;
+			if (!grown.OpenReadWrite(growPath.c_str()) || !grown.Resize(static_cast<std::size_t>(newHeader.fileSize)))
+			{
+				throw std::runtime_error("[SlotMap] Could not create grown persistent slotmap file.");
+			}
+
+			unsigned char* data = grown.Data();
+			std::memcpy(data + newHeader.slotsOffset, slots, capacity * sizeof(SlotMapKey));
+			std::memcpy(data + newHeader.valueToSlotOffset, valueToSlot, header->size * sizeof(unsigned int));
+			std::memcpy(data + newHeader.valuesOffset, values, header->size * sizeof(T));
+
+			// Every slot is taken (that's why we grow), so the new ones form the whole free list.
+			SlotMapKey* newSlots = reinterpret_cast<SlotMapKey*>(data + newHeader.slotsOffset);
+			for (int i = capacity; i < newCapacity; ++i)
+			{
+				newSlots[i] = SlotMapKey(i + 1 < newCapacity ? i + 1 : i, header->regrowGeneration);
+			}
+
+			newHeader.firstFreeSlot = capacity;
+			newHeader.lastFreeSlot = newCapacity - 1;
+			std::memcpy(data, &newHeader, sizeof(newHeader));
+
+			if (!grown.Flush(0, grown.Size()))
+			{
+				throw std::runtime_error("[SlotMap] Could not write grown persistent slotmap file.");
+			}
+		}
+
+		file.Close();
+		header = nullptr;
+
+		if (!MappedFile::ReplaceFile(growPath.c_str(), path.c_str()) || !file.OpenReadWrite(path.c_str()))
+		{
+			throw std::runtime_error("[SlotMap] Could not replace persistent slotmap file with its grown copy.");
+		}
+
+		Bind();
+	}
+} // namespace Unalmas
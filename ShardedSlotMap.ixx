@@ -0,0 +1,271 @@
+export module ShardedSlotMap;
+
+// A SlotMap split into a fixed number of independently locked shards, so that
+// many threads can insert and erase at the same time.
+//
+// Guarantees:
+// the shard id is encoded in the low bits of the key's index, so a lookup goes
+// straight to its shard and never takes a global lock
+// each thread inserts into its "own" shard (assigned round-robin the first time
+// the thread inserts), so writers on different threads rarely contend
+// shards are padded to a cache line each, so their locks don't false-share
+// Insert throws std::overflow_error, in release builds too, once a shard's index
+// no longer fits next to the shard id in a key
+// keys are only valid in the ShardedSlotMap that issued them
+
+import <atomic>;
+import <bit>;
+import <cstddef>;
+import <climits>;
+import <mutex>;
+import <shared_mutex>;
+import <thread>;
+import <utility>;
+import <vector>;
+import <stdexcept>;
+import SlotMap;
+
+export namespace Unalmas
+{
+	template <typename T, int Shards = 16>
+	class ShardedSlotMap
+	{
+		static_assert(Shards > 0 && (Shards & (Shards - 1)) == 0, "The number of shards must be a power of two.");
+
+	private:
+		static constexpr std::size_t CacheLineSize = 64;
+		static constexpr int ShardMask = Shards - 1;
+		static constexpr int ShardBits = std::countr_zero(static_cast<unsigned int>(Shards));
+		static constexpr int MaxLocalIndex = INT_MAX >> ShardBits;
+
+		struct alignas(CacheLineSize) Shard
+		{
+			Shard() = default;
+			explicit Shard(int capacity) : map(capacity) {}
+
+			mutable std::shared_mutex	lock;
+			SlotMap<T>					map;
+		};
+
+		Shard	shards[Shards];
+
+	public:
+		ShardedSlotMap() = default;
+		ShardedSlotMap(int capacityPerShard) : ShardedSlotMap(capacityPerShard, std::make_index_sequence<Shards>())
+		{}
+
+		ShardedSlotMap(const ShardedSlotMap& rhs) = delete;
+		ShardedSlotMap(ShardedSlotMap&& rhs) = delete;
+		ShardedSlotMap& operator=(const ShardedSlotMap& rhs) = delete;
+		ShardedSlotMap& operator=(ShardedSlotMap&& rhs) = delete;
+
+		template <typename U>
+		SlotMapKey				Insert(U&& value);
+
+		bool					Erase(const SlotMapKey& key);
+		bool					TryGet(const SlotMapKey& key, T& value) const;
+
+		// Calls func(T&) on the value while its shard is locked; returns false
+		// if the key is no longer valid.
+		template <typename F>
+		bool					Visit(const SlotMapKey& key, F&& func);
+
+		int						Size() const;
+		void					Clear();
+
+		// The shards' stats added up (maxGeneration is the highest of them). The
+		// shards peak at different times, so peakSize is an upper bound.
+		SlotMapStats			Stats() const;
+
+		// Visits every value, one shard after the other.
+		template <typename F>
+		void					ForEach(F&& func);
+
+		// Visits every value, with each shard on its own thread; func must be safe
+		// to call concurrently for values in different shards. Every call starts
+		// and joins Shards threads, so it is meant for coarse, infrequent passes
+		// over a large map, not for per-frame work.
+		template <typename F>
+		void					ParallelForEach(F&& func);
+
+		static int				ShardOf(const SlotMapKey& key) { return key.index & ShardMask; }
+
+	private:
+		template <std::size_t... Is>
+		ShardedSlotMap(int capacityPerShard, std::index_sequence<Is...>)
+			: shards{ ((void)Is, Shard(capacityPerShard))... }
+		{}
+
+		static int				ThreadShard();
+		static SlotMapKey		ToLocal(const SlotMapKey& key) { return SlotMapKey(key.index >> ShardBits, key.generation); }
+	};
+
+	template <typename T, int Shards>
+	int ShardedSlotMap<T, Shards>::ThreadShard()
+	{
+		static std::atomic<unsigned int> nextShard{ 0 };
+		thread_local const int shard = static_cast<int>(nextShard.fetch_add(1, std::memory_order_relaxed) & ShardMask);
+		return shard;
+	}
+
+	template <typename T, int Shards>
+	template <typename U>
+	SlotMapKey ShardedSlotMap<T, Shards>::Insert(U&& value)
+	{
+		const int shardIndex = ThreadShard();
+		Shard& shard = shards[shardIndex];
+
+		std::unique_lock lock(shard.lock);
+		const SlotMapKey local = shard.map.Insert(std::forward<U>(value));
+
+		// Checked in release builds too: past this, the shifted index would
+		// overflow into the sign bit and the key would alias another slot.
+		if (local.index > MaxLocalIndex)
+		{
+			shard.map.Erase(local);
+			throw std::overflow_error("[ShardedSlotMap] Shard is too large to encode its keys.");
+		}
+
+		return SlotMapKey((local.index << ShardBits) | shardIndex, local.generation);
+	}
+
+	template <typename T, int Shards>
+	bool ShardedSlotMap<T, Shards>::Erase(const SlotMapKey& key)
+	{
+		if (key.index < 0)
+		{
+			return false;
+		}
+
+		Shard& shard = shards[ShardOf(key)];
+		const SlotMapKey local = ToLocal(key);
+
+		std::unique_lock lock(shard.lock);
+		return local.index < shard.map.Capacity() && shard.map.Erase(local);
+	}
+
+	template <typename T, int Shards>
+	bool ShardedSlotMap<T, Shards>::TryGet(const SlotMapKey& key, T& value) const
+	{
+		if (key.index < 0)
+		{
+			return false;
+		}
+
+		const Shard& shard = shards[ShardOf(key)];
+
+		std::shared_lock lock(shard.lock);
+		return shard.map.TryGet(ToLocal(key), value);
+	}
+
+	template <typename T, int Shards>
+	template <typename F>
+	bool ShardedSlotMap<T, Shards>::Visit(const SlotMapKey& key, F&& func)
+	{
+		if (key.index < 0)
+		{
+			return false;
+		}
+
+		Shard& shard = shards[ShardOf(key)];
+		const SlotMapKey local = ToLocal(key);
+
+		std::unique_lock lock(shard.lock);
+		if (!shard.map.Contains(local))
+		{
+			return false;
+		}
+
+		func(shard.map[local]);
+		return true;
+	}
+
+	template <typename T, int Shards>
+	int ShardedSlotMap<T, Shards>::Size() const
+	{
+		int size = 0;
+		for (const Shard& shard : shards)
+		{
+			std::shared_lock lock(shard.lock);
+			size += shard.map.Size();
+		}
+
+		return size;
+	}
+
+	template <typename T, int Shards>
+	SlotMapStats ShardedSlotMap<T, Shards>::Stats() const
+	{
+		SlotMapStats total;
+		for (const Shard& shard : shards)
+		{
+			SlotMapStats stats;
+			{
+				std::shared_lock lock(shard.lock);
+				stats = shard.map.Stats();
+			}
+
+			total.size += stats.size;
+			total.capacity += stats.capacity;
+			total.reservedCount += stats.reservedCount;
+			total.freeSlots += stats.freeSlots;
+			total.peakSize += stats.peakSize;
+			total.maxGeneration = stats.maxGeneration > total.maxGeneration ? stats.maxGeneration : total.maxGeneration;
+			total.growCount += stats.growCount;
+			total.bytesCopied += stats.bytesCopied;
+			total.eraseMoves += stats.eraseMoves;
+			total.staleLookups += stats.staleLookups;
+		}
+
+		return total;
+	}
+
+	template <typename T, int Shards>
+	void ShardedSlotMap<T, Shards>::Clear()
+	{
+		for (Shard& shard : shards)
+		{
+			std::unique_lock lock(shard.lock);
+			shard.map.Clear();
+		}
+	}
+
+	template <typename T, int Shards>
+	template <typename F>
+	void ShardedSlotMap<T, Shards>::ForEach(F&& func)
+	{
+		for (Shard& shard : shards)
+		{
+			std::unique_lock lock(shard.lock);
+			for (auto& value : shard.map)
+			{
+				func(value);
+			}
+		}
+	}
+
+	template <typename T, int Shards>
+	template <typename F>
+	void ShardedSlotMap<T, Shards>::ParallelForEach(F&& func)
+	{
+		std::vector<std::thread> workers;
+		workers.reserve(Shards);
+
+		for (Shard& shard : shards)
+		{
+			workers.emplace_back([&shard, &func]()
+			{
+				std::unique_lock lock(shard.lock);
+				for (auto& value : shard.map)
+				{
+					func(value);
+				}
+			});
+		}
+
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+} // namespace Unalmas
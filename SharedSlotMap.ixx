@@ -0,0 +1,787 @@
+module;
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+export module SharedSlotMap;
+
+#define DEFAULT_CAPACITY 8
+
+// A slotmap in named shared memory: one process writes, any number of processes
+// on the same host read, without each keeping its own copy.
+//
+// Guarantees:
+// all state lives in the shared segments, and refers to other state by index or
+// by offset from the start of its segment, never by pointer, so every process
+// can map the segments at whatever address it likes
+// readers never lock and never block the writer; like ConcurrentSlotMap, each
+// slot carries a sequence counter which is odd while the writer touches it, and
+// readers retry a lookup whose slot changed underneath them
+// growing creates a new, bigger storage segment (named after the map plus a
+// storage generation), and publishes its generation in the control segment;
+// readers switch over on their next lookup, and the old segment is freed by the
+// OS once the last process has unmapped it; a reader that fails to open the new
+// segment keeps reading the old one (as of that grow) and tries again next lookup
+// the writer can hand the pages past the last value back to the OS
+// (ReleaseUnusedPages()); readers never read there, and the pages come back
+// zeroed when the map grows into them again
+//
+// Values are copied byte by byte through relaxed atomics, as in ConcurrentSlotMap,
+// so T must be trivially copyable, and must mean the same in every process (no pointers).
+
+import <atomic>;
+import <cstdint>;
+import <cstddef>;
+import <cstring>;
+import <new>;
+import <string>;
+import <utility>;
+import <stdexcept>;
+import <type_traits>;
+import SlotMap;
+import ConcurrentSlotMap;
+
+export namespace Unalmas
+{
+	// A named shared memory segment, mapped into this process.
+	class SharedMemorySegment
+	{
+	public:
+		SharedMemorySegment() = default;
+		~SharedMemorySegment() { Close(); }
+
+		SharedMemorySegment(const SharedMemorySegment& rhs) = delete;
+		SharedMemorySegment& operator=(const SharedMemorySegment& rhs) = delete;
+
+		void					Swap(SharedMemorySegment& other);
+
+		bool					Create(const std::string& name, std::size_t size);	// Fails if a segment of that name exists
+		bool					OpenReadOnly(const std::string& name);
+		void					Close();
+
+		// Removes the name; processes that have the segment mapped keep it until they unmap it.
+		static void				Unlink(const std::string& name);
+
+		// Frees the whole pages within the given range, for every process that has
+		// the segment mapped; they read as zeros afterwards. Returns the bytes freed.
+		std::size_t				Discard(std::size_t offset, std::size_t length);
+
+		unsigned char* Data() const { return data; }
+		std::size_t				Size() const { return size; }
+
+	private:
+#ifdef _WIN32
+		HANDLE					mapping{ nullptr };
+#endif
+		unsigned char* data{ nullptr };
+		std::size_t				size{ 0 };
+	};
+
+	namespace SharedSlotMapDetail
+	{
+		constexpr std::uint32_t Version = 1;
+
+		struct Slot
+		{
+			std::atomic<unsigned int>	sequence{ 0 };
+			std::atomic<int>			index{ 0 };
+			std::atomic<int>			generation{ 0 };
+		};
+
+		static_assert(std::atomic<unsigned int>::is_always_lock_free && std::atomic<int>::is_always_lock_free,
+			"Shared slotmaps need address-free atomics.");
+
+		// The small, fixed segment both sides find by name.
+		struct Control
+		{
+			char						magic[8]{ 'S', 'H', 'S', 'L', 'O', 'T', 'S', '\0' };
+			std::uint32_t				version{ Version };
+			std::uint32_t				elementSize{ 0 };
+			std::uint32_t				elementAlignment{ 0 };
+			std::atomic<std::uint32_t>	storageGeneration{ 0 };
+			std::atomic<int>			size{ 0 };
+			std::atomic<int>			capacity{ 0 };
+		};
+
+		// At the start of each storage segment; the arrays follow at these offsets.
+		struct StorageHeader
+		{
+			std::int32_t				capacity{ 0 };
+			std::uint32_t				padding{ 0 };
+			std::uint64_t				slotsOffset{ 0 };
+			std::uint64_t				valueToSlotOffset{ 0 };
+			std::uint64_t				valuesOffset{ 0 };
+			std::uint64_t				segmentSize{ 0 };
+		};
+
+		template <typename T>
+		StorageHeader MakeStorageHeader(int capacity)
+		{
+			const auto alignUp = [](std::uint64_t offset) { return (offset + 63) & ~std::uint64_t(63); };
+
+			StorageHeader header;
+			header.capacity = capacity;
+			header.slotsOffset = alignUp(sizeof(StorageHeader));
+			header.valueToSlotOffset = alignUp(header.slotsOffset + static_cast<std::uint64_t>(capacity) * sizeof(Slot));
+			header.valuesOffset = alignUp(header.valueToSlotOffset + static_cast<std::uint64_t>(capacity) * sizeof(unsigned int));
+			header.segmentSize = header.valuesOffset + static_cast<std::uint64_t>(capacity) * sizeof(T);
+			return header;
+		}
+
+		inline std::string StorageName(const std::string& name, std::uint32_t generation)
+		{
+			return name + "." + std::to_string(generation);
+		}
+	}
+
+	// The writing side, which owns the segments; there must only be one per name.
+	template <typename T>
+	class SharedSlotMap
+	{
+		static_assert(std::is_trivially_copyable<T>(), "Shared slotmaps require a trivially copyable element type.");
+
+	private:
+		using Slot = SharedSlotMapDetail::Slot;
+		using Control = SharedSlotMapDetail::Control;
+		using StorageHeader = SharedSlotMapDetail::StorageHeader;
+
+		std::string				name;
+		SharedMemorySegment		controlSegment;
+		SharedMemorySegment		storageSegment;
+		Control* control{ nullptr };
+		Slot* slots{ nullptr };
+		unsigned int* valueToSlot{ nullptr };
+		T* values{ nullptr };
+		int						capacity{ 0 };
+		int						firstFreeSlot{ 0 };
+		int						lastFreeSlot{ 0 };
+
+	public:
+		// Creates the segments; name follows the platform's rules for shared
+		// memory names (e.g. "/handles" for POSIX).
+		explicit SharedSlotMap(const char* name, int capacity = DEFAULT_CAPACITY);
+		~SharedSlotMap();
+
+		SharedSlotMap(const SharedSlotMap& rhs) = delete;
+		SharedSlotMap(SharedSlotMap&& rhs) = delete;
+		SharedSlotMap& operator=(const SharedSlotMap& rhs) = delete;
+		SharedSlotMap& operator=(SharedSlotMap&& rhs) = delete;
+
+		bool					TryGet(const SlotMapKey& key, T& value) const;
+		bool					Contains(const SlotMapKey& key) const;
+		int						Size() const { return control->size.load(std::memory_order_relaxed); }
+		int						Capacity() const { return capacity; }
+
+		SlotMapKey				Insert(const T& value);
+		bool					Update(const SlotMapKey& key, const T& value);
+		bool					Erase(const SlotMapKey& key);
+
+		// Frees the pages of the value arrays past the last value, e.g. after most
+		// of the map was erased; returns the bytes freed. Capacity stays the same.
+		std::size_t				ReleaseUnusedPages();
+
+	private:
+		void					MapStorage(int capacity, std::uint32_t generation, SharedMemorySegment& previous);
+		void					AppendToFreeList(int slotIndex);
+		void					Grow();
+
+		static void				BeginWrite(Slot& slot);
+		static void				EndWrite(Slot& slot);
+	};
+
+	// The reading side, in any process. A reader switches to a new storage
+	// segment when the writer grows, so one reader must not be shared between threads.
+	template <typename T>
+	class SharedSlotMapReader
+	{
+	private:
+		using Slot = SharedSlotMapDetail::Slot;
+		using Control = SharedSlotMapDetail::Control;
+		using StorageHeader = SharedSlotMapDetail::StorageHeader;
+
+		std::string				name;
+		SharedMemorySegment		controlSegment;
+		SharedMemorySegment		storageSegment;
+		const Control* control{ nullptr };
+		const Slot* slots{ nullptr };
+		const T* values{ nullptr };
+		int						capacity{ 0 };
+		std::uint32_t			storageGeneration{ 0 };
+
+	public:
+		explicit SharedSlotMapReader(const char* name);
+
+		SharedSlotMapReader(const SharedSlotMapReader& rhs) = delete;
+		SharedSlotMapReader& operator=(const SharedSlotMapReader& rhs) = delete;
+
+		bool					TryGet(const SlotMapKey& key, T& value);
+		int						Size() const { return control->size.load(std::memory_order_acquire); }
+		int						Capacity() const { return control->capacity.load(std::memory_order_acquire); }
+
+	private:
+		bool					Refresh();
+	};
+
+	void SharedMemorySegment::Swap(SharedMemorySegment& other)
+	{
+#ifdef _WIN32
+		std::swap(mapping, other.mapping);
+#endif
+		std::swap(data, other.data);
+		std::swap(size, other.size);
+	}
+
+#ifdef _WIN32
+	bool SharedMemorySegment::Create(const std::string& name, std::size_t size_)
+	{
+		Close();
+
+		const std::uint64_t size64 = size_;
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64), name.c_str());
+		if (mapping == nullptr)
+		{
+			return false;
+		}
+
+		// CreateFileMappingA hands back an existing mapping of that name, which
+		// someone else owns (and which may be smaller); don't take it over.
+		if (GetLastError() == ERROR_ALREADY_EXISTS)
+		{
+			Close();
+			return false;
+		}
+
+		data = static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size_));
+		if (data == nullptr)
+		{
+			Close();
+			return false;
+		}
+
+		std::memset(data, 0, size_);
+		size = size_;
+		return true;
+	}
+
+	bool SharedMemorySegment::OpenReadOnly(const std::string& name)
+	{
+		Close();
+
+		mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+		if (mapping == nullptr)
+		{
+			return false;
+		}
+
+		data = static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (data == nullptr)
+		{
+			Close();
+			return false;
+		}
+
+		MEMORY_BASIC_INFORMATION info;
+		VirtualQuery(data, &info, sizeof(info));
+		size = info.RegionSize;
+		return true;
+	}
+
+	void SharedMemorySegment::Close()
+	{
+		if (data != nullptr)
+		{
+			UnmapViewOfFile(data);
+		}
+
+		if (mapping != nullptr)
+		{
+			CloseHandle(mapping);
+		}
+
+		mapping = nullptr;
+		data = nullptr;
+		size = 0;
+	}
+
+	void SharedMemorySegment::Unlink(const std::string&)
+	{
+		// Named mappings go away with their last handle; there is no name to remove.
+	}
+
+	std::size_t SharedMemorySegment::Discard(std::size_t, std::size_t)
+	{
+		// The pages of a named mapping stay committed for as long as it is mapped
+		// anywhere; DiscardVirtualMemory only works on private memory.
+		return 0;
+	}
+#else
+	bool SharedMemorySegment::Create(const std::string& name, std::size_t size_)
+	{
+		Close();
+
+		// An existing segment of that name may be mapped by live readers, or be
+		// another writer's; don't truncate it underneath them.
+		const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		void* mapped = MAP_FAILED;
+		if (ftruncate(fd, static_cast<off_t>(size_)) == 0)
+		{
+			mapped = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+
+		close(fd);
+
+		if (mapped == MAP_FAILED)
+		{
+			shm_unlink(name.c_str());
+			return false;
+		}
+
+		data = static_cast<unsigned char*>(mapped);
+		size = size_;
+		return true;
+	}
+
+	bool SharedMemorySegment::OpenReadOnly(const std::string& name)
+	{
+		Close();
+
+		const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		struct stat info;
+		void* mapped = MAP_FAILED;
+		if (fstat(fd, &info) == 0 && info.st_size > 0)
+		{
+			mapped = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+		}
+
+		close(fd);
+
+		if (mapped == MAP_FAILED)
+		{
+			return false;
+		}
+
+		data = static_cast<unsigned char*>(mapped);
+		size = static_cast<std::size_t>(info.st_size);
+		return true;
+	}
+
+	void SharedMemorySegment::Close()
+	{
+		if (data != nullptr)
+		{
+			munmap(data, size);
+		}
+
+		data = nullptr;
+		size = 0;
+	}
+
+	void SharedMemorySegment::Unlink(const std::string& name)
+	{
+		shm_unlink(name.c_str());
+	}
+
+	std::size_t SharedMemorySegment::Discard(std::size_t offset, std::size_t length)
+	{
+		const std::size_t pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+		const std::size_t first = (offset + pageSize - 1) / pageSize * pageSize;
+		const std::size_t last = (offset + length > size ? size : offset + length) / pageSize * pageSize;
+
+		if (data == nullptr || first >= last)
+		{
+			return 0;
+		}
+
+#ifdef MADV_REMOVE
+		// Shared memory is a tmpfs file on Linux: MADV_DONTNEED would only drop
+		// this process's view of the pages, MADV_REMOVE frees them.
+		const int advice = MADV_REMOVE;
+#else
+		const int advice = MADV_DONTNEED;
+#endif
+
+		return madvise(data + first, last - first, advice) == 0 ? last - first : 0;
+	}
+#endif
+
+	template <typename T>
+	SharedSlotMap<T>::SharedSlotMap(const char* name_, int capacity_) : name{ name_ }
+	{
+		if (!controlSegment.Create(name, sizeof(Control)))
+		{
+			throw std::runtime_error("[SlotMap] Could not create shared slotmap segment.");
+		}
+
+		control = new (controlSegment.Data()) Control();
+		control->elementSize = sizeof(T);
+		control->elementAlignment = alignof(T);
+
+		SharedMemorySegment none;
+		MapStorage(capacity_ < 1 ? 1 : capacity_, 0, none);
+
+		firstFreeSlot = -1;
+		for (int i = 0; i < capacity; ++i)
+		{
+			AppendToFreeList(i);
+		}
+
+		control->capacity.store(capacity, std::memory_order_release);
+	}
+
+	template <typename T>
+	SharedSlotMap<T>::~SharedSlotMap()
+	{
+		const std::uint32_t generation = control->storageGeneration.load(std::memory_order_relaxed);
+
+		storageSegment.Close();
+		controlSegment.Close();
+
+		SharedMemorySegment::Unlink(SharedSlotMapDetail::StorageName(name, generation));
+		SharedMemorySegment::Unlink(name);
+	}
+
+	template <typename T>
+	void SharedSlotMap<T>::MapStorage(int newCapacity, std::uint32_t generation, SharedMemorySegment& previous)
+	{
+		// Nothing changes unless the new segment could be created; the current one
+		// is handed back in previous, still mapped.
+		const StorageHeader header = SharedSlotMapDetail::MakeStorageHeader<T>(newCapacity);
+		SharedMemorySegment segment;
+		if (!segment.Create(SharedSlotMapDetail::StorageName(name, generation), static_cast<std::size_t>(header.segmentSize)))
+		{
+			throw std::runtime_error("[SlotMap] Could not create shared slotmap storage segment.");
+		}
+
+		storageSegment.Swap(segment);
+		previous.Swap(segment);
+
+		unsigned char* data = storageSegment.Data();
+		std::memcpy(data, &header, sizeof(header));
+
+		slots = reinterpret_cast<Slot*>(data + header.slotsOffset);
+		valueToSlot = reinterpret_cast<unsigned int*>(data + header.valueToSlotOffset);
+		values = reinterpret_cast<T*>(data + header.valuesOffset);
+		capacity = newCapacity;
+
+		for (int i = 0; i < newCapacity; ++i)
+		{
+			new (&slots[i]) Slot();
+		}
+	}
+
+	template <typename T>
+	void SharedSlotMap<T>::BeginWrite(Slot& slot)
+	{
+		slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	template <typename T>
+	void SharedSlotMap<T>::EndWrite(Slot& slot)
+	{
+		slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	template <typename T>
+	bool SharedSlotMap<T>::Contains(const SlotMapKey& key) const
+	{
+		return 0 <= key.index && key.index < capacity && slots[key.index].generation.load(std::memory_order_relaxed) == key.generation;
+	}
+
+	template <typename T>
+	bool SharedSlotMap<T>::TryGet(const SlotMapKey& key, T& value) const
+	{
+		// Only this process writes, so its own reads need no retries.
+		if (Contains(key))
+		{
+			std::memcpy(&value, &values[slots[key.index].index.load(std::memory_order_relaxed)], sizeof(T));
+			return true;
+		}
+
+		return false;
+	}
+
+	template <typename T>
+	SlotMapKey SharedSlotMap<T>::Insert(const T& value)
+	{
+		if (firstFreeSlot == -1)
+		{
+			Grow();
+		}
+
+		const int newValueIndex = Size();
+		const int slotIndex = firstFreeSlot;
+		Slot& slot = slots[slotIndex];
+
+		BeginWrite(slot);
+
+		ConcurrentSlotMapDetail::StoreValue(values[newValueIndex], value);
+		valueToSlot[newValueIndex] = slotIndex;
+
+		if (slot.index.load(std::memory_order_relaxed) == firstFreeSlot)
+		{
+			firstFreeSlot = -1;				// Ran out of free slots!
+			lastFreeSlot = -1;
+		}
+		else
+		{
+			firstFreeSlot = slot.index.load(std::memory_order_relaxed);
+		}
+
+		slot.index.store(newValueIndex, std::memory_order_relaxed);
+
+		EndWrite(slot);
+
+		control->size.store(newValueIndex + 1, std::memory_order_release);
+
+		return SlotMapKey(slotIndex, slot.generation.load(std::memory_order_relaxed));
+	}
+
+	template <typename T>
+	bool SharedSlotMap<T>::Update(const SlotMapKey& key, const T& value)
+	{
+		if (!Contains(key))
+		{
+			return false;
+		}
+
+		Slot& slot = slots[key.index];
+
+		BeginWrite(slot);
+		ConcurrentSlotMapDetail::StoreValue(values[slot.index.load(std::memory_order_relaxed)], value);
+		EndWrite(slot);
+
+		return true;
+	}
+
+	template <typename T>
+	bool SharedSlotMap<T>::Erase(const SlotMapKey& key)
+	{
+		if (!Contains(key))
+		{
+			return false;
+		}
+
+		Slot& slot = slots[key.index];
+
+		BeginWrite(slot);
+
+		slot.generation.store(key.generation + 1, std::memory_order_relaxed);
+
+		const int valueIndex = slot.index.load(std::memory_order_relaxed);
+		const int lastValueIndex = Size() - 1;
+
+		// Move the last item into the freed position, bumping its slot as well.
+		if (valueIndex != lastValueIndex)
+		{
+			const unsigned int movedSlotIndex = valueToSlot[lastValueIndex];
+			Slot& movedSlot = slots[movedSlotIndex];
+
+			BeginWrite(movedSlot);
+			ConcurrentSlotMapDetail::StoreValue(values[valueIndex], values[lastValueIndex]);
+			valueToSlot[valueIndex] = movedSlotIndex;
+			movedSlot.index.store(valueIndex, std::memory_order_relaxed);
+			EndWrite(movedSlot);
+		}
+
+		AppendToFreeList(key.index);
+
+		EndWrite(slot);
+
+		control->size.store(lastValueIndex, std::memory_order_release);
+
+		return true;
+	}
+
+	template <typename T>
+	std::size_t SharedSlotMap<T>::ReleaseUnusedPages()
+	{
+		const StorageHeader header = SharedSlotMapDetail::MakeStorageHeader<T>(capacity);
+		const std::size_t count = static_cast<std::size_t>(Size());
+		const std::size_t unused = static_cast<std::size_t>(capacity) - count;
+
+		return storageSegment.Discard(static_cast<std::size_t>(header.valueToSlotOffset) + count * sizeof(unsigned int), unused * sizeof(unsigned int))
+			+ storageSegment.Discard(static_cast<std::size_t>(header.valuesOffset) + count * sizeof(T), unused * sizeof(T));
+	}
+
+	template <typename T>
+	void SharedSlotMap<T>::AppendToFreeList(int slotIndex)
+	{
+		if (firstFreeSlot == -1)
+		{
+			firstFreeSlot = slotIndex;
+		}
+		else
+		{
+			slots[lastFreeSlot].index.store(slotIndex, std::memory_order_relaxed);
+		}
+
+		slots[slotIndex].index.store(slotIndex, std::memory_order_relaxed);
+		lastFreeSlot = slotIndex;
+	}
+
+	template <typename T>
+	void SharedSlotMap<T>::Grow()
+	{
+		const std::uint32_t oldGeneration = control->storageGeneration.load(std::memory_order_relaxed);
+		const int oldCapacity = capacity;
+		const int count = Size();
+
+		// Keep the old storage mapped while copying out of it. If the new one
+		// can't be created, MapStorage throws before touching anything.
+		SharedMemorySegment oldSegment;
+		const Slot* oldSlots = slots;
+		const unsigned int* oldValueToSlot = valueToSlot;
+		const T* oldValues = values;
+
+		MapStorage(oldCapacity * 2, oldGeneration + 1, oldSegment);
+
+		for (int i = 0; i < oldCapacity; ++i)
+		{
+			slots[i].index.store(oldSlots[i].index.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			slots[i].generation.store(oldSlots[i].generation.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+
+		std::memcpy(valueToSlot, oldValueToSlot, count * sizeof(unsigned int));
+		std::memcpy(values, oldValues, count * sizeof(T));
+
+		for (int i = oldCapacity; i < capacity; ++i)
+		{
+			AppendToFreeList(i);
+		}
+
+		// Readers still in the old segment see a consistent state; it is never written again.
+		control->storageGeneration.store(oldGeneration + 1, std::memory_order_release);
+		control->capacity.store(capacity, std::memory_order_release);
+
+		SharedMemorySegment::Unlink(SharedSlotMapDetail::StorageName(name, oldGeneration));
+	}
+
+	template <typename T>
+	SharedSlotMapReader<T>::SharedSlotMapReader(const char* name_) : name{ name_ }
+	{
+		if (!controlSegment.OpenReadOnly(name) || controlSegment.Size() < sizeof(Control))
+		{
+			throw std::runtime_error("[SlotMap] Could not open shared slotmap segment.");
+		}
+
+		control = reinterpret_cast<const Control*>(controlSegment.Data());
+
+		if (std::memcmp(control->magic, Control().magic, sizeof(control->magic)) != 0 ||
+			control->version != SharedSlotMapDetail::Version)
+		{
+			throw std::runtime_error("[SlotMap] Not a shared slotmap segment, or a different version.");
+		}
+
+		if (control->elementSize != sizeof(T) || control->elementAlignment != alignof(T))
+		{
+			throw std::runtime_error("[SlotMap] Shared slotmap holds a different element type.");
+		}
+
+		storageGeneration = control->storageGeneration.load(std::memory_order_acquire) + 1;
+		if (!Refresh())
+		{
+			throw std::runtime_error("[SlotMap] Could not open shared slotmap storage segment.");
+		}
+	}
+
+	template <typename T>
+	bool SharedSlotMapReader<T>::Refresh()
+	{
+		while (true)
+		{
+			const std::uint32_t generation = control->storageGeneration.load(std::memory_order_acquire);
+			if (generation == storageGeneration)
+			{
+				return true;
+			}
+
+			// The writer may grow again (and remove this generation's name) before we get to open it.
+			// Until the new segment is open, lookups keep going to the current one.
+			SharedMemorySegment segment;
+			if (segment.OpenReadOnly(SharedSlotMapDetail::StorageName(name, generation)))
+			{
+				const unsigned char* data = segment.Data();
+				StorageHeader header;
+				std::memcpy(&header, data, sizeof(header));
+
+				if (segment.Size() < header.segmentSize)
+				{
+					return false;
+				}
+
+				storageSegment.Swap(segment);
+
+				slots = reinterpret_cast<const Slot*>(data + header.slotsOffset);
+				values = reinterpret_cast<const T*>(data + header.valuesOffset);
+				capacity = header.capacity;
+				storageGeneration = generation;
+				return true;
+			}
+
+			if (control->storageGeneration.load(std::memory_order_acquire) == generation)
+			{
+				return false;
+			}
+		}
+	}
+
+	template <typename T>
+	bool SharedSlotMapReader<T>::TryGet(const SlotMapKey& key, T& value)
+	{
+		// If the new storage segment can't be opened yet, the one already open
+		// still answers for every key the writer had when it last grew.
+		Refresh();
+
+		if (key.index < 0 || key.index >= capacity)
+		{
+			return false;
+		}
+
+		const Slot& slot = slots[key.index];
+		alignas(T) unsigned char copy[sizeof(T)];
+
+		while (true)
+		{
+			const unsigned int before = slot.sequence.load(std::memory_order_acquire);
+			if ((before & 1) != 0)
+			{
+				continue;					// Writer is in the middle of touching this slot
+			}
+
+			if (slot.generation.load(std::memory_order_relaxed) != key.generation)
+			{
+				return false;
+			}
+
+			const int valueIndex = slot.index.load(std::memory_order_relaxed);
+			ConcurrentSlotMapDetail::LoadValue(copy, values[valueIndex]);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.sequence.load(std::memory_order_relaxed) == before)
+			{
+				std::memcpy(&value, copy, sizeof(T));
+				return true;
+			}
+		}
+	}
+} // namespace Unalmas
@@ -1,4 +1,5 @@
 //#define SLOTMAP_RELEASE
+//#define SLOTMAP_STATS
 export module SlotMap;
 
 #define DEFAULT_CAPACITY 8
@@ -9,15 +10,26 @@ export module SlotMap;
 // stable keys, even if elements are moved around due to removal
 // insert calls return a unique key
 // keys to erased values won't work (until an overflow occurs)
+// keys with a negative generation never match a slot, reserved ones included
+// capacity only goes down when asked to: ShrinkToFit() trims the value arrays
+// down to the values, CompactSlots() drops the free slots at the end of the slot
+// array; keys that are valid stay valid, and stale ones stay stale
+// free slots are reused oldest first by default; see SlotMapReuse for the others
+// with SLOTMAP_STATS defined, Stats() also reports what the map has been doing
+// (grows, erase moves, stale lookups...); without it, none of that is counted
 
 // YouTube link: https://youtu.be/-8UZhDjgeZU?si=mZStcyE8M_fa-CkS
 
+import <atomic>;
+import <bit>;
 import <cassert>;
+import <cstdint>;
 import <cstring>;
 import <cstdlib>;
 import <utility>;
 import <type_traits>;
 import <stdexcept>;
+import <vector>;
 
 export namespace Unalmas
 {
@@ -33,6 +45,89 @@ export namespace Unalmas
 		}
 	};
 
+	// Whether the counters in SlotMapStats are kept (see SLOTMAP_STATS).
+#ifdef SLOTMAP_STATS
+	constexpr bool SlotMapStatsEnabled = true;
+#else
+	constexpr bool SlotMapStatsEnabled = false;
+#endif
+
+	// What a map looks like, and has been doing; cheap enough to take often.
+	// The counters below freeSlots stay 0 unless SlotMapStatsEnabled.
+	struct SlotMapStats
+	{
+		int				size{ 0 };
+		int				capacity{ 0 };
+		int				reservedCount{ 0 };
+		int				freeSlots{ 0 };			// Length of the free list
+
+		int				peakSize{ 0 };
+		int				maxGeneration{ 0 };		// Highest generation any slot got to
+		std::uint64_t	growCount{ 0 };			// Of the slots, or of the value arrays alone
+		std::uint64_t	bytesCopied{ 0 };		// By all the grows
+		std::uint64_t	eraseMoves{ 0 };		// Values moved into the gap an erase left
+		std::uint64_t	staleLookups{ 0 };		// Lookups with a key of an older generation
+	};
+
+	// Bytes of one of a map's arrays, by what its entries hold.
+	struct SlotMapArrayUsage
+	{
+		std::size_t		live{ 0 };		// Entries belonging to live values or reserved keys, even if they hold nothing for them
+		std::size_t		free{ 0 };		// Slots on the free list, waiting to be reused
+		std::size_t		slack{ 0 };		// Entries past the live values, that hold nothing (see ShrinkToFit())
+
+		std::size_t		Total() const { return live + free + slack; }
+	};
+
+	// Where a map's memory goes; see SlotMap::MemoryUsage().
+	struct SlotMapMemoryUsage
+	{
+		SlotMapArrayUsage	slots;
+		SlotMapArrayUsage	values;
+		SlotMapArrayUsage	valueToSlot;
+		SlotMapArrayUsage	freeListLinks;		// Back links of the free list, one per slot
+		SlotMapArrayUsage	freeSlotBits;		// Only with SlotMapReuse::LowestIndex
+		double				occupancy{ 0.0 };	// Fraction of value storage holding live values
+
+		std::size_t		Total() const { return slots.Total() + values.Total() + valueToSlot.Total() + freeListLinks.Total() + freeSlotBits.Total(); }
+		std::size_t		Live() const { return slots.live + values.live + valueToSlot.live + freeListLinks.live; }
+	};
+
+	// Which free slot an insert takes.
+	enum class SlotMapReuse
+	{
+		Fifo,			// The one freed longest ago; spreads generations out the most
+		Lifo,			// The one freed last, which is likely still in cache
+		LowestIndex,	// Keeps the slots in use packed at the start of the slot array
+	};
+
+	// A set of indices, as a bitmap with summary levels on top (one bit per
+	// non-empty word of the level below), so that finding the lowest index in it
+	// reads one word per level.
+	class SlotMapBitset
+	{
+	public:
+		// Indices from count on are dropped; new ones start out unset.
+		void					Resize(int count);
+		void					SetAll();
+		void					ResetAll();
+
+		void					Set(int index);
+		void					Reset(int index);
+		bool					Test(int index) const { return (levels[0][index >> 6] >> (index & 63)) & 1; }
+
+		// -1 if no index is set.
+		int						FindFirst() const;
+
+		std::size_t				MemoryBytes() const;
+
+	private:
+		void					RebuildSummaries();
+
+		int						count{ 0 };
+		std::vector<std::vector<std::uint64_t>>	levels;		// levels[0] has a bit per index
+	};
+
 	template <typename T>
 	struct SlotMapConstIterator
 	{
@@ -86,6 +181,41 @@ export namespace Unalmas
 		}
 	};
 
+	// The internal arrays of a SlotMap, as they are. Meant for code that persists
+	// or mirrors a map verbatim (see SlotMapFile); a map rebuilt from a layout
+	// accepts every key the original did.
+	template <typename T>
+	struct SlotMapLayout
+	{
+		const SlotMapKey* slots{ nullptr };			// capacity entries
+		const T* values{ nullptr };					// size entries
+		const unsigned int* valueToSlot{ nullptr };	// size entries
+		int						firstFreeSlot{ -1 };
+		int						lastFreeSlot{ -1 };
+		int						size{ 0 };
+		int						capacity{ 0 };
+		int						reservedCount{ 0 };
+		int						regrowGeneration{ 0 };		// See SlotMap::CompactSlots()
+	};
+
+	// Arrays for a SlotMap to take over, e.g. from a loader that filled them in
+	// place. They must be allocated the way SlotMap allocates them: slots and
+	// valueToSlot with new[] and values with std::malloc, capacity entries each,
+	// of which the first size values are constructed.
+	template <typename T>
+	struct SlotMapStorage
+	{
+		SlotMapKey* slots{ nullptr };
+		T* values{ nullptr };
+		unsigned int* valueToSlot{ nullptr };
+		int						firstFreeSlot{ -1 };
+		int						lastFreeSlot{ -1 };
+		int						size{ 0 };
+		int						capacity{ 0 };
+		int						reservedCount{ 0 };
+		int						regrowGeneration{ 0 };
+	};
+
 	template <typename T>
 	class SlotMap
 	{
@@ -93,17 +223,36 @@ export namespace Unalmas
 		SlotMapKey* slots{ nullptr };
 		T* values{ nullptr };
 		unsigned int* valueToSlot{ nullptr };
+		int* previousFreeSlot{ nullptr };	// Back links of the free list, so InsertAt can unlink from its middle
 		int						firstFreeSlot{ 0 };
 		int						lastFreeSlot{ 0 };
 		int						size{ 0 };
 		int						capacity{ 0 };
+		int						valueCapacity{ 0 };		// Of values and valueToSlot; size + reservedCount <= valueCapacity <= capacity
+		int						reservedCount{ 0 };
+		int						regrowGeneration{ 0 };	// Slots added by Grow() start here, see CompactSlots()
+		SlotMapReuse			reuse{ SlotMapReuse::Fifo };
+		SlotMapBitset			freeSlotBits;			// Only kept for SlotMapReuse::LowestIndex
+
+#ifdef SLOTMAP_STATS
+		// Lookups are const, and may run on several threads at once (under a
+		// shared lock, see ShardedSlotMap), so the one counter they touch is atomic.
+		mutable std::atomic<std::uint64_t>	staleLookups{ 0 };
+		std::uint64_t			growCount{ 0 };
+		std::uint64_t			bytesCopied{ 0 };
+		std::uint64_t			eraseMoves{ 0 };
+		int						peakSize{ 0 };
+		int						maxGeneration{ 0 };
+#endif
 
 	public:
 		SlotMap();
-		SlotMap(int capacity);
+		SlotMap(int capacity, SlotMapReuse reuse = SlotMapReuse::Fifo);
 
 		SlotMap(const SlotMap& rhs);	// Only supported for trivially copyable T types
 		SlotMap(SlotMap&& rhs);
+		SlotMap(const SlotMapLayout<T>& layout, SlotMapReuse reuse = SlotMapReuse::Fifo);	// Only supported for trivially copyable T types
+		SlotMap(SlotMapStorage<T>&& storage, SlotMapReuse reuse = SlotMapReuse::Fifo);		// Takes ownership of the arrays
 		~SlotMap();
 
 		SlotMap& operator=(const SlotMap& rhs) = delete;	// Copy and move assignment ops are deleted,
@@ -119,10 +268,14 @@ export namespace Unalmas
 		T& operator[](const SlotMapKey& key) const;
 		T& operator[](int index) const;
 		bool					TryGet(const SlotMapKey& key, T& value) const;
+		bool					Contains(const SlotMapKey& key) const;
 		Unalmas::SlotMapKey		GetKeyForIndex(int index) const;
 
 		int						Size() const { return size; }
 		int						Capacity() const { return capacity; }
+		int						ValueCapacity() const { return valueCapacity; }
+		SlotMapStats			Stats() const;
+		SlotMapMemoryUsage		MemoryUsage() const;
 
 		template <typename U>
 		SlotMapKey   			Insert(U&& value);
@@ -130,16 +283,182 @@ export namespace Unalmas
 		bool					Erase(const SlotMapKey& key);
 		void					Clear();
 
+		// Gives back the value storage past the live (and reserved) values; it
+		// grows again on demand, independently of the slots.
+		void					ShrinkToFit();
+
+		// Drops the free slots at the end of the slot array (keeping at least the
+		// default capacity), and returns how many went. Slots in use or reserved
+		// are never moved, so no key changes; slots added back later start at a
+		// generation past every key that was issued for the dropped ones. Layouts
+		// (and so slotmap files) carry that generation along.
+		int						CompactSlots();
+
+		// Only changes which free slots are taken from now on.
+		void					SetReuse(SlotMapReuse reuse);
+		SlotMapReuse			Reuse() const { return reuse; }
+
+		// Inserts under a given key, e.g. one issued by another slotmap that this
+		// one replicates. The key's slot must be free (neither taken nor reserved),
+		// and its generation can't go backwards, so older keys stay invalid;
+		// returns false otherwise. Grows if the index is beyond the capacity.
+		template <typename... Args>
+		bool					InsertAt(const SlotMapKey& key, Args&&... args);
+
+		// Makes sure the key's slot never hands out that key or an older one: the
+		// next key it issues has a later generation. The slot must be free, like
+		// for InsertAt; returns false otherwise. Grows if the index is beyond the
+		// capacity.
+		bool					RetireKey(const SlotMapKey& key);
+
+		// Two-phase insertion: reserving takes a slot off the free list and returns
+		// its key right away, but lookups with that key fail until a value is
+		// committed to it. The reserved slot's generation is stored inverted
+		// (so negative) in the meantime, which keeps lookups free of extra checks.
+		SlotMapKey				ReserveKey();
+		std::vector<SlotMapKey>	ReserveKeys(int count);		// Returns no keys for count <= 0
+		template <typename... Args>
+		void					Commit(const SlotMapKey& key, Args&&... args);
+		bool					CancelReservation(const SlotMapKey& key);
+		int						ReservedCount() const { return reservedCount; }
+
+		SlotMapLayout<T>		GetLayout() const;
+
 		SlotMapConstIterator<T>	begin() const;
 		SlotMapConstIterator<T>	end() const;
 
 		SlotMapIterator<T>		begin();
 
 	private:
-		void					Grow();
+		void					Grow(int minCapacity = 0);
+		void					GrowValues(int minValueCapacity);
+		void					ResizeValues(int newValueCapacity);
 		void					DestructExistingItems();
+
+		int						PopFreeSlot();
+		void					PushFreeSlot(int slotIndex);
+		void					AppendFreeSlot(int slotIndex);
+		void					UnlinkFreeSlot(int slotIndex);
+		void					RebuildFreeSlotLinks();
+		void					ResetStats();
+		void					CountGeneration(int generation);
+		void					CountStaleLookup(const SlotMapKey& slot, const SlotMapKey& key) const;
 	};
 
+	void SlotMapBitset::Resize(int count_)
+	{
+		count = count_;
+
+		if (levels.empty())
+		{
+			levels.emplace_back();
+		}
+
+		levels[0].resize((count + 63) / 64, 0);
+		if (count % 64 != 0)
+		{
+			levels[0].back() &= (std::uint64_t(1) << (count % 64)) - 1;
+		}
+
+		RebuildSummaries();
+	}
+
+	void SlotMapBitset::SetAll()
+	{
+		levels[0].assign(levels[0].size(), ~std::uint64_t(0));
+		Resize(count);
+	}
+
+	void SlotMapBitset::ResetAll()
+	{
+		levels[0].assign(levels[0].size(), 0);
+		RebuildSummaries();
+	}
+
+	void SlotMapBitset::RebuildSummaries()
+	{
+		levels.resize(1);
+
+		// Down to a single word, so that FindFirst() always starts from one.
+		while (levels.back().size() > 1)
+		{
+			const std::vector<std::uint64_t>& below = levels.back();
+			std::vector<std::uint64_t> summary((below.size() + 63) / 64, 0);
+
+			for (std::size_t i = 0; i < below.size(); ++i)
+			{
+				summary[i >> 6] |= std::uint64_t(below[i] != 0) << (i & 63);
+			}
+
+			levels.push_back(std::move(summary));
+		}
+
+		if (levels.back().empty())
+		{
+			levels.back().push_back(0);
+		}
+	}
+
+	void SlotMapBitset::Set(int index)
+	{
+		for (std::vector<std::uint64_t>& level : levels)
+		{
+			std::uint64_t& word = level[index >> 6];
+			const bool wasEmpty = word == 0;
+
+			word |= std::uint64_t(1) << (index & 63);
+			if (!wasEmpty)
+			{
+				break;		// The levels above already know about this word
+			}
+
+			index >>= 6;
+		}
+	}
+
+	void SlotMapBitset::Reset(int index)
+	{
+		for (std::vector<std::uint64_t>& level : levels)
+		{
+			std::uint64_t& word = level[index >> 6];
+
+			word &= ~(std::uint64_t(1) << (index & 63));
+			if (word != 0)
+			{
+				break;
+			}
+
+			index >>= 6;
+		}
+	}
+
+	int SlotMapBitset::FindFirst() const
+	{
+		if (levels.empty() || levels.back()[0] == 0)
+		{
+			return -1;
+		}
+
+		int index = 0;
+		for (auto level = levels.rbegin(); level != levels.rend(); ++level)
+		{
+			index = (index << 6) + std::countr_zero((*level)[index]);
+		}
+
+		return index;
+	}
+
+	std::size_t SlotMapBitset::MemoryBytes() const
+	{
+		std::size_t bytes = 0;
+		for (const std::vector<std::uint64_t>& level : levels)
+		{
+			bytes += level.capacity() * sizeof(std::uint64_t);
+		}
+
+		return bytes;
+	}
+
 	template <typename T>
 	Unalmas::SlotMapKey SlotMap<T>::GetKeyForIndex(int index) const
 	{
@@ -182,9 +501,12 @@ export namespace Unalmas
 #endif
 
 		const SlotMapKey& slot = slots[key.index];
+		CountStaleLookup(slot, key);
 
 #ifndef SLOTMAP_RELEASE
-		if (slot.generation != key.generation)
+		// Reserved slots store their generation inverted, so a negative one
+		// would match them.
+		if (slot.generation != key.generation || key.generation < 0)
 		{
 			throw std::runtime_error("[SlotMap] Trying to use a key which is no longer valid.");
 		}
@@ -212,38 +534,147 @@ export namespace Unalmas
 		if (0 <= key.index && key.index < capacity)
 		{
 			const SlotMapKey& slot = slots[key.index];
-			if (slot.generation == key.generation)
+			if (slot.generation == key.generation && key.generation >= 0)
 			{
 				value = values[slot.index];
 				return true;
 			}
+
+			CountStaleLookup(slot, key);
 		}
 
 		return false;
 	}
 
+	template <typename T>
+	bool SlotMap<T>::Contains(const SlotMapKey& key) const
+	{
+		if (0 <= key.index && key.index < capacity)
+		{
+			CountStaleLookup(slots[key.index], key);
+			return slots[key.index].generation == key.generation && key.generation >= 0;
+		}
+
+		return false;
+	}
+
+	template <typename T>
+	SlotMapStats SlotMap<T>::Stats() const
+	{
+		SlotMapStats stats;
+		stats.size = size;
+		stats.capacity = capacity;
+		stats.reservedCount = reservedCount;
+		stats.freeSlots = capacity - size - reservedCount;
+
+#ifdef SLOTMAP_STATS
+		stats.peakSize = peakSize;
+		stats.maxGeneration = maxGeneration;
+		stats.growCount = growCount;
+		stats.bytesCopied = bytesCopied;
+		stats.eraseMoves = eraseMoves;
+		stats.staleLookups = staleLookups.load(std::memory_order_relaxed);
+#endif
+
+		return stats;
+	}
+
+	template <typename T>
+	SlotMapMemoryUsage SlotMap<T>::MemoryUsage() const
+	{
+		// Slots (and their back links) are either in use or on the free list; the
+		// dense arrays have valueCapacity entries, and only use their first size.
+		const std::size_t used = static_cast<std::size_t>(size);
+		const std::size_t reserved = static_cast<std::size_t>(reservedCount);
+		const std::size_t unused = static_cast<std::size_t>(capacity) - used;
+		const std::size_t unusedValues = static_cast<std::size_t>(valueCapacity) - used;
+
+		SlotMapMemoryUsage usage;
+		usage.slots.live = (used + reserved) * sizeof(SlotMapKey);
+		usage.slots.free = (unused - reserved) * sizeof(SlotMapKey);
+		usage.values.live = used * sizeof(T);
+		usage.values.slack = unusedValues * sizeof(T);
+		usage.valueToSlot.live = used * sizeof(unsigned int);
+		usage.valueToSlot.slack = unusedValues * sizeof(unsigned int);
+		usage.freeListLinks.free = (unused - reserved) * sizeof(int);
+		usage.freeListLinks.live = (used + reserved) * sizeof(int);
+		usage.freeSlotBits.free = freeSlotBits.MemoryBytes();
+		usage.occupancy = valueCapacity > 0 ? static_cast<double>(size) / valueCapacity : 0.0;
+
+		return usage;
+	}
+
+	template <typename T>
+	void SlotMap<T>::ResetStats()
+	{
+#ifdef SLOTMAP_STATS
+		// Maps made from another map's arrays start counting from here, but
+		// their generations go back further.
+		staleLookups.store(0, std::memory_order_relaxed);
+		growCount = 0;
+		bytesCopied = 0;
+		eraseMoves = 0;
+		peakSize = size;
+		maxGeneration = 0;
+
+		for (int i = 0; i < capacity; ++i)
+		{
+			const int generation = slots[i].generation;
+			CountGeneration(generation < 0 ? ~generation : generation);
+		}
+#endif
+	}
+
+	template <typename T>
+	void SlotMap<T>::CountGeneration([[maybe_unused]] int generation)
+	{
+#ifdef SLOTMAP_STATS
+		maxGeneration = generation > maxGeneration ? generation : maxGeneration;
+#endif
+	}
+
+	template <typename T>
+	void SlotMap<T>::CountStaleLookup([[maybe_unused]] const SlotMapKey& slot, [[maybe_unused]] const SlotMapKey& key) const
+	{
+#ifdef SLOTMAP_STATS
+		if (slot.generation != key.generation)
+		{
+			staleLookups.fetch_add(1, std::memory_order_relaxed);
+		}
+#endif
+	}
+
 	template <typename T>
 	SlotMap<T>::SlotMap() : SlotMap<T>(DEFAULT_CAPACITY)
 	{
 	}
 
 	template <typename T>
-	SlotMap<T>::SlotMap(int capacity_)
-		: size{ 0 }, capacity{ capacity_ }, firstFreeSlot{ 0 }
+	SlotMap<T>::SlotMap(int capacity_, SlotMapReuse reuse_)
+		: size{ 0 }, capacity{ capacity_ }, valueCapacity{ capacity_ }, firstFreeSlot{ 0 }, reuse{ reuse_ }
 	{
 		slots = new SlotMapKey[capacity];
 		values = static_cast<T*>(std::malloc(capacity * sizeof(T)));
 		valueToSlot = new unsigned int[capacity];
+		previousFreeSlot = new int[capacity];
 
 		for (int i = 0; i < capacity - 1; ++i)
 		{
 			slots[i] = SlotMapKey(i + 1, 0);
+			previousFreeSlot[i] = i - 1;
 		}
 
 		// The last slot's index (showing the _next_ free slot)
 		// should point to itself at start.
 		slots[capacity - 1] = SlotMapKey(capacity - 1, 0);
+		previousFreeSlot[capacity - 1] = capacity - 2;
 		lastFreeSlot = capacity - 1;
+
+		if (reuse == SlotMapReuse::LowestIndex)
+		{
+			freeSlotBits.Resize(capacity);
+			freeSlotBits.SetAll();
+		}
 	}
 
 	template <typename T>
@@ -253,35 +684,133 @@ export namespace Unalmas
 
 		size = rhs.size;
 		capacity = rhs.capacity;
+		valueCapacity = rhs.valueCapacity;
 		firstFreeSlot = rhs.firstFreeSlot;
 		lastFreeSlot = rhs.lastFreeSlot;
+		reservedCount = rhs.reservedCount;
+		regrowGeneration = rhs.regrowGeneration;
+		reuse = rhs.reuse;
+		freeSlotBits = rhs.freeSlotBits;
+
+		slots = new SlotMapKey[capacity];
+		values = static_cast<T*>(std::malloc(valueCapacity * sizeof(T)));
+		valueToSlot = new unsigned int[valueCapacity];
+
+		std::memcpy(slots, rhs.slots, capacity * sizeof(SlotMapKey));
+		std::memcpy(valueToSlot, rhs.valueToSlot, size * sizeof(unsigned int));
+		std::memcpy(values, rhs.values, size * sizeof(T));
+
+		previousFreeSlot = new int[capacity];
+		std::memcpy(previousFreeSlot, rhs.previousFreeSlot, capacity * sizeof(int));
+
+		ResetStats();
+	}
+
+
+	template <typename T>
+	SlotMap<T>::SlotMap(const SlotMapLayout<T>& layout, SlotMapReuse reuse_) : reuse{ reuse_ }
+	{
+		static_assert(std::is_trivially_copyable<T>(), "You can only restore slotmaps with a trivially copyable element type.");
+
+		size = layout.size;
+		capacity = layout.capacity;
+		valueCapacity = layout.capacity;
+		firstFreeSlot = layout.firstFreeSlot;
+		lastFreeSlot = layout.lastFreeSlot;
+		reservedCount = layout.reservedCount;
+		regrowGeneration = layout.regrowGeneration;
 
 		slots = new SlotMapKey[capacity];
 		values = static_cast<T*>(std::malloc(capacity * sizeof(T)));
 		valueToSlot = new unsigned int[capacity];
 
-		std::memcpy(slots, rhs.slots, capacity * sizeof(SlotMapKey));
-		std::memcpy(valueToSlot, rhs.valueToSlot, capacity * sizeof(unsigned int));
-		std::memcpy(values, rhs.values, capacity * sizeof(T));
+		std::memcpy(slots, layout.slots, capacity * sizeof(SlotMapKey));
+		std::memcpy(valueToSlot, layout.valueToSlot, size * sizeof(unsigned int));
+		std::memcpy(values, layout.values, size * sizeof(T));
+
+		// Layouts don't carry the free list's back links; they follow from its forward links.
+		previousFreeSlot = new int[capacity];
+		RebuildFreeSlotLinks();
+
+		ResetStats();
+	}
+
+	template <typename T>
+	SlotMap<T>::SlotMap(SlotMapStorage<T>&& storage, SlotMapReuse reuse_) : reuse{ reuse_ }
+	{
+		size = storage.size;
+		capacity = storage.capacity;
+		valueCapacity = storage.capacity;
+		firstFreeSlot = storage.firstFreeSlot;
+		lastFreeSlot = storage.lastFreeSlot;
+		reservedCount = storage.reservedCount;
+		regrowGeneration = storage.regrowGeneration;
+
+		slots = storage.slots;
+		values = storage.values;
+		valueToSlot = storage.valueToSlot;
+
+		storage.slots = nullptr;
+		storage.values = nullptr;
+		storage.valueToSlot = nullptr;
+
+		previousFreeSlot = new int[capacity];
+		RebuildFreeSlotLinks();
+
+		ResetStats();
 	}
 
+	template <typename T>
+	SlotMapLayout<T> SlotMap<T>::GetLayout() const
+	{
+		SlotMapLayout<T> layout;
+		layout.slots = slots;
+		layout.values = values;
+		layout.valueToSlot = valueToSlot;
+		layout.firstFreeSlot = firstFreeSlot;
+		layout.lastFreeSlot = lastFreeSlot;
+		layout.size = size;
+		layout.capacity = capacity;
+		layout.reservedCount = reservedCount;
+		layout.regrowGeneration = regrowGeneration;
+		return layout;
+	}
 
 	template <typename T>
 	SlotMap<T>::SlotMap(SlotMap<T>&& rhs)
 	{
 		size = rhs.size;
 		capacity = rhs.capacity;
+		valueCapacity = rhs.valueCapacity;
 		firstFreeSlot = rhs.firstFreeSlot;
+		lastFreeSlot = rhs.lastFreeSlot;
+		reservedCount = rhs.reservedCount;
+		regrowGeneration = rhs.regrowGeneration;
+		reuse = rhs.reuse;
+		freeSlotBits = std::move(rhs.freeSlotBits);
 
 		slots = rhs.slots;
 		values = rhs.values;
 		valueToSlot = rhs.valueToSlot;
+		previousFreeSlot = rhs.previousFreeSlot;
 
 		rhs.slots = nullptr;
 		rhs.values = nullptr;
 		rhs.valueToSlot = nullptr;
+		rhs.previousFreeSlot = nullptr;
 		rhs.capacity = 0;
+		rhs.valueCapacity = 0;
 		rhs.size = 0;
+		rhs.reservedCount = 0;
+
+#ifdef SLOTMAP_STATS
+		staleLookups.store(rhs.staleLookups.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		growCount = rhs.growCount;
+		bytesCopied = rhs.bytesCopied;
+		eraseMoves = rhs.eraseMoves;
+		peakSize = rhs.peakSize;
+		maxGeneration = rhs.maxGeneration;
+#endif
 	}
 
 	template <typename T>
@@ -293,6 +822,7 @@ export namespace Unalmas
 		std::free(values);
 
 		delete[] slots;
+		delete[] previousFreeSlot;
 	}
 
 	template <typename T>
@@ -311,78 +841,223 @@ export namespace Unalmas
 		for (int i = 0; i < capacity; ++i)
 		{
 			SlotMapKey& key = slots[i];
+			if (key.generation < 0)
+			{
+				key.generation = ~key.generation;		// Drop any outstanding reservation
+			}
+
 			key.index = i + 1;
 			key.generation += 1;
+			previousFreeSlot[i] = i - 1;
 		}
 
+		slots[capacity - 1].index = capacity - 1;
+
 		firstFreeSlot = 0;
+		lastFreeSlot = capacity - 1;
 		size = 0;
+		reservedCount = 0;
+
+		if (reuse == SlotMapReuse::LowestIndex)
+		{
+			freeSlotBits.SetAll();
+		}
+
+#ifdef SLOTMAP_STATS
+		maxGeneration++;		// Every slot went up by one
+#endif
 	}
 
 	template <typename T>
 	bool SlotMap<T>::Erase(const SlotMapKey& key)
 	{
+		// Stale keys may point past the end, once CompactSlots() dropped their slot.
+		if (key.index < 0 || key.index >= capacity)
+		{
+			return false;
+		}
+
 		SlotMapKey& slot = slots[key.index];
-		if (slot.generation == key.generation)
+		if (slot.generation == key.generation && key.generation >= 0)
 		{
 			slot.generation++;
+			CountGeneration(slot.generation);
+
 			const int valueIndex = slot.index;
-			const int removedSlotIndex = valueToSlot[valueIndex];
+			const int lastValueIndex = size - 1;
 
 			// Destruct existing item
 			values[valueIndex].~T();
 
-			// Move (or copy) last item into newly freed value allocation
-			if (size > 1)
+			// Move (or copy) last item into newly freed value allocation,
+			// and point its slot at the new location.
+			if (valueIndex != lastValueIndex)
 			{
-				if constexpr (std::is_move_assignable<T>())
+				if constexpr (std::is_move_constructible<T>())
 				{
-					values[valueIndex] = static_cast<T&&>(values[size - 1]);
+					new (&values[valueIndex]) T(static_cast<T&&>(values[lastValueIndex]));
 				}
 				else
 				{
-					values[valueIndex] = values[size - 1];
-					values[size - 1].~T();
+					new (&values[valueIndex]) T(values[lastValueIndex]);
 				}
 
-				valueToSlot[valueIndex] = valueToSlot[size - 1];
+				values[lastValueIndex].~T();
+
+				valueToSlot[valueIndex] = valueToSlot[lastValueIndex];
+				slots[valueToSlot[valueIndex]].index = valueIndex;
+
+#ifdef SLOTMAP_STATS
+				eraseMoves++;
+#endif
 			}
 
-			// If the first free slot is created by this removal, set both first and last
-			// to the removed slot, and make sure the slot's index is also pointing at itself.
-			if (firstFreeSlot == -1)
+			PushFreeSlot(key.index);
+
+			size--;
+
+			return true;
+		}
+
+		return false;
+	}
+
+	template <typename T>
+	int SlotMap<T>::PopFreeSlot()
+	{
+		if (firstFreeSlot == -1)
+		{
+			Grow();
+		}
+		else if (size + reservedCount == valueCapacity)
+		{
+			GrowValues(valueCapacity + 1);
+		}
+
+		const int slotIndex = reuse == SlotMapReuse::LowestIndex ? freeSlotBits.FindFirst() : firstFreeSlot;
+		UnlinkFreeSlot(slotIndex);
+
+		return slotIndex;
+	}
+
+	template <typename T>
+	void SlotMap<T>::PushFreeSlot(int slotIndex)
+	{
+		if (reuse != SlotMapReuse::Lifo || firstFreeSlot == -1)
+		{
+			AppendFreeSlot(slotIndex);
+			return;
+		}
+
+		slots[slotIndex].index = firstFreeSlot;
+		previousFreeSlot[firstFreeSlot] = slotIndex;
+		firstFreeSlot = slotIndex;
+	}
+
+	template <typename T>
+	void SlotMap<T>::AppendFreeSlot(int slotIndex)
+	{
+		// If the first free slot is created by this removal, set both first and last
+		// to the removed slot, and make sure the slot's index is also pointing at itself.
+		if (firstFreeSlot == -1)
+		{
+			firstFreeSlot = slotIndex;
+		}
+		else
+		{
+			slots[lastFreeSlot].index = slotIndex;
+		}
+
+		slots[slotIndex].index = slotIndex;
+		previousFreeSlot[slotIndex] = lastFreeSlot;
+		lastFreeSlot = slotIndex;
+
+		if (reuse == SlotMapReuse::LowestIndex)
+		{
+			freeSlotBits.Set(slotIndex);
+		}
+	}
+
+	template <typename T>
+	void SlotMap<T>::UnlinkFreeSlot(int slotIndex)
+	{
+		// The head's back link isn't kept up to date when the head is taken, so it's never read.
+		const int next = slots[slotIndex].index;
+
+		if (slotIndex == firstFreeSlot)
+		{
+			if (next == slotIndex)
 			{
-				firstFreeSlot = removedSlotIndex;
+				firstFreeSlot = -1;				// Ran out of free slots!
+				lastFreeSlot = -1;
 			}
 			else
 			{
-				slots[lastFreeSlot].index = removedSlotIndex;
+				firstFreeSlot = next;
 			}
+		}
+		else if (slotIndex == lastFreeSlot)
+		{
+			lastFreeSlot = previousFreeSlot[slotIndex];
+			slots[lastFreeSlot].index = lastFreeSlot;
+		}
+		else
+		{
+			slots[previousFreeSlot[slotIndex]].index = next;
+			previousFreeSlot[next] = previousFreeSlot[slotIndex];
+		}
 
-			slots[removedSlotIndex].index = removedSlotIndex;
-			lastFreeSlot = removedSlotIndex;
+		if (reuse == SlotMapReuse::LowestIndex)
+		{
+			freeSlotBits.Reset(slotIndex);
+		}
+	}
 
-			// Adjust the affected slot:
-			SlotMapKey& movedSlot = slots[valueToSlot[valueIndex]];
-			movedSlot.index = valueIndex;
+	template <typename T>
+	void SlotMap<T>::RebuildFreeSlotLinks()
+	{
+		// The bitmap too, where there is one; both follow from the forward links.
+		if (reuse == SlotMapReuse::LowestIndex)
+		{
+			freeSlotBits.Resize(capacity);
+			freeSlotBits.ResetAll();
+		}
 
-			size--;
+		for (int slot = firstFreeSlot, previous = -1; slot != -1; )
+		{
+			previousFreeSlot[slot] = previous;
+			previous = slot;
 
-			return true;
-		}
+			if (reuse == SlotMapReuse::LowestIndex)
+			{
+				freeSlotBits.Set(slot);
+			}
 
-		return false;
+			const int next = slots[slot].index;
+			slot = next == slot ? -1 : next;
+		}
 	}
 
 	template <typename T>
-	template <typename U>
-	SlotMapKey SlotMap<T>::Insert(U&& value)
+	void SlotMap<T>::SetReuse(SlotMapReuse reuse_)
 	{
-		while (capacity <= size)
+		reuse = reuse_;
+
+		if (reuse == SlotMapReuse::LowestIndex)
 		{
-			Grow();
+			RebuildFreeSlotLinks();
+		}
+		else
+		{
+			freeSlotBits = SlotMapBitset();
 		}
+	}
 
+	template <typename T>
+	template <typename U>
+	SlotMapKey SlotMap<T>::Insert(U&& value)
+	{
+		const int slotIndex = PopFreeSlot();
 		const int newValueIndex = size++;
 
 		if constexpr (std::is_move_assignable<T>())
@@ -394,42 +1069,256 @@ export namespace Unalmas
 			new (&values[newValueIndex]) T(value);
 		}
 
-		const int slotIndex = firstFreeSlot;
 		SlotMapKey& slot = slots[slotIndex];
 
 		valueToSlot[newValueIndex] = slotIndex;
+		slot.index = newValueIndex;
 
-		if (slot.index == firstFreeSlot)
+#ifdef SLOTMAP_STATS
+		peakSize = size > peakSize ? size : peakSize;
+#endif
+
+		return SlotMapKey(slotIndex, slot.generation);
+	}
+
+	template <typename T>
+	template <typename... Args>
+	bool SlotMap<T>::InsertAt(const SlotMapKey& key, Args&&... args)
+	{
+		if (key.index < 0 || key.generation < 0)
 		{
-			firstFreeSlot = -1;				// Ran out of free slots!
-			lastFreeSlot = -1;
+			return false;
 		}
-		else
+
+		if (key.index >= capacity)
+		{
+			Grow(key.index + 1);
+		}
+
+		SlotMapKey& slot = slots[key.index];
+
+		// A slot is taken if the value it points at points back at it; free slots
+		// point at the next free slot instead, which never does.
+		const bool taken = slot.index < size && valueToSlot[slot.index] == static_cast<unsigned int>(key.index);
+		if (taken || slot.generation < 0 || slot.generation > key.generation)
 		{
-			firstFreeSlot = slot.index;
+			return false;
 		}
 
+		if (size + reservedCount == valueCapacity)
+		{
+			GrowValues(valueCapacity + 1);
+		}
+
+		UnlinkFreeSlot(key.index);
+
+		const int newValueIndex = size;
+		new (&values[newValueIndex]) T(std::forward<Args>(args)...);
+		size++;
+
+		valueToSlot[newValueIndex] = key.index;
 		slot.index = newValueIndex;
+		slot.generation = key.generation;
+		CountGeneration(key.generation);
 
-		return SlotMapKey(slotIndex, slot.generation);
+#ifdef SLOTMAP_STATS
+		peakSize = size > peakSize ? size : peakSize;
+#endif
+
+		return true;
+	}
+
+	template <typename T>
+	bool SlotMap<T>::RetireKey(const SlotMapKey& key)
+	{
+		if (key.index < 0 || key.generation < 0)
+		{
+			return false;
+		}
+
+		if (key.index >= capacity)
+		{
+			Grow(key.index + 1);
+		}
+
+		SlotMapKey& slot = slots[key.index];
+
+		const bool taken = slot.index < size && valueToSlot[slot.index] == static_cast<unsigned int>(key.index);
+		if (taken || slot.generation < 0)
+		{
+			return false;
+		}
+
+		if (slot.generation <= key.generation)
+		{
+			slot.generation = key.generation + 1;
+			CountGeneration(slot.generation);
+		}
+
+		return true;
 	}
 
 	template <typename T>
-	void SlotMap<T>::Grow()
+	SlotMapKey SlotMap<T>::ReserveKey()
 	{
-		const int newCapacity = capacity * 2;
+		const int slotIndex = PopFreeSlot();
+		SlotMapKey& slot = slots[slotIndex];
+
+		const int generation = slot.generation;
+		slot.generation = ~generation;
+		reservedCount++;
+
+		return SlotMapKey(slotIndex, generation);
+	}
+
+	template <typename T>
+	std::vector<SlotMapKey> SlotMap<T>::ReserveKeys(int count)
+	{
+		if (count <= 0)
+		{
+			return {};
+		}
+
+		// Grow at most once, however many keys are asked for.
+		const int freeSlots = capacity - size - reservedCount;
+		if (freeSlots < count)
+		{
+			Grow(capacity + count - freeSlots);
+		}
+		else if (size + reservedCount + count > valueCapacity)
+		{
+			GrowValues(size + reservedCount + count);
+		}
 
-		T* newValues = static_cast<T*>(std::malloc(newCapacity * sizeof(T)));
+		std::vector<SlotMapKey> keys;
+		keys.reserve(count);
+
+		for (int i = 0; i < count; ++i)
+		{
+			keys.push_back(ReserveKey());
+		}
+
+		return keys;
+	}
+
+	template <typename T>
+	template <typename... Args>
+	void SlotMap<T>::Commit(const SlotMapKey& key, Args&&... args)
+	{
+#ifndef SLOTMAP_RELEASE
+		if (key.index < 0 || key.index >= capacity || slots[key.index].generation != ~key.generation)
+		{
+			throw std::runtime_error("[SlotMap] Trying to commit a key which is not reserved.");
+		}
+#endif
+
+		SlotMapKey& slot = slots[key.index];
+
+		// Reserved slots were taken out of the free list, so there is always
+		// room left for their values.
+		const int newValueIndex = size;
+		new (&values[newValueIndex]) T(std::forward<Args>(args)...);
+		size++;
+
+		valueToSlot[newValueIndex] = key.index;
+		slot.index = newValueIndex;
+		slot.generation = key.generation;
+		reservedCount--;
+
+#ifdef SLOTMAP_STATS
+		peakSize = size > peakSize ? size : peakSize;
+#endif
+	}
+
+	template <typename T>
+	bool SlotMap<T>::CancelReservation(const SlotMapKey& key)
+	{
+		if (key.index < 0 || key.index >= capacity)
+		{
+			return false;
+		}
+
+		SlotMapKey& slot = slots[key.index];
+		if (slot.generation != ~key.generation)
+		{
+			return false;
+		}
+
+		slot.generation = key.generation + 1;
+		CountGeneration(slot.generation);
+		reservedCount--;
+		PushFreeSlot(key.index);
+
+		return true;
+	}
+
+	template <typename T>
+	void SlotMap<T>::Grow(int minCapacity)
+	{
+		const int newCapacity = capacity * 2 < minCapacity ? minCapacity : capacity * 2;
 
 		SlotMapKey* newSlots = new SlotMapKey[newCapacity];
-		unsigned int* newValueToSlot = new unsigned int[newCapacity];
+		int* newPreviousFreeSlot = new int[newCapacity];
 
-		memcpy(newValueToSlot, valueToSlot, capacity * sizeof(unsigned int));
 		memcpy(newSlots, slots, capacity * sizeof(SlotMapKey));
+		memcpy(newPreviousFreeSlot, previousFreeSlot, capacity * sizeof(int));
+
+		delete[] slots;
+		delete[] previousFreeSlot;
+
+		slots = newSlots;
+		previousFreeSlot = newPreviousFreeSlot;
+
+		if (reuse == SlotMapReuse::LowestIndex)
+		{
+			freeSlotBits.Resize(newCapacity);
+		}
+
+		// New slots go to the back of the free list whatever the policy, lowest first.
+		for (int i = capacity; i < newCapacity; ++i)
+		{
+			slots[i].generation = regrowGeneration;
+			AppendFreeSlot(i);
+		}
+
+		ResizeValues(newCapacity);
+
+#ifdef SLOTMAP_STATS
+		growCount++;
+		bytesCopied += static_cast<std::uint64_t>(capacity) * (sizeof(SlotMapKey) + sizeof(int))
+			+ static_cast<std::uint64_t>(size) * (sizeof(T) + sizeof(unsigned int));
+#endif
+
+		capacity = newCapacity;
+	}
+
+	template <typename T>
+	void SlotMap<T>::GrowValues(int minValueCapacity)
+	{
+		// There is a free slot for every value that can still be added, so the
+		// value arrays never need to get bigger than the slots.
+		int newValueCapacity = valueCapacity * 2 < minValueCapacity ? minValueCapacity : valueCapacity * 2;
+		newValueCapacity = newValueCapacity > capacity ? capacity : newValueCapacity;
+
+		ResizeValues(newValueCapacity);
+
+#ifdef SLOTMAP_STATS
+		growCount++;
+		bytesCopied += static_cast<std::uint64_t>(size) * (sizeof(T) + sizeof(unsigned int));
+#endif
+	}
+
+	template <typename T>
+	void SlotMap<T>::ResizeValues(int newValueCapacity)
+	{
+		T* newValues = static_cast<T*>(std::malloc(newValueCapacity * sizeof(T)));
+		unsigned int* newValueToSlot = new unsigned int[newValueCapacity];
+
+		memcpy(newValueToSlot, valueToSlot, size * sizeof(unsigned int));
 
 		if constexpr (std::is_trivially_copyable_v<T>)
 		{
-			memcpy(newValues, values, capacity * sizeof(T));
+			memcpy(newValues, values, size * sizeof(T));
 		}
 		else
 		{
@@ -442,30 +1331,113 @@ export namespace Unalmas
 				else
 				{
 					new (&newValues[i]) T(values[i]);
-					values[i].~T();
 				}
+
+				values[i].~T();
 			}
 		}
 
-		delete[] slots;
 		std::free(values);
 		delete[] valueToSlot;
 
-		slots = newSlots;
 		values = newValues;
 		valueToSlot = newValueToSlot;
+		valueCapacity = newValueCapacity;
+	}
+
+	template <typename T>
+	void SlotMap<T>::ShrinkToFit()
+	{
+		// Reserved keys are owed room for their values when they're committed.
+		const int needed = size + reservedCount > 0 ? size + reservedCount : 1;
+		if (needed < valueCapacity)
+		{
+			ResizeValues(needed);
+		}
+	}
+
+	template <typename T>
+	int SlotMap<T>::CompactSlots()
+	{
+		// A slot is in use if its value points back at it (free slots point at
+		// the next free slot instead, see InsertAt), and reserved if its
+		// generation is inverted; only the free ones at the end can go.
+		const int minCapacity = capacity < DEFAULT_CAPACITY ? capacity : DEFAULT_CAPACITY;
+
+		int newCapacity = capacity;
+		int droppedGeneration = regrowGeneration;
+
+		while (newCapacity > minCapacity)
+		{
+			const SlotMapKey& slot = slots[newCapacity - 1];
+			const bool taken = slot.index < size && valueToSlot[slot.index] == static_cast<unsigned int>(newCapacity - 1);
+			if (taken || slot.generation < 0)
+			{
+				break;
+			}
 
-		for (int i = capacity; i < newCapacity - 1; ++i)
+			// Free slots are already a generation past the last key issued for them.
+			droppedGeneration = slot.generation > droppedGeneration ? slot.generation : droppedGeneration;
+			--newCapacity;
+		}
+
+		const int released = capacity - newCapacity;
+		if (released == 0)
 		{
-			slots[i].index = i + 1;
+			return 0;
 		}
 
-		slots[newCapacity - 1].index = newCapacity - 1;
+		// Take the dropped slots out of the free list, keeping the order of the rest.
+		int previous = -1;
+		for (int slot = firstFreeSlot; slot != -1; )
+		{
+			const int next = slots[slot].index == slot ? -1 : slots[slot].index;
+
+			if (slot < newCapacity)
+			{
+				if (previous == -1)
+				{
+					firstFreeSlot = slot;
+				}
+				else
+				{
+					slots[previous].index = slot;
+				}
+
+				previous = slot;
+			}
 
-		firstFreeSlot = capacity;
-		lastFreeSlot = newCapacity - 1;
+			slot = next;
+		}
 
+		firstFreeSlot = previous == -1 ? -1 : firstFreeSlot;
+		lastFreeSlot = previous;
+		if (previous != -1)
+		{
+			slots[previous].index = previous;
+		}
+
+		SlotMapKey* newSlots = new SlotMapKey[newCapacity];
+		int* newPreviousFreeSlot = new int[newCapacity];
+
+		memcpy(newSlots, slots, newCapacity * sizeof(SlotMapKey));
+
+		delete[] slots;
+		delete[] previousFreeSlot;
+
+		slots = newSlots;
+		previousFreeSlot = newPreviousFreeSlot;
 		capacity = newCapacity;
+		regrowGeneration = droppedGeneration;
+
+		RebuildFreeSlotLinks();
+
+		if (valueCapacity > capacity)
+		{
+			ResizeValues(capacity);
+		}
+
+		return released;
 	}
 
 	template <typename T>
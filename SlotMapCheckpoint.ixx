@@ -0,0 +1,284 @@
+module;
+
+#include <cstdio>
+
+export module SlotMapCheckpoint;
+
+// Writes checkpoints of a CowSlotMap on a background thread, in the SlotMapFile
+// snapshot format, so they can be mapped or loaded like any other snapshot.
+//
+// Guarantees:
+// the owner of the map only pays for taking a snapshot (O(capacity / Chunk)) and
+// for copying the pages it modifies while the checkpoint is being written; all
+// I/O happens on the checkpoint thread
+// the file is written front to back in buffer-sized writes, with the C runtime's
+// own buffering turned off
+// with a budget set, the writes are paced so that they average out to at most
+// that many bytes per second
+// the checkpoint goes to a temporary file, which is synced and then renamed over
+// the destination, so the previous checkpoint survives a crash or a cancel
+
+import <algorithm>;
+import <atomic>;
+import <chrono>;
+import <cstdint>;
+import <cstddef>;
+import <cstring>;
+import <memory>;
+import <stdexcept>;
+import <string>;
+import <thread>;
+import <vector>;
+import <type_traits>;
+import SlotMap;
+import SlotMapFile;
+import CowSlotMap;
+
+export namespace Unalmas
+{
+	struct SlotMapCheckpointOptions
+	{
+		std::size_t		bufferSize{ 4 << 20 };	// Bytes per write; at least 1
+		std::uint64_t	bytesPerSecond{ 0 };	// I/O budget; 0 means as fast as possible
+	};
+
+	class SlotMapCheckpointWriter
+	{
+	private:
+		SlotMapCheckpointOptions	options;
+		std::thread					worker;
+		std::atomic<bool>			running{ false };
+		std::atomic<bool>			cancelled{ false };
+		std::atomic<bool>			succeeded{ false };
+		std::atomic<std::uint64_t>	bytesWritten{ 0 };
+
+	public:
+		SlotMapCheckpointWriter() = default;
+		explicit SlotMapCheckpointWriter(const SlotMapCheckpointOptions& options);
+		~SlotMapCheckpointWriter();
+
+		SlotMapCheckpointWriter(const SlotMapCheckpointWriter& rhs) = delete;
+		SlotMapCheckpointWriter& operator=(const SlotMapCheckpointWriter& rhs) = delete;
+
+		// Starts writing the snapshot to path; returns false if a checkpoint is
+		// still being written.
+		template <typename T, int Chunk>
+		bool						Start(CowSlotMapSnapshot<T, Chunk> snapshot, const char* path);
+
+		bool						IsRunning() const { return running.load(std::memory_order_acquire); }
+		std::uint64_t				BytesWritten() const { return bytesWritten.load(std::memory_order_relaxed); }
+
+		// Waits for the current checkpoint; returns true if it was written completely.
+		bool						Wait();
+
+		// Stops the current checkpoint early, leaving the previous one in place.
+		void						Cancel();
+
+	private:
+		// Collects writes into large blocks, and paces them.
+		class Stream
+		{
+		public:
+			Stream(SlotMapCheckpointWriter& owner, std::FILE* file);
+
+			bool					Write(const void* bytes, std::size_t count);
+			bool					PadTo(std::uint64_t offset);
+			bool					Finish();
+
+		private:
+			bool					WriteBuffer();
+
+			SlotMapCheckpointWriter& owner;
+			std::FILE* file;
+			std::unique_ptr<unsigned char[]>	buffer;
+			std::size_t				used{ 0 };
+			std::uint64_t			offset{ 0 };
+			std::chrono::steady_clock::time_point	start;
+		};
+
+		template <typename T, int Chunk>
+		bool						WriteCheckpoint(const CowSlotMapSnapshot<T, Chunk>& snapshot, std::FILE* file);
+	};
+
+	SlotMapCheckpointWriter::SlotMapCheckpointWriter(const SlotMapCheckpointOptions& options_) : options{ options_ }
+	{
+		if (options.bufferSize == 0)
+		{
+			throw std::invalid_argument("[SlotMapCheckpointWriter] Buffer size has to be at least one byte.");
+		}
+	}
+
+	SlotMapCheckpointWriter::~SlotMapCheckpointWriter()
+	{
+		Cancel();
+	}
+
+	bool SlotMapCheckpointWriter::Wait()
+	{
+		if (worker.joinable())
+		{
+			worker.join();
+		}
+
+		return succeeded.load(std::memory_order_acquire);
+	}
+
+	void SlotMapCheckpointWriter::Cancel()
+	{
+		cancelled.store(true, std::memory_order_relaxed);
+		Wait();
+	}
+
+	template <typename T, int Chunk>
+	bool SlotMapCheckpointWriter::Start(CowSlotMapSnapshot<T, Chunk> snapshot, const char* path)
+	{
+		static_assert(std::is_trivially_copyable<T>(), "Only slotmaps with a trivially copyable element type can be checkpointed.");
+
+		if (IsRunning())
+		{
+			return false;
+		}
+
+		if (worker.joinable())
+		{
+			worker.join();
+		}
+
+		running.store(true, std::memory_order_relaxed);
+		cancelled.store(false, std::memory_order_relaxed);
+		succeeded.store(false, std::memory_order_relaxed);
+		bytesWritten.store(0, std::memory_order_relaxed);
+
+		worker = std::thread([this, snapshot = std::move(snapshot), destination = std::string(path)]()
+		{
+			const std::string temporary = destination + ".tmp";
+			bool ok = false;
+
+			if (std::FILE* file = std::fopen(temporary.c_str(), "wb"))
+			{
+				ok = WriteCheckpoint(snapshot, file);
+				ok = std::fclose(file) == 0 && ok;
+				ok = ok && MappedFile::ReplaceFile(temporary.c_str(), destination.c_str());
+
+				if (!ok)
+				{
+					std::remove(temporary.c_str());
+				}
+			}
+
+			succeeded.store(ok, std::memory_order_release);
+			running.store(false, std::memory_order_release);
+		});
+
+		return true;
+	}
+
+	template <typename T, int Chunk>
+	bool SlotMapCheckpointWriter::WriteCheckpoint(const CowSlotMapSnapshot<T, Chunk>& snapshot, std::FILE* file)
+	{
+		SlotMapLayout<T> layout;
+		layout.size = snapshot.Size();
+		layout.capacity = snapshot.Capacity();
+		layout.firstFreeSlot = snapshot.FirstFreeSlot();
+		layout.lastFreeSlot = snapshot.LastFreeSlot();
+
+		const SlotMapFileHeader header = MakeSlotMapFileHeader(layout);
+		Stream stream(*this, file);
+
+		bool ok = stream.Write(&header, sizeof(header));
+
+		ok = ok && stream.PadTo(header.slotsOffset);
+		for (int chunk = 0; ok && chunk < snapshot.ChunkCount(); ++chunk)
+		{
+			ok = stream.Write(snapshot.SlotChunk(chunk), Chunk * sizeof(SlotMapKey));
+		}
+
+		// Only the first size entries of the dense arrays are stored.
+		const auto denseEntries = [&](int chunk) { return static_cast<std::size_t>(std::min(Chunk, layout.size - chunk * Chunk)); };
+		const int denseChunks = (layout.size + Chunk - 1) / Chunk;
+
+		ok = ok && stream.PadTo(header.valueToSlotOffset);
+		for (int chunk = 0; ok && chunk < denseChunks; ++chunk)
+		{
+			ok = stream.Write(snapshot.ValueToSlotChunk(chunk), denseEntries(chunk) * sizeof(unsigned int));
+		}
+
+		ok = ok && stream.PadTo(header.valuesOffset);
+		for (int chunk = 0; ok && chunk < denseChunks; ++chunk)
+		{
+			ok = stream.Write(snapshot.ValueChunk(chunk), denseEntries(chunk) * sizeof(T));
+		}
+
+		return ok && stream.Finish() && MappedFile::SyncFile(file);
+	}
+
+	SlotMapCheckpointWriter::Stream::Stream(SlotMapCheckpointWriter& owner_, std::FILE* file_)
+		: owner{ owner_ }, file{ file_ }, buffer{ new unsigned char[owner_.options.bufferSize] },
+		start{ std::chrono::steady_clock::now() }
+	{
+		// Our writes are already as large as they get; another copy wouldn't help.
+		std::setvbuf(file, nullptr, _IONBF, 0);
+	}
+
+	bool SlotMapCheckpointWriter::Stream::Write(const void* bytes, std::size_t count)
+	{
+		const unsigned char* source = static_cast<const unsigned char*>(bytes);
+		const std::size_t capacity = owner.options.bufferSize;
+
+		while (count > 0)
+		{
+			const std::size_t part = std::min(count, capacity - used);
+			std::memcpy(buffer.get() + used, source, part);
+
+			used += part;
+			offset += part;
+			source += part;
+			count -= part;
+
+			if (used == capacity && !WriteBuffer())
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool SlotMapCheckpointWriter::Stream::PadTo(std::uint64_t target)
+	{
+		static const unsigned char padding[SlotMapFileAlignment]{};
+		return offset <= target && target - offset <= SlotMapFileAlignment && Write(padding, static_cast<std::size_t>(target - offset));
+	}
+
+	bool SlotMapCheckpointWriter::Stream::Finish()
+	{
+		return used == 0 || WriteBuffer();
+	}
+
+	bool SlotMapCheckpointWriter::Stream::WriteBuffer()
+	{
+		if (owner.cancelled.load(std::memory_order_relaxed) || std::fwrite(buffer.get(), 1, used, file) != used)
+		{
+			return false;
+		}
+
+		const std::uint64_t total = owner.bytesWritten.fetch_add(used, std::memory_order_relaxed) + used;
+		used = 0;
+
+		// Token bucket with no burst allowance: never get ahead of what the budget
+		// allows by now. A cancel wakes us up within a few milliseconds.
+		if (const std::uint64_t budget = owner.options.bytesPerSecond)
+		{
+			const auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<double>(static_cast<double>(total) / static_cast<double>(budget)));
+
+			while (std::chrono::steady_clock::now() < due && !owner.cancelled.load(std::memory_order_relaxed))
+			{
+				std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+					due - std::chrono::steady_clock::now(), std::chrono::milliseconds(5)));
+			}
+		}
+
+		return !owner.cancelled.load(std::memory_order_relaxed);
+	}
+} // namespace Unalmas
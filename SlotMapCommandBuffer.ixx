@@ -0,0 +1,178 @@
+export module SlotMapCommandBuffer;
+
+// Records inserts and erases from worker threads, and applies them to the
+// target map in one go at a sync point.
+//
+// Each worker records into its own Recorder, so recording never contends.
+// Inserts hand out their final key immediately: recorders carry a pool of
+// keys reserved on the map (lookups with them fail until Apply()). Pools are
+// topped up in Apply(); a worker that runs dry mid-frame reserves more under
+// a lock, which may grow the map, so size keysPerWorker to avoid that while
+// other threads are reading the map.
+//
+// Apply() commits all recorded inserts first (appending to the dense value
+// array), then all recorded erases. The map must outlive the buffer.
+//
+// Guarantees:
+// built on SlotMap's public reservation API only (ReserveKeys, Commit and
+// CancelReservation), so the map itself carries no command buffer state
+// keys handed out by a Recorder are final: they stay valid once applied, and
+// fail lookups until then
+// anything recorded but not applied when the buffer is destroyed is dropped,
+// and its reserved slots are handed back to the map
+
+import <mutex>;
+import <utility>;
+import <vector>;
+import <stdexcept>;
+import SlotMap;
+
+export namespace Unalmas
+{
+	template <typename T>
+	class SlotMapCommandBuffer
+	{
+	public:
+		class alignas(64) Recorder
+		{
+		public:
+			template <typename U>
+			SlotMapKey			Insert(U&& value);
+			void				Erase(const SlotMapKey& key);
+
+		private:
+			friend class SlotMapCommandBuffer<T>;
+
+			struct PendingInsert
+			{
+				SlotMapKey		key;
+				T				value;
+			};
+
+			SlotMapCommandBuffer<T>* owner{ nullptr };
+			std::vector<SlotMapKey>		reservedKeys;
+			std::vector<PendingInsert>	inserts;
+			std::vector<SlotMapKey>		erases;
+		};
+
+		SlotMapCommandBuffer(SlotMap<T>& map, int workerCount, int keysPerWorker = 64);
+		~SlotMapCommandBuffer();
+
+		SlotMapCommandBuffer(const SlotMapCommandBuffer& rhs) = delete;
+		SlotMapCommandBuffer& operator=(const SlotMapCommandBuffer& rhs) = delete;
+
+		Recorder& ForWorker(int workerIndex);
+
+		// Only call this when no worker is recording.
+		void					Apply();
+
+	private:
+		void					Refill(Recorder& recorder);
+
+		SlotMap<T>& map;
+		std::vector<Recorder>	recorders;
+		std::mutex				refillLock;
+		int						keysPerWorker;
+	};
+
+	template <typename T>
+	SlotMapCommandBuffer<T>::SlotMapCommandBuffer(SlotMap<T>& map_, int workerCount, int keysPerWorker_)
+		: map{ map_ }, recorders(workerCount), keysPerWorker{ keysPerWorker_ }
+	{
+		for (Recorder& recorder : recorders)
+		{
+			recorder.owner = this;
+			Refill(recorder);
+		}
+	}
+
+	template <typename T>
+	SlotMapCommandBuffer<T>::~SlotMapCommandBuffer()
+	{
+		// Anything not applied is dropped, and its reserved keys are handed back.
+		for (Recorder& recorder : recorders)
+		{
+			for (const auto& insert : recorder.inserts)
+			{
+				map.CancelReservation(insert.key);
+			}
+
+			for (const auto& key : recorder.reservedKeys)
+			{
+				map.CancelReservation(key);
+			}
+		}
+	}
+
+	template <typename T>
+	typename SlotMapCommandBuffer<T>::Recorder& SlotMapCommandBuffer<T>::ForWorker(int workerIndex)
+	{
+#ifndef SLOTMAP_RELEASE
+		if (workerIndex < 0 || workerIndex >= static_cast<int>(recorders.size()))
+		{
+			throw std::out_of_range("[SlotMapCommandBuffer] Worker index is out of bounds.");
+		}
+#endif
+
+		return recorders[workerIndex];
+	}
+
+	template <typename T>
+	void SlotMapCommandBuffer<T>::Refill(Recorder& recorder)
+	{
+		std::lock_guard lock(refillLock);
+		const int missing = keysPerWorker - static_cast<int>(recorder.reservedKeys.size());
+		if (missing > 0)
+		{
+			const auto keys = map.ReserveKeys(missing);
+			recorder.reservedKeys.insert(recorder.reservedKeys.end(), keys.begin(), keys.end());
+		}
+	}
+
+	template <typename T>
+	void SlotMapCommandBuffer<T>::Apply()
+	{
+		for (Recorder& recorder : recorders)
+		{
+			for (auto& insert : recorder.inserts)
+			{
+				map.Commit(insert.key, std::move(insert.value));
+			}
+
+			recorder.inserts.clear();
+		}
+
+		for (Recorder& recorder : recorders)
+		{
+			for (const auto& key : recorder.erases)
+			{
+				map.Erase(key);
+			}
+
+			recorder.erases.clear();
+			Refill(recorder);
+		}
+	}
+
+	template <typename T>
+	template <typename U>
+	SlotMapKey SlotMapCommandBuffer<T>::Recorder::Insert(U&& value)
+	{
+		if (reservedKeys.empty())
+		{
+			owner->Refill(*this);
+		}
+
+		const SlotMapKey key = reservedKeys.back();
+		reservedKeys.pop_back();
+
+		inserts.push_back(PendingInsert{ key, T(std::forward<U>(value)) });
+		return key;
+	}
+
+	template <typename T>
+	void SlotMapCommandBuffer<T>::Recorder::Erase(const SlotMapKey& key)
+	{
+		erases.push_back(key);
+	}
+} // namespace Unalmas
@@ -0,0 +1,251 @@
+export module SlotMapDelta;
+
+#define DEFAULT_CAPACITY 8
+
+// Change logs for replicating a slotmap to standby copies.
+//
+// Guarantees:
+// JournaledSlotMap records every insert, erase and update, in order, and can
+// hand out everything that happened since a mark the caller held on to
+// deltas are compacted: an update overwrites the value of an earlier insert or
+// update of the same key in the same delta, instead of adding a record
+// applying a delta to a replica that held the same keys as the primary at the
+// delta's start mark gives the replica the same keys and values as the primary
+// has at the delta's end mark
+// records hold their value in a std::optional, so T doesn't have to be default
+// constructible
+//
+// Each insert record carries the key the primary got, and the replica inserts
+// under that exact key (SlotMap::InsertAt), so it doesn't matter in which order
+// the replica's free list hands out slots.
+
+import <cstddef>;
+import <cstdint>;
+import <optional>;
+import <unordered_map>;
+import <utility>;
+import <vector>;
+import <stdexcept>;
+import SlotMap;
+
+export namespace Unalmas
+{
+	enum class SlotMapDeltaOp : unsigned char
+	{
+		Insert,
+		Update,
+		Erase,
+		Clear,
+	};
+
+	template <typename T>
+	struct SlotMapDeltaRecord
+	{
+		SlotMapDeltaOp		op;
+		SlotMapKey			key;		// The key the primary returned (Insert) or was given (Update, Erase)
+		std::optional<T>	value;		// Empty for Erase and Clear
+	};
+
+	template <typename T>
+	struct SlotMapDelta
+	{
+		std::uint64_t						from{ 0 };		// Mark the replica must be at
+		std::uint64_t						to{ 0 };		// Mark the replica is at afterwards
+		std::vector<SlotMapDeltaRecord<T>>	records;
+	};
+
+	// A SlotMap that journals its changes. Values can only be changed through
+	// Update(), so that every change ends up in the journal.
+	template <typename T>
+	class JournaledSlotMap
+	{
+	private:
+		SlotMap<T>							map;
+		std::vector<SlotMapDeltaRecord<T>>	journal;
+		std::uint64_t						firstMark{ 0 };		// Mark of journal[0]
+
+	public:
+		JournaledSlotMap() : JournaledSlotMap(DEFAULT_CAPACITY) {}
+		JournaledSlotMap(int capacity) : map(capacity) {}
+
+		const T& operator[](const SlotMapKey& key) const { return map[key]; }
+		bool								TryGet(const SlotMapKey& key, T& value) const { return map.TryGet(key, value); }
+		bool								Contains(const SlotMapKey& key) const { return map.Contains(key); }
+		int									Size() const { return map.Size(); }
+		int									Capacity() const { return map.Capacity(); }
+
+		// For seeding a replica; a replica copied now is at Mark().
+		const SlotMap<T>& Map() const { return map; }
+
+		SlotMapConstIterator<T>				begin() const { return map.begin(); }
+		SlotMapConstIterator<T>				end() const { return map.end(); }
+
+		template <typename U>
+		SlotMapKey							Insert(U&& value);
+		bool								Update(const SlotMapKey& key, const T& value);
+		bool								Erase(const SlotMapKey& key);
+		void								Clear();
+
+		// The position in the journal after the last change so far.
+		std::uint64_t						Mark() const { return firstMark + journal.size(); }
+
+		// Everything that changed since the given mark, which must not have been discarded.
+		SlotMapDelta<T>						DeltaSince(std::uint64_t mark) const;
+
+		// Drops journal records before the given mark; call it with the oldest
+		// mark any replica still needs.
+		void								DiscardBefore(std::uint64_t mark);
+	};
+
+	// Replays a delta on a replica. Returns false if the replica didn't hold the
+	// same keys as the primary at the delta's start mark, in which case it may
+	// have been partially changed and should be seeded again.
+	template <typename T>
+	bool									ApplyDelta(SlotMap<T>& replica, const SlotMapDelta<T>& delta);
+
+	template <typename T>
+	template <typename U>
+	SlotMapKey JournaledSlotMap<T>::Insert(U&& value)
+	{
+		const SlotMapKey key = map.Insert(std::forward<U>(value));
+		journal.push_back(SlotMapDeltaRecord<T>{ SlotMapDeltaOp::Insert, key, map[key] });
+
+		return key;
+	}
+
+	template <typename T>
+	bool JournaledSlotMap<T>::Update(const SlotMapKey& key, const T& value)
+	{
+		if (!map.Contains(key))
+		{
+			return false;
+		}
+
+		map[key] = value;
+		journal.push_back(SlotMapDeltaRecord<T>{ SlotMapDeltaOp::Update, key, value });
+
+		return true;
+	}
+
+	template <typename T>
+	bool JournaledSlotMap<T>::Erase(const SlotMapKey& key)
+	{
+		if (!map.Contains(key))
+		{
+			return false;
+		}
+
+		map.Erase(key);
+		journal.push_back(SlotMapDeltaRecord<T>{ SlotMapDeltaOp::Erase, key });
+
+		return true;
+	}
+
+	template <typename T>
+	void JournaledSlotMap<T>::Clear()
+	{
+		map.Clear();
+		journal.push_back(SlotMapDeltaRecord<T>{ SlotMapDeltaOp::Clear, SlotMapKey() });
+	}
+
+	template <typename T>
+	SlotMapDelta<T> JournaledSlotMap<T>::DeltaSince(std::uint64_t mark) const
+	{
+#ifndef SLOTMAP_RELEASE
+		if (mark < firstMark || mark > Mark())
+		{
+			throw std::out_of_range("[SlotMap] Journal mark was discarded, or is in the future.");
+		}
+#endif
+
+		SlotMapDelta<T> delta;
+		delta.from = mark;
+		delta.to = Mark();
+
+		// Record index of the latest insert or update of each live key.
+		std::unordered_map<int, int> latestValue;
+
+		for (std::size_t i = static_cast<std::size_t>(mark - firstMark); i < journal.size(); ++i)
+		{
+			const SlotMapDeltaRecord<T>& record = journal[i];
+
+			if (record.op == SlotMapDeltaOp::Update)
+			{
+				const auto found = latestValue.find(record.key.index);
+				if (found != latestValue.end())
+				{
+					delta.records[found->second].value = record.value;
+					continue;
+				}
+			}
+
+			if (record.op == SlotMapDeltaOp::Clear)
+			{
+				latestValue.clear();
+			}
+			else if (record.op == SlotMapDeltaOp::Erase)
+			{
+				latestValue.erase(record.key.index);
+			}
+			else
+			{
+				latestValue[record.key.index] = static_cast<int>(delta.records.size());
+			}
+
+			delta.records.push_back(record);
+		}
+
+		return delta;
+	}
+
+	template <typename T>
+	void JournaledSlotMap<T>::DiscardBefore(std::uint64_t mark)
+	{
+		if (mark <= firstMark)
+		{
+			return;
+		}
+
+		const std::uint64_t count = mark < Mark() ? mark - firstMark : journal.size();
+		journal.erase(journal.begin(), journal.begin() + static_cast<std::ptrdiff_t>(count));
+		firstMark += count;
+	}
+
+	template <typename T>
+	bool ApplyDelta(SlotMap<T>& replica, const SlotMapDelta<T>& delta)
+	{
+		for (const SlotMapDeltaRecord<T>& record : delta.records)
+		{
+			switch (record.op)
+			{
+			case SlotMapDeltaOp::Insert:
+				if (!replica.InsertAt(record.key, *record.value))
+				{
+					return false;
+				}
+				break;
+
+			case SlotMapDeltaOp::Update:
+				if (!replica.Contains(record.key))
+				{
+					return false;
+				}
+				replica[record.key] = *record.value;
+				break;
+
+			case SlotMapDeltaOp::Erase:
+				if (!replica.Contains(record.key) || !replica.Erase(record.key))
+				{
+					return false;
+				}
+				break;
+
+			case SlotMapDeltaOp::Clear:
+				replica.Clear();
+				break;
+			}
+		}
+
+		return true;
+	}
+} // namespace Unalmas
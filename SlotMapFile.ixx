@@ -0,0 +1,715 @@
+module;
+
+#include <cstdio>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+export module SlotMapFile;
+
+// Versioned binary snapshots of slotmaps with trivially copyable element types.
+//
+// Guarantees:
+// the file holds the slots, valueToSlot and values arrays verbatim, plus the
+// free list head and tail, so every key issued before saving is valid after loading;
+// it also holds the generation slots dropped by CompactSlots() come back at, so
+// keys issued for them stay invalid after loading and growing
+// MappedSlotMap maps a file and validates its header, without copying (or even
+// touching) any elements; pages are faulted in by the OS as they are read
+// LoadSlotMap turns a file into a regular, mutable SlotMap with one bulk copy
+// per array, rather than one insert per element; it verifies the slots first
+// (O(capacity)), and throws if they are inconsistent
+// SaveSlotMap writes to path + ".tmp", syncs it and renames it over path, so a
+// crash or a failed write leaves the previous file intact
+// MappedSlotMap lookups check where a slot points before following it, so a
+// corrupt file can't make them read past the values
+//
+// The format is native: files can't be exchanged between machines of different
+// byte order, or between builds where T's size or alignment differs.
+
+import <cstdint>;
+import <cstdio>;
+import <cstddef>;
+import <cstring>;
+import <stdexcept>;
+import <string>;
+import <type_traits>;
+import SlotMap;
+
+export namespace Unalmas
+{
+	constexpr std::uint32_t SlotMapFileVersion = 2;
+	constexpr std::uint32_t SlotMapFileByteOrder = 0x01020304;
+	constexpr std::uint64_t SlotMapFileAlignment = 64;
+
+	// Header flags
+	constexpr std::uint32_t SlotMapFileCapacityArrays = 1;	// valueToSlot and values hold capacity entries, not size
+	constexpr std::uint32_t SlotMapFileOpenForWriting = 2;	// Set while a PersistentSlotMap has the file open
+
+	struct SlotMapFileHeader
+	{
+		char			magic[8]{ 'S', 'L', 'O', 'T', 'M', 'A', 'P', '\0' };
+		std::uint32_t	version{ SlotMapFileVersion };
+		std::uint32_t	byteOrder{ SlotMapFileByteOrder };
+		std::uint32_t	elementSize{ 0 };
+		std::uint32_t	elementAlignment{ 0 };
+		std::int32_t	size{ 0 };
+		std::int32_t	capacity{ 0 };
+		std::int32_t	firstFreeSlot{ -1 };
+		std::int32_t	lastFreeSlot{ -1 };
+		std::int32_t	reservedCount{ 0 };
+		std::int32_t	regrowGeneration{ 0 };	// Generation of slots added by growing, see SlotMap::CompactSlots()
+		std::uint32_t	flags{ 0 };
+		std::uint32_t	unused{ 0 };
+		std::uint64_t	slotsOffset{ 0 };
+		std::uint64_t	valueToSlotOffset{ 0 };
+		std::uint64_t	valuesOffset{ 0 };
+		std::uint64_t	fileSize{ 0 };
+	};
+
+	// A file mapped into memory; unmapped when destroyed.
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		~MappedFile() { Close(); }
+
+		MappedFile(const MappedFile& rhs) = delete;
+		MappedFile& operator=(const MappedFile& rhs) = delete;
+
+		bool					OpenReadOnly(const char* path);
+		bool					OpenReadWrite(const char* path);	// Creates the file if needed
+		void					Close();
+
+		// Changes the file's size and maps it again; Data() moves.
+		bool					Resize(std::size_t newSize);
+
+		// Writes the given range of a writable mapping back to disk, and waits for it.
+		bool					Flush(std::size_t offset, std::size_t length);
+
+		const unsigned char* Data() const { return data; }
+		unsigned char* Data() { return data; }
+		std::size_t				Size() const { return size; }
+
+		static std::size_t		PageSize();
+
+		// Atomically replaces "to" with "from", and waits for the directory entry
+		// to reach the disk; neither may be open.
+		static bool				ReplaceFile(const char* from, const char* to);
+
+		// Flushes a stdio file and waits for its contents to reach the disk.
+		static bool				SyncFile(std::FILE* file);
+
+	private:
+		bool					Map();
+		void					Unmap();
+
+		bool					writable{ false };
+#ifdef _WIN32
+		HANDLE					file{ INVALID_HANDLE_VALUE };
+		HANDLE					mapping{ nullptr };
+#else
+		int						fd{ -1 };
+#endif
+		unsigned char* data{ nullptr };
+		std::size_t				size{ 0 };
+	};
+
+	// Computes where each array goes in a file holding the given layout. Snapshots
+	// store size entries of valueToSlot and values; files that are written in place
+	// reserve room for arrayEntries (i.e. capacity) instead.
+	template <typename T>
+	SlotMapFileHeader			MakeSlotMapFileHeader(const SlotMapLayout<T>& layout, int arrayEntries = -1);
+
+	// Checks a header against the file it came from and the element type it is
+	// read as; returns nullptr if it is fine, or a description of the problem.
+	template <typename T>
+	const char* ValidateSlotMapFileHeader(const SlotMapFileHeader& header, std::uint64_t fileSize);
+
+	// Walks all slots and values to check that they are consistent with each
+	// other; O(capacity), and touches every page of a mapped layout.
+	template <typename T>
+	bool						VerifySlotMapLayout(const SlotMapLayout<T>& layout);
+
+	template <typename T>
+	bool						SaveSlotMap(const SlotMapLayout<T>& layout, const char* path);
+
+	template <typename T>
+	bool						SaveSlotMap(const SlotMap<T>& map, const char* path) { return SaveSlotMap(map.GetLayout(), path); }
+
+	// A read-only slotmap served straight from a mapped snapshot file.
+	template <typename T>
+	class MappedSlotMap
+	{
+		static_assert(std::is_trivially_copyable<T>(), "Only slotmaps with a trivially copyable element type can be mapped.");
+
+	public:
+		explicit MappedSlotMap(const char* path);
+
+		MappedSlotMap(const MappedSlotMap& rhs) = delete;
+		MappedSlotMap& operator=(const MappedSlotMap& rhs) = delete;
+
+		const T& operator[](const SlotMapKey& key) const;
+		const T& operator[](int index) const;
+		bool					TryGet(const SlotMapKey& key, T& value) const;
+		bool					Contains(const SlotMapKey& key) const;
+		SlotMapKey				GetKeyForIndex(int index) const;
+
+		int						Size() const { return layout.size; }
+		int						Capacity() const { return layout.capacity; }
+
+		SlotMapConstIterator<T>	begin() const { return SlotMapConstIterator<T>(const_cast<T*>(layout.values), layout.size, 0); }
+		SlotMapConstIterator<T>	end() const { return SlotMapConstIterator<T>(const_cast<T*>(layout.values), layout.size, layout.size); }
+
+		SlotMapLayout<T>		GetLayout() const { return layout; }
+
+		// Unlike opening the file, this touches every page.
+		bool					Verify() const { return VerifySlotMapLayout(layout); }
+
+	private:
+		MappedFile				file;
+		SlotMapLayout<T>		layout;
+	};
+
+	template <typename T>
+	SlotMap<T>					LoadSlotMap(const char* path);
+
+	bool MappedFile::OpenReadOnly(const char* path)
+	{
+		Close();
+		writable = false;
+
+#ifdef _WIN32
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize))
+		{
+			Close();
+			return false;
+		}
+
+		size = static_cast<std::size_t>(fileSize.QuadPart);
+#else
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		struct stat info;
+		if (fstat(fd, &info) != 0)
+		{
+			Close();
+			return false;
+		}
+
+		size = static_cast<std::size_t>(info.st_size);
+#endif
+
+		if (size == 0 || !Map())
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	bool MappedFile::OpenReadWrite(const char* path)
+	{
+		Close();
+		writable = true;
+
+#ifdef _WIN32
+		file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize))
+		{
+			Close();
+			return false;
+		}
+
+		size = static_cast<std::size_t>(fileSize.QuadPart);
+#else
+		fd = open(path, O_RDWR | O_CREAT, 0644);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		struct stat info;
+		if (fstat(fd, &info) != 0)
+		{
+			Close();
+			return false;
+		}
+
+		size = static_cast<std::size_t>(info.st_size);
+#endif
+
+		// An empty file can't be mapped; it stays unmapped until the first Resize().
+		if (size > 0 && !Map())
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	bool MappedFile::Map()
+	{
+#ifdef _WIN32
+		mapping = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr)
+		{
+			return false;
+		}
+
+		data = static_cast<unsigned char*>(MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+#else
+		void* mapped = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+		data = mapped == MAP_FAILED ? nullptr : static_cast<unsigned char*>(mapped);
+#endif
+
+		return data != nullptr;
+	}
+
+	void MappedFile::Unmap()
+	{
+#ifdef _WIN32
+		if (data != nullptr)
+		{
+			UnmapViewOfFile(data);
+		}
+
+		if (mapping != nullptr)
+		{
+			CloseHandle(mapping);
+		}
+
+		mapping = nullptr;
+#else
+		if (data != nullptr)
+		{
+			munmap(data, size);
+		}
+#endif
+
+		data = nullptr;
+	}
+
+	void MappedFile::Close()
+	{
+		Unmap();
+
+#ifdef _WIN32
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file);
+		}
+
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+
+		fd = -1;
+#endif
+
+		size = 0;
+	}
+
+	bool MappedFile::Resize(std::size_t newSize)
+	{
+		if (!writable)
+		{
+			return false;
+		}
+
+		Unmap();
+
+#ifdef _WIN32
+		LARGE_INTEGER position;
+		position.QuadPart = static_cast<LONGLONG>(newSize);
+		if (!SetFilePointerEx(file, position, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+		{
+			return false;
+		}
+#else
+		if (ftruncate(fd, static_cast<off_t>(newSize)) != 0)
+		{
+			return false;
+		}
+#endif
+
+		size = newSize;
+		return size == 0 || Map();
+	}
+
+	bool MappedFile::Flush(std::size_t offset, std::size_t length)
+	{
+		if (!writable || data == nullptr || offset >= size)
+		{
+			return false;
+		}
+
+		// Both msync and FlushViewOfFile want to start at a page boundary.
+		const std::size_t start = offset - offset % PageSize();
+		const std::size_t end = offset + length < size ? offset + length : size;
+
+#ifdef _WIN32
+		return FlushViewOfFile(data + start, end - start) && FlushFileBuffers(file);
+#else
+		return msync(data + start, end - start, MS_SYNC) == 0;
+#endif
+	}
+
+	std::size_t MappedFile::PageSize()
+	{
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return static_cast<std::size_t>(info.dwAllocationGranularity);
+#else
+		return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+	bool MappedFile::ReplaceFile(const char* from, const char* to)
+	{
+#ifdef _WIN32
+		return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		if (std::rename(from, to) != 0)
+		{
+			return false;
+		}
+
+		// The rename is only durable once the directory holding it is.
+		const std::string name(to);
+		const std::size_t slash = name.find_last_of('/');
+		const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : name.substr(0, slash);
+
+		const int directoryFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+		if (directoryFd < 0)
+		{
+			return false;
+		}
+
+		const bool synced = fsync(directoryFd) == 0;
+		close(directoryFd);
+
+		return synced;
+#endif
+	}
+
+	bool MappedFile::SyncFile(std::FILE* file)
+	{
+		if (std::fflush(file) != 0)
+		{
+			return false;
+		}
+
+#ifdef _WIN32
+		return _commit(_fileno(file)) == 0;
+#else
+		return fsync(fileno(file)) == 0;
+#endif
+	}
+
+	template <typename T>
+	SlotMapFileHeader MakeSlotMapFileHeader(const SlotMapLayout<T>& layout, int arrayEntries)
+	{
+		static_assert(alignof(T) <= SlotMapFileAlignment, "Element type is too strictly aligned for slotmap files.");
+
+		if (arrayEntries < 0)
+		{
+			arrayEntries = layout.size;
+		}
+
+		const auto alignUp = [](std::uint64_t offset) { return (offset + SlotMapFileAlignment - 1) & ~(SlotMapFileAlignment - 1); };
+
+		SlotMapFileHeader header;
+		header.elementSize = sizeof(T);
+		header.elementAlignment = alignof(T);
+		header.size = layout.size;
+		header.capacity = layout.capacity;
+		header.firstFreeSlot = layout.firstFreeSlot;
+		header.lastFreeSlot = layout.lastFreeSlot;
+		header.reservedCount = layout.reservedCount;
+		header.regrowGeneration = layout.regrowGeneration;
+
+		header.slotsOffset = alignUp(sizeof(SlotMapFileHeader));
+		header.valueToSlotOffset = alignUp(header.slotsOffset + static_cast<std::uint64_t>(layout.capacity) * sizeof(SlotMapKey));
+		header.valuesOffset = alignUp(header.valueToSlotOffset + static_cast<std::uint64_t>(arrayEntries) * sizeof(unsigned int));
+		header.fileSize = header.valuesOffset + static_cast<std::uint64_t>(arrayEntries) * sizeof(T);
+		header.flags = arrayEntries == layout.size ? 0 : SlotMapFileCapacityArrays;
+
+		return header;
+	}
+
+	template <typename T>
+	const char* ValidateSlotMapFileHeader(const SlotMapFileHeader& header, std::uint64_t fileSize)
+	{
+		const SlotMapFileHeader expected;
+
+		if (fileSize < sizeof(SlotMapFileHeader) || std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0)
+		{
+			return "Not a slotmap file.";
+		}
+
+		if (header.version != SlotMapFileVersion)
+		{
+			return "Unsupported slotmap file version.";
+		}
+
+		if (header.byteOrder != SlotMapFileByteOrder)
+		{
+			return "Slotmap file was written on a machine with a different byte order.";
+		}
+
+		if (header.elementSize != sizeof(T) || header.elementAlignment != alignof(T))
+		{
+			return "Slotmap file holds a different element type.";
+		}
+
+		if (header.capacity <= 0 || header.size < 0 || header.reservedCount < 0 || header.regrowGeneration < 0 ||
+			static_cast<std::int64_t>(header.size) + header.reservedCount > header.capacity ||
+			header.firstFreeSlot < -1 || header.firstFreeSlot >= header.capacity ||
+			header.lastFreeSlot < -1 || header.lastFreeSlot >= header.capacity ||
+			(header.firstFreeSlot == -1) != (header.lastFreeSlot == -1))
+		{
+			return "Slotmap file header is inconsistent.";
+		}
+
+		// Recomputing the offsets catches truncated files and tampered offsets alike.
+		SlotMapLayout<T> layout;
+		layout.size = header.size;
+		layout.capacity = header.capacity;
+		const SlotMapFileHeader computed = MakeSlotMapFileHeader(layout,
+			(header.flags & SlotMapFileCapacityArrays) != 0 ? header.capacity : header.size);
+
+		if (header.slotsOffset != computed.slotsOffset || header.valueToSlotOffset != computed.valueToSlotOffset ||
+			header.valuesOffset != computed.valuesOffset || header.fileSize != computed.fileSize || fileSize < header.fileSize)
+		{
+			return "Slotmap file is truncated or corrupt.";
+		}
+
+		return nullptr;
+	}
+
+	template <typename T>
+	bool VerifySlotMapLayout(const SlotMapLayout<T>& layout)
+	{
+		for (int i = 0; i < layout.size; ++i)
+		{
+			const unsigned int slotIndex = layout.valueToSlot[i];
+			if (slotIndex >= static_cast<unsigned int>(layout.capacity) || layout.slots[slotIndex].index != i ||
+				layout.slots[slotIndex].generation < 0)
+			{
+				return false;
+			}
+		}
+
+		// Every other slot is either reserved or on the free list; the free list
+		// must end in a slot that points at itself, within capacity steps.
+		int freeCount = 0;
+		int lastVisited = -1;
+		for (int slot = layout.firstFreeSlot; slot != -1; ++freeCount)
+		{
+			if (freeCount > layout.capacity || slot < 0 || slot >= layout.capacity)
+			{
+				return false;
+			}
+
+			lastVisited = slot;
+			const int next = layout.slots[slot].index;
+			slot = next == slot ? -1 : next;
+		}
+
+		return lastVisited == layout.lastFreeSlot && freeCount + layout.size + layout.reservedCount == layout.capacity;
+	}
+
+	template <typename T>
+	bool SaveSlotMap(const SlotMapLayout<T>& layout, const char* path)
+	{
+		static_assert(std::is_trivially_copyable<T>(), "Only slotmaps with a trivially copyable element type can be saved.");
+
+		const SlotMapFileHeader header = MakeSlotMapFileHeader(layout);
+
+		// Written next to the destination and renamed over it once it is on disk,
+		// so a crash or a failed write leaves the previous file in place.
+		const std::string temporary = std::string(path) + ".tmp";
+		std::FILE* file = std::fopen(temporary.c_str(), "wb");
+		if (file == nullptr)
+		{
+			return false;
+		}
+
+		static const unsigned char padding[SlotMapFileAlignment]{};
+		std::uint64_t written = 0;
+
+		const auto writeAt = [&](std::uint64_t offset, const void* bytes, std::uint64_t count)
+		{
+			bool ok = std::fwrite(padding, 1, static_cast<std::size_t>(offset - written), file) == offset - written;
+			ok = ok && (count == 0 || std::fwrite(bytes, 1, static_cast<std::size_t>(count), file) == count);
+			written = offset + count;
+			return ok;
+		};
+
+		bool ok = writeAt(0, &header, sizeof(header));
+		ok = ok && writeAt(header.slotsOffset, layout.slots, static_cast<std::uint64_t>(layout.capacity) * sizeof(SlotMapKey));
+		ok = ok && writeAt(header.valueToSlotOffset, layout.valueToSlot, static_cast<std::uint64_t>(layout.size) * sizeof(unsigned int));
+		ok = ok && writeAt(header.valuesOffset, layout.values, static_cast<std::uint64_t>(layout.size) * sizeof(T));
+		ok = ok && MappedFile::SyncFile(file);
+
+		ok = std::fclose(file) == 0 && ok;
+		ok = ok && MappedFile::ReplaceFile(temporary.c_str(), path);
+
+		if (!ok)
+		{
+			std::remove(temporary.c_str());
+		}
+
+		return ok;
+	}
+
+	template <typename T>
+	MappedSlotMap<T>::MappedSlotMap(const char* path)
+	{
+		if (!file.OpenReadOnly(path))
+		{
+			throw std::runtime_error("[SlotMap] Could not map slotmap file.");
+		}
+
+		SlotMapFileHeader header;
+		std::memcpy(&header, file.Data(), file.Size() < sizeof(header) ? file.Size() : sizeof(header));
+
+		if (const char* error = ValidateSlotMapFileHeader<T>(header, file.Size()))
+		{
+			throw std::runtime_error(error);
+		}
+
+		layout.slots = reinterpret_cast<const SlotMapKey*>(file.Data() + header.slotsOffset);
+		layout.valueToSlot = reinterpret_cast<const unsigned int*>(file.Data() + header.valueToSlotOffset);
+		layout.values = reinterpret_cast<const T*>(file.Data() + header.valuesOffset);
+		layout.firstFreeSlot = header.firstFreeSlot;
+		layout.lastFreeSlot = header.lastFreeSlot;
+		layout.size = header.size;
+		layout.capacity = header.capacity;
+		layout.reservedCount = header.reservedCount;
+		layout.regrowGeneration = header.regrowGeneration;
+	}
+
+	template <typename T>
+	const T& MappedSlotMap<T>::operator[](const SlotMapKey& key) const
+	{
+#ifndef SLOTMAP_RELEASE
+		if (key.index < 0 || key.index >= layout.capacity)
+		{
+			throw std::out_of_range("[SlotMap] Key index is out of bounds.");
+		}
+
+		// Reserved slots store their generation inverted, so a negative one would match them.
+		if (layout.slots[key.index].generation != key.generation || key.generation < 0)
+		{
+			throw std::runtime_error("[SlotMap] Trying to use a key which is no longer valid.");
+		}
+#endif
+
+		// The slots come from the file, so this one is checked in release builds too.
+		const int index = layout.slots[key.index].index;
+		if (index < 0 || index >= layout.size)
+		{
+			throw std::out_of_range("[SlotMap] Slotmap file is corrupt: key points past the values.");
+		}
+
+		return layout.values[index];
+	}
+
+	template <typename T>
+	const T& MappedSlotMap<T>::operator[](int index) const
+	{
+#ifndef SLOTMAP_RELEASE
+		if (index < 0 || index >= layout.size)
+		{
+			throw std::out_of_range("[SlotMap] Index is out of bounds.");
+		}
+#endif
+
+		return layout.values[index];
+	}
+
+	template <typename T>
+	bool MappedSlotMap<T>::TryGet(const SlotMapKey& key, T& value) const
+	{
+		if (Contains(key))
+		{
+			value = layout.values[layout.slots[key.index].index];
+			return true;
+		}
+
+		return false;
+	}
+
+	template <typename T>
+	bool MappedSlotMap<T>::Contains(const SlotMapKey& key) const
+	{
+		// Also checks where the slot points, so a corrupt file can't send a lookup
+		// past the values. Reserved slots point at a stale free link, and store
+		// their generation inverted, so negative generations are turned away.
+		return 0 <= key.index && key.index < layout.capacity && layout.slots[key.index].generation == key.generation &&
+			key.generation >= 0 && 0 <= layout.slots[key.index].index && layout.slots[key.index].index < layout.size;
+	}
+
+	template <typename T>
+	SlotMapKey MappedSlotMap<T>::GetKeyForIndex(int index) const
+	{
+#ifndef SLOTMAP_RELEASE
+		if (index < 0 || index >= layout.size)
+		{
+			throw std::out_of_range("[SlotMap] Trying to look up invalid index.");
+		}
+#endif
+
+		const unsigned int slotIndex = layout.valueToSlot[index];
+		return SlotMapKey(static_cast<int>(slotIndex), layout.slots[slotIndex].generation);
+	}
+
+
+	template <typename T>
+	SlotMap<T> LoadSlotMap(const char* path)
+	{
+		const MappedSlotMap<T> mapped(path);
+
+		// A SlotMap follows the free list to rebuild its back links, and writes
+		// as it goes, so the slots from disk have to be sound first.
+		if (!mapped.Verify())
+		{
+			throw std::runtime_error("[SlotMap] Slotmap file is corrupt.");
+		}
+
+		return SlotMap<T>(mapped.GetLayout());
+	}
+} // namespace Unalmas
@@ -0,0 +1,336 @@
+export module SlotMapLoader;
+
+// Loads large slotmap files (see SlotMapFile) with several threads, and serves
+// lookups while it is still loading.
+//
+// Guarantees:
+// the constructor verifies the slots (see VerifySlotMapLayout) and throws if
+// they are inconsistent; then the slots and valueToSlot arrays are copied in
+// parallel before it returns; after that, the values are constructed by the
+// worker threads, in chunks, straight into the array the finished SlotMap will own
+// the file is mapped, so the workers fault in (and read) different parts of it
+// at the same time
+// chunks are handed out front to back; lookups of values in the loaded prefix
+// succeed while the rest is still loading
+// Finish() hands the arrays over to a regular SlotMap without copying them
+//
+// The file stores Stored records (trivially copyable, as in any slotmap file);
+// the map holds T values constructed from them, so T itself may be anything
+// constructible from a const Stored&.
+
+import <algorithm>;
+import <atomic>;
+import <cstdlib>;
+import <cstring>;
+import <exception>;
+import <memory>;
+import <new>;
+import <thread>;
+import <vector>;
+import <stdexcept>;
+import <type_traits>;
+import SlotMap;
+import SlotMapFile;
+
+export namespace Unalmas
+{
+	template <typename T, typename Stored = T>
+	class SlotMapLoader
+	{
+		static_assert(std::is_constructible<T, const Stored&>(), "T must be constructible from the records stored in the file.");
+
+	private:
+		MappedFile							file;
+		SlotMapStorage<T>					storage;
+		const Stored* stored{ nullptr };
+		int									chunkSize{ 0 };
+		int									chunkCount{ 0 };
+
+		std::vector<std::thread>			workers;
+		std::unique_ptr<std::atomic<unsigned char>[]>	chunkState;	// Pending, Loaded or Failed
+		std::atomic<int>					nextChunk{ 0 };
+		std::atomic<int>					loadedChunks{ 0 };			// Chunks [0, loadedChunks) are all loaded
+		std::atomic<bool>					failed{ false };
+		bool								finished{ false };
+
+		static constexpr unsigned char		Pending = 0;
+		static constexpr unsigned char		Loaded = 1;
+		static constexpr unsigned char		Failed = 2;
+
+	public:
+		// threads == 0 uses one thread per hardware thread.
+		explicit SlotMapLoader(const char* path, int threads = 0, int chunkSize = 1 << 16);
+		~SlotMapLoader();
+
+		SlotMapLoader(const SlotMapLoader& rhs) = delete;
+		SlotMapLoader& operator=(const SlotMapLoader& rhs) = delete;
+
+		// Also returns false if the key's value hasn't been loaded yet.
+		bool								TryGet(const SlotMapKey& key, T& value) const;
+
+		int									Size() const { return storage.size; }
+		int									LoadedSize() const;
+		bool								IsDone() const { return LoadedSize() == storage.size; }
+
+		// Waits for the remaining values, and returns the map; throws if any of
+		// them could not be constructed. Only call once.
+		SlotMap<T>							Finish();
+
+	private:
+		void								Work();
+		void								LoadChunk(int chunk);
+		void								AdvanceLoadedChunks();
+		void								Join();
+		void								DestroyLoadedValues();
+
+		template <typename F>
+		static void							Parallel(int threads, int count, F&& func);
+	};
+
+	template <typename T, typename Stored>
+	SlotMapLoader<T, Stored>::SlotMapLoader(const char* path, int threads, int chunkSize_) : chunkSize{ chunkSize_ < 1 ? 1 : chunkSize_ }
+	{
+		if (!file.OpenReadOnly(path))
+		{
+			throw std::runtime_error("[SlotMap] Could not map slotmap file.");
+		}
+
+		SlotMapFileHeader header;
+		std::memcpy(&header, file.Data(), file.Size() < sizeof(header) ? file.Size() : sizeof(header));
+
+		if (const char* error = ValidateSlotMapFileHeader<Stored>(header, file.Size()))
+		{
+			throw std::runtime_error(error);
+		}
+
+		const auto* slots = reinterpret_cast<const SlotMapKey*>(file.Data() + header.slotsOffset);
+		const auto* valueToSlot = reinterpret_cast<const unsigned int*>(file.Data() + header.valueToSlotOffset);
+		stored = reinterpret_cast<const Stored*>(file.Data() + header.valuesOffset);
+
+		// The finished SlotMap follows the free list from the file, and lookups
+		// follow the slots, so check them before anything is allocated or started.
+		SlotMapLayout<Stored> layout;
+		layout.slots = slots;
+		layout.valueToSlot = valueToSlot;
+		layout.firstFreeSlot = header.firstFreeSlot;
+		layout.lastFreeSlot = header.lastFreeSlot;
+		layout.size = header.size;
+		layout.capacity = header.capacity;
+		layout.reservedCount = header.reservedCount;
+
+		if (!VerifySlotMapLayout(layout))
+		{
+			throw std::runtime_error("[SlotMap] Slotmap file is corrupt.");
+		}
+
+		if (threads <= 0)
+		{
+			threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		}
+
+		const int capacity = header.capacity;
+		const int size = header.size;
+
+		storage.capacity = capacity;
+		storage.size = size;
+		storage.firstFreeSlot = header.firstFreeSlot;
+		storage.lastFreeSlot = header.lastFreeSlot;
+		storage.reservedCount = header.reservedCount;
+		storage.regrowGeneration = header.regrowGeneration;
+		storage.slots = new SlotMapKey[capacity];
+		storage.valueToSlot = new unsigned int[capacity];
+		storage.values = static_cast<T*>(std::malloc(capacity * sizeof(T)));
+
+		// The key arrays are small next to the values; copy them before anyone can look anything up.
+		Parallel(threads, (capacity + chunkSize - 1) / chunkSize, [&](int chunk)
+		{
+			const int first = chunk * chunkSize;
+			const int count = std::min(chunkSize, capacity - first);
+			std::memcpy(storage.slots + first, slots + first, count * sizeof(SlotMapKey));
+
+			if (first < size)
+			{
+				std::memcpy(storage.valueToSlot + first, valueToSlot + first, std::min(count, size - first) * sizeof(unsigned int));
+			}
+		});
+
+		chunkCount = (size + chunkSize - 1) / chunkSize;
+		chunkState.reset(new std::atomic<unsigned char>[chunkCount]);
+		for (int i = 0; i < chunkCount; ++i)
+		{
+			chunkState[i].store(Pending, std::memory_order_relaxed);
+		}
+
+		for (int i = 0; i < std::min(threads, chunkCount); ++i)
+		{
+			workers.emplace_back([this]() { Work(); });
+		}
+	}
+
+	template <typename T, typename Stored>
+	SlotMapLoader<T, Stored>::~SlotMapLoader()
+	{
+		if (!finished)
+		{
+			failed.store(true);			// Makes the workers stop early
+			Join();
+			DestroyLoadedValues();
+
+			delete[] storage.slots;
+			delete[] storage.valueToSlot;
+			std::free(storage.values);
+		}
+	}
+
+	template <typename T, typename Stored>
+	template <typename F>
+	void SlotMapLoader<T, Stored>::Parallel(int threads, int count, F&& func)
+	{
+		std::atomic<int> next{ 0 };
+		const auto work = [&]()
+		{
+			for (int i = next.fetch_add(1); i < count; i = next.fetch_add(1))
+			{
+				func(i);
+			}
+		};
+
+		std::vector<std::thread> helpers;
+		for (int i = 1; i < std::min(threads, count); ++i)
+		{
+			helpers.emplace_back(work);
+		}
+
+		work();
+
+		for (auto& helper : helpers)
+		{
+			helper.join();
+		}
+	}
+
+	template <typename T, typename Stored>
+	void SlotMapLoader<T, Stored>::Work()
+	{
+		for (int chunk = nextChunk.fetch_add(1); chunk < chunkCount && !failed.load(std::memory_order_relaxed);
+			chunk = nextChunk.fetch_add(1))
+		{
+			LoadChunk(chunk);
+		}
+	}
+
+	template <typename T, typename Stored>
+	void SlotMapLoader<T, Stored>::LoadChunk(int chunk)
+	{
+		const int first = chunk * chunkSize;
+		const int last = std::min(first + chunkSize, storage.size);
+
+		int i = first;
+		try
+		{
+			for (; i < last; ++i)
+			{
+				new (&storage.values[i]) T(stored[i]);
+			}
+		}
+		catch (...)
+		{
+			// Leave no half-loaded chunk behind.
+			while (i-- > first)
+			{
+				storage.values[i].~T();
+			}
+
+			chunkState[chunk].store(Failed, std::memory_order_release);
+			failed.store(true);
+			return;
+		}
+
+		chunkState[chunk].store(Loaded, std::memory_order_release);
+		AdvanceLoadedChunks();
+	}
+
+	template <typename T, typename Stored>
+	void SlotMapLoader<T, Stored>::AdvanceLoadedChunks()
+	{
+		// Whoever finishes the chunk at the front moves the front along.
+		int loaded = loadedChunks.load(std::memory_order_acquire);
+		while (loaded < chunkCount && chunkState[loaded].load(std::memory_order_acquire) == Loaded)
+		{
+			if (loadedChunks.compare_exchange_weak(loaded, loaded + 1, std::memory_order_acq_rel))
+			{
+				++loaded;
+			}
+		}
+	}
+
+	template <typename T, typename Stored>
+	int SlotMapLoader<T, Stored>::LoadedSize() const
+	{
+		return std::min(storage.size, loadedChunks.load(std::memory_order_acquire) * chunkSize);
+	}
+
+	template <typename T, typename Stored>
+	bool SlotMapLoader<T, Stored>::TryGet(const SlotMapKey& key, T& value) const
+	{
+		if (key.index < 0 || key.index >= storage.capacity)
+		{
+			return false;
+		}
+
+		// Reserved slots store their generation inverted, and still point at a
+		// stale free link, so a negative generation would find an unrelated value.
+		const SlotMapKey& slot = storage.slots[key.index];
+		if (slot.generation != key.generation || key.generation < 0 || slot.index >= LoadedSize())
+		{
+			return false;
+		}
+
+		value = storage.values[slot.index];
+		return true;
+	}
+
+	template <typename T, typename Stored>
+	void SlotMapLoader<T, Stored>::Join()
+	{
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+
+		workers.clear();
+	}
+
+	template <typename T, typename Stored>
+	void SlotMapLoader<T, Stored>::DestroyLoadedValues()
+	{
+		for (int chunk = 0; chunk < chunkCount; ++chunk)
+		{
+			if (chunkState[chunk].load(std::memory_order_relaxed) == Loaded)
+			{
+				const int first = chunk * chunkSize;
+				const int last = std::min(first + chunkSize, storage.size);
+				for (int i = first; i < last; ++i)
+				{
+					storage.values[i].~T();
+				}
+			}
+		}
+	}
+
+	template <typename T, typename Stored>
+	SlotMap<T> SlotMapLoader<T, Stored>::Finish()
+	{
+		Join();
+
+		if (failed.load())
+		{
+			throw std::runtime_error("[SlotMap] Could not construct all values of the slotmap file.");
+		}
+
+		finished = true;
+		file.Close();
+
+		return SlotMap<T>(std::move(storage));
+	}
+} // namespace Unalmas
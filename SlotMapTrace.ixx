@@ -0,0 +1,423 @@
+export module SlotMapTrace;
+
+#define DEFAULT_CAPACITY 8
+
+// Recording what a slotmap is asked to do, to replay it later (e.g. against a
+// different configuration, see Benchmarks replay).
+//
+// Guarantees:
+// TracedSlotMap behaves exactly like the SlotMap it wraps; while it isn't
+// recording, the only extra cost per call is a null pointer check
+// every insert, erase, lookup (operator[], TryGet, Contains), iteration and
+// clear is recorded in call order, with the key involved and the time since
+// recording started
+// recording can start at any point: the keys that are live by then are written
+// first, so a replay can recreate them before the recorded calls
+// records are variable-length (usually 4 to 8 bytes) and written in large blocks
+//
+// Lookups that throw (operator[] with a stale key) aren't recorded.
+
+import <chrono>;
+import <cstdint>;
+import <cstdio>;
+import <cstring>;
+import <utility>;
+import <vector>;
+import SlotMap;
+
+export namespace Unalmas
+{
+	enum class SlotMapTraceOp : unsigned char
+	{
+		Existing,	// Key was live when recording started
+		Insert,
+		Erase,
+		Get,		// operator[]
+		TryGet,
+		Contains,
+		Iterate,	// begin(); no key
+		Clear,		// No key
+	};
+
+	struct SlotMapTraceRecord
+	{
+		SlotMapTraceOp	op{ SlotMapTraceOp::Existing };
+		SlotMapKey		key;
+		std::uint64_t	nanoseconds{ 0 };	// Since recording started
+	};
+
+	struct SlotMapTraceHeader
+	{
+		char			magic[8]{ 'S', 'M', 'T', 'R', 'A', 'C', 'E', '\0' };
+		std::uint32_t	version{ 1 };
+		std::uint32_t	elementSize{ 0 };
+	};
+
+	class SlotMapTraceWriter
+	{
+	public:
+		SlotMapTraceWriter() = default;
+		~SlotMapTraceWriter() { Close(); }
+
+		SlotMapTraceWriter(const SlotMapTraceWriter& rhs) = delete;
+		SlotMapTraceWriter& operator=(const SlotMapTraceWriter& rhs) = delete;
+
+		bool					Open(const char* path, int elementSize);
+
+		// Returns false if anything could not be written since Open.
+		bool					Close();
+
+		bool					IsOpen() const { return file != nullptr; }
+		std::uint64_t			RecordCount() const { return recordCount; }
+
+		void					Record(SlotMapTraceOp op, const SlotMapKey& key = SlotMapKey());
+
+	private:
+		void					Put(std::uint64_t value);
+		bool					WriteBuffer();
+
+		static constexpr std::size_t	BufferSize = 1 << 16;
+
+		std::FILE* file{ nullptr };
+		std::vector<unsigned char>		buffer;
+		std::chrono::steady_clock::time_point	start;
+		std::uint64_t			lastNanoseconds{ 0 };
+		std::uint64_t			recordCount{ 0 };
+		bool					failed{ false };
+	};
+
+	class SlotMapTraceReader
+	{
+	public:
+		SlotMapTraceReader() = default;
+		~SlotMapTraceReader() { Close(); }
+
+		SlotMapTraceReader(const SlotMapTraceReader& rhs) = delete;
+		SlotMapTraceReader& operator=(const SlotMapTraceReader& rhs) = delete;
+
+		// Returns false if the file can't be read, or isn't a trace.
+		bool					Open(const char* path);
+		void					Close();
+
+		int						ElementSize() const { return static_cast<int>(header.elementSize); }
+
+		// Returns false at the end of the trace (or at a truncated record).
+		bool					Next(SlotMapTraceRecord& record);
+
+	private:
+		bool					Get(std::uint64_t& value);
+
+		std::FILE* file{ nullptr };
+		SlotMapTraceHeader		header;
+		std::uint64_t			nanoseconds{ 0 };
+	};
+
+	// A SlotMap that can record the calls made to it.
+	template <typename T>
+	class TracedSlotMap
+	{
+	private:
+		SlotMap<T>							map;
+		SlotMapTraceWriter					writer;
+		SlotMapTraceWriter* trace{ nullptr };	// Set while recording
+
+	public:
+		TracedSlotMap() : TracedSlotMap(DEFAULT_CAPACITY) {}
+		TracedSlotMap(int capacity) : map(capacity) {}
+
+		// Starts writing a trace to the given file, beginning with the keys that
+		// are live right now. Returns false if the file can't be opened.
+		bool								StartRecording(const char* path);
+
+		// Returns false if any part of the trace could not be written.
+		bool								StopRecording();
+		bool								IsRecording() const { return trace != nullptr; }
+
+		T& operator[](const SlotMapKey& key) const;
+		bool								TryGet(const SlotMapKey& key, T& value) const;
+		bool								Contains(const SlotMapKey& key) const;
+		int									Size() const { return map.Size(); }
+		int									Capacity() const { return map.Capacity(); }
+
+		template <typename U>
+		SlotMapKey							Insert(U&& value);
+		bool								Erase(const SlotMapKey& key);
+		void								Clear();
+
+		SlotMapConstIterator<T>				begin() const;
+		SlotMapConstIterator<T>				end() const { return map.end(); }
+
+		// Unrecorded access, e.g. for saving the map.
+		const SlotMap<T>& Map() const { return map; }
+	};
+
+	bool SlotMapTraceWriter::Open(const char* path, int elementSize)
+	{
+		Close();
+
+		file = std::fopen(path, "wb");
+		if (!file)
+		{
+			return false;
+		}
+
+		SlotMapTraceHeader header;
+		header.elementSize = static_cast<std::uint32_t>(elementSize);
+
+		buffer.clear();
+		buffer.reserve(BufferSize);
+		buffer.resize(sizeof(header));
+		std::memcpy(buffer.data(), &header, sizeof(header));
+
+		start = std::chrono::steady_clock::now();
+		lastNanoseconds = 0;
+		recordCount = 0;
+		failed = false;
+
+		return true;
+	}
+
+	bool SlotMapTraceWriter::Close()
+	{
+		if (!file)
+		{
+			return !failed;
+		}
+
+		WriteBuffer();
+		failed = std::fclose(file) != 0 || failed;
+		file = nullptr;
+
+		return !failed;
+	}
+
+	void SlotMapTraceWriter::Record(SlotMapTraceOp op, const SlotMapKey& key)
+	{
+		const auto now = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count());
+
+		// Op, time since the previous record, then the key; index + 1 so that the
+		// missing key (-1) is 0, and the generation zigzag encoded, as reserved
+		// slots have negative ones.
+		buffer.push_back(static_cast<unsigned char>(op));
+		Put(now - lastNanoseconds);
+		Put(static_cast<std::uint64_t>(static_cast<std::int64_t>(key.index) + 1));
+		Put((static_cast<std::uint32_t>(key.generation) << 1) ^ static_cast<std::uint32_t>(key.generation >> 31));
+
+		lastNanoseconds = now;
+		++recordCount;
+
+		if (buffer.size() + 32 > BufferSize)
+		{
+			WriteBuffer();
+		}
+	}
+
+	void SlotMapTraceWriter::Put(std::uint64_t value)
+	{
+		// LEB128: seven bits per byte, low bits first.
+		while (value >= 0x80)
+		{
+			buffer.push_back(static_cast<unsigned char>(value | 0x80));
+			value >>= 7;
+		}
+
+		buffer.push_back(static_cast<unsigned char>(value));
+	}
+
+	bool SlotMapTraceWriter::WriteBuffer()
+	{
+		if (!buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size())
+		{
+			failed = true;
+		}
+
+		buffer.clear();
+		return !failed;
+	}
+
+	bool SlotMapTraceReader::Open(const char* path)
+	{
+		Close();
+
+		file = std::fopen(path, "rb");
+		if (!file)
+		{
+			return false;
+		}
+
+		const SlotMapTraceHeader expected;
+		if (std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+			|| header.version != expected.version)
+		{
+			Close();
+			return false;
+		}
+
+		nanoseconds = 0;
+		return true;
+	}
+
+	void SlotMapTraceReader::Close()
+	{
+		if (file)
+		{
+			std::fclose(file);
+			file = nullptr;
+		}
+	}
+
+	bool SlotMapTraceReader::Get(std::uint64_t& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			const int byte = std::getc(file);
+			if (byte == EOF)
+			{
+				return false;
+			}
+
+			value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool SlotMapTraceReader::Next(SlotMapTraceRecord& record)
+	{
+		if (!file)
+		{
+			return false;
+		}
+
+		const int op = std::getc(file);
+		std::uint64_t delta;
+		std::uint64_t index;
+		std::uint64_t generation;
+
+		if (op == EOF || op > static_cast<int>(SlotMapTraceOp::Clear) || !Get(delta) || !Get(index) || !Get(generation))
+		{
+			return false;
+		}
+
+		nanoseconds += delta;
+
+		record.op = static_cast<SlotMapTraceOp>(op);
+		record.nanoseconds = nanoseconds;
+		record.key.index = static_cast<int>(static_cast<std::int64_t>(index) - 1);
+		record.key.generation = static_cast<int>(static_cast<std::uint32_t>(generation >> 1) ^ (0u - static_cast<std::uint32_t>(generation & 1)));
+
+		return true;
+	}
+
+	template <typename T>
+	bool TracedSlotMap<T>::StartRecording(const char* path)
+	{
+		StopRecording();
+
+		if (!writer.Open(path, sizeof(T)))
+		{
+			return false;
+		}
+
+		for (int i = 0; i < map.Size(); ++i)
+		{
+			writer.Record(SlotMapTraceOp::Existing, map.GetKeyForIndex(i));
+		}
+
+		trace = &writer;
+		return true;
+	}
+
+	template <typename T>
+	bool TracedSlotMap<T>::StopRecording()
+	{
+		trace = nullptr;
+		return writer.Close();
+	}
+
+	template <typename T>
+	T& TracedSlotMap<T>::operator[](const SlotMapKey& key) const
+	{
+		T& value = map[key];
+		if (trace)
+		{
+			trace->Record(SlotMapTraceOp::Get, key);
+		}
+
+		return value;
+	}
+
+	template <typename T>
+	bool TracedSlotMap<T>::TryGet(const SlotMapKey& key, T& value) const
+	{
+		if (trace)
+		{
+			trace->Record(SlotMapTraceOp::TryGet, key);
+		}
+
+		return map.TryGet(key, value);
+	}
+
+	template <typename T>
+	bool TracedSlotMap<T>::Contains(const SlotMapKey& key) const
+	{
+		if (trace)
+		{
+			trace->Record(SlotMapTraceOp::Contains, key);
+		}
+
+		return map.Contains(key);
+	}
+
+	template <typename T>
+	template <typename U>
+	SlotMapKey TracedSlotMap<T>::Insert(U&& value)
+	{
+		const SlotMapKey key = map.Insert(std::forward<U>(value));
+		if (trace)
+		{
+			trace->Record(SlotMapTraceOp::Insert, key);
+		}
+
+		return key;
+	}
+
+	template <typename T>
+	bool TracedSlotMap<T>::Erase(const SlotMapKey& key)
+	{
+		if (trace)
+		{
+			trace->Record(SlotMapTraceOp::Erase, key);
+		}
+
+		return map.Erase(key);
+	}
+
+	template <typename T>
+	void TracedSlotMap<T>::Clear()
+	{
+		if (trace)
+		{
+			trace->Record(SlotMapTraceOp::Clear);
+		}
+
+		map.Clear();
+	}
+
+	template <typename T>
+	SlotMapConstIterator<T> TracedSlotMap<T>::begin() const
+	{
+		if (trace)
+		{
+			trace->Record(SlotMapTraceOp::Iterate);
+		}
+
+		return map.begin();
+	}
+} // namespace Unalmas
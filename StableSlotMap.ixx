@@ -0,0 +1,654 @@
+export module StableSlotMap;
+
+#define DEFAULT_CAPACITY 8
+
+// A slotmap that keeps each value at its key's index, instead of in a dense
+// array behind the slots: a lookup reads the generation and the value at the
+// same index, and an erase never moves another value.
+//
+// Guarantees:
+// constant time lookup, erase, and insert (InsertAt excepted, see there)
+// values never move while they are in the map (until it grows), so references
+// and pointers to them stay valid across inserts and erases of other values
+// keys to erased values won't work (until an overflow occurs)
+// keys with a negative generation never match a slot, free ones included
+// iteration visits the live values in index order, and jumps over each run of
+// free slots in one step, using a jump-counting skipfield: the first and last
+// slot of every free run hold its length, live slots hold 0
+// free runs are reused from their first slot, most recently freed run first,
+// so inserts fill holes instead of spreading out
+//
+// The price is that the values are no longer contiguous: iterating a map with
+// many holes touches more memory than SlotMap's dense array would.
+
+import <cstddef>;
+import <cstdlib>;
+import <cstring>;
+import <new>;
+import <stdexcept>;
+import <type_traits>;
+import <utility>;
+import SlotMap;
+
+export namespace Unalmas
+{
+	// Read-only view of a stable slotmap's arrays, valid until the map next changes.
+	template <typename T>
+	struct StableSlotMapLayout
+	{
+		const T* values{ nullptr };				// capacity entries, constructed where the generation isn't negative
+		const int* generations{ nullptr };		// capacity entries; inverted while the slot is free
+		int						size{ 0 };
+		int						capacity{ 0 };
+	};
+
+	template <typename T>
+	struct StableSlotMapConstIterator
+	{
+		StableSlotMapConstIterator(T* values_, const int* skipfield_, const int* generations_, int capacity_, int index_)
+			: values{ values_ }, skipfield{ skipfield_ }, generations{ generations_ }, capacity{ capacity_ }, index{ index_ }
+		{}
+
+		bool operator!=(const StableSlotMapConstIterator<T>& rhs) const
+		{
+			return values != rhs.values || index != rhs.index;
+		}
+
+		StableSlotMapConstIterator& operator++()
+		{
+			// The slot after a live one is either live too, or starts a free run.
+			++index;
+			index += skipfield[index];
+			return *this;
+		}
+
+		const T& operator*() const
+		{
+#ifndef SLOTMAP_RELEASE
+			if (index < 0 || index >= capacity)
+			{
+				throw std::out_of_range("[SlotMap] Trying to dereference invalid iterator.");
+			}
+#endif
+
+			return values[index];
+		}
+
+		// The key of the value the iterator is at.
+		SlotMapKey Key() const { return SlotMapKey(index, generations[index]); }
+
+	protected:
+		T* values;
+		const int* skipfield;
+		const int* generations;
+		int		capacity;
+		int		index;
+	};
+
+	template <typename T>
+	struct StableSlotMapIterator : public StableSlotMapConstIterator<T>
+	{
+		StableSlotMapIterator(T* values_, const int* skipfield_, const int* generations_, int capacity_, int index_)
+			: StableSlotMapConstIterator<T>(values_, skipfield_, generations_, capacity_, index_)
+		{}
+
+		T& operator*() const
+		{
+#ifndef SLOTMAP_RELEASE
+			if (this->index < 0 || this->index >= this->capacity)
+			{
+				throw std::out_of_range("[SlotMap] Trying to dereference invalid iterator.");
+			}
+#endif
+
+			return this->values[this->index];
+		}
+	};
+
+	template <typename T>
+	class StableSlotMap
+	{
+	private:
+		T* values{ nullptr };
+		int* generations{ nullptr };		// Inverted (so negative) while the slot is free
+		int* skipfield{ nullptr };			// capacity + 1 entries; the last one stays 0, so iteration ends there
+		int* nextFreeRun{ nullptr };		// Links of the free runs, at their first slot
+		int* previousFreeRun{ nullptr };
+		int						firstFreeRun{ -1 };
+		int						size{ 0 };
+		int						capacity{ 0 };
+
+	public:
+		StableSlotMap();
+		StableSlotMap(int capacity);
+
+		StableSlotMap(const StableSlotMap& rhs) = delete;
+		StableSlotMap(StableSlotMap&& rhs);
+		~StableSlotMap();
+
+		StableSlotMap& operator=(const StableSlotMap& rhs) = delete;	// See SlotMap
+		StableSlotMap& operator=(StableSlotMap&& rhs) = delete;
+
+		T& operator[](const SlotMapKey& key) const;
+		bool					TryGet(const SlotMapKey& key, T& value) const;
+		bool					Contains(const SlotMapKey& key) const;
+
+		int						Size() const { return size; }
+		int						Capacity() const { return capacity; }
+		SlotMapMemoryUsage		MemoryUsage() const;
+
+		template <typename U>
+		SlotMapKey				Insert(U&& value);
+
+		// Inserts under a given key, like SlotMap::InsertAt. Linear in how far the
+		// key's slot is from the start of its free run, as the run has to be split.
+		template <typename... Args>
+		bool					InsertAt(const SlotMapKey& key, Args&&... args);
+
+		// Like SlotMap::RetireKey.
+		bool					RetireKey(const SlotMapKey& key);
+
+		bool					Erase(const SlotMapKey& key);
+		void					Clear();
+
+		StableSlotMapLayout<T>	GetLayout() const;
+
+		StableSlotMapConstIterator<T>	begin() const;
+		StableSlotMapConstIterator<T>	end() const;
+
+		StableSlotMapIterator<T>		begin();
+		StableSlotMapIterator<T>		end();
+
+	private:
+		void					Grow(int minCapacity = 0);
+		void					DestructExistingItems();
+		void					MarkFree(int first, int count);
+
+		void					PushFreeRun(int first);
+		void					UnlinkFreeRun(int first);
+		void					MoveFreeRun(int from, int to);
+	};
+
+	template <typename T>
+	StableSlotMap<T>::StableSlotMap() : StableSlotMap<T>(DEFAULT_CAPACITY)
+	{
+	}
+
+	template <typename T>
+	StableSlotMap<T>::StableSlotMap(int capacity_)
+	{
+		capacity = capacity_ < 1 ? 1 : capacity_;
+
+		values = static_cast<T*>(std::malloc(capacity * sizeof(T)));
+		generations = new int[capacity];
+		skipfield = new int[capacity + 1];
+		nextFreeRun = new int[capacity];
+		previousFreeRun = new int[capacity];
+
+		for (int i = 0; i < capacity; ++i)
+		{
+			generations[i] = ~0;
+		}
+
+		skipfield[capacity] = 0;
+		MarkFree(0, capacity);
+		PushFreeRun(0);
+	}
+
+	template <typename T>
+	StableSlotMap<T>::StableSlotMap(StableSlotMap<T>&& rhs)
+	{
+		values = rhs.values;
+		generations = rhs.generations;
+		skipfield = rhs.skipfield;
+		nextFreeRun = rhs.nextFreeRun;
+		previousFreeRun = rhs.previousFreeRun;
+		firstFreeRun = rhs.firstFreeRun;
+		size = rhs.size;
+		capacity = rhs.capacity;
+
+		rhs.values = nullptr;
+		rhs.generations = nullptr;
+		rhs.skipfield = nullptr;
+		rhs.nextFreeRun = nullptr;
+		rhs.previousFreeRun = nullptr;
+		rhs.firstFreeRun = -1;
+		rhs.size = 0;
+		rhs.capacity = 0;
+	}
+
+	template <typename T>
+	StableSlotMap<T>::~StableSlotMap()
+	{
+		DestructExistingItems();
+		std::free(values);
+
+		delete[] generations;
+		delete[] skipfield;
+		delete[] nextFreeRun;
+		delete[] previousFreeRun;
+	}
+
+	template <typename T>
+	void StableSlotMap<T>::DestructExistingItems()
+	{
+		if (size == 0)
+		{
+			return;
+		}
+
+		for (int i = skipfield[0]; i < capacity; ++i, i += skipfield[i])
+		{
+			values[i].~T();
+		}
+	}
+
+	template <typename T>
+	void StableSlotMap<T>::MarkFree(int first, int count)
+	{
+		// Only the ends of a run are ever read.
+		skipfield[first] = count;
+		skipfield[first + count - 1] = count;
+	}
+
+	template <typename T>
+	void StableSlotMap<T>::PushFreeRun(int first)
+	{
+		nextFreeRun[first] = firstFreeRun;
+		previousFreeRun[first] = -1;
+
+		if (firstFreeRun != -1)
+		{
+			previousFreeRun[firstFreeRun] = first;
+		}
+
+		firstFreeRun = first;
+	}
+
+	template <typename T>
+	void StableSlotMap<T>::UnlinkFreeRun(int first)
+	{
+		const int next = nextFreeRun[first];
+		const int previous = previousFreeRun[first];
+
+		if (previous == -1)
+		{
+			firstFreeRun = next;
+		}
+		else
+		{
+			nextFreeRun[previous] = next;
+		}
+
+		if (next != -1)
+		{
+			previousFreeRun[next] = previous;
+		}
+	}
+
+	template <typename T>
+	void StableSlotMap<T>::MoveFreeRun(int from, int to)
+	{
+		// The run now starts somewhere else, but keeps its place in the list.
+		const int next = nextFreeRun[from];
+		const int previous = previousFreeRun[from];
+
+		nextFreeRun[to] = next;
+		previousFreeRun[to] = previous;
+
+		if (previous == -1)
+		{
+			firstFreeRun = to;
+		}
+		else
+		{
+			nextFreeRun[previous] = to;
+		}
+
+		if (next != -1)
+		{
+			previousFreeRun[next] = to;
+		}
+	}
+
+	template <typename T>
+	T& StableSlotMap<T>::operator[](const SlotMapKey& key) const
+	{
+#ifndef SLOTMAP_RELEASE
+		if (key.index < 0 || key.index >= capacity)
+		{
+			throw std::out_of_range("[SlotMap] Key index is out of bounds.");
+		}
+
+		// Free slots store their generation inverted, so a negative one would match them.
+		if (generations[key.index] != key.generation || key.generation < 0)
+		{
+			throw std::runtime_error("[SlotMap] Trying to use a key which is no longer valid.");
+		}
+#endif
+
+		return values[key.index];
+	}
+
+	template <typename T>
+	bool StableSlotMap<T>::TryGet(const SlotMapKey& key, T& value) const
+	{
+		// Free slots have negative generations, which no valid key has.
+		if (0 <= key.index && key.index < capacity && generations[key.index] == key.generation && key.generation >= 0)
+		{
+			value = values[key.index];
+			return true;
+		}
+
+		return false;
+	}
+
+	template <typename T>
+	bool StableSlotMap<T>::Contains(const SlotMapKey& key) const
+	{
+		return 0 <= key.index && key.index < capacity && generations[key.index] == key.generation && key.generation >= 0;
+	}
+
+	template <typename T>
+	SlotMapMemoryUsage StableSlotMap<T>::MemoryUsage() const
+	{
+		// Generations and the skipfield take the place of the slots; there is no
+		// valueToSlot, and the free run links come with every slot, whether it is
+		// in use or not.
+		const std::size_t used = static_cast<std::size_t>(size);
+		const std::size_t unused = static_cast<std::size_t>(capacity) - used;
+
+		SlotMapMemoryUsage usage;
+		usage.slots.live = used * 2 * sizeof(int);
+		usage.slots.free = unused * 2 * sizeof(int) + sizeof(int);
+		usage.values.live = used * sizeof(T);
+		usage.values.free = unused * sizeof(T);
+		usage.freeListLinks.live = used * 2 * sizeof(int);
+		usage.freeListLinks.free = unused * 2 * sizeof(int);
+		usage.occupancy = capacity > 0 ? static_cast<double>(size) / capacity : 0.0;
+
+		return usage;
+	}
+
+	template <typename T>
+	template <typename U>
+	SlotMapKey StableSlotMap<T>::Insert(U&& value)
+	{
+		if (firstFreeRun == -1)
+		{
+			Grow();
+		}
+
+		// Take the first slot of the run; the rest of it (if any) moves up by one.
+		const int index = firstFreeRun;
+		const int length = skipfield[index];
+
+		if (length == 1)
+		{
+			UnlinkFreeRun(index);
+		}
+		else
+		{
+			MarkFree(index + 1, length - 1);
+			MoveFreeRun(index, index + 1);
+		}
+
+		skipfield[index] = 0;
+		new (&values[index]) T(std::forward<U>(value));
+		generations[index] = ~generations[index];
+		size++;
+
+		return SlotMapKey(index, generations[index]);
+	}
+
+	template <typename T>
+	template <typename... Args>
+	bool StableSlotMap<T>::InsertAt(const SlotMapKey& key, Args&&... args)
+	{
+		if (key.index < 0 || key.generation < 0)
+		{
+			return false;
+		}
+
+		if (key.index >= capacity)
+		{
+			Grow(key.index + 1);
+		}
+
+		const int index = key.index;
+		if (generations[index] >= 0 || ~generations[index] > key.generation)
+		{
+			return false;
+		}
+
+		// Runs start right after a live slot (or at 0); the end holds the length.
+		int first = index;
+		while (first > 0 && generations[first - 1] < 0)
+		{
+			--first;
+		}
+
+		const int last = first + skipfield[first] - 1;
+
+		if (first < index)
+		{
+			MarkFree(first, index - first);
+		}
+
+		if (index < last)
+		{
+			MarkFree(index + 1, last - index);
+		}
+
+		if (first == index)
+		{
+			if (index < last)
+			{
+				MoveFreeRun(index, index + 1);
+			}
+			else
+			{
+				UnlinkFreeRun(index);
+			}
+		}
+		else if (index < last)
+		{
+			PushFreeRun(index + 1);
+		}
+
+		skipfield[index] = 0;
+		new (&values[index]) T(std::forward<Args>(args)...);
+		generations[index] = key.generation;
+		size++;
+
+		return true;
+	}
+
+	template <typename T>
+	bool StableSlotMap<T>::RetireKey(const SlotMapKey& key)
+	{
+		if (key.index < 0 || key.generation < 0)
+		{
+			return false;
+		}
+
+		if (key.index >= capacity)
+		{
+			Grow(key.index + 1);
+		}
+
+		int& generation = generations[key.index];
+		if (generation >= 0)
+		{
+			return false;
+		}
+
+		// Free slots hold the generation of the next key they issue, inverted.
+		if (~generation <= key.generation)
+		{
+			generation = ~(key.generation + 1);
+		}
+
+		return true;
+	}
+
+	template <typename T>
+	bool StableSlotMap<T>::Erase(const SlotMapKey& key)
+	{
+		if (key.index < 0 || key.index >= capacity || generations[key.index] != key.generation || key.generation < 0)
+		{
+			return false;
+		}
+
+		const int index = key.index;
+
+		values[index].~T();
+		generations[index] = ~(key.generation + 1);
+		size--;
+
+		// Join the free runs on either side, if there are any; the one before
+		// keeps its place in the list, the one after is absorbed.
+		const bool freeBefore = index > 0 && generations[index - 1] < 0;
+		const bool freeAfter = index + 1 < capacity && generations[index + 1] < 0;
+
+		const int before = freeBefore ? skipfield[index - 1] : 0;
+		const int after = freeAfter ? skipfield[index + 1] : 0;
+
+		if (freeAfter)
+		{
+			if (freeBefore)
+			{
+				UnlinkFreeRun(index + 1);
+			}
+			else
+			{
+				MoveFreeRun(index + 1, index);
+			}
+		}
+		else if (!freeBefore)
+		{
+			PushFreeRun(index);
+		}
+
+		MarkFree(index - before, before + 1 + after);
+
+		return true;
+	}
+
+	template <typename T>
+	void StableSlotMap<T>::Clear()
+	{
+		DestructExistingItems();
+
+		for (int i = 0; i < capacity; ++i)
+		{
+			if (generations[i] >= 0)
+			{
+				generations[i] = ~(generations[i] + 1);
+			}
+		}
+
+		firstFreeRun = -1;
+		size = 0;
+		MarkFree(0, capacity);
+		PushFreeRun(0);
+	}
+
+	template <typename T>
+	void StableSlotMap<T>::Grow(int minCapacity)
+	{
+		const int newCapacity = capacity * 2 < minCapacity ? minCapacity : capacity * 2;
+
+		T* newValues = static_cast<T*>(std::malloc(newCapacity * sizeof(T)));
+		int* newGenerations = new int[newCapacity];
+		int* newSkipfield = new int[newCapacity + 1];
+		int* newNextFreeRun = new int[newCapacity];
+		int* newPreviousFreeRun = new int[newCapacity];
+
+		std::memcpy(newGenerations, generations, capacity * sizeof(int));
+		std::memcpy(newSkipfield, skipfield, capacity * sizeof(int));
+		std::memcpy(newNextFreeRun, nextFreeRun, capacity * sizeof(int));
+		std::memcpy(newPreviousFreeRun, previousFreeRun, capacity * sizeof(int));
+
+		if constexpr (std::is_trivially_copyable_v<T>)
+		{
+			std::memcpy(newValues, values, capacity * sizeof(T));
+		}
+		else if (size > 0)
+		{
+			for (int i = skipfield[0]; i < capacity; ++i, i += skipfield[i])
+			{
+				new (&newValues[i]) T(std::move(values[i]));
+				values[i].~T();
+			}
+		}
+
+		std::free(values);
+		delete[] generations;
+		delete[] skipfield;
+		delete[] nextFreeRun;
+		delete[] previousFreeRun;
+
+		values = newValues;
+		generations = newGenerations;
+		skipfield = newSkipfield;
+		nextFreeRun = newNextFreeRun;
+		previousFreeRun = newPreviousFreeRun;
+
+		for (int i = capacity; i < newCapacity; ++i)
+		{
+			generations[i] = ~0;
+		}
+
+		skipfield[newCapacity] = 0;
+
+		// The new slots extend a free run at the old end, or start one of their own.
+		if (generations[capacity - 1] < 0)
+		{
+			const int length = skipfield[capacity - 1];
+			MarkFree(capacity - length, length + newCapacity - capacity);
+		}
+		else
+		{
+			MarkFree(capacity, newCapacity - capacity);
+			PushFreeRun(capacity);
+		}
+
+		capacity = newCapacity;
+	}
+
+	template <typename T>
+	StableSlotMapLayout<T> StableSlotMap<T>::GetLayout() const
+	{
+		StableSlotMapLayout<T> layout;
+		layout.values = values;
+		layout.generations = generations;
+		layout.size = size;
+		layout.capacity = capacity;
+		return layout;
+	}
+
+	template <typename T>
+	StableSlotMapConstIterator<T> StableSlotMap<T>::begin() const
+	{
+		return StableSlotMapConstIterator<T>(values, skipfield, generations, capacity, skipfield[0]);
+	}
+
+	template <typename T>
+	StableSlotMapConstIterator<T> StableSlotMap<T>::end() const
+	{
+		return StableSlotMapConstIterator<T>(values, skipfield, generations, capacity, capacity);
+	}
+
+	template <typename T>
+	StableSlotMapIterator<T> StableSlotMap<T>::begin()
+	{
+		return StableSlotMapIterator<T>(values, skipfield, generations, capacity, skipfield[0]);
+	}
+
+	template <typename T>
+	StableSlotMapIterator<T> StableSlotMap<T>::end()
+	{
+		return StableSlotMapIterator<T>(values, skipfield, generations, capacity, capacity);
+	}
+} // namespace Unalmas
@@ -3,8 +3,29 @@
 #include <vector>
 #include <iostream>
 #include <unordered_set>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <chrono>
+#include <climits>
 
 import SlotMap;
+import SlotMapCommandBuffer;
+import ConcurrentSlotMap;
+import ShardedSlotMap;
+import ConcurrentSlotAllocator;
+import DoubleBufferedSlotMap;
+import SlotMapFile;
+import PersistentSlotMap;
+import SlotMapDelta;
+import SharedSlotMap;
+import CowSlotMap;
+import SlotMapCheckpoint;
+import SlotMapLoader;
+import SlotMapTrace;
+import StableSlotMap;
+import AdaptiveSlotMap;
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 using namespace Unalmas;
@@ -41,6 +62,30 @@ namespace UnitTests
 		int value;
 	};
 
+	// Counts live instances, and throws on a copy once copiesLeft runs out.
+	struct CopyCounted
+	{
+		static inline int live = 0;
+		static inline int copiesLeft = 1 << 30;
+
+		explicit CopyCounted(int value_) : value{ value_ } { ++live; }
+
+		CopyCounted(const CopyCounted& rhs) : value{ rhs.value }
+		{
+			if (copiesLeft-- == 0)
+			{
+				throw std::runtime_error("Copy failed.");
+			}
+
+			++live;
+		}
+
+		CopyCounted& operator=(const CopyCounted& rhs) = default;
+		~CopyCounted() { --live; }
+
+		int value;
+	};
+
 	struct Noisy
 	{
 		Noisy()
@@ -770,5 +815,2860 @@ namespace UnitTests
 
 			Assert::IsTrue(0 < slotmap.Size() && slotmap.Size() < itemCount);
 		}
+		TEST_METHOD(EraseLastDenseValueAndReuse)
+		{
+			Unalmas::SlotMap<std::string> slotmap;
+			const auto a = slotmap.Insert(std::string("a long enough string to live on the heap"));
+			const auto b = slotmap.Insert(std::string("another long enough string for the heap"));
+
+			Assert::IsTrue(slotmap.Erase(a));		// Moves b's value to the front
+			Assert::IsTrue(slotmap.Erase(b));		// b's value is now the last (and only) one
+
+			const auto c = slotmap.Insert(std::string("c"));
+			const auto d = slotmap.Insert(std::string("d"));
+			const auto e = slotmap.Insert(std::string("e"));
+
+			Assert::IsTrue(slotmap.Size() == 3);
+			Assert::IsTrue(slotmap[c] == "c" && slotmap[d] == "d" && slotmap[e] == "e");
+		}
+	};
+
+	TEST_CLASS(ConcurrentSlotMapTests)
+	{
+	public:
+		struct Pair
+		{
+			int value;
+			int doubled;
+		};
+
+		TEST_METHOD(InsertGetErase)
+		{
+			Unalmas::ConcurrentSlotMap<int> slotmap;
+			const auto key = slotmap.Insert(42);
+
+			int value = 0;
+			Assert::IsTrue(slotmap.TryGet(key, value));
+			Assert::IsTrue(value == 42);
+
+			Assert::IsTrue(slotmap.Erase(key));
+			Assert::IsFalse(slotmap.TryGet(key, value));
+			Assert::IsFalse(slotmap.Erase(key));
+			Assert::IsTrue(slotmap.Size() == 0);
+		}
+
+		TEST_METHOD(GrowKeepsKeys)
+		{
+			Unalmas::ConcurrentSlotMap<int> slotmap(4);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 100; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			Assert::IsTrue(slotmap.Size() == 100 && slotmap.Capacity() >= 100);
+
+			for (int i = 0; i < 100; i += 3)
+			{
+				Assert::IsTrue(slotmap.Erase(keys[i]));
+			}
+
+			int value = -1;
+			for (int i = 0; i < 100; ++i)
+			{
+				Assert::IsTrue(slotmap.TryGet(keys[i], value) == (i % 3 != 0));
+				Assert::IsTrue(i % 3 == 0 || value == i);
+			}
+		}
+
+		TEST_METHOD(UpdateAndClear)
+		{
+			Unalmas::ConcurrentSlotMap<int> slotmap;
+			const auto key = slotmap.Insert(1);
+			Assert::IsTrue(slotmap.Update(key, 2));
+
+			int value = 0;
+			Assert::IsTrue(slotmap.TryGet(key, value) && value == 2);
+
+			slotmap.Clear();
+			Assert::IsFalse(slotmap.TryGet(key, value));
+			Assert::IsFalse(slotmap.Update(key, 3));
+
+			const auto newKey = slotmap.Insert(4);
+			Assert::IsTrue(slotmap.TryGet(newKey, value) && value == 4);
+		}
+
+		TEST_METHOD(ReadersDuringWrites)
+		{
+			constexpr int itemCount = 2000;
+			Unalmas::ConcurrentSlotMap<Pair> slotmap(4);
+			std::vector<Unalmas::SlotMapKey> keys(itemCount);
+			std::atomic<int> published{ 0 };
+			std::atomic<bool> done{ false };
+			std::atomic<int> tornReads{ 0 };
+
+			std::vector<std::thread> readers;
+			for (int r = 0; r < 3; ++r)
+			{
+				readers.emplace_back([&]()
+				{
+					while (!done.load())
+					{
+						const int count = published.load();
+						for (int i = 0; i < count; ++i)
+						{
+							Pair pair{};
+							if (slotmap.TryGet(keys[i], pair) && pair.doubled != pair.value * 2)
+							{
+								tornReads++;
+							}
+						}
+					}
+				});
+			}
+
+			for (int i = 0; i < itemCount; ++i)
+			{
+				keys[i] = slotmap.Insert(Pair{ i, i * 2 });
+				published.store(i + 1);
+
+				if (i % 4 == 0)
+				{
+					slotmap.Erase(keys[i / 2]);
+				}
+			}
+
+			done.store(true);
+			for (auto& reader : readers)
+			{
+				reader.join();
+			}
+
+			Assert::IsTrue(tornReads.load() == 0);
+
+			Pair pair{};
+			Assert::IsTrue(slotmap.TryGet(keys[itemCount - 1], pair) && pair.value == itemCount - 1);
+		}
+	};
+
+	TEST_CLASS(ShardedSlotMapTests)
+	{
+	public:
+		TEST_METHOD(InsertGetErase)
+		{
+			Unalmas::ShardedSlotMap<int, 4> slotmap;
+			const auto key = slotmap.Insert(42);
+
+			int value = 0;
+			Assert::IsTrue(slotmap.TryGet(key, value) && value == 42);
+			Assert::IsTrue(slotmap.Size() == 1);
+
+			Assert::IsTrue(slotmap.Erase(key));
+			Assert::IsFalse(slotmap.TryGet(key, value));
+			Assert::IsFalse(slotmap.Erase(key));
+			Assert::IsTrue(slotmap.Size() == 0);
+		}
+
+		TEST_METHOD(InvalidKeys)
+		{
+			Unalmas::ShardedSlotMap<int, 4> slotmap(2);
+			slotmap.Insert(1);
+
+			int value = 0;
+			Assert::IsFalse(slotmap.TryGet(SlotMapKey{ -1, 0 }, value));
+			Assert::IsFalse(slotmap.TryGet(SlotMapKey{ 1000, 0 }, value));
+			Assert::IsFalse(slotmap.Erase(SlotMapKey{ 1000, 0 }));
+		}
+
+		TEST_METHOD(Visit)
+		{
+			Unalmas::ShardedSlotMap<NonCopyable> slotmap;
+			const auto key = slotmap.Insert(NonCopyable(7));
+
+			Assert::IsTrue(slotmap.Visit(key, [](NonCopyable& item) { item.value *= 2; }));
+
+			int seen = 0;
+			slotmap.Visit(key, [&](NonCopyable& item) { seen = item.value; });
+			Assert::IsTrue(seen == 14);
+		}
+
+		TEST_METHOD(ManyThreads)
+		{
+			constexpr int threadCount = 8;
+			constexpr int perThread = 1000;
+			Unalmas::ShardedSlotMap<int, 8> slotmap;
+			std::vector<std::vector<Unalmas::SlotMapKey>> keys(threadCount);
+
+			std::vector<std::thread> threads;
+			for (int t = 0; t < threadCount; ++t)
+			{
+				threads.emplace_back([&, t]()
+				{
+					for (int i = 0; i < perThread; ++i)
+					{
+						keys[t].push_back(slotmap.Insert(t * perThread + i));
+						if (i % 2 == 1)
+						{
+							slotmap.Erase(keys[t][i - 1]);
+						}
+					}
+				});
+			}
+
+			for (auto& thread : threads)
+			{
+				thread.join();
+			}
+
+			Assert::IsTrue(slotmap.Size() == threadCount * perThread / 2);
+
+			int value = 0;
+			for (int t = 0; t < threadCount; ++t)
+			{
+				for (int i = 0; i < perThread; ++i)
+				{
+					Assert::IsTrue(slotmap.TryGet(keys[t][i], value) == (i % 2 == 1));
+					Assert::IsTrue(i % 2 == 0 || value == t * perThread + i);
+				}
+			}
+
+			std::atomic<long long> sum{ 0 };
+			slotmap.ParallelForEach([&](int& item) { sum += item; });
+
+			long long expected = 0;
+			slotmap.ForEach([&](int& item) { expected += item; });
+			Assert::IsTrue(sum.load() == expected && expected > 0);
+		}
+	};
+
+	TEST_CLASS(ConcurrentSlotAllocatorTests)
+	{
+	public:
+		TEST_METHOD(AcquireAndRelease)
+		{
+			Unalmas::ConcurrentSlotAllocator allocator(4);
+			const auto key = allocator.Acquire();
+
+			Assert::IsTrue(key.IsValid());
+			Assert::IsTrue(allocator.IsAlive(key));
+			Assert::IsTrue(allocator.Size() == 1);
+
+			Assert::IsTrue(allocator.Release(key));
+			Assert::IsFalse(allocator.IsAlive(key));
+			Assert::IsFalse(allocator.Release(key));	// Double release should fail
+			Assert::IsTrue(allocator.Size() == 0);
+
+			const auto reused = allocator.Acquire();
+			Assert::IsTrue(reused.index == key.index && reused.generation == key.generation + 1);
+			Assert::IsFalse(allocator.IsAlive(key));
+		}
+
+		TEST_METHOD(Grow)
+		{
+			Unalmas::ConcurrentSlotAllocator allocator(2);
+			std::unordered_set<int> indices;
+			for (int i = 0; i < 100; ++i)
+			{
+				const auto key = allocator.Acquire();
+				Assert::IsTrue(indices.insert(key.index).second);
+			}
+
+			Assert::IsTrue(allocator.Size() == 100 && allocator.Capacity() >= 100);
+			Assert::IsFalse(allocator.IsAlive(SlotMapKey{ allocator.Capacity(), 0 }));
+		}
+
+		TEST_METHOD(ManyThreads)
+		{
+			constexpr int threadCount = 8;
+			constexpr int iterations = 5000;
+			Unalmas::ConcurrentSlotAllocator allocator(4);
+			std::vector<std::atomic<int>> owners(threadCount * 64 + 1024);
+			std::atomic<int> collisions{ 0 };
+
+			std::vector<std::thread> threads;
+			for (int t = 0; t < threadCount; ++t)
+			{
+				threads.emplace_back([&]()
+				{
+					std::vector<Unalmas::SlotMapKey> held;
+					for (int i = 0; i < iterations; ++i)
+					{
+						if (held.size() < 32 && (i % 3 != 2))
+						{
+							const auto key = allocator.Acquire();
+							if (owners[key.index].fetch_add(1) != 0)
+							{
+								collisions++;
+							}
+							held.push_back(key);
+						}
+						else if (!held.empty())
+						{
+							const auto key = held.back();
+							held.pop_back();
+							owners[key.index].fetch_sub(1);
+							if (!allocator.Release(key))
+							{
+								collisions++;
+							}
+						}
+					}
+
+					for (const auto& key : held)
+					{
+						owners[key.index].fetch_sub(1);
+						allocator.Release(key);
+					}
+				});
+			}
+
+			for (auto& thread : threads)
+			{
+				thread.join();
+			}
+
+			Assert::IsTrue(collisions.load() == 0);
+			Assert::IsTrue(allocator.Size() == 0);
+		}
+	};
+
+	TEST_CLASS(SlotMapCommandBufferTests)
+	{
+	public:
+		TEST_METHOD(ProvisionalKeysFailUntilApplied)
+		{
+			Unalmas::SlotMap<int> slotmap;
+			Unalmas::SlotMapCommandBuffer<int> buffer(slotmap, 1, 4);
+
+			const auto key = buffer.ForWorker(0).Insert(42);
+
+			int value = 0;
+			Assert::IsTrue(key.IsValid());
+			Assert::IsFalse(slotmap.TryGet(key, value));
+			Assert::IsFalse(slotmap.Erase(key));
+			Assert::IsTrue(slotmap.Size() == 0);
+
+			buffer.Apply();
+
+			Assert::IsTrue(slotmap.TryGet(key, value) && value == 42);
+			Assert::IsTrue(slotmap.Size() == 1);
+		}
+
+		TEST_METHOD(EraseIsDeferred)
+		{
+			Unalmas::SlotMap<int> slotmap;
+			const auto key = slotmap.Insert(1);
+
+			Unalmas::SlotMapCommandBuffer<int> buffer(slotmap, 2);
+			buffer.ForWorker(1).Erase(key);
+			Assert::IsTrue(slotmap.Contains(key));
+
+			buffer.Apply();
+			Assert::IsFalse(slotmap.Contains(key));
+		}
+
+		TEST_METHOD(InsertThenEraseInSameFrame)
+		{
+			Unalmas::SlotMap<int> slotmap;
+			Unalmas::SlotMapCommandBuffer<int> buffer(slotmap, 2);
+
+			const auto key = buffer.ForWorker(0).Insert(5);
+			buffer.ForWorker(1).Erase(key);
+			buffer.Apply();
+
+			Assert::IsFalse(slotmap.Contains(key));
+			Assert::IsTrue(slotmap.Size() == 0);
+		}
+
+		TEST_METHOD(UnappliedReservationsAreReleased)
+		{
+			Unalmas::SlotMap<int> slotmap(4);
+			SlotMapKey dropped;
+			{
+				Unalmas::SlotMapCommandBuffer<int> buffer(slotmap, 1, 4);
+				dropped = buffer.ForWorker(0).Insert(1);
+			}
+
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 4; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			Assert::IsTrue(slotmap.Size() == 4 && slotmap.Capacity() == 4);
+			Assert::IsFalse(slotmap.Contains(dropped));
+
+			slotmap.Clear();
+			Assert::IsTrue(slotmap.Size() == 0);
+		}
+
+		TEST_METHOD(ManyWorkers)
+		{
+			constexpr int workerCount = 4;
+			constexpr int perWorker = 500;
+			Unalmas::SlotMap<int> slotmap;
+			Unalmas::SlotMapCommandBuffer<int> buffer(slotmap, workerCount, 16);
+			std::vector<std::vector<Unalmas::SlotMapKey>> keys(workerCount);
+
+			std::vector<std::thread> workers;
+			for (int w = 0; w < workerCount; ++w)
+			{
+				workers.emplace_back([&, w]()
+				{
+					auto& recorder = buffer.ForWorker(w);
+					for (int i = 0; i < perWorker; ++i)
+					{
+						keys[w].push_back(recorder.Insert(w * perWorker + i));
+					}
+				});
+			}
+
+			for (auto& worker : workers)
+			{
+				worker.join();
+			}
+
+			buffer.Apply();
+			Assert::IsTrue(slotmap.Size() == workerCount * perWorker);
+
+			int value = 0;
+			for (int w = 0; w < workerCount; ++w)
+			{
+				for (int i = 0; i < perWorker; ++i)
+				{
+					Assert::IsTrue(slotmap.TryGet(keys[w][i], value) && value == w * perWorker + i);
+				}
+			}
+		}
+	};
+
+	TEST_CLASS(KeyReservationTests)
+	{
+	public:
+		TEST_METHOD(ReservedKeyFailsLookupsUntilCommitted)
+		{
+			Unalmas::SlotMap<int> slotmap;
+			const auto key = slotmap.ReserveKey();
+
+			int value = 0;
+			Assert::IsTrue(key.IsValid());
+			Assert::IsFalse(slotmap.Contains(key));
+			Assert::IsFalse(slotmap.TryGet(key, value));
+			Assert::IsFalse(slotmap.Erase(key));
+			Assert::ExpectException<std::runtime_error>([&]() { slotmap[key]; });
+			Assert::IsTrue(slotmap.Size() == 0 && slotmap.ReservedCount() == 1);
+
+			slotmap.Commit(key, 42);
+
+			Assert::IsTrue(slotmap.TryGet(key, value) && value == 42);
+			Assert::IsTrue(slotmap.Size() == 1 && slotmap.ReservedCount() == 0);
+			Assert::ExpectException<std::runtime_error>([&]() { slotmap.Commit(key, 43); });
+		}
+
+		TEST_METHOD(ReserveKeysGrowsOnce)
+		{
+			Unalmas::SlotMap<int> slotmap(4);
+			slotmap.Insert(0);
+
+			const auto keys = slotmap.ReserveKeys(100);
+			Assert::IsTrue(keys.size() == 100);
+			Assert::IsTrue(slotmap.Capacity() == 101);
+
+			std::unordered_set<Unalmas::SlotMapKey> unique(keys.begin(), keys.end());
+			Assert::IsTrue(unique.size() == 100);
+
+			for (int i = 99; i >= 0; --i)
+			{
+				slotmap.Commit(keys[i], i);
+			}
+
+			for (int i = 0; i < 100; ++i)
+			{
+				Assert::IsTrue(slotmap[keys[i]] == i);
+			}
+
+			Assert::IsTrue(slotmap.Size() == 101 && slotmap.Capacity() == 101);
+		}
+
+		TEST_METHOD(ReserveNoKeys)
+		{
+			Unalmas::SlotMap<int> slotmap(4);
+			Assert::IsTrue(slotmap.ReserveKeys(0).empty() && slotmap.ReserveKeys(-5).empty());
+			Assert::IsTrue(slotmap.ReservedCount() == 0 && slotmap.Capacity() == 4);
+		}
+
+		TEST_METHOD(NegativeGenerationsDontMatchReservedSlots)
+		{
+			Unalmas::SlotMap<int> slotmap(4);
+			const auto key = slotmap.ReserveKey();
+
+			// The reserved slot stores this generation until it is committed.
+			const Unalmas::SlotMapKey forged(key.index, ~key.generation);
+			int value = 0;
+
+			Assert::IsFalse(slotmap.TryGet(forged, value));
+			Assert::IsFalse(slotmap.Contains(forged));
+			Assert::IsFalse(slotmap.Erase(forged));
+			Assert::ExpectException<std::runtime_error>([&]() { return slotmap[forged]; });
+			Assert::IsTrue(slotmap.ReservedCount() == 1 && slotmap.Size() == 0);
+
+			slotmap.Commit(key, 5);
+			Assert::IsTrue(slotmap.TryGet(key, value) && value == 5);
+		}
+
+		TEST_METHOD(CommitConstructsInPlace)
+		{
+			struct Pair
+			{
+				Pair(int a_, int b_) : a{ a_ }, b{ b_ } {}
+				int a;
+				int b;
+			};
+
+			Unalmas::SlotMap<Pair> slotmap;
+			const auto key = slotmap.ReserveKey();
+			slotmap.Commit(key, 1, 2);
+
+			Assert::IsTrue(slotmap[key].a == 1 && slotmap[key].b == 2);
+		}
+
+		TEST_METHOD(InsertAfterReservingEverything)
+		{
+			Unalmas::SlotMap<int> slotmap(4);
+			const auto keys = slotmap.ReserveKeys(4);
+
+			const auto inserted = slotmap.Insert(7);
+			Assert::IsTrue(slotmap[inserted] == 7);
+			Assert::IsTrue(slotmap.Capacity() == 8);
+
+			slotmap.Commit(keys[0], 1);
+			Assert::IsTrue(slotmap[keys[0]] == 1);
+		}
+
+		TEST_METHOD(CancelAndClear)
+		{
+			Unalmas::SlotMap<int> slotmap(2);
+			const auto cancelled = slotmap.ReserveKey();
+			Assert::IsTrue(slotmap.CancelReservation(cancelled));
+			Assert::IsFalse(slotmap.CancelReservation(cancelled));
+
+			const auto reused = slotmap.ReserveKey();
+			Assert::IsTrue(reused != cancelled);
+
+			slotmap.Clear();
+			Assert::IsTrue(slotmap.ReservedCount() == 0);
+			Assert::IsFalse(slotmap.CancelReservation(reused));
+
+			const auto a = slotmap.Insert(1);
+			const auto b = slotmap.Insert(2);
+			Assert::IsTrue(slotmap[a] == 1 && slotmap[b] == 2 && slotmap.Capacity() == 2);
+		}
+	};
+
+	TEST_CLASS(DoubleBufferedSlotMapTests)
+	{
+	public:
+		TEST_METHOD(WritesBecomeVisibleOnSwap)
+		{
+			Unalmas::DoubleBufferedSlotMap<int> slotmap;
+			const auto key = slotmap.Insert(1);
+
+			int value = 0;
+			Assert::IsFalse(slotmap.TryGet(key, value));
+			Assert::IsTrue(slotmap.Size() == 0 && slotmap.BackSize() == 1);
+
+			slotmap.Swap();
+			Assert::IsTrue(slotmap.Read(key) == 1);
+
+			slotmap.Write(key) = 2;
+			Assert::IsTrue(slotmap.Read(key) == 1);
+
+			slotmap.Swap();
+			Assert::IsTrue(slotmap.Read(key) == 2);
+
+			// Nothing written this frame: both buffers must agree after another swap.
+			slotmap.Swap();
+			Assert::IsTrue(slotmap.Read(key) == 2);
+			Assert::IsTrue(slotmap.Write(key) == 2);
+		}
+
+		TEST_METHOD(EraseBecomesVisibleOnSwap)
+		{
+			Unalmas::DoubleBufferedSlotMap<std::string> slotmap;
+			const auto key = slotmap.Insert(std::string("value"));
+			slotmap.Swap();
+
+			Assert::IsTrue(slotmap.Erase(key));
+			Assert::IsFalse(slotmap.Erase(key));
+			Assert::IsTrue(slotmap.Read(key) == "value");
+
+			slotmap.Swap();
+
+			std::string value;
+			Assert::IsFalse(slotmap.TryGet(key, value));
+			Assert::IsTrue(slotmap.Size() == 0);
+
+			slotmap.Swap();
+			Assert::IsFalse(slotmap.TryGet(key, value));
+		}
+
+		TEST_METHOD(GrowDoesNotDisturbFront)
+		{
+			Unalmas::DoubleBufferedSlotMap<int> slotmap(2);
+			const auto first = slotmap.Insert(0);
+			slotmap.Swap();
+
+			const int* frontValue = &slotmap.Read(first);
+
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 50; ++i)
+			{
+				keys.push_back(slotmap.Insert(i + 1));
+			}
+
+			Assert::IsTrue(&slotmap.Read(first) == frontValue);
+			Assert::IsTrue(slotmap.Size() == 1);
+
+			slotmap.Swap();
+			Assert::IsTrue(slotmap.Size() == 51);
+
+			for (int i = 0; i < 50; ++i)
+			{
+				Assert::IsTrue(slotmap.Read(keys[i]) == i + 1);
+			}
+
+			slotmap.Write(keys[10]) = -1;
+			slotmap.Swap();
+			slotmap.Swap();
+			Assert::IsTrue(slotmap.Read(keys[10]) == -1 && slotmap.Read(keys[11]) == 12);
+
+			int sum = 0;
+			slotmap.ForEach([&](const Unalmas::SlotMapKey&, const int& value) { sum += value; });
+			Assert::IsTrue(sum == 50 * 51 / 2 - 11 - 1);
+		}
+	};
+
+	TEST_CLASS(SlotMapFileTests)
+	{
+	public:
+		const char* path = "slotmap_file_test.bin";
+
+		TEST_METHOD_CLEANUP(TearDown)
+		{
+			std::remove(path);
+		}
+
+		TEST_METHOD(KeysSurviveSaveAndMap)
+		{
+			Unalmas::SlotMap<double> slotmap;
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 100; ++i)
+			{
+				keys.push_back(slotmap.Insert(i * 0.5));
+			}
+
+			for (int i = 0; i < 100; i += 4)
+			{
+				slotmap.Erase(keys[i]);
+			}
+
+			Assert::IsTrue(Unalmas::SaveSlotMap(slotmap, path));
+
+			const Unalmas::MappedSlotMap<double> mapped(path);
+			Assert::IsTrue(mapped.Verify());
+			Assert::IsTrue(mapped.Size() == slotmap.Size() && mapped.Capacity() == slotmap.Capacity());
+
+			double value = 0.0;
+			for (int i = 0; i < 100; ++i)
+			{
+				Assert::IsTrue(mapped.TryGet(keys[i], value) == (i % 4 != 0));
+				Assert::IsTrue(i % 4 == 0 || value == i * 0.5);
+			}
+
+			int count = 0;
+			for (const auto& item : mapped)
+			{
+				Assert::IsTrue(item == mapped[mapped.GetKeyForIndex(count)]);
+				count++;
+			}
+
+			Assert::IsTrue(count == mapped.Size());
+		}
+
+		TEST_METHOD(LoadedMapKeepsWorking)
+		{
+			Unalmas::SlotMap<int> slotmap(4);
+			const auto a = slotmap.Insert(1);
+			const auto b = slotmap.Insert(2);
+			slotmap.Erase(a);
+			Assert::IsTrue(Unalmas::SaveSlotMap(slotmap, path));
+
+			Unalmas::SlotMap<int> loaded = Unalmas::LoadSlotMap<int>(path);
+			Assert::IsTrue(loaded[b] == 2);
+			Assert::IsFalse(loaded.Contains(a));
+
+			const auto c = loaded.Insert(3);
+			const auto fromOriginal = slotmap.Insert(3);
+			Assert::IsTrue(c == fromOriginal);
+
+			for (int i = 0; i < 20; ++i)
+			{
+				loaded.Insert(i);
+			}
+
+			Assert::IsTrue(loaded[b] == 2 && loaded[c] == 3);
+		}
+
+		TEST_METHOD(RejectsMismatchedFiles)
+		{
+			Unalmas::SlotMap<int> slotmap;
+			slotmap.Insert(1);
+			Assert::IsTrue(Unalmas::SaveSlotMap(slotmap, path));
+
+			auto wrongType = [&]() { Unalmas::MappedSlotMap<double> mapped(path); };
+			Assert::ExpectException<std::runtime_error>(wrongType);
+
+			std::FILE* truncated = std::fopen(path, "wb");
+			std::fputs("SLOTMAP", truncated);
+			std::fclose(truncated);
+
+			auto corrupt = [&]() { Unalmas::MappedSlotMap<int> mapped(path); };
+			Assert::ExpectException<std::runtime_error>(corrupt);
+
+			auto missing = [&]() { Unalmas::MappedSlotMap<int> mapped("does_not_exist.bin"); };
+			Assert::ExpectException<std::runtime_error>(missing);
+		}
+
+		TEST_METHOD(SaveReplacesTheFileInOneStep)
+		{
+			Unalmas::SlotMap<int> slotmap;
+			const auto key = slotmap.Insert(1);
+			Assert::IsTrue(Unalmas::SaveSlotMap(slotmap, path));
+
+			slotmap[key] = 2;
+			Assert::IsTrue(Unalmas::SaveSlotMap(slotmap, path));
+
+			const std::string temporary = std::string(path) + ".tmp";
+			Assert::IsTrue(std::fopen(temporary.c_str(), "rb") == nullptr);
+
+			const Unalmas::MappedSlotMap<int> mapped(path);
+			Assert::IsTrue(mapped[key] == 2);
+		}
+
+		TEST_METHOD(CorruptSlotsDontReadPastTheValues)
+		{
+			Unalmas::SlotMap<int> slotmap;
+			const auto key = slotmap.Insert(1);
+			Assert::IsTrue(Unalmas::SaveSlotMap(slotmap, path));
+
+			// The slot keeps its generation, but points far past the one value.
+			Unalmas::SlotMapFileHeader header;
+			std::FILE* file = std::fopen(path, "r+b");
+			std::fread(&header, sizeof(header), 1, file);
+			std::fseek(file, static_cast<long>(header.slotsOffset + key.index * sizeof(Unalmas::SlotMapKey)), SEEK_SET);
+			const int index = 1000000;
+			std::fwrite(&index, sizeof(index), 1, file);
+			std::fclose(file);
+
+			const Unalmas::MappedSlotMap<int> mapped(path);
+			int value = 0;
+			Assert::IsFalse(mapped.TryGet(key, value));
+			Assert::IsFalse(mapped.Contains(key));
+
+			auto lookup = [&]() { return mapped[key]; };
+			Assert::ExpectException<std::out_of_range>(lookup);
+		}
+
+		TEST_METHOD(CorruptFreeListIsNotLoaded)
+		{
+			Unalmas::SlotMap<int> slotmap(8);
+			const auto key = slotmap.Insert(1);
+			Assert::IsTrue(Unalmas::SaveSlotMap(slotmap, path));
+
+			// The next free slot after the taken one now links far outside the slots.
+			Unalmas::SlotMapFileHeader header;
+			std::FILE* file = std::fopen(path, "r+b");
+			std::fread(&header, sizeof(header), 1, file);
+			std::fseek(file, static_cast<long>(header.slotsOffset + header.firstFreeSlot * sizeof(Unalmas::SlotMapKey)), SEEK_SET);
+			const int next = 1000000;
+			std::fwrite(&next, sizeof(next), 1, file);
+			std::fclose(file);
+
+			const Unalmas::MappedSlotMap<int> mapped(path);
+			Assert::IsFalse(mapped.Verify());
+			Assert::IsTrue(mapped[key] == 1);
+
+			Assert::ExpectException<std::runtime_error>([&]() { Unalmas::LoadSlotMap<int>(path); });
+		}
+
+		TEST_METHOD(NegativeGenerationsDontMatchReservedSlots)
+		{
+			// Slot 3 gets reserved while its free link still points at value 0.
+			Unalmas::SlotMap<int> slotmap(4);
+			const auto a = slotmap.Insert(1);
+			slotmap.Insert(2);
+			slotmap.Insert(3);
+			slotmap.Erase(a);
+			const auto reserved = slotmap.ReserveKey();
+			Assert::IsTrue(Unalmas::SaveSlotMap(slotmap, path));
+
+			const Unalmas::MappedSlotMap<int> mapped(path);
+			const Unalmas::SlotMapKey forged(reserved.index, ~reserved.generation);
+			int value = 0;
+
+			Assert::IsFalse(mapped.TryGet(forged, value));
+			Assert::IsFalse(mapped.Contains(forged));
+			Assert::ExpectException<std::runtime_error>([&]() { return mapped[forged]; });
+		}
+	};
+
+	TEST_CLASS(PersistentSlotMapTests)
+	{
+	public:
+		const char* path = "persistent_slotmap_test.bin";
+		const char* copyPath = "persistent_slotmap_copy.bin";
+
+		TEST_METHOD_CLEANUP(TearDown)
+		{
+			std::remove(path);
+			std::remove(copyPath);
+		}
+
+		// Copies the file as it is on disk right now, e.g. while a map still has it open.
+		void CopyFile(const char* from, const char* to)
+		{
+			std::FILE* in = std::fopen(from, "rb");
+			std::FILE* out = std::fopen(to, "wb");
+			char buffer[4096];
+			for (std::size_t read; (read = std::fread(buffer, 1, sizeof(buffer), in)) > 0; )
+			{
+				std::fwrite(buffer, 1, read, out);
+			}
+
+			std::fclose(in);
+			std::fclose(out);
+		}
+
+		// Overwrites bytes of a closed file, e.g. to leave it as a killed process would have.
+		void PatchFile(const char* at, std::uint64_t offset, const void* data, std::size_t bytes)
+		{
+			std::FILE* file = std::fopen(at, "r+b");
+			std::fseek(file, static_cast<long>(offset), SEEK_SET);
+			std::fwrite(data, 1, bytes, file);
+			std::fclose(file);
+		}
+
+		Unalmas::SlotMapFileHeader ReadHeader(const char* at)
+		{
+			Unalmas::SlotMapFileHeader header;
+			std::FILE* file = std::fopen(at, "rb");
+			std::fread(&header, sizeof(header), 1, file);
+			std::fclose(file);
+			return header;
+		}
+
+		TEST_METHOD(KeysSurviveReopening)
+		{
+			std::vector<Unalmas::SlotMapKey> keys;
+			{
+				Unalmas::PersistentSlotMap<int> slotmap(path, 4);
+				for (int i = 0; i < 100; ++i)
+				{
+					keys.push_back(slotmap.Insert(i));
+				}
+
+				for (int i = 0; i < 100; i += 3)
+				{
+					Assert::IsTrue(slotmap.Erase(keys[i]));
+				}
+
+				Assert::IsTrue(slotmap.Update(keys[1], -1));
+				Assert::IsTrue(slotmap.Capacity() >= 100);
+			}
+
+			Unalmas::PersistentSlotMap<int> reopened(path);
+			Assert::IsFalse(reopened.WasRecovered());
+			Assert::IsTrue(reopened.Size() == 66);
+
+			int value = 0;
+			for (int i = 0; i < 100; ++i)
+			{
+				Assert::IsTrue(reopened.TryGet(keys[i], value) == (i % 3 != 0));
+				Assert::IsTrue(i % 3 == 0 || value == (i == 1 ? -1 : i));
+			}
+
+			const auto key = reopened.Insert(1000);
+			Assert::IsTrue(reopened[key] == 1000);
+			Assert::IsFalse(reopened.Contains(keys[0]));
+		}
+
+		TEST_METHOD(SnapshotsAndPersistentFilesShareAFormat)
+		{
+			Unalmas::SlotMapKey key;
+			{
+				Unalmas::PersistentSlotMap<double> slotmap(path);
+				key = slotmap.Insert(2.5);
+			}
+
+			const Unalmas::MappedSlotMap<double> mapped(path);
+			Assert::IsTrue(mapped.Verify());
+			Assert::IsTrue(mapped[key] == 2.5);
+		}
+
+		TEST_METHOD(FlushOnlyWritesDirtyPages)
+		{
+			Unalmas::PersistentSlotMap<int> slotmap(path, 100000);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 100000; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			Assert::IsTrue(slotmap.DirtyPageCount() > 1);
+			Assert::IsTrue(slotmap.Flush());
+			Assert::IsTrue(slotmap.DirtyPageCount() == 0);
+
+			slotmap.Update(keys[50000], 0);
+			Assert::IsTrue(slotmap.DirtyPageCount() == 1);
+			Assert::IsTrue(slotmap.Flush());
+		}
+
+		TEST_METHOD(CrashedFileIsRepairedOnOpen)
+		{
+			Unalmas::PersistentSlotMap<int> slotmap(path);
+			const auto a = slotmap.Insert(1);
+			const auto b = slotmap.Insert(2);
+			slotmap.Erase(a);
+			Assert::IsTrue(slotmap.Flush());
+
+			// A copy taken while the map is open looks just like the file of a crashed process.
+			CopyFile(path, copyPath);
+			{
+				Unalmas::PersistentSlotMap<int> recovered(copyPath);
+				Assert::IsTrue(recovered.WasRecovered());
+				Assert::IsTrue(recovered[b] == 2);
+				Assert::IsFalse(recovered.Contains(a));
+			}
+
+			// Break the free list: its tail no longer matches the header. It's rebuilt.
+			CopyFile(path, copyPath);
+			{
+				Unalmas::SlotMapFileHeader header = ReadHeader(copyPath);
+				header.lastFreeSlot = b.index;
+				PatchFile(copyPath, 0, &header, sizeof(header));
+			}
+
+			{
+				Unalmas::PersistentSlotMap<int> repaired(copyPath);
+				Assert::IsTrue(repaired.WasRecovered() && repaired.Size() == 1);
+				Assert::IsTrue(repaired[b] == 2);
+
+				for (int i = 0; i < 20; ++i)
+				{
+					Assert::IsTrue(repaired.Insert(i).index != b.index);
+				}
+
+				Assert::IsTrue(repaired[b] == 2 && repaired.Size() == 21);
+			}
+		}
+
+		TEST_METHOD(InterruptedCallsAreRepairedOnOpen)
+		{
+			Unalmas::PersistentSlotMap<int> slotmap(path, 8);
+			const auto a = slotmap.Insert(10);
+			const auto b = slotmap.Insert(20);
+			const auto c = slotmap.Insert(30);
+			Assert::IsTrue(slotmap.Flush());
+
+			const Unalmas::SlotMapFileHeader header = ReadHeader(path);
+			const auto slotAt = [&](int index) { return header.slotsOffset + index * sizeof(Unalmas::SlotMapKey); };
+
+			// Killed inside Insert, right after the size went up, before anything else.
+			CopyFile(path, copyPath);
+			{
+				Unalmas::SlotMapFileHeader grown = header;
+				grown.size++;
+				PatchFile(copyPath, 0, &grown, sizeof(grown));
+			}
+
+			{
+				Unalmas::PersistentSlotMap<int> repaired(copyPath);
+				Assert::IsTrue(repaired.Size() == 3);
+				Assert::IsTrue(repaired[a] == 10 && repaired[b] == 20 && repaired[c] == 30);
+
+				const auto d = repaired.Insert(40);
+				Assert::IsTrue(d.index != a.index && d.index != b.index && d.index != c.index && repaired[d] == 40);
+			}
+
+			// Killed inside Erase(a), once its slot let go of the value, with the
+			// last value half moved into the hole and the generation not bumped yet.
+			CopyFile(path, copyPath);
+			{
+				const int detached = -1;
+				const int moved = 30;
+				PatchFile(copyPath, slotAt(a.index) + offsetof(Unalmas::SlotMapKey, index), &detached, sizeof(detached));
+				PatchFile(copyPath, header.valuesOffset, &moved, sizeof(moved));
+			}
+
+			{
+				Unalmas::PersistentSlotMap<int> repaired(copyPath);
+				Assert::IsTrue(repaired.WasRecovered() && repaired.Size() == 2);
+				Assert::IsFalse(repaired.Contains(a));
+				Assert::IsTrue(repaired[b] == 20 && repaired[c] == 30);
+
+				int sum = 0;
+				for (const int value : repaired)
+				{
+					sum += value;
+				}
+
+				Assert::IsTrue(sum == 50);
+
+				// The freed slot hands out a new key, never a again.
+				for (int i = 0; i < 6; ++i)
+				{
+					Assert::IsTrue(repaired.Insert(i) != a);
+				}
+			}
+		}
+	};
+
+	TEST_CLASS(SlotMapDeltaTests)
+	{
+	public:
+		TEST_METHOD(ReplicaSeededFromAFreshMap)
+		{
+			// The replica's free list and generations differ from the primary's.
+			Unalmas::JournaledSlotMap<int> primary(2);
+			const auto a = primary.Insert(1);
+			primary.Erase(a);
+			const std::uint64_t mark = primary.Mark();
+
+			Unalmas::SlotMap<int> replica(2);
+			const auto b = primary.Insert(2);
+			const auto c = primary.Insert(3);
+			const auto d = primary.Insert(4);
+
+			Assert::IsTrue(Unalmas::ApplyDelta(replica, primary.DeltaSince(mark)));
+			Assert::IsTrue(replica[b] == 2 && replica[c] == 3 && replica[d] == 4);
+			Assert::IsFalse(replica.Contains(a));
+		}
+
+		TEST_METHOD(ReplicaGetsTheSameKeys)
+		{
+			Unalmas::JournaledSlotMap<int> primary(4);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 10; ++i)
+			{
+				keys.push_back(primary.Insert(i));
+			}
+
+			Unalmas::SlotMap<int> replica(primary.Map());
+			std::uint64_t replicaMark = primary.Mark();
+
+			for (int round = 0; round < 5; ++round)
+			{
+				primary.Erase(keys[round]);
+				primary.Update(keys[round + 5], round * 100);
+				keys.push_back(primary.Insert(round + 10));
+
+				const auto delta = primary.DeltaSince(replicaMark);
+				Assert::IsTrue(delta.from == replicaMark && delta.to == primary.Mark());
+				Assert::IsTrue(Unalmas::ApplyDelta(replica, delta));
+				replicaMark = delta.to;
+			}
+
+			Assert::IsTrue(replica.Size() == primary.Size());
+			for (const auto& key : keys)
+			{
+				Assert::IsTrue(replica.Contains(key) == primary.Contains(key));
+				Assert::IsTrue(!primary.Contains(key) || replica[key] == primary[key]);
+			}
+		}
+
+		TEST_METHOD(UpdatesAreCompacted)
+		{
+			Unalmas::JournaledSlotMap<int> primary;
+			const std::uint64_t mark = primary.Mark();
+
+			const auto a = primary.Insert(1);
+			for (int i = 0; i < 100; ++i)
+			{
+				primary.Update(a, i);
+			}
+
+			const auto b = primary.Insert(2);
+			primary.Erase(b);
+
+			const auto delta = primary.DeltaSince(mark);
+			Assert::IsTrue(delta.records.size() == 3);
+			Assert::IsTrue(delta.records[0].op == Unalmas::SlotMapDeltaOp::Insert && delta.records[0].value == 99);
+
+			Unalmas::SlotMap<int> replica;
+			Assert::IsTrue(Unalmas::ApplyDelta(replica, delta));
+			Assert::IsTrue(replica[a] == 99);
+			Assert::IsFalse(replica.Contains(b));
+		}
+
+		TEST_METHOD(ValuesNeedNoDefaultConstructor)
+		{
+			struct Position
+			{
+				Position(int x_, int y_) : x{ x_ }, y{ y_ } {}
+				int x;
+				int y;
+			};
+
+			Unalmas::JournaledSlotMap<Position> primary;
+			const std::uint64_t mark = primary.Mark();
+			const auto a = primary.Insert(Position(1, 2));
+			const auto b = primary.Insert(Position(3, 4));
+			primary.Update(a, Position(5, 6));
+			primary.Erase(b);
+
+			const auto delta = primary.DeltaSince(mark);
+			Assert::IsFalse(delta.records.back().value.has_value());
+
+			Unalmas::SlotMap<Position> replica;
+			Assert::IsTrue(Unalmas::ApplyDelta(replica, delta));
+			Assert::IsTrue(replica[a].x == 5 && replica[a].y == 6);
+			Assert::IsFalse(replica.Contains(b));
+		}
+
+		TEST_METHOD(DivergedReplicaIsDetected)
+		{
+			Unalmas::JournaledSlotMap<int> primary;
+			const std::uint64_t mark = primary.Mark();
+			primary.Insert(1);
+
+			Unalmas::SlotMap<int> replica;
+			replica.Insert(5);
+
+			Assert::IsFalse(Unalmas::ApplyDelta(replica, primary.DeltaSince(mark)));
+		}
+
+		TEST_METHOD(DiscardedRecordsAreGone)
+		{
+			Unalmas::JournaledSlotMap<int> primary;
+			primary.Insert(1);
+			const std::uint64_t mark = primary.Mark();
+			primary.Insert(2);
+
+			primary.DiscardBefore(mark);
+			Assert::IsTrue(primary.DeltaSince(mark).records.size() == 1);
+
+			bool threw = false;
+			try
+			{
+				primary.DeltaSince(0);
+			}
+			catch (const std::out_of_range&)
+			{
+				threw = true;
+			}
+
+			Assert::IsTrue(threw);
+		}
+	};
+
+	TEST_CLASS(InsertAtTests)
+	{
+	public:
+		TEST_METHOD(InsertsUnderTheGivenKey)
+		{
+			Unalmas::SlotMap<int> slotmap(8);
+
+			// Head, middle and tail of the free list.
+			Assert::IsTrue(slotmap.InsertAt(Unalmas::SlotMapKey(0, 0), 10));
+			Assert::IsTrue(slotmap.InsertAt(Unalmas::SlotMapKey(4, 3), 14));
+			Assert::IsTrue(slotmap.InsertAt(Unalmas::SlotMapKey(7, 1), 17));
+
+			Assert::IsTrue(slotmap[Unalmas::SlotMapKey(0, 0)] == 10);
+			Assert::IsTrue(slotmap[Unalmas::SlotMapKey(4, 3)] == 14);
+			Assert::IsTrue(slotmap[Unalmas::SlotMapKey(7, 1)] == 17);
+			Assert::IsTrue(slotmap.Size() == 3);
+
+			// The remaining free slots are still handed out, each once.
+			std::unordered_set<int> indices;
+			for (int i = 0; i < 5; ++i)
+			{
+				const auto key = slotmap.Insert(i);
+				Assert::IsTrue(key.index != 0 && key.index != 4 && key.index != 7);
+				indices.insert(key.index);
+			}
+
+			Assert::IsTrue(indices.size() == 5 && slotmap.Capacity() == 8);
+		}
+
+		TEST_METHOD(RefusesTakenReservedAndOlderSlots)
+		{
+			Unalmas::SlotMap<int> slotmap(4);
+			const auto a = slotmap.Insert(1);
+			const auto reserved = slotmap.ReserveKey();
+			const auto b = slotmap.Insert(2);
+			slotmap.Erase(b);
+
+			Assert::IsFalse(slotmap.InsertAt(a, 5));
+			Assert::IsFalse(slotmap.InsertAt(reserved, 5));
+			Assert::IsFalse(slotmap.InsertAt(b, 5));
+			Assert::IsFalse(slotmap.InsertAt(Unalmas::SlotMapKey(-1, 0), 5));
+			Assert::IsTrue(slotmap.InsertAt(Unalmas::SlotMapKey(b.index, b.generation + 1), 5));
+		}
+
+		TEST_METHOD(GrowsToFitTheIndex)
+		{
+			Unalmas::SlotMap<int> slotmap(4);
+			const auto key = Unalmas::SlotMapKey(100, 2);
+
+			Assert::IsTrue(slotmap.InsertAt(key, 7));
+			Assert::IsTrue(slotmap.Capacity() > 100 && slotmap[key] == 7);
+
+			for (int i = 0; i < 200; ++i)
+			{
+				Assert::IsTrue(slotmap.Insert(i).index != 100);
+			}
+
+			slotmap.Erase(key);
+			slotmap.Clear();
+			Assert::IsTrue(slotmap.InsertAt(Unalmas::SlotMapKey(50, 5), 1));
+		}
+
+		TEST_METHOD(RestoredMapsKnowTheirFreeList)
+		{
+			Unalmas::SlotMap<int> slotmap(8);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 8; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			slotmap.Erase(keys[2]);
+			slotmap.Erase(keys[5]);
+			slotmap.Erase(keys[6]);
+
+			Unalmas::SlotMap<int> restored(slotmap.GetLayout());
+			Assert::IsTrue(restored.InsertAt(Unalmas::SlotMapKey(5, 1), 55));
+			Assert::IsTrue(restored.Insert(0).index == 2);
+			Assert::IsTrue(restored.Insert(0).index == 6);
+			Assert::IsTrue(restored[Unalmas::SlotMapKey(5, 1)] == 55);
+		}
+
+		TEST_METHOD(RetiredKeysAreNeverHandedOut)
+		{
+			Unalmas::SlotMap<int> slotmap(4);
+			const auto a = slotmap.Insert(1);
+			const auto reserved = slotmap.ReserveKey();
+
+			Assert::IsFalse(slotmap.RetireKey(a));
+			Assert::IsFalse(slotmap.RetireKey(reserved));
+			Assert::IsTrue(slotmap.RetireKey(Unalmas::SlotMapKey(2, 6)));
+			Assert::IsTrue(slotmap.RetireKey(Unalmas::SlotMapKey(2, 3)));	// Already past it
+			Assert::IsTrue(slotmap.RetireKey(Unalmas::SlotMapKey(20, 0)));
+
+			Assert::IsFalse(slotmap.InsertAt(Unalmas::SlotMapKey(2, 6), 5));
+			Assert::IsTrue(slotmap.InsertAt(Unalmas::SlotMapKey(2, 7), 5));
+			Assert::IsFalse(slotmap.InsertAt(Unalmas::SlotMapKey(20, 0), 5));
+
+			Unalmas::StableSlotMap<int> stable(4);
+			const auto b = stable.Insert(1);
+
+			Assert::IsFalse(stable.RetireKey(b));
+			Assert::IsTrue(stable.RetireKey(Unalmas::SlotMapKey(2, 6)));
+			Assert::IsTrue(stable.RetireKey(Unalmas::SlotMapKey(20, 0)));
+			Assert::IsFalse(stable.InsertAt(Unalmas::SlotMapKey(2, 6), 5));
+			Assert::IsTrue(stable.InsertAt(Unalmas::SlotMapKey(2, 7), 5));
+			Assert::IsTrue(stable.Capacity() > 20 && stable.Size() == 2);
+		}
+	};
+
+	TEST_CLASS(SharedSlotMapTests)
+	{
+	public:
+		// Readers would normally live in other processes; the segments don't know the difference.
+		const char* name = "/slotmap_shared_test";
+
+		TEST_METHOD(ReaderSeesWriterChanges)
+		{
+			Unalmas::SharedSlotMap<int> writer(name, 4);
+			const auto a = writer.Insert(1);
+			const auto b = writer.Insert(2);
+
+			Unalmas::SharedSlotMapReader<int> reader(name);
+			int value = 0;
+			Assert::IsTrue(reader.TryGet(a, value) && value == 1);
+
+			writer.Update(a, 10);
+			writer.Erase(b);
+
+			Assert::IsTrue(reader.TryGet(a, value) && value == 10);
+			Assert::IsFalse(reader.TryGet(b, value));
+			Assert::IsTrue(reader.Size() == 1);
+		}
+
+		TEST_METHOD(ReaderFollowsGrowth)
+		{
+			Unalmas::SharedSlotMap<double> writer(name, 2);
+			Unalmas::SharedSlotMapReader<double> reader(name);
+
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 100; ++i)
+			{
+				keys.push_back(writer.Insert(i * 2.0));
+			}
+
+			Assert::IsTrue(reader.Capacity() >= 100);
+
+			double value = 0.0;
+			for (int i = 0; i < 100; ++i)
+			{
+				Assert::IsTrue(reader.TryGet(keys[i], value) && value == i * 2.0);
+			}
+		}
+
+		TEST_METHOD(ReaderKeepsItsSegmentWhenTheNewOneWontOpen)
+		{
+			Unalmas::SharedSlotMap<int> writer(name, 2);
+			const auto key = writer.Insert(7);
+
+			Unalmas::SharedSlotMapReader<int> reader(name);
+			int value = 0;
+			Assert::IsTrue(reader.TryGet(key, value) && value == 7);
+
+			for (int i = 0; i < 8; ++i)
+			{
+				writer.Insert(i);
+			}
+
+			// Take away the grown segment's name before the reader gets to open it.
+			for (std::uint32_t generation = 0; generation < 16; ++generation)
+			{
+				Unalmas::SharedMemorySegment::Unlink(Unalmas::SharedSlotMapDetail::StorageName(name, generation));
+			}
+
+			Assert::IsTrue(reader.TryGet(key, value) && value == 7);
+		}
+
+		TEST_METHOD(SecondWriterIsRejected)
+		{
+			Unalmas::SharedSlotMap<int> writer(name, 2);
+			const auto key = writer.Insert(3);
+
+			Assert::ExpectException<std::runtime_error>([&]() { Unalmas::SharedSlotMap<int> other(name, 2); });
+
+			Unalmas::SharedSlotMapReader<int> reader(name);
+			int value = 0;
+			Assert::IsTrue(reader.TryGet(key, value) && value == 3);
+		}
+
+		TEST_METHOD(FailedGrowKeepsTheStorage)
+		{
+			Unalmas::SharedSlotMap<int> writer(name, 2);
+			const auto a = writer.Insert(1);
+			const auto b = writer.Insert(2);
+
+			// Somebody else holds the name of the next storage segment.
+			Unalmas::SharedMemorySegment blocker;
+			Assert::IsTrue(blocker.Create(Unalmas::SharedSlotMapDetail::StorageName(name, 1), 64));
+
+			Assert::ExpectException<std::runtime_error>([&]() { writer.Insert(3); });
+
+			int value = 0;
+			Assert::IsTrue(writer.TryGet(a, value) && value == 1);
+			Assert::IsTrue(writer.TryGet(b, value) && value == 2);
+
+			blocker.Close();
+			Unalmas::SharedMemorySegment::Unlink(Unalmas::SharedSlotMapDetail::StorageName(name, 1));
+
+			const auto c = writer.Insert(3);
+			Unalmas::SharedSlotMapReader<int> reader(name);
+			Assert::IsTrue(reader.TryGet(a, value) && value == 1);
+			Assert::IsTrue(reader.TryGet(c, value) && value == 3);
+		}
+
+		TEST_METHOD(ConcurrentReadsDuringWrites)
+		{
+			Unalmas::SharedSlotMap<long long> writer(name, 8);
+			const auto stable = writer.Insert(42);
+			std::atomic<bool> done{ false };
+			std::atomic<int> failures{ 0 };
+
+			std::thread readerThread([&]()
+			{
+				Unalmas::SharedSlotMapReader<long long> reader(name);
+				long long value = 0;
+				while (!done.load())
+				{
+					if (!reader.TryGet(stable, value) || value != 42)
+					{
+						failures.fetch_add(1);
+					}
+				}
+			});
+
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 20000; ++i)
+			{
+				keys.push_back(writer.Insert(i));
+				if (i % 3 == 0)
+				{
+					writer.Erase(keys[i / 2]);
+				}
+			}
+
+			done.store(true);
+			readerThread.join();
+
+			Assert::IsTrue(failures.load() == 0);
+		}
+
+		TEST_METHOD(MismatchedElementTypeIsRejected)
+		{
+			Unalmas::SharedSlotMap<int> writer(name);
+
+			bool threw = false;
+			try
+			{
+				Unalmas::SharedSlotMapReader<double> reader(name);
+			}
+			catch (const std::runtime_error&)
+			{
+				threw = true;
+			}
+
+			Assert::IsTrue(threw);
+		}
+
+		TEST_METHOD(ReleaseUnusedPagesKeepsValues)
+		{
+			Unalmas::SharedSlotMap<long long> writer(name, 8);
+			Unalmas::SharedSlotMapReader<long long> reader(name);
+
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 50000; ++i)
+			{
+				keys.push_back(writer.Insert(i));
+			}
+
+			for (int i = 10; i < 50000; ++i)
+			{
+				writer.Erase(keys[i]);
+			}
+
+			// Frees nothing where the platform can't; the map works the same either way.
+			writer.ReleaseUnusedPages();
+
+			long long value = 0;
+			for (int i = 0; i < 10; ++i)
+			{
+				Assert::IsTrue(reader.TryGet(keys[i], value) && value == i);
+			}
+
+			for (int i = 0; i < 20000; ++i)
+			{
+				keys[10 + i] = writer.Insert(-i);
+			}
+
+			for (int i = 0; i < 20000; ++i)
+			{
+				Assert::IsTrue(reader.TryGet(keys[10 + i], value) && value == -i);
+			}
+		}
+	};
+
+	TEST_CLASS(CowSlotMapTests)
+	{
+	public:
+		TEST_METHOD(SnapshotDoesNotChange)
+		{
+			Unalmas::CowSlotMap<std::string, 4> slotmap;
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 20; ++i)
+			{
+				keys.push_back(slotmap.Insert(std::to_string(i)));
+			}
+
+			const auto snapshot = slotmap.Snapshot();
+
+			slotmap[keys[3]] = "changed";
+			slotmap.Erase(keys[0]);
+			for (int i = 0; i < 20; ++i)
+			{
+				slotmap.Insert("new");
+			}
+
+			Assert::IsTrue(snapshot.Size() == 20 && slotmap.Size() == 39);
+			for (int i = 0; i < 20; ++i)
+			{
+				Assert::IsTrue(snapshot[keys[i]] == std::to_string(i));
+			}
+
+			Assert::IsTrue(slotmap[keys[3]] == "changed");
+			Assert::IsFalse(slotmap.Contains(keys[0]));
+		}
+
+		TEST_METHOD(OnlyTouchedPagesAreCopied)
+		{
+			Unalmas::CowSlotMap<int, 64> slotmap;
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 64 * 16; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			Assert::IsTrue(slotmap.CopiedPages() == 0);
+
+			{
+				const auto snapshot = slotmap.Snapshot();
+				slotmap[keys[100]] = -1;
+				slotmap[keys[101]] = -1;
+				Assert::IsTrue(slotmap.CopiedPages() == 1);
+				Assert::IsTrue(snapshot[keys[100]] == 100);
+			}
+
+			// Nobody shares the page anymore.
+			slotmap[keys[500]] = -1;
+			Assert::IsTrue(slotmap.CopiedPages() == 1);
+		}
+
+		TEST_METHOD(FailedPageCopyLeavesNothingBehind)
+		{
+			Unalmas::CowSlotMap<CopyCounted, 8> slotmap;
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 8; ++i)
+			{
+				keys.push_back(slotmap.Insert(CopyCounted(i)));
+			}
+
+			const auto snapshot = slotmap.Snapshot();
+			const int before = CopyCounted::live;
+
+			// The page copy fails halfway through its values.
+			CopyCounted::copiesLeft = 4;
+			Assert::ExpectException<std::runtime_error>([&]() { slotmap[keys[0]].value = -1; });
+			Assert::IsTrue(CopyCounted::live == before);
+
+			CopyCounted::copiesLeft = 1 << 30;
+			slotmap[keys[0]].value = -1;
+			Assert::IsTrue(snapshot[keys[0]].value == 0 && slotmap[keys[0]].value == -1);
+		}
+
+		TEST_METHOD(SnapshotReadOnAnotherThread)
+		{
+			Unalmas::CowSlotMap<long long, 32> slotmap;
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 1000; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			auto snapshot = slotmap.Snapshot();
+			long long expected = 0;
+			snapshot.ForEach([&](long long value) { expected += value; });
+
+			std::atomic<bool> consistent{ true };
+			std::thread reader([&, snapshot = std::move(snapshot)]()
+			{
+				for (int round = 0; round < 50; ++round)
+				{
+					long long sum = 0;
+					snapshot.ForEach([&](long long value) { sum += value; });
+					if (sum != expected)
+					{
+						consistent.store(false);
+					}
+				}
+			});
+
+			for (int i = 0; i < 1000; i += 2)
+			{
+				slotmap[keys[i]] = 0;
+				slotmap.Erase(keys[i + 1]);
+				slotmap.Insert(7);
+			}
+
+			reader.join();
+			Assert::IsTrue(consistent.load());
+		}
+	};
+
+	TEST_CLASS(SlotMapCheckpointTests)
+	{
+	public:
+		const char* path = "slotmap_checkpoint_test.bin";
+
+		TEST_METHOD_CLEANUP(TearDown)
+		{
+			std::remove(path);
+		}
+
+		TEST_METHOD(CheckpointMatchesSnapshot)
+		{
+			Unalmas::CowSlotMap<int, 64> slotmap;
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 10000; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			for (int i = 0; i < 10000; i += 7)
+			{
+				slotmap.Erase(keys[i]);
+			}
+
+			Unalmas::SlotMapCheckpointOptions options;
+			options.bufferSize = 4096;
+
+			Unalmas::SlotMapCheckpointWriter writer(options);
+			Assert::IsTrue(writer.Start(slotmap.Snapshot(), path));
+
+			// Keep writing while the checkpoint is written.
+			for (int i = 1; i < 10000; i += 7)
+			{
+				slotmap[keys[i]] = -1;
+				slotmap.Erase(keys[i + 1]);
+			}
+
+			Assert::IsTrue(writer.Wait());
+			Assert::IsFalse(writer.IsRunning());
+
+			const Unalmas::MappedSlotMap<int> checkpoint(path);
+			Assert::IsTrue(checkpoint.Verify());
+			Assert::IsTrue(writer.BytesWritten() > checkpoint.Capacity() * sizeof(Unalmas::SlotMapKey));
+
+			int value = 0;
+			for (int i = 0; i < 10000; ++i)
+			{
+				Assert::IsTrue(checkpoint.TryGet(keys[i], value) == (i % 7 != 0));
+				Assert::IsTrue(i % 7 == 0 || value == i);
+			}
+
+			// The checkpoint keeps working as a regular slotmap, free list included.
+			auto loaded = Unalmas::LoadSlotMap<int>(path);
+			const auto key = loaded.Insert(5);
+			Assert::IsTrue(loaded[key] == 5 && loaded.Size() == checkpoint.Size() + 1);
+		}
+
+		TEST_METHOD(WritesAreThrottled)
+		{
+			Unalmas::CowSlotMap<long long> slotmap;
+			for (int i = 0; i < 4096; ++i)
+			{
+				slotmap.Insert(i);
+			}
+
+			Unalmas::SlotMapCheckpointOptions options;
+			options.bufferSize = 4096;
+			options.bytesPerSecond = 1 << 20;
+
+			Unalmas::SlotMapCheckpointWriter writer(options);
+			const auto start = std::chrono::steady_clock::now();
+			Assert::IsTrue(writer.Start(slotmap.Snapshot(), path));
+			Assert::IsTrue(writer.Wait());
+			const auto elapsed = std::chrono::steady_clock::now() - start;
+
+			// About 80 KB at 1 MB/s.
+			const double expected = static_cast<double>(writer.BytesWritten()) / options.bytesPerSecond;
+			Assert::IsTrue(std::chrono::duration<double>(elapsed).count() >= expected * 0.9);
+		}
+
+		TEST_METHOD(WriterIsNotHeldUpByACheckpoint)
+		{
+			constexpr int count = 1 << 13;
+			Unalmas::CowSlotMap<long long> slotmap;
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < count; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			// A budget of one byte per second stalls the checkpoint after its first
+			// buffer, until it is cancelled.
+			Unalmas::SlotMapCheckpointOptions options;
+			options.bufferSize = 4096;
+			options.bytesPerSecond = 1;
+
+			Unalmas::SlotMapCheckpointWriter writer(options);
+			Assert::IsTrue(writer.Start(slotmap.Snapshot(), path));
+
+			// All of this has to get done while the checkpoint can't make progress.
+			for (int i = 0; i < count; i += 2)
+			{
+				slotmap.Erase(keys[i]);
+				slotmap[keys[i + 1]] = -i;
+			}
+
+			for (int i = 0; i < count / 2; ++i)
+			{
+				slotmap.Insert(i);
+			}
+
+			Assert::IsTrue(writer.IsRunning() && writer.BytesWritten() <= options.bufferSize);
+			Assert::IsTrue(slotmap.Size() == count && slotmap[keys[1]] == 0 && slotmap[keys[count - 1]] == -(count - 2));
+
+			writer.Cancel();
+			Assert::IsFalse(writer.Wait());
+		}
+
+		TEST_METHOD(ZeroBufferSizeIsRejected)
+		{
+			Unalmas::SlotMapCheckpointOptions options;
+			options.bufferSize = 0;
+
+			Assert::ExpectException<std::invalid_argument>([&]() { Unalmas::SlotMapCheckpointWriter writer(options); });
+		}
+
+		TEST_METHOD(CancelKeepsThePreviousCheckpoint)
+		{
+			Unalmas::CowSlotMap<int> slotmap;
+			const auto key = slotmap.Insert(1);
+
+			Unalmas::SlotMapCheckpointOptions options;
+			options.bufferSize = 64;
+			options.bytesPerSecond = 1024;
+
+			Unalmas::SlotMapCheckpointWriter writer(options);
+			Assert::IsTrue(writer.Start(slotmap.Snapshot(), path));
+			Assert::IsFalse(writer.Start(slotmap.Snapshot(), path));
+			writer.Cancel();
+			Assert::IsFalse(writer.Wait());
+
+			options.bytesPerSecond = 0;
+			Unalmas::SlotMapCheckpointWriter fastWriter(options);
+			Assert::IsTrue(fastWriter.Start(slotmap.Snapshot(), path));
+			Assert::IsTrue(fastWriter.Wait());
+
+			slotmap[key] = 2;
+			Assert::IsTrue(writer.Start(slotmap.Snapshot(), path));
+			writer.Cancel();
+
+			const Unalmas::MappedSlotMap<int> checkpoint(path);
+			Assert::IsTrue(checkpoint[key] == 1);
+		}
+	};
+
+	TEST_CLASS(SlotMapLoaderTests)
+	{
+	public:
+		const char* path = "slotmap_loader_test.bin";
+
+		struct Named
+		{
+			Named(const int& value) : text{ std::to_string(value) }
+			{
+				if (value == thrower)
+				{
+					throw std::runtime_error("Can't name this one.");
+				}
+
+				while (value >= gatedFrom && !gateOpen.load())
+				{
+					std::this_thread::yield();
+				}
+			}
+
+			std::string text;
+
+			static inline int thrower = -1;
+			static inline int gatedFrom = INT_MAX;
+			static inline std::atomic<bool> gateOpen{ false };
+		};
+
+		TEST_METHOD_INITIALIZE(SetUp)
+		{
+			Named::thrower = -1;
+			Named::gatedFrom = INT_MAX;
+			Named::gateOpen.store(false);
+		}
+
+		TEST_METHOD_CLEANUP(TearDown)
+		{
+			std::remove(path);
+		}
+
+		std::vector<Unalmas::SlotMapKey> SaveNumbers(int count, int eraseEvery = 5)
+		{
+			Unalmas::SlotMap<int> slotmap;
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < count; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			for (int i = 0; eraseEvery > 0 && i < count; i += eraseEvery)
+			{
+				slotmap.Erase(keys[i]);
+			}
+
+			Unalmas::SaveSlotMap(slotmap, path);
+			return keys;
+		}
+
+		TEST_METHOD(LoadsNonTrivialValuesInParallel)
+		{
+			const auto keys = SaveNumbers(10000);
+
+			Unalmas::SlotMapLoader<Named, int> loader(path, 4, 256);
+			Unalmas::SlotMap<Named> slotmap = loader.Finish();
+
+			Assert::IsTrue(slotmap.Size() == 8000);
+			for (int i = 0; i < 10000; ++i)
+			{
+				Assert::IsTrue(slotmap.Contains(keys[i]) == (i % 5 != 0));
+				Assert::IsTrue(i % 5 == 0 || slotmap[keys[i]].text == std::to_string(i));
+			}
+
+			// Keys keep coming off the same free list as in a plainly loaded copy.
+			Unalmas::SlotMap<int> plain = Unalmas::LoadSlotMap<int>(path);
+			const auto key = slotmap.Insert(Named(1));
+			const auto plainKey = plain.Insert(1);
+			Assert::IsTrue(key.index == plainKey.index && key.generation == plainKey.generation);
+		}
+
+		TEST_METHOD(LookupsWhileLoading)
+		{
+			// Without erases, values are stored in order, so loading stops right at the gate.
+			const auto keys = SaveNumbers(100, 0);
+			Named::gatedFrom = 60;
+
+			Unalmas::SlotMapLoader<Named, int> loader(path, 1, 10);
+			while (loader.LoadedSize() < 60)
+			{
+				std::this_thread::yield();
+			}
+
+			Named value(0);
+			for (int i = 0; i < 100; ++i)
+			{
+				Assert::IsTrue(loader.TryGet(keys[i], value) == (i < 60));
+			}
+
+			Assert::IsTrue(value.text == "59" && !loader.IsDone());
+
+			Named::gateOpen.store(true);
+			Unalmas::SlotMap<Named> slotmap = loader.Finish();
+			Assert::IsTrue(slotmap[keys[99]].text == "99");
+		}
+
+		TEST_METHOD(FailedConstructionThrows)
+		{
+			SaveNumbers(1000);
+			Named::thrower = 501;
+
+			Unalmas::SlotMapLoader<Named, int> loader(path, 3, 16);
+
+			bool threw = false;
+			try
+			{
+				loader.Finish();
+			}
+			catch (const std::runtime_error&)
+			{
+				threw = true;
+			}
+
+			Assert::IsTrue(threw);
+		}
+
+		TEST_METHOD(CorruptSlotsAreRejected)
+		{
+			Unalmas::SlotMap<int> slotmap(8);
+			slotmap.Insert(1);
+			Unalmas::SaveSlotMap(slotmap, path);
+
+			// The first free slot now links far outside the slots.
+			Unalmas::SlotMapFileHeader header;
+			std::FILE* file = std::fopen(path, "r+b");
+			std::fread(&header, sizeof(header), 1, file);
+			std::fseek(file, static_cast<long>(header.slotsOffset + header.firstFreeSlot * sizeof(Unalmas::SlotMapKey)), SEEK_SET);
+			const int next = 1000000;
+			std::fwrite(&next, sizeof(next), 1, file);
+			std::fclose(file);
+
+			Assert::ExpectException<std::runtime_error>([&]() { Unalmas::SlotMapLoader<Named, int> loader(path, 2, 4); });
+		}
+
+		TEST_METHOD(NegativeGenerationsDontMatchReservedSlots)
+		{
+			// Slot 3 gets reserved while its free link still points at value 0.
+			Unalmas::SlotMap<int> slotmap(4);
+			const auto a = slotmap.Insert(1);
+			slotmap.Insert(2);
+			slotmap.Insert(3);
+			slotmap.Erase(a);
+			const auto reserved = slotmap.ReserveKey();
+			Unalmas::SaveSlotMap(slotmap, path);
+
+			Unalmas::SlotMapLoader<Named, int> loader(path, 1, 4);
+			while (!loader.IsDone())
+			{
+				std::this_thread::yield();
+			}
+
+			Named value(0);
+			Assert::IsFalse(loader.TryGet(Unalmas::SlotMapKey(reserved.index, ~reserved.generation), value));
+			loader.Finish();
+		}
+	};
+
+	TEST_CLASS(SlotMapTraceTests)
+	{
+	public:
+		const char* path = "slotmap_trace_test.bin";
+
+		TEST_METHOD_CLEANUP(TearDown)
+		{
+			std::remove(path);
+		}
+
+		TEST_METHOD(RecordsCallsInOrder)
+		{
+			using Op = Unalmas::SlotMapTraceOp;
+
+			Unalmas::TracedSlotMap<int> slotmap;
+			const auto a = slotmap.Insert(1);
+			const auto stale = slotmap.Insert(2);
+			slotmap.Erase(stale);
+
+			Assert::IsTrue(slotmap.StartRecording(path));
+			const auto b = slotmap.Insert(3);
+			Assert::IsTrue(slotmap[b] == 3);
+
+			int value = 0;
+			Assert::IsTrue(slotmap.TryGet(a, value) && value == 1);
+			Assert::IsFalse(slotmap.Contains(stale));
+			Assert::IsTrue(slotmap.Erase(a));
+
+			int sum = 0;
+			for (const int item : slotmap)
+			{
+				sum += item;
+			}
+
+			slotmap.Clear();
+			Assert::IsTrue(slotmap.StopRecording());
+
+			// Not recorded anymore.
+			slotmap.Insert(4);
+
+			const std::pair<Op, Unalmas::SlotMapKey> expected[]
+			{
+				{ Op::Existing, a },
+				{ Op::Insert, b },
+				{ Op::Get, b },
+				{ Op::TryGet, a },
+				{ Op::Contains, stale },
+				{ Op::Erase, a },
+				{ Op::Iterate, Unalmas::SlotMapKey() },
+				{ Op::Clear, Unalmas::SlotMapKey() },
+			};
+
+			Unalmas::SlotMapTraceReader reader;
+			Assert::IsTrue(reader.Open(path));
+			Assert::IsTrue(reader.ElementSize() == sizeof(int));
+
+			Unalmas::SlotMapTraceRecord record;
+			std::uint64_t previous = 0;
+			for (const auto& [op, key] : expected)
+			{
+				Assert::IsTrue(reader.Next(record));
+				Assert::IsTrue(record.op == op && record.key == key && record.nanoseconds >= previous);
+				previous = record.nanoseconds;
+			}
+
+			Assert::IsFalse(reader.Next(record));
+			Assert::IsTrue(sum == 3);
+		}
+
+		TEST_METHOD(KeysOfAnyRangeRoundTrip)
+		{
+			// Reserved slots have negative generations.
+			const Unalmas::SlotMapKey keys[]{ { 0, 0 }, { 123456789, -5 }, { 7, 2147483647 }, { 3, -2147483647 - 1 } };
+
+			Unalmas::SlotMapTraceWriter writer;
+			Assert::IsTrue(writer.Open(path, 16));
+			for (const auto& key : keys)
+			{
+				writer.Record(Unalmas::SlotMapTraceOp::Contains, key);
+			}
+			Assert::IsTrue(writer.Close() && writer.RecordCount() == 4);
+
+			Unalmas::SlotMapTraceReader reader;
+			Assert::IsTrue(reader.Open(path) && reader.ElementSize() == 16);
+
+			Unalmas::SlotMapTraceRecord record;
+			for (const auto& key : keys)
+			{
+				Assert::IsTrue(reader.Next(record) && record.key == key);
+			}
+
+			Assert::IsFalse(reader.Next(record));
+		}
+
+		TEST_METHOD(RejectsOtherFiles)
+		{
+			Unalmas::SlotMap<int> slotmap;
+			slotmap.Insert(1);
+			Unalmas::SaveSlotMap(slotmap, path);
+
+			Unalmas::SlotMapTraceReader reader;
+			Assert::IsFalse(reader.Open(path));
+			Assert::IsFalse(reader.Open("no_such_trace.bin"));
+		}
+	};
+
+	TEST_CLASS(SlotMapStatsTests)
+	{
+	public:
+		TEST_METHOD(ReportsShapeAlways)
+		{
+			Unalmas::SlotMap<int> slotmap(4);
+			slotmap.Insert(1);
+			slotmap.Insert(2);
+			slotmap.ReserveKey();
+
+			const Unalmas::SlotMapStats stats = slotmap.Stats();
+			Assert::IsTrue(stats.size == 2 && stats.capacity == 4 && stats.reservedCount == 1 && stats.freeSlots == 1);
+		}
+
+		TEST_METHOD(CountsWhatTheMapDid)
+		{
+			Unalmas::SlotMap<int> slotmap(4);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 10; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			Assert::IsTrue(slotmap.Erase(keys[0]));		// Moves the last value (9) into its place
+			Assert::IsTrue(slotmap.Erase(keys[8]));		// Is the last value, nothing to move
+
+			int value = 0;
+			Assert::IsFalse(slotmap.TryGet(keys[0], value));
+			Assert::IsFalse(slotmap.Contains(keys[8]));
+			Assert::IsTrue(slotmap.Contains(keys[1]));
+			Assert::IsFalse(slotmap.Contains(Unalmas::SlotMapKey()));	// Not stale, just missing
+
+			Unalmas::SlotMapStats stats = slotmap.Stats();
+			Assert::IsTrue(stats.size == 8 && stats.capacity == 16 && stats.freeSlots == 8);
+
+			if (!Unalmas::SlotMapStatsEnabled)
+			{
+				Assert::IsTrue(stats.growCount == 0 && stats.bytesCopied == 0 && stats.eraseMoves == 0
+					&& stats.staleLookups == 0 && stats.peakSize == 0 && stats.maxGeneration == 0);
+				return;
+			}
+
+			Assert::IsTrue(stats.growCount == 2);		// 4 -> 8 -> 16
+			Assert::IsTrue(stats.bytesCopied >= (4 + 8) * sizeof(int));
+			Assert::IsTrue(stats.eraseMoves == 1);
+			Assert::IsTrue(stats.staleLookups == 2);
+			Assert::IsTrue(stats.peakSize == 10);
+			Assert::IsTrue(stats.maxGeneration == 1);
+
+			slotmap.Clear();
+			stats = slotmap.Stats();
+			Assert::IsTrue(stats.maxGeneration == 2 && stats.peakSize == 10 && stats.size == 0);
+
+			// A copy starts counting afresh, but knows how far its generations got.
+			const Unalmas::SlotMap<int> copy(slotmap);
+			stats = copy.Stats();
+			Assert::IsTrue(stats.growCount == 0 && stats.maxGeneration == 2);
+		}
+
+		TEST_METHOD(ConcurrentVariants)
+		{
+			Unalmas::ConcurrentSlotMap<int> concurrent(4);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 6; ++i)
+			{
+				keys.push_back(concurrent.Insert(i));
+			}
+
+			concurrent.Erase(keys[0]);
+
+			int value = 0;
+			Assert::IsFalse(concurrent.TryGet(keys[0], value));
+
+			Unalmas::SlotMapStats stats = concurrent.Stats();
+			Assert::IsTrue(stats.size == 5 && stats.capacity == 8 && stats.freeSlots == 3);
+
+			if (Unalmas::SlotMapStatsEnabled)
+			{
+				Assert::IsTrue(stats.growCount == 1 && stats.eraseMoves == 1 && stats.staleLookups == 1
+					&& stats.peakSize == 6 && stats.maxGeneration == 1);
+			}
+
+			Unalmas::ShardedSlotMap<int, 4> sharded(8);
+			std::vector<std::thread> threads;
+			for (int t = 0; t < 4; ++t)
+			{
+				threads.emplace_back([&sharded]()
+				{
+					for (int i = 0; i < 100; ++i)
+					{
+						sharded.Erase(sharded.Insert(i));
+					}
+				});
+			}
+
+			for (auto& thread : threads)
+			{
+				thread.join();
+			}
+
+			stats = sharded.Stats();
+			Assert::IsTrue(stats.size == 0 && stats.capacity == 4 * 8 && stats.freeSlots == 4 * 8);
+
+			if (Unalmas::SlotMapStatsEnabled)
+			{
+				// Each shard went through its 8 slots in turn.
+				Assert::IsTrue(stats.growCount == 0 && stats.maxGeneration >= 100 / 8 && stats.peakSize >= 1);
+			}
+		}
+
+		TEST_METHOD(MemoryUsage)
+		{
+			Unalmas::SlotMap<double> slotmap(8);
+			const auto key = slotmap.Insert(1.0);
+			slotmap.Insert(2.0);
+			slotmap.Insert(3.0);
+			slotmap.Insert(4.0);
+			slotmap.Erase(key);
+			slotmap.ReserveKey();
+
+			// 3 values, 1 reserved key, 4 free slots.
+			const Unalmas::SlotMapMemoryUsage usage = slotmap.MemoryUsage();
+			Assert::IsTrue(usage.slots.live == 4 * sizeof(Unalmas::SlotMapKey) && usage.slots.free == 4 * sizeof(Unalmas::SlotMapKey));
+			Assert::IsTrue(usage.values.live == 3 * sizeof(double) && usage.values.slack == 5 * sizeof(double));
+			Assert::IsTrue(usage.valueToSlot.live == 3 * sizeof(unsigned int) && usage.valueToSlot.slack == 5 * sizeof(unsigned int));
+			Assert::IsTrue(usage.freeListLinks.live == 4 * sizeof(int) && usage.freeListLinks.free == 4 * sizeof(int) && usage.freeListLinks.slack == 0);
+			Assert::IsTrue(usage.Total() == 8 * (sizeof(Unalmas::SlotMapKey) + sizeof(double) + sizeof(unsigned int) + sizeof(int)));
+			Assert::IsTrue(usage.occupancy == 3.0 / 8.0);
+		}
+	};
+
+	TEST_CLASS(SlotMapShrinkTests)
+	{
+	public:
+		TEST_METHOD(ShrinkToFitKeepsKeys)
+		{
+			Unalmas::SlotMap<int> slotmap;
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 1000; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			for (int i = 10; i < 1000; ++i)
+			{
+				slotmap.Erase(keys[i]);
+			}
+
+			slotmap.ShrinkToFit();
+			Assert::IsTrue(slotmap.ValueCapacity() == 10 && slotmap.Capacity() == 1024);
+			Assert::IsTrue(slotmap.MemoryUsage().values.slack == 0);
+
+			for (int i = 0; i < 10; ++i)
+			{
+				Assert::IsTrue(slotmap[keys[i]] == i);
+			}
+
+			Assert::IsFalse(slotmap.Contains(keys[500]));
+
+			// The values grow back on their own, without growing the slots.
+			for (int i = 10; i < 1000; ++i)
+			{
+				keys[i] = slotmap.Insert(i);
+			}
+
+			Assert::IsTrue(slotmap.Capacity() == 1024 && slotmap.ValueCapacity() >= 1000);
+			for (int i = 0; i < 1000; ++i)
+			{
+				Assert::IsTrue(slotmap[keys[i]] == i);
+			}
+		}
+
+		TEST_METHOD(ShrinkToFitLeavesRoomForReservations)
+		{
+			Unalmas::SlotMap<std::string> slotmap(16);
+			const auto kept = slotmap.Insert(std::string("kept"));
+			const auto reserved = slotmap.ReserveKeys(2);
+
+			slotmap.ShrinkToFit();
+			Assert::IsTrue(slotmap.ValueCapacity() == 3);
+
+			slotmap.Commit(reserved[0], "first");
+			slotmap.Commit(reserved[1], "second");
+			const auto inserted = slotmap.Insert(std::string("inserted"));
+			Assert::IsTrue(slotmap.InsertAt(Unalmas::SlotMapKey(15, 3), "at"));
+
+			Assert::IsTrue(slotmap[kept] == "kept" && slotmap[reserved[0]] == "first" && slotmap[reserved[1]] == "second");
+			Assert::IsTrue(slotmap[inserted] == "inserted" && slotmap[Unalmas::SlotMapKey(15, 3)] == "at");
+			Assert::IsTrue(slotmap.Size() == 5 && slotmap.Capacity() == 16);
+		}
+
+		TEST_METHOD(CompactSlotsDropsFreeTail)
+		{
+			Unalmas::SlotMap<int> slotmap;
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 1000; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			// Erasing from the middle leaves a hole that has to stay.
+			slotmap.Erase(keys[5]);
+			for (int i = 20; i < 1000; ++i)
+			{
+				slotmap.Erase(keys[i]);
+			}
+
+			Assert::IsTrue(slotmap.CompactSlots() == 1024 - 20);
+			Assert::IsTrue(slotmap.Capacity() == 20 && slotmap.ValueCapacity() == 20);
+			Assert::IsTrue(slotmap.CompactSlots() == 0);
+
+			for (int i = 0; i < 20; ++i)
+			{
+				Assert::IsTrue(i == 5 ? !slotmap.Contains(keys[i]) : slotmap[keys[i]] == i);
+			}
+
+			int value = 0;
+			Assert::IsFalse(slotmap.Contains(keys[500]) || slotmap.TryGet(keys[500], value) || slotmap.Erase(keys[500]));
+
+			// Slots added back don't bring the dropped keys back to life.
+			std::vector<Unalmas::SlotMapKey> newKeys;
+			for (int i = 0; i < 2000; ++i)
+			{
+				newKeys.push_back(slotmap.Insert(-i));
+			}
+
+			for (int i = 20; i < 1000; ++i)
+			{
+				Assert::IsFalse(slotmap.Contains(keys[i]));
+			}
+
+			for (int i = 0; i < 2000; ++i)
+			{
+				Assert::IsTrue(slotmap[newKeys[i]] == -i);
+			}
+		}
+
+		TEST_METHOD(CompactSlotsStopsAtReservedSlots)
+		{
+			Unalmas::SlotMap<int> slotmap(16);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 12; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			const auto reserved = slotmap.ReserveKey();	// Slot 12
+			for (int i = 2; i < 12; ++i)
+			{
+				slotmap.Erase(keys[i]);
+			}
+
+			Assert::IsTrue(slotmap.CompactSlots() == 3);
+			Assert::IsTrue(slotmap.Capacity() == 13);
+
+			slotmap.Commit(reserved, 12);
+			Assert::IsTrue(slotmap[reserved] == 12 && slotmap[keys[0]] == 0 && slotmap[keys[1]] == 1);
+		}
+
+		TEST_METHOD(CompactedSlotsStayDeadAfterSaveAndLoad)
+		{
+			const char* path = "slotmap_compact_test.bin";
+
+			Unalmas::SlotMap<int> slotmap;
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 100; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			for (int i = 10; i < 100; ++i)
+			{
+				slotmap.Erase(keys[i]);
+			}
+
+			Assert::IsTrue(slotmap.CompactSlots() > 0);
+			Assert::IsTrue(Unalmas::SaveSlotMap(slotmap, path));
+
+			Unalmas::SlotMap<int> loaded = Unalmas::LoadSlotMap<int>(path);
+			Unalmas::SlotMap<int> rebuilt(slotmap.GetLayout());
+			std::remove(path);
+
+			for (Unalmas::SlotMap<int>* map : { &loaded, &rebuilt })
+			{
+				// Grow back over the dropped slots.
+				for (int i = 0; i < 200; ++i)
+				{
+					map->Insert(-i);
+				}
+
+				for (int i = 10; i < 100; ++i)
+				{
+					Assert::IsFalse(map->Contains(keys[i]));
+				}
+
+				for (int i = 0; i < 10; ++i)
+				{
+					Assert::IsTrue((*map)[keys[i]] == i);
+				}
+			}
+		}
+	};
+
+	TEST_CLASS(SlotMapReuseTests)
+	{
+	public:
+		// Fills slots 0..7, then frees 5, 2 and 6 in that order.
+		static Unalmas::SlotMapKey InsertAfterErasing(Unalmas::SlotMapReuse reuse)
+		{
+			Unalmas::SlotMap<int> slotmap(8, reuse);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 8; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			slotmap.Erase(keys[5]);
+			slotmap.Erase(keys[2]);
+			slotmap.Erase(keys[6]);
+
+			return slotmap.Insert(8);
+		}
+
+		TEST_METHOD(PoliciesPickTheirSlot)
+		{
+			Assert::IsTrue(InsertAfterErasing(Unalmas::SlotMapReuse::Fifo).index == 5);
+			Assert::IsTrue(InsertAfterErasing(Unalmas::SlotMapReuse::Lifo).index == 6);
+			Assert::IsTrue(InsertAfterErasing(Unalmas::SlotMapReuse::LowestIndex).index == 2);
+		}
+
+		TEST_METHOD(LowestIndexKeepsSlotsPacked)
+		{
+			Unalmas::SlotMap<int> slotmap(8, Unalmas::SlotMapReuse::LowestIndex);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 5000; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			for (int i = 0; i < 5000; i += 3)
+			{
+				slotmap.Erase(keys[i]);
+			}
+
+			for (int i = 0; i < 5000; ++i)
+			{
+				slotmap.Erase(keys[i]);
+			}
+
+			// Everything is free now, spread over 8192 slots; new keys start from the bottom.
+			for (int i = 0; i < 100; ++i)
+			{
+				Assert::IsTrue(slotmap.Insert(i).index == i);
+			}
+
+			Assert::IsTrue(slotmap.MemoryUsage().freeSlotBits.Total() > 0);
+		}
+
+		TEST_METHOD(PoliciesAgreeWithAReference)
+		{
+			const Unalmas::SlotMapReuse policies[]{ Unalmas::SlotMapReuse::Fifo, Unalmas::SlotMapReuse::Lifo, Unalmas::SlotMapReuse::LowestIndex };
+			for (const Unalmas::SlotMapReuse reuse : policies)
+			{
+				Unalmas::SlotMap<int> slotmap(4, reuse);
+				std::vector<std::pair<Unalmas::SlotMapKey, int>> live;
+				std::vector<Unalmas::SlotMapKey> erased;
+				unsigned int random = 12345;
+
+				for (int i = 0; i < 20000; ++i)
+				{
+					random = random * 1664525u + 1013904223u;
+					const unsigned int choice = (random >> 16) % 10;
+
+					if (choice < 5 || live.empty())
+					{
+						live.emplace_back(slotmap.Insert(i), i);
+					}
+					else if (choice < 9)
+					{
+						const std::size_t victim = (random >> 8) % live.size();
+						Assert::IsTrue(slotmap.Erase(live[victim].first));
+						erased.push_back(live[victim].first);
+						live[victim] = live.back();
+						live.pop_back();
+					}
+					else
+					{
+						const auto key = slotmap.ReserveKey();
+						slotmap.Commit(key, i);
+						live.emplace_back(key, i);
+					}
+
+					if (i == 10000)
+					{
+						slotmap.CompactSlots();
+					}
+				}
+
+				Assert::IsTrue(slotmap.Size() == static_cast<int>(live.size()));
+				for (const auto& [key, value] : live)
+				{
+					Assert::IsTrue(slotmap[key] == value);
+				}
+
+				for (const auto& key : erased)
+				{
+					Assert::IsFalse(slotmap.Contains(key));
+				}
+			}
+		}
+
+		TEST_METHOD(SwitchingPoliciesKeepsTheFreeList)
+		{
+			Unalmas::SlotMap<int> slotmap(16);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 16; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			slotmap.Erase(keys[9]);
+			slotmap.Erase(keys[3]);
+			slotmap.SetReuse(Unalmas::SlotMapReuse::LowestIndex);
+
+			Assert::IsTrue(slotmap.Insert(100).index == 3);
+			Assert::IsTrue(slotmap.InsertAt(Unalmas::SlotMapKey(9, 1), 200));
+			Assert::IsTrue(slotmap.Insert(300).index == 16);
+
+			slotmap.Clear();
+			Assert::IsTrue(slotmap.Insert(0).index == 0);
+
+			slotmap.SetReuse(Unalmas::SlotMapReuse::Lifo);
+			const auto key = slotmap.Insert(1);
+			slotmap.Erase(key);
+			Assert::IsTrue(slotmap.Insert(2).index == key.index);
+		}
+	};
+
+	TEST_CLASS(StableSlotMapTests)
+	{
+	public:
+		TEST_METHOD(InsertLookupErase)
+		{
+			Unalmas::StableSlotMap<std::string> slotmap(2);
+			const auto a = slotmap.Insert(std::string("a"));
+			const auto b = slotmap.Insert(std::string("b"));
+			const auto c = slotmap.Insert(std::string("c"));
+
+			Assert::IsTrue(slotmap.Size() == 3 && slotmap.Capacity() == 4);
+			Assert::IsTrue(slotmap[a] == "a" && slotmap[b] == "b" && slotmap[c] == "c");
+
+			Assert::IsTrue(slotmap.Erase(b));
+			Assert::IsFalse(slotmap.Erase(b));
+			Assert::IsFalse(slotmap.Contains(b));
+
+			std::string value;
+			Assert::IsFalse(slotmap.TryGet(b, value));
+			Assert::IsTrue(slotmap.TryGet(c, value) && value == "c");
+
+			// The freed slot is reused, under a new generation.
+			const auto d = slotmap.Insert(std::string("d"));
+			Assert::IsTrue(d.index == b.index && d.generation != b.generation);
+			Assert::IsFalse(slotmap.Contains(b));
+		}
+
+		TEST_METHOD(NegativeGenerationsDontMatchFreeSlots)
+		{
+			Unalmas::StableSlotMap<int> slotmap(4);
+			const auto kept = slotmap.Insert(1);
+			const auto erased = slotmap.Insert(2);
+			slotmap.Erase(erased);
+
+			// Free slots store the generation of their next key, inverted.
+			const Unalmas::SlotMapKey forged(erased.index, ~(erased.generation + 1));
+			const Unalmas::SlotMapKey forgedUnused(3, ~0);
+			int value = 0;
+
+			for (const auto& key : { forged, forgedUnused })
+			{
+				Assert::IsFalse(slotmap.TryGet(key, value));
+				Assert::IsFalse(slotmap.Contains(key));
+				Assert::IsFalse(slotmap.Erase(key));
+				Assert::ExpectException<std::runtime_error>([&]() { return slotmap[key]; });
+			}
+
+			Assert::IsTrue(slotmap.Size() == 1 && slotmap[kept] == 1);
+
+			const auto inserted = slotmap.Insert(3);
+			Assert::IsTrue(slotmap[inserted] == 3 && slotmap.Size() == 2);
+		}
+
+		TEST_METHOD(ErasingDoesNotMoveOtherValues)
+		{
+			Unalmas::StableSlotMap<int> slotmap(64);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 64; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			const int* last = &slotmap[keys[63]];
+			for (int i = 0; i < 63; ++i)
+			{
+				slotmap.Erase(keys[i]);
+			}
+
+			Assert::IsTrue(&slotmap[keys[63]] == last && *last == 63);
+		}
+
+		TEST_METHOD(IterationSkipsFreeRuns)
+		{
+			Unalmas::StableSlotMap<int> slotmap;
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 100; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			// Runs of every length from 1 up, joined from either side.
+			std::vector<int> expected;
+			for (int i = 0, run = 1; i < 100; )
+			{
+				expected.push_back(i++);
+				for (int j = 0; j < run && i < 100; ++j, ++i)
+				{
+					slotmap.Erase(keys[(j % 2) ? i : 100 - 1 - i]);
+				}
+				run++;
+			}
+
+			std::vector<int> visited;
+			for (auto it = slotmap.begin(); it != slotmap.end(); ++it)
+			{
+				Assert::IsTrue(slotmap.Contains(it.Key()) && slotmap[it.Key()] == *it);
+				visited.push_back(*it);
+			}
+
+			Assert::IsTrue(static_cast<int>(visited.size()) == slotmap.Size());
+			for (std::size_t i = 1; i < visited.size(); ++i)
+			{
+				Assert::IsTrue(keys[visited[i - 1]].index < keys[visited[i]].index);
+			}
+
+			slotmap.Clear();
+			Assert::IsFalse(slotmap.begin() != slotmap.end());
+			Assert::IsFalse(slotmap.Contains(keys[0]));
+		}
+
+		TEST_METHOD(InsertAtSplitsFreeRuns)
+		{
+			Unalmas::StableSlotMap<int> slotmap(16);
+			Assert::IsTrue(slotmap.InsertAt(Unalmas::SlotMapKey(5, 3), 5));
+			Assert::IsTrue(slotmap.InsertAt(Unalmas::SlotMapKey(10, 0), 10));
+			Assert::IsTrue(slotmap.InsertAt(Unalmas::SlotMapKey(0, 1), 0));
+			Assert::IsTrue(slotmap.InsertAt(Unalmas::SlotMapKey(15, 0), 15));
+			Assert::IsTrue(slotmap.InsertAt(Unalmas::SlotMapKey(40, 0), 40));
+
+			Assert::IsFalse(slotmap.InsertAt(Unalmas::SlotMapKey(5, 4), 0));		// Taken
+			Assert::IsTrue(slotmap.Erase(Unalmas::SlotMapKey(5, 3)));
+			Assert::IsFalse(slotmap.InsertAt(Unalmas::SlotMapKey(5, 3), 0));		// Generation went backwards
+
+			// Every other slot is still free, exactly once.
+			std::vector<int> inserted;
+			while (slotmap.Size() < slotmap.Capacity())
+			{
+				inserted.push_back(slotmap.Insert(-1).index);
+			}
+
+			std::sort(inserted.begin(), inserted.end());
+			Assert::IsTrue(std::adjacent_find(inserted.begin(), inserted.end()) == inserted.end());
+			Assert::IsTrue(static_cast<int>(inserted.size()) == slotmap.Capacity() - 4);
+
+			int sum = 0;
+			for (const int value : slotmap)
+			{
+				sum += value;
+			}
+
+			Assert::IsTrue(sum == 10 + 15 + 40 - static_cast<int>(inserted.size()));
+		}
+
+		TEST_METHOD(AgreesWithAReference)
+		{
+			Unalmas::StableSlotMap<std::string> slotmap(4);
+			std::vector<std::pair<Unalmas::SlotMapKey, std::string>> live;
+			std::vector<Unalmas::SlotMapKey> erased;
+			unsigned int random = 777;
+
+			for (int i = 0; i < 20000; ++i)
+			{
+				random = random * 1664525u + 1013904223u;
+				const unsigned int choice = (random >> 16) % 20;
+				const std::string value = std::to_string(i);
+
+				if (choice < 10 || live.empty())
+				{
+					live.emplace_back(slotmap.Insert(value), value);
+				}
+				else if (choice < 19)
+				{
+					const std::size_t victim = (random >> 4) % live.size();
+					Assert::IsTrue(slotmap.Erase(live[victim].first));
+					erased.push_back(live[victim].first);
+					live[victim] = live.back();
+					live.pop_back();
+				}
+				else
+				{
+					// Somewhere free, with a generation past any that slot had.
+					const Unalmas::SlotMapKey key((random >> 4) % (slotmap.Capacity() + 8), 1000000 + i);
+					if (slotmap.InsertAt(key, value))
+					{
+						live.emplace_back(key, value);
+					}
+				}
+
+				if (i % 5000 == 4999)
+				{
+					int count = 0;
+					for (auto it = slotmap.begin(); it != slotmap.end(); ++it)
+					{
+						Assert::IsTrue(slotmap.Contains(it.Key()));
+						++count;
+					}
+
+					Assert::IsTrue(count == slotmap.Size());
+				}
+			}
+
+			Assert::IsTrue(slotmap.Size() == static_cast<int>(live.size()));
+			for (const auto& [key, value] : live)
+			{
+				Assert::IsTrue(slotmap[key] == value);
+			}
+
+			for (const auto& key : erased)
+			{
+				Assert::IsFalse(slotmap.Contains(key));
+			}
+		}
+	};
+
+	TEST_CLASS(AdaptiveSlotMapTests)
+	{
+	public:
+		TEST_METHOD(KeysSurviveMigrations)
+		{
+			Unalmas::AdaptiveSlotMapPolicy policy;
+			policy.window = 0;
+
+			Unalmas::AdaptiveSlotMap<std::string> slotmap(4, policy);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 100; ++i)
+			{
+				keys.push_back(slotmap.Insert(std::to_string(i)));
+			}
+
+			for (int i = 0; i < 100; i += 3)
+			{
+				slotmap.Erase(keys[i]);
+			}
+
+			const auto check = [&]()
+			{
+				Assert::IsTrue(slotmap.Size() == 66);
+				for (int i = 0; i < 100; ++i)
+				{
+					Assert::IsTrue(slotmap.Contains(keys[i]) == (i % 3 != 0));
+					Assert::IsTrue(i % 3 == 0 || slotmap[keys[i]] == std::to_string(i));
+
+					const std::string* found = slotmap.Find(keys[i]);
+					Assert::IsTrue(i % 3 == 0 ? found == nullptr : *found == std::to_string(i));
+				}
+			};
+
+			slotmap.SetMode(Unalmas::AdaptiveSlotMapMode::Stable);
+			Assert::IsTrue(slotmap.IsMigrating() && slotmap.Mode() == Unalmas::AdaptiveSlotMapMode::Dense);
+			Assert::IsTrue(slotmap.Migrate(1 << 20));
+			Assert::IsTrue(slotmap.Mode() == Unalmas::AdaptiveSlotMapMode::Stable);
+			check();
+
+			// Freed slots hand out newer keys than the erased ones, in either layout.
+			const auto reused = slotmap.Insert(std::string("new"));
+			Assert::IsTrue(reused.index % 3 == 0 && reused.index < 100 && reused != keys[reused.index]);
+			slotmap.Erase(reused);
+
+			slotmap.SetMode(Unalmas::AdaptiveSlotMapMode::Dense);
+			Assert::IsTrue(slotmap.Migrate(1 << 20));
+			Assert::IsTrue(slotmap.Mode() == Unalmas::AdaptiveSlotMapMode::Dense && slotmap.MigrationCount() == 2);
+			check();
+			Assert::IsFalse(slotmap.Contains(reused));
+		}
+
+		TEST_METHOD(ChangesDuringMigrationAreKept)
+		{
+			Unalmas::AdaptiveSlotMapPolicy policy;
+			policy.window = 0;
+			policy.migrationStep = 3;
+
+			Unalmas::AdaptiveSlotMap<std::string> slotmap(4, policy);
+			std::vector<std::pair<Unalmas::SlotMapKey, std::string>> live;
+			std::vector<Unalmas::SlotMapKey> erased;
+			unsigned int random = 4242;
+
+			for (int i = 0; i < 20000; ++i)
+			{
+				random = random * 1664525u + 1013904223u;
+				const unsigned int choice = (random >> 16) % 100;
+				const std::string value = std::to_string(i);
+
+				if (!slotmap.IsMigrating() || choice == 0)
+				{
+					// Head the other way, or back (abandoning the migration) now and then.
+					slotmap.SetMode(slotmap.Mode() == Unalmas::AdaptiveSlotMapMode::Dense
+						? Unalmas::AdaptiveSlotMapMode::Stable : Unalmas::AdaptiveSlotMapMode::Dense);
+				}
+
+				if (choice < 45 || live.empty())
+				{
+					live.emplace_back(slotmap.Insert(value), value);
+				}
+				else if (choice < 85)
+				{
+					const std::size_t victim = (random >> 4) % live.size();
+					Assert::IsTrue(slotmap.Erase(live[victim].first));
+					erased.push_back(live[victim].first);
+					live[victim] = live.back();
+					live.pop_back();
+				}
+				else if (choice < 99)
+				{
+					auto& [key, old] = live[(random >> 4) % live.size()];
+					Assert::IsTrue(slotmap.Update(key, value));
+					old = value;
+				}
+				else
+				{
+					slotmap.Clear();
+					erased.clear();
+					live.clear();
+				}
+			}
+
+			Assert::IsTrue(slotmap.MigrationCount() > 10);
+
+			// Finish whichever migration is underway, and check both layouts.
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				Assert::IsTrue(slotmap.Migrate(1 << 20));
+				Assert::IsTrue(slotmap.Size() == static_cast<int>(live.size()));
+
+				for (const auto& [key, value] : live)
+				{
+					Assert::IsTrue(slotmap[key] == value);
+				}
+
+				for (const auto& key : erased)
+				{
+					Assert::IsFalse(slotmap.Contains(key));
+				}
+
+				int count = 0;
+				slotmap.ForEach([&](const std::string&) { ++count; });
+				Assert::IsTrue(count == slotmap.Size());
+
+				slotmap.SetMode(slotmap.Mode() == Unalmas::AdaptiveSlotMapMode::Dense
+					? Unalmas::AdaptiveSlotMapMode::Stable : Unalmas::AdaptiveSlotMapMode::Dense);
+			}
+		}
+
+		TEST_METHOD(FollowsTheMix)
+		{
+			Unalmas::AdaptiveSlotMapPolicy policy;
+			policy.window = 1000;
+
+			Unalmas::AdaptiveSlotMap<int> slotmap(16, policy);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 500; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			// Lookups only: goes stable.
+			for (int i = 0; i < 10000; ++i)
+			{
+				Assert::IsTrue(slotmap[keys[i % 500]] == i % 500);
+			}
+
+			// Lookups copy every slot over, but only a change finishes the migration.
+			Assert::IsTrue(slotmap.Mode() == Unalmas::AdaptiveSlotMapMode::Dense && slotmap.IsMigrating());
+			Assert::IsTrue(slotmap.Update(keys[0], 0));
+			Assert::IsTrue(slotmap.Mode() == Unalmas::AdaptiveSlotMapMode::Stable && !slotmap.IsMigrating());
+
+			// Mostly iteration: back to dense.
+			int sum = 0;
+			for (int i = 0; i < 200; ++i)
+			{
+				slotmap.ForEach([&](int value) { sum += value; });
+				slotmap.Contains(keys[i]);
+			}
+
+			Assert::IsTrue(sum == 200 * (499 * 500 / 2));
+			Assert::IsTrue(slotmap.Migrate(1));
+			Assert::IsTrue(slotmap.Mode() == Unalmas::AdaptiveSlotMapMode::Dense && slotmap.MigrationCount() == 2);
+		}
+
+		TEST_METHOD(LookupsKeepReferencesValid)
+		{
+			Unalmas::AdaptiveSlotMapPolicy policy;
+			policy.window = 100;
+
+			Unalmas::AdaptiveSlotMap<std::string> slotmap(16, policy);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 64; ++i)
+			{
+				keys.push_back(slotmap.Insert(std::to_string(i)));
+			}
+
+			const std::string& first = slotmap[keys[0]];
+			for (int i = 0; i < 1000; ++i)
+			{
+				slotmap.Contains(keys[i % 64]);
+			}
+
+			Assert::IsTrue(first == "0");
+		}
+
+		TEST_METHOD(RefusesToMigrateBackwards)
+		{
+			Unalmas::AdaptiveSlotMapPolicy policy;
+			policy.window = 0;
+			policy.migrationStep = 1;
+
+			Unalmas::AdaptiveSlotMap<int> slotmap(64, policy);
+			std::vector<Unalmas::SlotMapKey> keys;
+			for (int i = 0; i < 64; ++i)
+			{
+				keys.push_back(slotmap.Insert(i));
+			}
+
+			slotmap.SetMode(Unalmas::AdaptiveSlotMapMode::Stable);
+			Assert::IsFalse(slotmap.Migrate(40));
+			Assert::IsFalse(slotmap.Migrate(-30));
+			Assert::IsFalse(slotmap.Migrate(0));
+			Assert::IsTrue(slotmap.Erase(keys[20]));
+			Assert::IsTrue(slotmap.Migrate(1 << 20));
+
+			Assert::IsTrue(slotmap.Mode() == Unalmas::AdaptiveSlotMapMode::Stable);
+			Assert::IsFalse(slotmap.Contains(keys[20]));
+			Assert::IsTrue(slotmap.Size() == 63);
+
+			policy.migrationStep = 0;
+			Assert::ExpectException<std::invalid_argument>([&]() { Unalmas::AdaptiveSlotMap<int> stuck(8, policy); });
+		}
 	};
 }